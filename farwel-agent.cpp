@@ -0,0 +1,636 @@
+extern  "C" {
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stddef.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+}
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include "include/main.h"
+#include "include/real.h"
+#include "include/snapshot.h"
+#include "include/connectors/agent.h"
+
+static FWL::Real             real;
+static volatile sig_atomic_t stopping = 0;
+
+namespace FWL {
+    //! -- serves agent connectors: every client process gets its own rings, every worker its own Main
+    class Agentd
+    {
+        private:
+            enum {
+                Detach = 0xFFFF
+            };
+
+            //! -- with the connector it was routed to: the name may have lost its mount prefix
+            typedef boost::unordered_map<int, std::pair<FileIntr, Connector *> >   Files;
+
+            struct Session
+            {
+                int               sock;
+                int               sq_event;
+                int               cq_event;
+                pid_t             pid;
+                uint32_t          entries;
+                uint32_t          slot_size;
+                AgentShared       *shared;
+                size_t            size;
+                uint32_t          cq_tail;
+                boost::mutex      cq_lock;
+                //! -- open files per worker, only touched by that worker's thread
+                std::vector<Files> files;
+
+                Session() : sock(-1), sq_event(-1), cq_event(-1), pid(0), entries(0), slot_size(0), shared(NULL), size(0), cq_tail(0) {}
+                ~Session()
+                {
+                    if (shared) {
+                        ::munmap(shared, size);
+                    }
+                    int fds[] = { sock, sq_event, cq_event };
+                    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+                        if (fds[i] >= 0) {
+                            real.close(fds[i]);
+                        }
+                    }
+                }
+
+                void Complete(const AgentCompletion& completion)
+                {
+                    boost::mutex::scoped_lock lock(cq_lock);
+                    shared->Completions(entries)[cq_tail % entries] = completion;
+                    __sync_synchronize();
+                    shared->cq.tail = ++cq_tail;
+                }
+
+                void Signal()
+                {
+                    __sync_synchronize();
+                    if (shared->cq.sleeping) {
+                        uint64_t one = 1;
+                        real.write(cq_event, &one, sizeof(one));
+                    }
+                }
+            };
+
+            typedef boost::shared_ptr<Session>                   SessionPtr;
+            typedef std::map<boost::thread::id, boost::thread *> Sessions;
+
+            struct Task
+            {
+                SessionPtr   session;
+                AgentRequest request;
+            };
+
+            struct Worker
+            {
+                std::auto_ptr<Main>       main;
+                boost::mutex              lock;
+                boost::condition_variable wakeup;
+                std::deque<Task>          tasks;
+                bool                      stop;
+                Worker() : stop(false) {}
+            };
+
+            std::string                        config_file_;
+            LogIntr                            log_;
+            std::vector<boost::shared_ptr<Worker> > workers_;
+            boost::thread_group                threads_;
+            boost::detail::atomic_count        ids_;
+            boost::mutex                       sessions_lock_;
+            std::vector<boost::thread::id>     finished_;
+
+            Log& Logger() { return *log_; }
+            SessionPtr handshake(int sock);
+            void serve(SessionPtr session);
+            void session(SessionPtr session);
+            void reap(Sessions& sessions);
+            void work(size_t index);
+            void execute(size_t index, Task& task);
+            FileIntr file(Session& session, size_t index, const AgentRequest& request, const PathHandle& path, Connector *connector);
+
+        public:
+            Agentd(const std::string& config_file, size_t workers, LogIntr log);
+            ~Agentd();
+            void Run(int listener);
+    };
+
+    Agentd::Agentd(const std::string& config_file, size_t workers, LogIntr log)
+        : config_file_(config_file)
+        , log_(log)
+        , ids_(0)
+    {
+        //! -- one set of connectors per worker: connectors needn't be thread safe and the worker count bounds backend connections.
+        //! -- Paths are spread over workers by hash, so more than one only suits backends whose state lives outside the process.
+        for (size_t i = 0; i < workers; ++i) {
+            boost::shared_ptr<Worker> worker(new Worker);
+            worker->main.reset(new Main(config_file_, false));
+            workers_.push_back(worker);
+        }
+        for (size_t i = 0; i < workers; ++i) {
+            threads_.create_thread(boost::bind(&Agentd::work, this, i));
+        }
+    }
+
+    Agentd::~Agentd()
+    {
+        BOOST_FOREACH(boost::shared_ptr<Worker>& worker, workers_)
+        {
+            boost::mutex::scoped_lock lock(worker->lock);
+            worker->stop = true;
+            worker->wakeup.notify_one();
+        }
+        threads_.join_all();
+    }
+
+    Agentd::SessionPtr Agentd::handshake(int sock)
+    {
+        AgentHello    hello;
+        int           fds[3] = { -1, -1, -1 };
+        char          control[CMSG_SPACE(sizeof(fds))];
+        struct iovec  iov;
+        struct msghdr msg;
+        SessionPtr    session(new Session);
+
+        session->sock = sock;
+        iov.iov_base  = &hello;
+        iov.iov_len   = sizeof(hello);
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) && (cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))) {
+            ::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        }
+        session->sq_event = fds[1];
+        session->cq_event = fds[2];
+
+        int32_t     status = 0;
+        struct stat buf;
+        if ((n != sizeof(hello)) || (fds[0] < 0) || (fds[1] < 0) || (fds[2] < 0) || (hello.magic != AgentMagic)) {
+            status = EPROTO;
+        } else if (hello.version != AgentVersion) {
+            status = EPROTONOSUPPORT;
+        } else {
+            session->pid       = hello.pid;
+            session->entries   = hello.entries;
+            session->slot_size = hello.slot_size;
+            session->size      = AgentShared::Size(hello.entries, hello.slot_size);
+            if (!hello.entries || (hello.entries > 4096) || (hello.slot_size > (16 << 20)) || ::fstat(fds[0], &buf) || ((size_t)buf.st_size < session->size)) {
+                status = EINVAL;
+            } else {
+                void *region = ::mmap(NULL, session->size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+                if (region == MAP_FAILED) {
+                    status = errno;
+                } else {
+                    session->shared  = (AgentShared *)region;
+                    session->cq_tail = session->shared->cq.tail;
+                }
+            }
+        }
+        if (fds[0] >= 0) {
+            real.close(fds[0]);
+        }
+        session->files.resize(workers_.size());
+        ::send(sock, &status, sizeof(status), MSG_NOSIGNAL);
+        if (status) {
+            Logger().Err("Agent: rejected client: %s", ::strerror(status));
+            return SessionPtr();
+        }
+        Logger().Inf("Agent: session for pid %u, %u entries of %u bytes", hello.pid, hello.entries, hello.slot_size);
+        return session;
+    }
+
+    void Agentd::serve(SessionPtr session)
+    {
+        AgentShared&                    shared = *session->shared;
+        uint32_t                        head   = shared.sq.head;
+        std::vector<std::vector<Task> > batches(workers_.size());
+
+        while (!stopping) {
+            //! -- everything queued since the last wakeup is handed to the workers in one go
+            while (head != shared.sq.tail) {
+                __sync_synchronize();
+                Task task;
+                task.session = session;
+                task.request = shared.Requests()[head % session->entries];
+                __sync_synchronize();
+                shared.sq.head = ++head;
+
+                const AgentRequest& request = task.request;
+                if ((request.slot >= session->entries) || ((size_t)request.path + request.path2 + request.size > session->slot_size)) {
+                    AgentCompletion completion = { request.slot % session->entries, EINVAL, -1, 0, 0 };
+                    session->Complete(completion);
+                    session->Signal();
+                    continue;
+                }
+                std::string path(shared.Slot(request.slot, session->entries, session->slot_size), request.path);
+                batches[boost::hash<std::string>()(path) % workers_.size()].push_back(task);
+            }
+            for (size_t i = 0; i < batches.size(); ++i) {
+                if (!batches[i].empty()) {
+                    Worker&                   worker = *workers_[i];
+                    boost::mutex::scoped_lock lock(worker.lock);
+                    worker.tasks.insert(worker.tasks.end(), batches[i].begin(), batches[i].end());
+                    worker.wakeup.notify_one();
+                    batches[i].clear();
+                }
+            }
+
+            shared.sq.sleeping = 1;
+            __sync_synchronize();
+            if (head != shared.sq.tail) {
+                shared.sq.sleeping = 0;
+                continue;
+            }
+            struct pollfd fds[2] = {
+                { session->sq_event, POLLIN, 0 },
+                { session->sock, POLLIN, 0 }
+            };
+            int ready = ::poll(fds, 2, 1000);
+            shared.sq.sleeping = 0;
+            if (ready > 0) {
+                uint64_t count;
+                if (fds[0].revents & POLLIN) {
+                    real.read(session->sq_event, &count, sizeof(count));
+                }
+                if (fds[1].revents) {
+                    break;
+                }
+            }
+        }
+
+        Logger().Inf("Agent: session for pid %u closed", session->pid);
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            Task task;
+            task.session    = session;
+            task.request.op = Detach;
+            Worker&                   worker = *workers_[i];
+            boost::mutex::scoped_lock lock(worker.lock);
+            worker.tasks.push_back(task);
+            worker.wakeup.notify_one();
+        }
+    }
+
+    void Agentd::work(size_t index)
+    {
+        Worker& worker = *workers_[index];
+
+        while (true) {
+            std::deque<Task> batch;
+            {
+                boost::mutex::scoped_lock lock(worker.lock);
+                while (worker.tasks.empty() && !worker.stop) {
+                    worker.wakeup.wait(lock);
+                }
+                if (worker.tasks.empty()) {
+                    return;
+                }
+                batch.swap(worker.tasks);
+            }
+
+            //! -- a client is woken once per batch, not once per completion
+            std::vector<Session *> touched;
+            BOOST_FOREACH(Task & task, batch)
+            {
+                execute(index, task);
+                if ((task.request.op != Detach) && (std::find(touched.begin(), touched.end(), task.session.get()) == touched.end())) {
+                    touched.push_back(task.session.get());
+                }
+            }
+            BOOST_FOREACH(Session * session, touched)
+            {
+                session->Signal();
+            }
+        }
+    }
+
+    FileIntr Agentd::file(Session& session, size_t index, const AgentRequest& request, const PathHandle& path, Connector *connector)
+    {
+        if (request.fd == -1) {
+            return FileIntr(new File(-1, path, request.flags));
+        }
+
+        Files&          files = session.files[index];
+        Files::iterator it    = files.find(request.fd);
+        if (it != files.end()) {
+            if ((it->second.first->Interned() == path) && (it->second.second == connector)) {
+                return it->second.first;
+            }
+            //! -- the client reused the descriptor without closing it here (a failed open)
+            it->second.second->Close(it->second.first);
+            files.erase(it);
+        }
+        FileIntr file(new File(++ids_, path, request.flags));
+        files.insert(std::make_pair(request.fd, std::make_pair(file, connector)));
+        return file;
+    }
+
+    void Agentd::execute(size_t index, Task& task)
+    {
+        Session&            session = *task.session;
+        const AgentRequest& request = task.request;
+        Main&               main    = *workers_[index]->main;
+
+        if (request.op == Detach) {
+            Files& files = session.files[index];
+            for (Files::iterator it = files.begin(); it != files.end(); ++it) {
+                it->second.second->Close(it->second.first);
+            }
+            files.clear();
+            return;
+        }
+
+        char            *slot = session.shared->Slot(request.slot, session.entries, session.slot_size);
+        PathHandle      path(slot, request.path);
+        std::string     path2(slot + request.path, request.path2);
+        char            *data      = slot + request.path + request.path2;
+        Connector       *connector = main.GetConnector(path);
+        AgentCompletion completion = { request.slot, 0, -1, 0, 0 };
+
+        errno = 0;
+        if (!connector) {
+            errno = ENOENT;
+        } else {
+            FileIntr target;
+            if (request.op <= AgentRead) {
+                target = file(session, index, request, path, connector);
+            }
+            switch (request.op) {
+                case AgentExists:
+                    completion.result = connector->Exists(target);
+                    break;
+                case AgentCreate:
+                    completion.result = connector->Create(target);
+                    break;
+                case AgentTruncate:
+                    completion.result = connector->Truncate(target);
+                    break;
+                case AgentWrite:
+                    target->Seek(request.offset);
+                    completion.result = connector->Write(target, data, request.size);
+                    break;
+                case AgentRead:
+                    target->Seek(request.offset);
+                    completion.result = connector->Read(target, data, request.size);
+                    break;
+                case AgentClose: {
+                    Files&          files = session.files[index];
+                    Files::iterator it    = files.find(request.fd);
+                    completion.result = 0;
+                    if (it != files.end()) {
+                        completion.result = it->second.second->Close(it->second.first) ? 0 : -1;
+                        files.erase(it);
+                    }
+                    break;
+                }
+                case AgentSize: {
+                    size_t size;
+                    target = file(session, index, request, path, connector);
+                    if (connector->GetFileSize(target, size)) {
+                        completion.result = size;
+                    }
+                    break;
+                }
+                case AgentList: {
+                    DirectoryIntr dir(new Directory(-1, path));
+                    if (connector->Open(dir)) {
+                        const std::vector<std::string>& names = dir->Files();
+                        size_t                          used  = 0;
+                        size_t                          i     = request.offset;
+                        for ( ; (i < names.size()) && (used + names[i].size() + 1 <= request.size); ++i) {
+                            ::memcpy(data + used, names[i].c_str(), names[i].size() + 1);
+                            used += names[i].size() + 1;
+                        }
+                        if (!used && (i < names.size())) {
+                            //! -- the next name alone doesn't fit in the slot, asking again wouldn't help
+                            errno = ENAMETOOLONG;
+                        } else {
+                            completion.result = used;
+                            completion.more   = i < names.size();
+                        }
+                        connector->Close(dir);
+                    }
+                    break;
+                }
+                case AgentMkDir:
+                    completion.result = connector->MkDir(path.Str(), request.offset);
+                    break;
+                case AgentUnlink:
+                    completion.result = connector->Unlink(path.Str());
+                    break;
+                case AgentRmDir:
+                    completion.result = connector->RmDir(path.Str());
+                    break;
+                case AgentRename: {
+                    //! -- within one mount the new name loses the same prefix
+                    PathHandle newpath(path2);
+                    if (main.GetConnector(newpath) == connector) {
+                        completion.result = connector->Rename(path.Str(), newpath.Str());
+                    } else {
+                        completion.result = connector->Rename(path.Str(), path2);
+                    }
+                    break;
+                }
+                default:
+                    errno = EINVAL;
+            }
+        }
+        if (completion.result < 0) {
+            completion.error = errno ? errno : EIO;
+        }
+        session.Complete(completion);
+    }
+
+    void Agentd::session(SessionPtr session)
+    {
+        serve(session);
+
+        boost::mutex::scoped_lock lock(sessions_lock_);
+        finished_.push_back(boost::this_thread::get_id());
+    }
+
+    //! -- joins sessions whose client went away; workers recycled by php-fpm reconnect all the time
+    void Agentd::reap(Sessions& sessions)
+    {
+        std::vector<boost::thread::id> finished;
+        {
+            boost::mutex::scoped_lock lock(sessions_lock_);
+            finished.swap(finished_);
+        }
+        BOOST_FOREACH(const boost::thread::id & id, finished)
+        {
+            Sessions::iterator it = sessions.find(id);
+            if (it != sessions.end()) {
+                it->second->join();
+                delete it->second;
+                sessions.erase(it);
+            }
+        }
+    }
+
+    void Agentd::Run(int listener)
+    {
+        Sessions sessions;
+
+        while (!stopping) {
+            reap(sessions);
+            struct pollfd fds = { listener, POLLIN, 0 };
+            if (::poll(&fds, 1, 1000) <= 0) {
+                continue;
+            }
+            int sock = ::accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            if (sock < 0) {
+                continue;
+            }
+            SessionPtr session = handshake(sock);
+            if (session) {
+                //! -- registered before the thread can report itself finished
+                boost::mutex::scoped_lock lock(sessions_lock_);
+                boost::thread             *thread = new boost::thread(boost::bind(&Agentd::session, this, session));
+                sessions[thread->get_id()] = thread;
+            }
+        }
+        for (Sessions::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+            it->second->join();
+            delete it->second;
+        }
+    }
+}
+
+static void stop(int)
+{
+    stopping = 1;
+}
+
+//! -- systemd readiness notification without linking libsystemd
+static void notify(const char *state)
+{
+    const char *path = getenv("NOTIFY_SOCKET");
+
+    if (!path || !*path) {
+        return;
+    }
+    struct sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (addr.sun_path[0] == '@') {
+        addr.sun_path[0] = 0;
+    }
+    int sock = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock >= 0) {
+        ::sendto(sock, state, ::strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&addr, offsetof(struct sockaddr_un, sun_path) + ::strlen(path));
+        real.close(sock);
+    }
+}
+
+static int listen(const std::string& path, mode_t mode)
+{
+    //! -- socket activation hands the listening socket over as fd 3
+    const char *pid = getenv("LISTEN_PID");
+    const char *fds = getenv("LISTEN_FDS");
+    if (pid && fds && ((pid_t)atoi(pid) == ::getpid()) && (atoi(fds) >= 1)) {
+        return 3;
+    }
+
+    struct sockaddr_un addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    ::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    real.unlink(path.c_str());
+    if ((sock < 0) || ::bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || ::chmod(path.c_str(), mode) || ::listen(sock, 128)) {
+        fprintf(stderr, "Couldn't listen on %s: %s\n", path.c_str(), ::strerror(errno));
+        return -1;
+    }
+    return sock;
+}
+
+int main(int argc, char **argv)
+{
+    const char  *env         = getenv("FRWL_CONFIG_FILE");
+    std::string config_file  = env ? env : "/etc/farwel/farwel.conf";
+    std::string socket_path;
+    int         workers      = 0;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "c:s:w:")) != -1) {
+        switch (opt) {
+            case 'c':
+                config_file = optarg;
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'w':
+                workers = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c config] [-s socket] [-w workers]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    FWL::JsonNode root;
+    try {
+        if (!FWL::Snapshot::Load(config_file, root)) {
+            boost::property_tree::read_json(config_file, root);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Couldn't read %s: %s\n", config_file.c_str(), e.what());
+        return 1;
+    }
+    if (socket_path.empty()) {
+        socket_path = root.get<std::string>("agent.socket", "/run/farwel/agent.sock");
+    }
+    if (workers <= 0) {
+        workers = root.get<int>("agent.workers", 1);
+    }
+    mode_t mode = ::strtoul(root.get<std::string>("agent.mode", "0660").c_str(), NULL, 8);
+
+    struct sigaction action;
+    ::memset(&action, 0, sizeof(action));
+    action.sa_handler = stop;
+    ::sigaction(SIGTERM, &action, NULL);
+    ::sigaction(SIGINT, &action, NULL);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    int listener = listen(socket_path, mode);
+    if (listener < 0) {
+        return 1;
+    }
+
+    FWL::LogIntr log(new FWL::Log(FWL::Log::Info));
+    log->RegisterSink("stderr", stderr);
+    log->UseSink("stderr");
+    {
+        FWL::Agentd agentd(config_file, workers, log);
+        log->Inf("Agent: listening on %s with %d workers", socket_path.c_str(), workers);
+        notify("READY=1");
+        agentd.Run(listener);
+        notify("STOPPING=1");
+    }
+    //! -- the socket file stays: a replacement agent may already have bound a new one to the same path
+    return 0;
+}
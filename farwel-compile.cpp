@@ -0,0 +1,120 @@
+extern  "C" {
+#include <getopt.h>
+#include <stdio.h>
+}
+#include <iostream>
+#include <boost/foreach.hpp>
+#include <boost/regex.hpp>
+#include "include/comparer.h"
+#include "include/json.h"
+#include "include/prefixtrie.h"
+#include "include/snapshot.h"
+
+//! -- checks what the library would otherwise only find out lazily, on the first matching call
+static int validate(const FWL::JsonNode& root)
+{
+    int errors = 0;
+
+    FWL::JsonNodeConstOp connectors = root.get_child_optional("connectors");
+    if (!connectors) {
+        fprintf(stderr, "no connectors\n");
+        return 1;
+    }
+    BOOST_FOREACH(const FWL::JsonNode::value_type & it, *connectors)
+    {
+        if (!it.second.get_optional<std::string>("type")) {
+            fprintf(stderr, "connector %s: no type\n", it.first.c_str());
+            ++errors;
+        }
+    }
+
+    FWL::JsonNodeConstOp locations = root.get_child_optional("locations");
+    if (!locations) {
+        fprintf(stderr, "no locations\n");
+        return errors + 1;
+    }
+    FWL::PrefixTrie prefixes;
+    BOOST_FOREACH(const FWL::JsonNode::value_type & it, *locations)
+    {
+        std::pair<std::string, std::string> rule;
+        std::string                         connector = it.second.get<std::string>("connector", "");
+
+        if (!FWL::Comparer::Parse(it.first, rule)) {
+            fprintf(stderr, "location %s: expected type://argument\n", it.first.c_str());
+            ++errors;
+        } else if (rule.first == "regexp") {
+            try {
+                boost::regex re(rule.second, boost::regex_constants::perl);
+            } catch (const boost::regex_error& e) {
+                fprintf(stderr, "location %s: %s\n", it.first.c_str(), e.what());
+                ++errors;
+            }
+        } else if (rule.first == "prefix") {
+            if (rule.second.empty() || (rule.second[0] != '/')) {
+                fprintf(stderr, "location %s: prefix must be an absolute path\n", it.first.c_str());
+                ++errors;
+            } else if (!prefixes.Add(rule.second, 0)) {
+                fprintf(stderr, "location %s: prefix is mounted twice\n", it.first.c_str());
+                ++errors;
+            }
+        }
+        if (!connectors->get_child_optional(FWL::JsonNode::path_type(connector, '\0'))) {
+            fprintf(stderr, "location %s: unknown connector '%s'\n", it.first.c_str(), connector.c_str());
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+int main(int argc, char **argv)
+{
+    bool dump = false;
+    int  opt;
+
+    while ((opt = getopt(argc, argv, "d")) != -1) {
+        switch (opt) {
+            case 'd':
+                dump = true;
+                break;
+            default:
+                optind = argc;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s config.conf config.snapshot\n       %s -d config.snapshot config.conf|-\n", argv[0], argv[0]);
+        return 1;
+    }
+    std::string input  = argv[optind];
+    std::string output = argv[optind + 1];
+
+    FWL::JsonNode root;
+    try {
+        if (dump) {
+            if (!FWL::Snapshot::Load(input, root)) {
+                fprintf(stderr, "%s is not a config snapshot\n", input.c_str());
+                return 1;
+            }
+            if (output == "-") {
+                boost::property_tree::write_json(std::cout, root);
+            } else {
+                boost::property_tree::write_json(output, root);
+            }
+            return 0;
+        }
+        boost::property_tree::read_json(input, root);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s: %s\n", input.c_str(), e.what());
+        return 1;
+    }
+
+    int errors = validate(root);
+    if (errors) {
+        fprintf(stderr, "%s: %d error(s), snapshot not written\n", input.c_str(), errors);
+        return 1;
+    }
+    if (!FWL::Snapshot::Save(output, root)) {
+        perror(output.c_str());
+        return 1;
+    }
+    return 0;
+}
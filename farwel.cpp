@@ -2,14 +2,31 @@ extern  "C" {
 #include <assert.h>
 #include <stdarg.h>
 #include <math.h>
+#include <pthread.h>
 }
 #include "include/real.h"
 #include "include/main.h"
 #include "include/path.h"
+#include "include/trace.h"
 
 static FWL::Real                real;
 static std::auto_ptr<FWL::Main> main;
 static FWL::Path                path_master;
+static const char               *config_file;
+static pthread_once_t           main_once = PTHREAD_ONCE_INIT;
+static __thread bool            main_loading;
+static bool                     main_loaded;
+static __thread bool            main_forking;
+static bool                     fork_warmup;
+//! -- destroyed before main: calls made while the connectors shut down (sqlite removing
+//! -- its -wal file on close) go to the real functions instead of a half destroyed Main
+static struct Unload
+{
+    ~Unload()
+    {
+        __atomic_store_n(&main_loaded, false, __ATOMIC_RELEASE);
+    }
+} unload;
 static uid_t uid = ::getuid();
 static uid_t gid = ::getgid();
 
@@ -43,21 +60,78 @@ const char *File(int id)
 #endif
 
 
+static void load()
+{
+    main_loading = true;
+    try {
+        main.reset(new FWL::Main(config_file));
+    } catch (const std::exception& e) {
+        fprintf(stderr, "farwel: %s: %s\n", config_file, e.what());
+    }
+    main_loading = false;
+    if (!main.get()) {
+        return;
+    }
+    __atomic_store_n(&main_loaded, true, __ATOMIC_RELEASE);
+}
+
+//! -- fd based calls: a virtual fd can't exist before Main does
+static bool Loaded()
+{
+    return __atomic_load_n(&main_loaded, __ATOMIC_ACQUIRE);
+}
+
+//! -- path based calls build Main on first use; calls made while it is being built go to the real functions
+static bool Load()
+{
+    if (main_loading) {
+        return false;
+    }
+    pthread_once(&main_once, load);
+    return Loaded();
+}
+
+//! -- a preforking server (php-fpm, Apache prefork) prepares Main once in the master and workers inherit
+//! -- it ready; any other fork only prepares a Main that already exists, so shells and make stay lazy
+static void prepare()
+{
+    main_forking = fork_warmup ? Load() : Loaded();
+    if (main_forking) {
+        main->BeforeFork();
+    }
+}
+
+static void parent()
+{
+    if (main_forking) {
+        main->AfterFork(false);
+    }
+}
+
+static void child()
+{
+    if (main_forking) {
+        main->AfterFork(true);
+    }
+}
+
 extern "C" {
     void __attribute__((constructor)) init(void)
     {
-        const char *config_file = getenv("FRWL_CONFIG_FILE");
+        config_file = getenv("FRWL_CONFIG_FILE");
 
         if (!config_file) {
             fprintf(stderr, "Config file is not set. Set env param FRWL_CONFIG_FILE\n");
             exit(-1);
         }
-        main.reset(new FWL::Main(config_file));
+        const char *warmup = getenv("FRWL_FORK_WARMUP");
+        fork_warmup = warmup && *warmup && strcmp(warmup, "0");
+        pthread_atfork(prepare, parent, child);
     }
 
     int open(const char *path, int flags, ...)
     {
-        if (!main.get()) {
+        if (!Load()) {
             VA_ARG(int, mode, flags);
 #ifndef NDEBUG
             int i = (mode) ? real.open(path, flags, mode) : real.open(path, flags);
@@ -69,11 +143,12 @@ extern "C" {
             return (mode) ? real.open(path, flags, mode) : real.open(path, flags);
 #endif
         }
-        std::string    realpath = path_master.Absolute(path);
-        FWL::Connector *cntr    = main->GetConnector(realpath);
-        main->Logger().Inf("Open FWL::Connector(%p): %s", cntr, realpath.c_str());
+        FWL::Main::Pin  pin(*main);
+        FWL::PathHandle realpath;
+        FWL::Connector  *cntr = main->Route(path_master, path, realpath);
+        FWL_INF(main->Logger(), "Open FWL::Connector(%p): %s", cntr, path);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             VA_ARG(int, mode, flags);
 #ifndef NDEBUG
             int i = (mode) ? real.open(path, flags, mode) : real.open(path, flags);
@@ -85,8 +160,11 @@ extern "C" {
             return (mode) ? real.open(path, flags, mode) : real.open(path, flags);
 #endif
         }
-        main->Logger().Inf("%s", cntr->Name().c_str());
-        return cntr->Open(realpath, flags);
+        FWL_INF(main->Logger(), "%s", cntr->Name().c_str());
+        FWL_PROBE2(open, realpath.Str().c_str(), flags);
+        int fd = cntr->Open(realpath, flags);
+        FWL_PROBE1(open_done, fd);
+        return fd;
     }
 
     int creat(const char *path, mode_t mode)
@@ -96,47 +174,59 @@ extern "C" {
 
     ssize_t write(int fd, const void *data, size_t size)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             return real.write(fd, data, size);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetConnector(fd);
-        main->Logger().Inf("Write FWL::Connector(%p): ", cntr);
+        FWL_INF(main->Logger(), "Write FWL::Connector(%p): ", cntr);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.write(fd, data, size);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
-        return cntr->Write(fd, data, size);
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
+        FWL_PROBE2(write, fd, size);
+        ssize_t ret = cntr->Write(fd, data, size);
+        FWL_PROBE2(write_done, fd, ret);
+        return ret;
     }
 
     int close(int fd)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             return real.close(fd);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetConnector(fd);
-        main->Logger().Inf("Write FWL::Connector(%p) %d - %s: ", cntr, fd, File(fd));
+        FWL_INF(main->Logger(), "Write FWL::Connector(%p) %d - %s: ", cntr, fd, File(fd));
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.close(fd);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
-        return cntr->Close(fd);
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
+        FWL_PROBE1(close, fd);
+        int ret = cntr->Close(fd);
+        FWL_PROBE2(close_done, fd, ret);
+        return ret;
     }
 
     ssize_t read(int fd, void *data, size_t size)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             return real.read(fd, data, size);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetConnector(fd);
-        main->Logger().Inf("Read FWL::Connector(%p) %d - %s: ", cntr, fd, File(fd));
+        FWL_INF(main->Logger(), "Read FWL::Connector(%p) %d - %s: ", cntr, fd, File(fd));
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.read(fd, data, size);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
-        return cntr->Read(fd, data, size);
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
+        FWL_PROBE2(read, fd, size);
+        ssize_t ret = cntr->Read(fd, data, size);
+        FWL_PROBE2(read_done, fd, ret);
+        return ret;
     }
 
     void __setStat(FWL::Connector *cntr, struct stat *buf, size_t size)
@@ -152,18 +242,22 @@ extern "C" {
 
     int stat(const char *path, struct stat *buf)
     {
-        if (!main.get()) {
+        if (!Load()) {
             return real.stat(path, buf);
         }
-        std::string    realpath = path_master.Absolute(path);
-        FWL::Connector *cntr    = main->GetConnector(realpath);
+        FWL::Main::Pin  pin(*main);
+        FWL::PathHandle realpath;
+        FWL::Connector  *cntr = main->Route(path_master, path, realpath);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.stat(path, buf);
         }
 
         size_t size = 0;
-        if (!cntr->GetFileSize(realpath, size)) {
+        FWL_PROBE1(stat, realpath.Str().c_str());
+        bool found = cntr->GetFileSize(realpath, size);
+        FWL_PROBE2(stat_done, found, size);
+        if (!found) {
             errno = ENOENT;
             return -1;
         }
@@ -173,16 +267,20 @@ extern "C" {
 
     int fstat(int fd, struct stat *buf)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             return real.fstat(fd, buf);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetConnector(fd);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.fstat(fd, buf);
         }
         size_t size = 0;
-        if (!cntr->GetFileSize(fd, size)) {
+        FWL_PROBE1(fstat, fd);
+        bool found = cntr->GetFileSize(fd, size);
+        FWL_PROBE2(fstat_done, found, size);
+        if (!found) {
             errno = ENOENT;
             return -1;
         }
@@ -197,114 +295,121 @@ extern "C" {
 
     int rmdir(const char *dir)
     {
-        if (!main.get()) {
+        if (!Load()) {
             return real.rmdir(dir);
         }
-        std::string    realpath = path_master.Absolute(dir);
-        FWL::Connector *cntr    = main->GetConnector(realpath);
-        main->Logger().Inf("RmDir(%s) FWL::Connector(%p): ", dir, cntr);
+        FWL::Main::Pin  pin(*main);
+        FWL::PathHandle realpath;
+        FWL::Connector  *cntr = main->Route(path_master, dir, realpath);
+        FWL_INF(main->Logger(), "RmDir(%s) FWL::Connector(%p): ", dir, cntr);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.rmdir(dir);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
-        return cntr->RmDir(realpath);
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
+        return cntr->RmDir(realpath.Str());
     }
 
     int mkdir(const char *dir, mode_t mode)
     {
-        if (!main.get()) {
+        if (!Load()) {
             return real.mkdir(dir, mode);
         }
-        std::string    realpath = path_master.Absolute(dir);
-        FWL::Connector *cntr    = main->GetConnector(realpath);
-        main->Logger().Inf("MkDir(%s) FWL::Connector(%p): ", dir, cntr);
+        FWL::Main::Pin  pin(*main);
+        FWL::PathHandle realpath;
+        FWL::Connector  *cntr = main->Route(path_master, dir, realpath);
+        FWL_INF(main->Logger(), "MkDir(%s) FWL::Connector(%p): ", dir, cntr);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.mkdir(dir, mode);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
-        return cntr->MkDir(realpath, mode);
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
+        return cntr->MkDir(realpath.Str(), mode);
         return 0;
     }
 
     DIR *opendir(const char *dir)
     {
-        if (!main.get()) {
+        if (!Load()) {
             return real.opendir(dir);
         }
-        std::string    realpath = path_master.Absolute(dir);
-        FWL::Connector *cntr    = main->GetConnector(realpath);
-        main->Logger().Inf("OpenDir(%s) FWL::Connector(%p): ", dir, cntr);
+        FWL::Main::Pin  pin(*main);
+        FWL::PathHandle realpath;
+        FWL::Connector  *cntr = main->Route(path_master, dir, realpath);
+        FWL_INF(main->Logger(), "OpenDir(%s) FWL::Connector(%p): ", dir, cntr);
         if (!cntr) {
             //! todo real write or something...think
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.opendir(dir);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
         return (DIR *)cntr->OpenDir(realpath);
     }
 
     struct dirent *readdir(DIR *dir)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             return real.readdir(dir);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetDirConnector(dir);
-        main->Logger().Inf("ReadDir FWL::Connector(%p): ", cntr);
+        FWL_INF(main->Logger(), "ReadDir FWL::Connector(%p): ", cntr);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.readdir(dir);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
         return cntr->ReadDir(dir);
     }
 
     int closedir(DIR *dir)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             return real.closedir(dir);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetDirConnector(dir);
-        main->Logger().Inf("CloseDir FWL::Connector(%p): ", cntr);
+        FWL_INF(main->Logger(), "CloseDir FWL::Connector(%p): ", cntr);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.closedir(dir);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
         return cntr->CloseDir(dir);
     }
 
     int unlink(const char *path)
     {
-        if (!main.get()) {
+        if (!Load()) {
             return real.unlink(path);
         }
-        std::string    realpath = path_master.Absolute(path);
-        FWL::Connector *cntr    = main->GetConnector(realpath);
-        main->Logger().Inf("Unlink FWL::Connector(%p): ", cntr);
+        FWL::Main::Pin  pin(*main);
+        FWL::PathHandle realpath;
+        FWL::Connector  *cntr = main->Route(path_master, path, realpath);
+        FWL_INF(main->Logger(), "Unlink FWL::Connector(%p): ", cntr);
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             return real.unlink(path);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
-        return cntr->Unlink(realpath);
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
+        return cntr->Unlink(realpath.Str());
     }
 
     int fcntl(int fd, int cmd, ...)
     {
-        if (!main.get()) {
+        if (!Loaded()) {
             VA_ARG(unsigned, p2, cmd);
             return (p2) ? real.fcntl(fd, cmd, p2) : real.fcntl(fd, cmd);
         }
+        FWL::Main::Pin pin(*main);
         FWL::Connector *cntr = main->GetConnector(fd);
-        main->Logger().Inf("Fcntl FWL::Connector(%p) %d - %s: ", cntr, fd, File(fd));
+        FWL_INF(main->Logger(), "Fcntl FWL::Connector(%p) %d - %s: ", cntr, fd, File(fd));
         if (!cntr) {
-            main->Logger().Inf("Call real function\n");
+            FWL_INF(main->Logger(), "Call real function\n");
             VA_ARG(unsigned, p2, cmd);
             return (p2) ? real.fcntl(fd, cmd, p2) : real.fcntl(fd, cmd);
         }
-        main->Logger().Inf("%s\n", cntr->Name().c_str());
+        FWL_INF(main->Logger(), "%s\n", cntr->Name().c_str());
         return 0;
     }
 }
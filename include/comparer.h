@@ -1,4 +1,6 @@
 #pragma once
+#include <string>
+#include <utility>
 #include <boost/intrusive_ptr.hpp>
 #include "object.h"
 namespace FWL {
@@ -7,7 +9,9 @@ namespace FWL {
     {
         public:
             static bool Parse(const std::string& str, std::pair<std::string, std::string>& ret);
-            virtual bool operator()(const std::string& target) = 0;
+            virtual bool operator()(const char *target, size_t size) = 0;
+            //! -- does now what would otherwise wait for the first lookup; run before fork so children share it
+            virtual void Prepare() {}
     };
 
     typedef boost::intrusive_ptr<Comparer>   ComparerIntr;
@@ -8,7 +8,7 @@ namespace FWL {
     {
         public:
             Always(const std::string& pattern);
-            bool operator()(const std::string& target);
+            bool operator()(const char *target, size_t size);
     };
 
 
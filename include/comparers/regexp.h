@@ -1,5 +1,6 @@
 #pragma once
 #include <boost/regex.hpp>
+#include <boost/thread/mutex.hpp>
 #include "comparer.h"
 
 namespace FWL {
@@ -7,10 +8,16 @@ namespace FWL {
         : public Comparer
     {
         private:
+            std::string  pattern_;
             boost::regex re_;
+            bool         valid_;
+            bool         compiled_;
+            boost::mutex lock_;
+            void compile();
         public:
             Regexp(const std::string& pattern);
-            bool operator()(const std::string& target);
+            bool operator()(const char *target, size_t size);
+            void Prepare();
     };
 
 
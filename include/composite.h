@@ -0,0 +1,29 @@
+#pragma once
+
+#include <boost/detail/atomic_count.hpp>
+#include "connector.h"
+
+namespace FWL {
+    class Composite
+        : public Connector
+    {
+        private:
+            static boost::detail::atomic_count scratch_;
+
+        protected:
+            Composite(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ConnectorIntr link(const ConnectorMap& connectors, const std::string& name);
+            static FileIntr scratch(const std::string& name, int flags);
+
+            static bool exists(Connector& target, FileIntr& file) { return target.Exists(file); }
+            static bool create(Connector& target, FileIntr& file) { return target.Create(file); }
+            static bool truncate(Connector& target, FileIntr& file) { return target.Truncate(file); }
+            static int write(Connector& target, FileIntr& file, const void *data, size_t size) { return target.Write(file, data, size); }
+            static int read(Connector& target, FileIntr& file, void *data, size_t size) { return target.Read(file, data, size); }
+            static bool close(Connector& target, FileIntr& file) { return target.Close(file); }
+            static bool open(Connector& target, DirectoryIntr& dir) { return target.Open(dir); }
+            static bool close(Connector& target, DirectoryIntr& dir) { return target.Close(dir); }
+            static bool length(Connector& target, FileIntr& file, size_t& size) { return target.GetFileSize(file, size); }
+            static bool copy(Connector& from, Connector& to, const std::string& name, const std::string& newname);
+    };
+}
@@ -4,23 +4,43 @@ extern "C" {
 #include <dirent.h>
 }
 
+#include <new>
 #include <vector>
 #include <boost/optional.hpp>
+#include <boost/unordered_map.hpp>
 #include "log.h"
+#include "trace.h"
 #include "object.h"
 #include "fdmanager.h"
+#include "flatmap.h"
 #include "json.h"
 #include "filesystem.h"
 namespace FWL {
+    class Connector;
+
+    //! -- for the child side of AfterFork: a condition variable or thread handle that parent threads were
+    //! -- inside of at fork time can neither be used nor destroyed in the child, so it is leaked and built anew
+    template <class T>
+    inline void Renew(T& object)
+    {
+        new (&object) T();
+    }
+
+    typedef boost::intrusive_ptr<Connector>                     ConnectorIntr;
+    typedef boost::unordered_map<std::string, ConnectorIntr>    ConnectorMap;
+
     class Connector
         : public Object
     {
+        friend class Composite;
+        friend class Agentd;
+
         private:
             std::string name_;
             FdManager&  fd_manager_;
-            typedef boost::unordered_map<int, FileIntr>   Files;
-            typedef boost::unordered_map<int, DirectoryIntr>     Directories;
-            typedef boost::unordered_map<std::string, NodeIntr> Nodes;
+            typedef FlatMap<int, FileIntr>             Files;
+            typedef FlatMap<int, DirectoryIntr>        Directories;
+            typedef FlatMap<PathHandle, NodeIntr>      Nodes;
 
             Files           files_;
             Directories     dirs_;
@@ -33,43 +53,50 @@ namespace FWL {
         protected:
             const JsonNode& Config() const { return config_; }
             Log& Logger() { return *log_; }
+            //! -- fd is often the map entry itself: hold a reference until both erases are done
             void remove(FileIntr& fd)
             {
-        	files_.erase(fd->Fd());
-        	nodes_.erase(fd->Name());
+        	FileIntr file(fd);
+        	files_.erase(file->Fd());
+        	nodes_.erase(file->Interned());
             }
             
             void remove(DirectoryIntr& fd)
             {
-        	dirs_.erase(fd->Fd());
-        	nodes_.erase(fd->Name());
+        	DirectoryIntr dir(fd);
+        	dirs_.erase(dir->Fd());
+        	nodes_.erase(dir->Interned());
             }
             
             void insert(DirectoryIntr& fd)
             {
         	dirs_.insert(std::make_pair(fd->Fd(), fd));
-        	nodes_.insert(std::make_pair(fd->Name(), fd));
+        	nodes_.insert(std::make_pair(fd->Interned(), fd));
             }
             
             void insert(FileIntr& fd)
             {
         	files_.insert(std::make_pair(fd->Fd(), fd));
-        	nodes_.insert(std::make_pair(fd->Name(), fd));
+        	nodes_.insert(std::make_pair(fd->Interned(), fd));
             }
 
         public:
             const std::string& Name() const { return name_; }
+            //! -- no open files or directories: a reload may drop it
+            bool Idle() const { return files_.empty() && dirs_.empty(); }
+            //! -- in a forked child: descriptors opened by the parent are the parent's
+            void Forget() { files_.clear(); dirs_.clear(); nodes_.clear(); }
             Connector(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
             //! -- file
-            int Open(const std::string& path, int flags);
+            int Open(const PathHandle& path, int flags);
             int Write(int fd, const void *data, size_t size);
             int Read(int fd, void *data, size_t size);
             int Close(int fd);
             
-            bool GetFileSize(const std::string& name, size_t& size);
+            bool GetFileSize(const PathHandle& name, size_t& size);
             bool GetFileSize(int fd, size_t& size);
             int CloseDir(DIR *d);
-            void *OpenDir(const std::string& name);
+            void *OpenDir(const PathHandle& name);
     
 	    //! -- noded
 	    virtual int Unlink(const std::string& path) = 0;
@@ -77,6 +104,15 @@ namespace FWL {
             virtual int MkDir(const std::string& dir, mode_t mode) = 0;
             virtual int RmDir(const std::string& str) = 0;
             virtual blksize_t GetBlockSize() const { return 0xFFFF; }
+            virtual bool Link(const ConnectorMap& connectors) { return true; }
+            //! -- owns files a second instance must not open while this one runs: a reload keeps
+            //! -- the running instance even if its config changed
+            virtual bool Exclusive() const { return false; }
+            //! -- pthread_atfork: BeforeFork takes the locks helper threads use and AfterFork releases them;
+            //! -- in the child AfterFork also lets go of what the parent keeps using (connections, rings)
+            //! -- and restarts helper threads
+            virtual void BeforeFork() {}
+            virtual void AfterFork(bool child) {}
             virtual struct dirent *ReadDir(DIR *d);
 
         protected:
@@ -94,8 +130,6 @@ namespace FWL {
             virtual bool GetFileSize(FileIntr& file, size_t& size) = 0;
     };
 
-    typedef boost::intrusive_ptr<Connector>   ConnectorIntr;
-
     class ConnectorFactory
         : public Object
     {
@@ -0,0 +1,159 @@
+#pragma once
+
+extern "C" {
+#include <stdint.h>
+#include <sys/types.h>
+}
+#include <vector>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "connector.h"
+#include "log.h"
+
+namespace FWL {
+    //! -- wire format shared with farwel-agent; both sides must agree on AgentVersion
+    enum {
+        AgentMagic   = 0x4657414e,
+        AgentVersion = 1
+    };
+
+    enum AgentOp {
+        AgentExists,
+        AgentCreate,
+        AgentTruncate,
+        AgentWrite,
+        AgentRead,
+        AgentClose,
+        AgentSize,
+        AgentList,
+        AgentMkDir,
+        AgentUnlink,
+        AgentRmDir,
+        AgentRename
+    };
+
+    //! -- sent once over the unix socket together with the memfd and both eventfds
+    struct AgentHello
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t pid;
+        uint32_t entries;
+        uint32_t slot_size;
+    };
+
+    //! -- a slot holds the path, the second path (rename) and the data, in that order
+    struct AgentRequest
+    {
+        uint32_t op;
+        uint32_t slot;
+        int32_t  fd;
+        int32_t  flags;
+        uint64_t offset;
+        uint32_t size;
+        uint16_t path;
+        uint16_t path2;
+    };
+
+    struct AgentCompletion
+    {
+        uint32_t slot;
+        int32_t  error;
+        int64_t  result;
+        uint32_t more;
+        uint32_t pad;
+    };
+
+    struct AgentRing
+    {
+        volatile uint32_t head;
+        volatile uint32_t sleeping;
+        char              pad0[56];
+        volatile uint32_t tail;
+        char              pad1[60];
+    };
+
+    //! -- layout: AgentShared, entries requests, entries completions, entries slots
+    struct AgentShared
+    {
+        uint32_t  magic;
+        uint32_t  version;
+        uint32_t  entries;
+        uint32_t  slot_size;
+        char      pad[48];
+        AgentRing sq;
+        AgentRing cq;
+
+        static size_t Size(size_t entries, size_t slot_size)
+        {
+            return sizeof(AgentShared) + entries * (sizeof(AgentRequest) + sizeof(AgentCompletion) + slot_size);
+        }
+        //! -- sizes are passed in: the agent never trusts what the client left in the header
+        AgentRequest *Requests() { return (AgentRequest *)(this + 1); }
+        AgentCompletion *Completions(size_t entries) { return (AgentCompletion *)(Requests() + entries); }
+        char *Slot(size_t index, size_t entries, size_t slot_size) { return (char *)(Completions(entries) + entries) + index * slot_size; }
+    };
+
+    class Agent
+        : public Connector
+    {
+        private:
+            std::string socket_;
+            size_t      entries_;
+            size_t      slot_size_;
+
+            //! -- session; set up on first use and again after a fork or a lost agent
+            boost::mutex              lock_;
+            int                       sock_;
+            int                       sq_event_;
+            int                       cq_event_;
+            AgentShared               *shared_;
+            size_t                    inflight_;
+            bool                      broken_;
+
+            boost::mutex              sq_lock_;
+            boost::mutex              cq_lock_;
+            boost::condition_variable cq_wakeup_;
+            boost::condition_variable slot_wakeup_;
+            bool                      reaping_;
+            std::vector<uint32_t>     free_;
+            std::vector<char>         finished_;
+            std::vector<AgentCompletion> completions_;
+
+            bool connect();
+            void disconnect();
+            bool begin();
+            void end();
+            int acquire();
+            bool reap(int slot);
+            bool call(AgentOp op, const FileIntr& file, const std::string& path, const std::string& path2, const void *data, size_t size, uint64_t offset, AgentCompletion& completion, void *out = NULL);
+            int64_t simple(AgentOp op, const FileIntr& file, const std::string& path, const std::string& path2 = std::string(), uint64_t offset = 0);
+
+        public:
+            Agent(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Agent();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class AgentFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
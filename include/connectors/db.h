@@ -1,21 +1,129 @@
 #pragma once
 
 #include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <soci/soci.h>
 #include "connector.h"
 #include "path.h"
 namespace FWL {
+    class Dialect
+        : public Object
+    {
+        public:
+            virtual const char *Name() const = 0;
+            virtual std::string Quote(const std::string& identifier) const = 0;
+            virtual std::string Concat(const std::string& left, const std::string& right) const = 0;
+            virtual std::string Length(const std::string& expr) const = 0;
+            virtual std::string CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const = 0;
+            //! -- the value column is binary: Value() turns a bound value or literal into the column type,
+            //! -- Select() is what a read selects; Encode()/Decode() convert the bytes bound to and read from them
+            virtual std::string Value(const std::string& expr) const { return expr; }
+            virtual std::string Select(const std::string& column) const { return column; }
+            virtual const std::string& Encode(const std::string& data, std::string& buf) const { return data; }
+            virtual void Decode(std::string& data) const {}
+            virtual void Prepare(soci::session& session, const JsonNode& config) const {}
+            static Dialect *Create(const std::string& name);
+    };
+
+    typedef boost::intrusive_ptr<Dialect>   DialectIntr;
+
+    class MysqlDialect
+        : public Dialect
+    {
+        public:
+            const char *Name() const { return "mysql"; }
+            std::string Quote(const std::string& identifier) const;
+            std::string Concat(const std::string& left, const std::string& right) const;
+            std::string Length(const std::string& expr) const;
+            std::string CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const;
+    };
+
+    class SqliteDialect
+        : public Dialect
+    {
+        public:
+            const char *Name() const { return "sqlite3"; }
+            std::string Quote(const std::string& identifier) const;
+            std::string Concat(const std::string& left, const std::string& right) const;
+            std::string Length(const std::string& expr) const;
+            std::string CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const;
+            std::string Value(const std::string& expr) const;
+            void Prepare(soci::session& session, const JsonNode& config) const;
+    };
+
+    class PostgresqlDialect
+        : public Dialect
+    {
+        public:
+            const char *Name() const { return "postgresql"; }
+            std::string Quote(const std::string& identifier) const;
+            std::string Concat(const std::string& left, const std::string& right) const;
+            std::string Length(const std::string& expr) const;
+            std::string CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const;
+            std::string Value(const std::string& expr) const;
+            std::string Select(const std::string& column) const;
+            const std::string& Encode(const std::string& data, std::string& buf) const;
+            void Decode(std::string& data) const;
+            void Prepare(soci::session& session, const JsonNode& config) const;
+    };
+
+    class DbAsync;
+
     class Db
         : public Connector
     {
         private:
+            struct Queries
+            {
+                std::string exists;
+                std::string create;
+                std::string truncate;
+                std::string update;
+                std::string append;
+                std::string remove;
+                std::string clear;
+                std::string read;
+                std::string readdir;
+                std::string length;
+                std::string rename;
+                std::string rename_dir;
+            };
+
+            struct Replica
+            {
+                std::string                     conn_str;
+                boost::shared_ptr<soci::session> session;
+                uint64_t                        retry_at;
+            };
+
+            typedef std::vector<Replica>                          Replicas;
+            typedef boost::unordered_map<std::string, uint64_t>   Written;
+            typedef std::vector<std::pair<std::string, std::string> >  Params;
+            typedef std::vector<std::vector<std::string> >        Rows;
+
             std::auto_ptr<soci::session> session_;
             std::string conn_str_;
             std::string table_name_;
             std::string key_column_;
             std::string value_column_;
             std::string parent_column_;
+            DialectIntr dialect_;
+            Queries     queries_;
+            Replicas    replicas_;
+            size_t      next_replica_;
+            uint64_t    consistency_window_;
+            uint64_t    replica_retry_;
+            Written     written_;
+            boost::shared_ptr<DbAsync> async_;
             soci::session& Session();
+            bool execute(const std::string& query, const Params& params, Rows *rows = NULL, uint64_t *affected = NULL);
+            soci::session& reader(const std::string& key, size_t& replica);
+            bool failed(size_t replica, const std::exception& e);
+            void touch(const std::string& key);
+            bool recent(const std::string& key);
+            void prepare(soci::session& session);
             bool update(const std::string& key, const std::string& value);
             bool append(const std::string& key, const std::string& value);
             bool remove(const std::string& key);
@@ -24,6 +132,8 @@ namespace FWL {
             bool length(const std::string& key, size_t& size);
         public:
             Db(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            void BeforeFork();
+            void AfterFork(bool child);
             bool Exists(FileIntr& file);
             bool Create(FileIntr& file);
             bool Truncate(FileIntr& file);
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include "composite.h"
+#include "log.h"
+
+namespace FWL {
+    class Diskcache
+        : public Composite
+    {
+        private:
+            enum SlotState {
+                SlotEmpty = 0,
+                SlotUsed  = 1,
+                SlotDead  = 2
+            };
+
+            //! -- the index is shared by every process using the same directory
+            struct IndexHeader
+            {
+                uint32_t magic;
+                uint32_t format;
+                uint64_t slots;
+                uint64_t used;
+                uint64_t clock;
+                uint64_t version;
+                uint64_t reserved[3];
+            };
+
+            struct Slot
+            {
+                uint64_t hash;
+                uint64_t version;
+                uint64_t size;
+                uint64_t atime;
+                uint64_t validated;
+                uint32_t state;
+                uint32_t length;
+                char     path[208];
+            };
+
+            typedef boost::unordered_map<int, int>   Handles;
+
+            ConnectorIntr backend_;
+            std::string   path_;
+            uint64_t      capacity_;
+            time_t        validate_interval_;
+
+            int           index_fd_;
+            IndexHeader   *header_;
+            Slot          *slots_;
+            size_t        index_size_;
+            boost::mutex  index_lock_;
+            boost::mutex  lock_;
+            Handles       handles_;
+            unsigned long hits_;
+            unsigned long misses_;
+
+            static uint64_t hash(const std::string& path);
+            std::string object(const Slot& slot) const;
+            bool attach(uint64_t slots);
+            void lockIndex();
+            void unlockIndex();
+            Slot *find(const std::string& path, bool insert);
+            void drop(Slot& slot);
+            void evict();
+            bool validate(const std::string& path);
+            int fill(FileIntr& file);
+            int handle(FileIntr& file);
+            void invalidate(const std::string& path);
+
+        public:
+            Diskcache(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Diskcache();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Link(const ConnectorMap& connectors);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class DiskcacheFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
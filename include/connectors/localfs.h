@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+extern "C" {
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+}
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "connector.h"
+#include "log.h"
+
+namespace FWL {
+    //! -- minimal io_uring driver; callers from several threads are submitted together
+    //! -- by whichever of them is currently inside io_uring_enter (group commit)
+    class Uring
+    {
+        private:
+            struct Completion
+            {
+                int  res;
+                bool done;
+            };
+
+            int                  fd_;
+            unsigned             entries_;
+            void                 *sq_ring_;
+            void                 *cq_ring_;
+            size_t               sq_ring_size_;
+            size_t               cq_ring_size_;
+            struct io_uring_sqe  *sqes_;
+            unsigned             *sq_head_;
+            unsigned             *sq_tail_;
+            unsigned             *sq_mask_;
+            unsigned             *sq_array_;
+            unsigned             *cq_head_;
+            unsigned             *cq_tail_;
+            unsigned             *cq_mask_;
+            struct io_uring_cqe  *cqes_;
+
+            boost::mutex              lock_;
+            boost::condition_variable changed_;
+            bool                      leader_;
+            unsigned                  queued_;
+            unsigned                  inflight_;
+            unsigned long             ops_;
+            unsigned long             enters_;
+
+            void setup(unsigned entries);
+            void teardown();
+            void reap();
+            void fail(int res);
+            int execute(const struct io_uring_sqe& sqe);
+
+        public:
+            Uring(unsigned entries);
+            ~Uring();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Valid() const { return fd_ >= 0; }
+            unsigned long Ops() const { return ops_; }
+            unsigned long Enters() const { return enters_; }
+            int Open(const char *path, int flags, mode_t mode);
+            int Close(int fd);
+            int Read(int fd, void *data, size_t size, off_t offset);
+            int Write(int fd, const void *data, size_t size, off_t offset);
+            int Fsync(int fd, bool datasync);
+            int Statx(const char *path, struct statx *buf);
+    };
+
+    class Localfs
+        : public Connector
+    {
+        private:
+            enum SyncMode {
+                SyncNone,
+                SyncData,
+                SyncFull
+            };
+
+            typedef boost::unordered_map<int, int>   Handles;
+
+            std::string  root_;
+            std::string  strip_;
+            mode_t       mode_;
+            SyncMode     sync_;
+            Uring        ring_;
+            boost::mutex lock_;
+            Handles      handles_;
+
+            std::string path(const std::string& name) const;
+            int open(FileIntr& file, int flags);
+            int handle(FileIntr& file);
+            int stat(const std::string& name, struct statx& buf);
+            int read(int fd, void *data, size_t size, off_t offset);
+            int write(int fd, const void *data, size_t size, off_t offset);
+            int sync(int fd);
+            int close(int fd);
+
+        public:
+            Localfs(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Localfs();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class LocalfsFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <set>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "connector.h"
+#include "log.h"
+
+namespace FWL {
+    class Logstore
+        : public Connector
+    {
+        private:
+            enum RecordType {
+                Put    = 1,
+                Delete = 2,
+                Dir    = 3,
+                Move   = 4
+            };
+
+            struct Header
+            {
+                uint32_t magic;
+                uint32_t crc;
+                uint32_t type;
+                uint32_t key_size;
+                uint64_t value_size;
+            };
+
+            struct Segment
+            {
+                uint32_t id;
+                int      fd;
+                char     *base;
+                size_t   size;
+                size_t   tail;
+                size_t   dead;
+            };
+
+            struct Location
+            {
+                uint32_t segment;
+                size_t   offset;
+                size_t   length;
+                size_t   record;
+                bool     dir;
+            };
+
+            struct Pending
+            {
+                std::string data;
+                bool        dirty;
+            };
+
+            typedef std::map<uint32_t, Segment>                          Segments;
+            typedef boost::unordered_map<std::string, Location>          Index;
+            typedef boost::unordered_map<std::string, std::set<std::string> > Children;
+            typedef boost::unordered_map<int, Pending>                   Pendings;
+
+            std::string path_;
+            size_t      segment_size_;
+            double      compaction_ratio_;
+            int         compaction_interval_;
+            bool        sync_;
+            //! -- set in a forked child: the parent keeps appending at the offsets the child would use
+            bool        readonly_;
+
+            boost::mutex              lock_;
+            boost::condition_variable wakeup_;
+            bool                      stop_;
+            Segments                  segments_;
+            Segment                   *active_;
+            Index                     index_;
+            Children                  children_;
+            Pendings                  pendings_;
+            boost::thread             compactor_;
+
+            static size_t recordSize(size_t key_size, size_t value_size);
+            std::string segmentName(uint32_t id) const;
+            Segment *openSegment(uint32_t id, size_t size, bool create);
+            void closeSegment(Segment& segment, bool unlink);
+            bool recover();
+            void replay(Segment& segment);
+            void attach(const std::string& key);
+            void detach(const std::string& key);
+            void apply(uint32_t type, const std::string& key, const Location& loc, const char *value);
+            void forget(const std::string& key);
+            bool append(uint32_t type, const std::string& key, const char *value, size_t size);
+            bool lookup(const std::string& key, Location& loc);
+            Pending& pending(FileIntr& file);
+            bool compact();
+            void compactor();
+
+        public:
+            Logstore(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Logstore();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exclusive() const { return true; }
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class LogstoreFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
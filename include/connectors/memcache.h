@@ -1,36 +1,82 @@
 #pragma once
 
 #include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
 #include "connector.h"
 #include "log.h"
 
-namespace memcache
-{
-    class Memcache;
-}
+struct memcached_st;
 
 namespace FWL {
     class Memcache
         : public Connector
     {
         private:
-            std::auto_ptr<memcache::Memcache> client_;
+            struct Prefetched
+            {
+                std::string value;
+                time_t      time;
+            };
+
+            //! -- value a descriptor has read, kept until any descriptor writes the same path
+            struct Content
+            {
+                std::string path;
+                std::string value;
+            };
+
+            typedef boost::unordered_map<std::string, Prefetched>   PrefetchCache;
+            typedef boost::unordered_map<int, Content>              Contents;
+            typedef boost::unordered_map<int, size_t>               Lengths;
+
+            memcached_st  *client_;
+            std::string   key_prefix_;
+            size_t        prefetch_limit_;
+            time_t        prefetch_ttl_;
+            int           cas_retries_;
+            PrefetchCache prefetch_;
+            Contents      contents_;
+            Lengths       lengths_;
+            //! -- memcached_st is not thread safe: one command at a time on the shared connection
+            boost::mutex  lock_;
+
+            std::string fileKey(const std::string& path) const { return key_prefix_ + "f:" + path; }
+            std::string dirKey(const std::string& path) const { return key_prefix_ + "d:" + path; }
+
+            bool get(const std::string& key, std::string& value);
+            bool gets(const std::string& key, std::string& value, uint64_t& cas);
+            bool set(const std::string& key, const std::string& value);
+            bool cas(const std::string& key, const std::string& value, uint64_t cas);
+            bool append(const std::string& key, const std::string& value);
+            bool remove(const std::string& key);
+
+            bool addEntry(const std::string& path);
+            bool removeEntry(const std::string& path);
+            bool content(FileIntr& file, std::string& value);
+            void prefetch(const std::string& dir, const std::vector<std::string>& files);
+            bool prefetched(const std::string& path, std::string& value);
+            void invalidate(const std::string& path);
+            int unlink(const std::string& path);
+
         public:
             Memcache(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
-            int Write(int fd, const void *data, size_t size);
-            int Read(int fd, void *data, size_t size);
-            int Rename(const std::string& name, const std::string& newname);
-
-            int MkDir(const std::string& name, mode_t mode);
-            int RmDir(const std::string& name);
-            bool GetFileSize(const std::string& name, size_t& size);
-            bool OpenDir(Directory& dir);
-            bool CloseDir(Directory& dir);
-            int CloseFd(int fd);
+            ~Memcache();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
             int Unlink(const std::string& path);
-            bool Exists(int fd, const std::string& name) { return false; }
-            bool Create(int fd, const std::string& name) { return false; }
-            bool Truncate(int fd, const std::string& name) { return false; }
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
     };
 
     class MemcacheFactory
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "composite.h"
+#include "log.h"
+
+namespace FWL {
+    class Mirror
+        : public Composite
+    {
+        private:
+            struct Attempt
+            {
+                size_t            replica;
+                FileIntr          file;
+                std::vector<char> data;
+                uint64_t          started;
+                int               ret;
+                int               error;
+                bool              done;
+                Attempt() : replica(0), started(0), ret(-1), error(0), done(false) {}
+            };
+
+            //! -- one hedged read; shared with the workers so a late loser can finish after the caller returned
+            struct Race
+                : public Object
+            {
+                boost::mutex              lock;
+                boost::condition_variable finished;
+                Attempt                   attempts[2];
+                bool                      abandoned;
+                Race() : abandoned(false) {}
+            };
+
+            typedef boost::intrusive_ptr<Race>        RaceIntr;
+            typedef std::pair<RaceIntr, size_t>       Task;
+
+            struct Replica
+                : public Object
+            {
+                ConnectorIntr             connector;
+                boost::mutex              call;
+                boost::mutex              lock;
+                boost::condition_variable wakeup;
+                std::deque<Task>          tasks;
+                Task                      current;
+                boost::thread             worker;
+                bool                      stop;
+                std::vector<uint32_t>     samples;
+                size_t                    next;
+                size_t                    filled;
+                double                    ewma;
+                unsigned long             reads;
+                unsigned long             errors;
+                Replica() : stop(false), next(0), filled(0), ewma(0), reads(0), errors(0) {}
+            };
+
+            typedef boost::intrusive_ptr<Replica>         ReplicaIntr;
+            typedef std::vector<ReplicaIntr>              Replicas;
+            typedef boost::unordered_map<int, size_t>     Listings;
+
+            Replicas      replicas_;
+            size_t        window_;
+            double        percentile_;
+            uint64_t      hedge_delay_;
+            uint64_t      hedge_min_;
+            uint64_t      hedge_max_;
+            unsigned long stats_interval_;
+
+            boost::mutex  lock_;
+            Listings      listings_;
+            unsigned long reads_;
+            unsigned long hedged_;
+            unsigned long hedge_wins_;
+
+            static uint64_t now();
+            void worker(ReplicaIntr replica);
+            void launch(RaceIntr& race, size_t attempt, size_t replica, FileIntr& file, size_t size);
+            void abandon(Replica& replica, int fd);
+            static void finish(Race& race, Attempt& attempt, int ret, int error);
+            void record(Replica& replica, uint64_t elapsed, bool failed);
+            void rank(std::vector<size_t>& order);
+            uint64_t delay(size_t replica);
+            void stats();
+            void report();
+
+        public:
+            Mirror(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Mirror();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Link(const ConnectorMap& connectors);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class MirrorFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
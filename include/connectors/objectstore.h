@@ -0,0 +1,145 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "connector.h"
+#include "log.h"
+
+namespace FWL {
+    class Objectstore
+        : public Connector
+    {
+        private:
+            struct Response
+            {
+                int                                                 status;
+                boost::unordered_map<std::string, std::string>      headers;
+                std::string                                         body;
+                bool                                                keep_alive;
+                Response() : status(0), keep_alive(true) {}
+                std::string Header(const std::string& name) const;
+            };
+
+            //! -- read-ahead window of one descriptor
+            struct Stream
+            {
+                off_t       start;
+                std::string data;
+                off_t       next;
+                off_t       total;
+                Stream() : start(0), next(0), total(-1) {}
+            };
+
+            //! -- buffered writes of one descriptor; bytes below base are already uploaded parts
+            struct Upload
+            {
+                std::string              data;
+                off_t                    base;
+                bool                     loaded;
+                std::string              id;
+                std::vector<std::string> etags;
+                Upload() : base(0), loaded(false) {}
+            };
+
+            //! -- ranges of one parallel read; the reader waits until pending drops to zero
+            struct Batch
+            {
+                boost::mutex              lock;
+                boost::condition_variable done;
+                size_t                    pending;
+                Batch() : pending(0) {}
+            };
+
+            struct Fetch
+            {
+                std::string key;
+                off_t       offset;
+                size_t      size;
+                std::string *data;
+                bool        *ok;
+                Batch       *batch;
+            };
+
+            typedef boost::unordered_map<int, Stream>   Streams;
+            typedef boost::unordered_map<int, Upload>   Uploads;
+            typedef std::deque<Fetch>                   Fetches;
+
+            std::string host_;
+            std::string port_;
+            std::string bucket_;
+            std::string prefix_;
+            std::string headers_;
+            int         timeout_ms_;
+            size_t      range_size_;
+            size_t      parallel_;
+            size_t      threshold_;
+            size_t      part_size_;
+            size_t      connections_;
+
+            boost::mutex              pool_lock_;
+            boost::condition_variable pool_wakeup_;
+            std::vector<int>          idle_;
+            size_t                    open_;
+            boost::mutex              lock_;
+            Streams                   streams_;
+            Uploads                   uploads_;
+            boost::mutex              fetch_lock_;
+            boost::condition_variable fetch_wakeup_;
+            Fetches                   fetches_;
+            boost::thread_group       fetchers_;
+            size_t                    fetcher_count_;
+            bool                      stop_;
+
+            std::string key(const std::string& path) const;
+            std::string target(const std::string& key) const;
+            static std::string encode(const std::string& str, bool slash);
+            static void extract(const std::string& xml, const std::string& tag, std::vector<std::string>& values);
+
+            int connect();
+            int checkout(bool fresh);
+            void checkin(int sock, bool reuse);
+            bool exchange(int sock, const std::string& request, bool head, Response& response);
+            bool request(const std::string& method, const std::string& target, const std::string& headers, const std::string& body, Response& response);
+
+            bool head(const std::string& key, size_t& size);
+            bool put(const std::string& key, const std::string& body);
+            bool remove(const std::string& key);
+            bool fetch(const std::string& key, off_t offset, size_t size, std::string& data, off_t *total);
+            void fetcher();
+            bool list(const std::string& prefix, bool delimiter, std::vector<std::string>& keys, std::vector<std::string>& prefixes);
+            bool uploadPart(const std::string& key, Upload& upload, size_t size);
+            bool flush(const std::string& key, Upload& upload);
+            bool move(const std::string& from, const std::string& to);
+
+        public:
+            Objectstore(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Objectstore();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class ObjectstoreFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include "composite.h"
+#include "log.h"
+
+namespace FWL {
+    class Overlay
+        : public Composite
+    {
+        private:
+            //! -- per descriptor: the lower file's real fd, or Upper once the file lives in the upper layer
+            enum {
+                Upper = -1
+            };
+
+            typedef boost::unordered_map<int, int>   Handles;
+
+            ConnectorIntr upper_;
+            std::string   lower_;
+            std::string   strip_;
+            boost::mutex  lock_;
+            Handles       handles_;
+
+            std::string lower(const std::string& path) const;
+            static std::string whiteout(const std::string& path);
+            static bool hidden(const std::string& name);
+            bool upper(const std::string& path);
+            bool opaque(const std::string& path);
+            bool whited(const std::string& path);
+            bool empty(const std::string& path, std::vector<std::string>& whiteouts);
+            bool shadow(const std::string& path);
+            bool unshadow(const std::string& path);
+            bool lowerFile(const std::string& path, size_t *size);
+            bool copyUp(const std::string& path, const std::string& newpath);
+            int handle(FileIntr& file);
+            void release(FileIntr& file);
+
+        public:
+            Overlay(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Overlay();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Link(const ConnectorMap& connectors);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class OverlayFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "composite.h"
+#include "log.h"
+
+namespace FWL {
+    class Placement
+        : public Composite
+    {
+        private:
+            //! -- every condition that is set has to hold; the first matching rule picks the target
+            struct Rule
+            {
+                size_t                   target;
+                size_t                   min_size;
+                size_t                   max_size;
+                unsigned long            min_accesses;
+                unsigned long            max_accesses;
+                std::vector<std::string> extensions;
+                bool Matches(const std::string& extension, size_t size, unsigned long accesses) const;
+            };
+
+            //! -- where an object lives; version changes on every modification so a migration
+            //! -- that raced with a writer is thrown away instead of published
+            struct Entry
+            {
+                size_t        target;
+                size_t        size;
+                bool          sized;
+                unsigned long accesses;
+                unsigned long epoch;
+                unsigned long version;
+                int           opened;
+                bool          queued;
+                Entry() : target(0), size(0), sized(false), accesses(0), epoch(0), version(0), opened(0), queued(false) {}
+            };
+
+            //! -- the target a descriptor was first used on; path is empty once the object is unlinked
+            struct Descriptor
+            {
+                size_t      target;
+                std::string path;
+                bool        written;
+                Descriptor() : target(0), written(false) {}
+            };
+
+            typedef std::vector<ConnectorIntr>                         Targets;
+            typedef std::vector<Rule>                                  Rules;
+            typedef boost::unordered_map<std::string, Entry>           Index;
+            typedef boost::unordered_map<std::string, size_t>          Hints;
+            typedef boost::unordered_map<int, Descriptor>              Descriptors;
+
+            std::vector<std::string> names_;
+            Targets                  targets_;
+            Rules                    rules_;
+            size_t                   default_;
+            Hints                    hints_;
+            unsigned long            interval_;
+            bool                     migrate_;
+
+            boost::mutex              lock_;
+            boost::condition_variable wakeup_;
+            bool                      stop_;
+            Index                     index_;
+            Descriptors               descriptors_;
+            std::deque<std::string>   queue_;
+            boost::thread             migrator_;
+            unsigned long             moved_;
+
+            size_t target(const std::string& name);
+            static std::string extension(const std::string& path);
+            size_t classify(const std::string& path, const Entry& entry) const;
+            unsigned long now() const;
+            void age(Entry& entry) const;
+            bool locate(const std::string& path, size_t& target);
+            bool pin(FileIntr& file, bool create, bool write, size_t& target);
+            bool pinned(FileIntr& file, size_t& target);
+            bool unpin(FileIntr& file, Descriptor& descriptor);
+            void detach(const std::string& path, bool under);
+            void reconsider(const std::string& path, Entry& entry);
+            void migrator();
+            void migrate(const std::string& path, boost::mutex::scoped_lock& lock);
+
+        public:
+            Placement(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Placement();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Link(const ConnectorMap& connectors);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class PlacementFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
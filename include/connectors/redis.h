@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include "connector.h"
+#include "log.h"
+
+namespace FWL {
+    class Redis
+        : public Connector
+    {
+        private:
+            struct Reply
+            {
+                enum Type {
+                    Status,
+                    Error,
+                    Integer,
+                    Bulk,
+                    Nil,
+                    Array
+                };
+                Type               type;
+                long long          integer;
+                std::string        str;
+                std::vector<Reply> elements;
+                Reply() : type(Nil), integer(0) {}
+                bool Ok() const { return type != Error; }
+            };
+
+            class Command
+            {
+                private:
+                    std::vector<std::string> args_;
+                public:
+                    Command& operator<<(const std::string& arg) { args_.push_back(arg); return *this; }
+                    Command& operator<<(long long arg);
+                    void Serialize(std::string& out) const;
+            };
+
+            typedef std::vector<Reply>   Replies;
+
+            std::string unix_socket_;
+            std::string host_;
+            std::string port_;
+            std::string password_;
+            int         db_;
+            std::string key_prefix_;
+            size_t      scan_count_;
+            //! -- one connection: held from the first queued command until its replies are read
+            boost::mutex lock_;
+            int         sock_;
+            std::string out_;
+            size_t      pending_;
+            std::string in_;
+            size_t      in_pos_;
+
+            std::string fileKey(const std::string& path) const { return key_prefix_ + "f:" + path; }
+            std::string dirKey(const std::string& path) const { return key_prefix_ + "d:" + path; }
+
+            bool connect(size_t& handshake);
+            void disconnect();
+            bool fill();
+            bool line(std::string& str);
+            bool parse(Reply& reply);
+            void queue(const Command& cmd);
+            bool exec(Replies& replies);
+            bool exec(const Command& cmd, Reply& reply);
+            bool members(const std::string& key, std::vector<std::string>& names);
+            int unlink(const std::string& path);
+            int rename(const std::string& name, const std::string& newname);
+
+        public:
+            Redis(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Redis();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class RedisFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "composite.h"
+#include "log.h"
+
+namespace FWL {
+    class Sharded
+        : public Composite
+    {
+        private:
+            typedef std::map<uint64_t, size_t>   Ring;
+            typedef std::vector<ConnectorIntr>   Shards;
+
+            Shards   shards_;
+            Ring     ring_;
+            size_t   vnodes_;
+            bool     by_parent_;
+
+            static uint64_t hash(const std::string& key);
+            static std::string parent(const std::string& path);
+            Connector& shard(const std::string& key);
+            Connector& place(const std::string& path);
+            Connector& list(const std::string& dir);
+            int move(const std::string& name, const std::string& newname);
+
+        public:
+            Sharded(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            bool Link(const ConnectorMap& connectors);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class ShardedFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
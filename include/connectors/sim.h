@@ -0,0 +1,87 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include "connector.h"
+#include "log.h"
+
+namespace FWL {
+    class Sim
+        : public Connector
+    {
+        private:
+            enum Kind {
+                ReadOp,
+                WriteOp,
+                MetaOp,
+                Kinds
+            };
+
+            enum Distribution {
+                Fixed,
+                Normal,
+                LongTail
+            };
+
+            //! -- injected behaviour of one kind of operation
+            struct Profile
+            {
+                Distribution distribution;
+                double       latency_us;
+                double       stddev_us;
+                double       tail_alpha;
+                double       max_us;
+                double       ops_per_sec;
+                double       bytes_per_sec;
+                double       error_rate;
+                int          error;
+                double       next_us;
+            };
+
+            typedef boost::unordered_map<std::string, std::string>             Files;
+            typedef boost::unordered_map<std::string, std::set<std::string> >  Children;
+
+            Profile        profiles_[Kinds];
+            boost::mt19937 random_;
+            boost::mutex   random_lock_;
+            boost::mutex   lock_;
+            Files          files_;
+            Children       children_;
+
+            static Profile profile(const JsonNode& config, const Profile& defaults);
+            static std::string normalize(const std::string& path);
+            static double now();
+            bool inject(Kind kind, size_t bytes);
+            void attach(const std::string& path);
+            void detach(const std::string& path);
+            void move(const std::string& from, const std::string& to);
+
+        public:
+            Sim(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class SimFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <list>
+#include <deque>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "composite.h"
+#include "log.h"
+
+namespace FWL {
+    class Tiered
+        : public Composite
+    {
+        private:
+            enum Admission {
+                AdmitAlways,
+                AdmitSecondAccess,
+                AdmitSize
+            };
+
+            enum Eviction {
+                EvictLru,
+                EvictFifo,
+                EvictNone
+            };
+
+            typedef std::list<std::string>   Order;
+
+            struct Resident
+            {
+                size_t          size;
+                Order::iterator position;
+            };
+
+            struct Counter
+            {
+                unsigned long hits;
+                unsigned long misses;
+                Counter() : hits(0), misses(0) {}
+                void Report(Log& log, const std::string& name, const char *tier) const;
+            };
+
+            typedef boost::unordered_map<std::string, Resident>   Residents;
+            typedef boost::unordered_map<std::string, int>        Accesses;
+            typedef boost::unordered_set<std::string>             Dirty;
+            typedef boost::unordered_map<int, std::string>        Descriptors;
+
+            ConnectorIntr upper_;
+            ConnectorIntr lower_;
+            bool          async_;
+            Admission     admission_;
+            size_t        admission_size_;
+            Eviction      eviction_;
+            size_t        capacity_;
+            unsigned long stats_interval_;
+
+            boost::mutex              lock_;
+            boost::condition_variable wakeup_;
+            bool                      stop_;
+            Residents                 residents_;
+            Order                     order_;
+            size_t                    used_;
+            Accesses                  accesses_;
+            Dirty                     dirty_;
+            Dirty                     destaging_;
+            Descriptors               descriptors_;
+            Accesses                  opened_;
+            std::deque<std::string>   destage_;
+            boost::thread             destager_;
+            Counter                   upper_stats_;
+            Counter                   lower_stats_;
+
+            bool resident(const std::string& path);
+            bool admit(FileIntr& file);
+            bool fill(FileIntr& file);
+            void account(const std::string& path, size_t size);
+            void forget(const std::string& path);
+            void evict();
+            void touch(FileIntr& file);
+            void use(FileIntr& file);
+            void settle(boost::mutex::scoped_lock& lock, const std::string& path);
+            void stats();
+            void destager();
+
+        public:
+            Tiered(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+            ~Tiered();
+            void BeforeFork();
+            void AfterFork(bool child);
+            bool Link(const ConnectorMap& connectors);
+            bool Exists(FileIntr& file);
+            bool Create(FileIntr& file);
+            bool Truncate(FileIntr& file);
+            int MkDir(const std::string& path, mode_t mode);
+            int Write(FileIntr& file, const void *data, size_t size);
+            int Read(FileIntr& file, void *data, size_t size);
+            bool Open(DirectoryIntr& dir);
+            bool Close(DirectoryIntr& dir);
+            bool Close(FileIntr& file);
+            bool GetFileSize(FileIntr& file, size_t& size);
+            int Unlink(const std::string& path);
+            int RmDir(const std::string& path);
+            int Rename(const std::string& name, const std::string& newname);
+    };
+
+    class TieredFactory
+        : public ConnectorFactory
+    {
+        public:
+            Connector *Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log);
+    };
+}
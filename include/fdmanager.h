@@ -1,5 +1,4 @@
 #pragma once
-#include <boost/unordered_map.hpp>
 #include <boost/detail/atomic_count.hpp>
 extern "C" {
 #include <sys/types.h>
@@ -9,21 +8,34 @@ extern "C" {
 namespace FWL {
     class Connector;
 
+    //! -- virtual descriptors are handed out in increasing order, so they are looked up in a table
+    //! -- indexed by the low bits of the descriptor: no hashing, no lock and no allocation per open
     class FdManager
     {
         private:
+            struct Slot
+            {
+                int       fd;
+                Connector *connector;
+            };
+
             int begin_;
             boost::detail::atomic_count fd_;
-            typedef boost::unordered_map<int, Connector *>   Connectors;
-            Connectors connectors_;
+            Slot *slots_;
+
+            FdManager(const FdManager&);
+            FdManager& operator=(const FdManager&);
 
             Connector *GetConnector(int fd);
             Connector *GetDirConnector(int *d) { return GetConnector(*d); }
             friend class Main;
         public:
             FdManager();
+            ~FdManager();
             int Begin() const;
+            //! -- -1 once every slot is taken by an open descriptor
             int Get(Connector *connector);
             bool Release(int fd, Connector *connector);
+            void Clear();
     };
 }
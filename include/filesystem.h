@@ -1,28 +1,52 @@
 #pragma once
-#include <boost/intrusive_ptr.hpp>
 extern "C" {
 #include <dirent.h>
 }
 
 #include <vector>
 #include <string>
-#include "object.h"
+#include "path.h"
+#include <boost/intrusive_ptr.hpp>
 namespace FWL {
+    //! -- a descriptor is used by one thread at a time, so its count isn't atomic; a composite that
+    //! -- hands one to a helper thread gives it a clone (see Mirror::launch)
     class Node
-	: public Object
     {
 	private:
+	    long refs_;
 	    int fd_;
-	    std::string name_;
+	    PathHandle name_;
+	    Node(const Node&);
+	    Node& operator=(const Node&);
 	public:
-	    Node(int fd, const std::string& name)
-		: fd_(fd)
+	    Node(int fd, const PathHandle& name)
+		: refs_(0)
+		, fd_(fd)
 		, name_(name)
 	    {}
-	    const std::string& Name() const { return name_; }
+	    virtual ~Node() {}
+	    void AddRef() { ++refs_; }
+	    void Release() { if (!--refs_) delete this; }
+	    const std::string& Name() const { return name_.Str(); }
+	    const PathHandle& Interned() const { return name_; }
 	    int Fd() const { return fd_; }
+	    //! -- what OpenDir hands out as the DIR pointer: readdir/closedir read the fd back through it
+	    int *Handle() { return &fd_; }
+	    //! -- pthread_atfork: the pool depots must not be locked by a thread that stays behind
+	    static void BeforeFork();
+	    static void AfterFork();
     };
 
+    inline void intrusive_ptr_add_ref(Node *node)
+    {
+        node->AddRef();
+    }
+
+    inline void intrusive_ptr_release(Node *node)
+    {
+        node->Release();
+    }
+
     typedef boost::intrusive_ptr<Node> NodeIntr;
 
     class File
@@ -32,8 +56,12 @@ namespace FWL {
             off_t      offset_;
             int flags_;
         public:
-            File(int fd, const std::string& name, int flags);
+            File(int fd, const PathHandle& name, int flags);
+            //! -- from a per-thread pool: opening and closing a file doesn't go to malloc
+            static void *operator new(size_t size);
+            static void operator delete(void *ptr, size_t size);
             off_t Offset() const { return offset_; }
+            void Seek(off_t offset) { offset_ = offset; }
             int Flags() const { return flags_; }
     };
 
@@ -48,7 +76,9 @@ namespace FWL {
             FileList      files_;
             struct dirent dirent_;
         public:
-            Directory(int fd, const std::string& name);
+            Directory(int fd, const PathHandle& name);
+            static void *operator new(size_t size);
+            static void operator delete(void *ptr, size_t size);
             const FileList& Files() const { return files_; }
             FileList& Files() { return files_; }
             void AddFile(const std::string& name);
@@ -0,0 +1,128 @@
+#pragma once
+#include <utility>
+#include <vector>
+#include <boost/functional/hash.hpp>
+namespace FWL {
+    //! -- open addressing with linear probing: entries live in one array, so inserting and erasing
+    //! -- allocate nothing once it has grown to the working set. Erasing shifts the following
+    //! -- entries back instead of leaving tombstones, so any erase invalidates iterators
+    template <class K, class V, class H = boost::hash<K> >
+    class FlatMap
+    {
+        public:
+            typedef std::pair<K, V>   value_type;
+
+        private:
+            struct Slot
+            {
+                value_type value;
+                bool       used;
+                Slot() : used(false) {}
+            };
+
+            std::vector<Slot> slots_;
+            size_t            size_;
+            H                 hash_;
+
+            size_t home(const K& key) const { return hash_(key) & (slots_.size() - 1); }
+
+            void grow()
+            {
+                std::vector<Slot> old(slots_.empty() ? 16 : slots_.size() * 2);
+                old.swap(slots_);
+                size_ = 0;
+                for (size_t i = 0; i < old.size(); ++i) {
+                    if (old[i].used) {
+                        insert(old[i].value);
+                    }
+                }
+            }
+
+        public:
+            class iterator
+            {
+                private:
+                    Slot *slot_;
+                public:
+                    explicit iterator(Slot *slot = NULL) : slot_(slot) {}
+                    value_type& operator*() const { return slot_->value; }
+                    value_type *operator->() const { return &slot_->value; }
+                    bool operator==(const iterator& other) const { return slot_ == other.slot_; }
+                    bool operator!=(const iterator& other) const { return slot_ != other.slot_; }
+            };
+
+            FlatMap() : size_(0) {}
+
+            iterator end() { return iterator(); }
+            bool empty() const { return !size_; }
+            size_t size() const { return size_; }
+
+            iterator find(const K& key)
+            {
+                if (!size_) {
+                    return end();
+                }
+                for (size_t i = home(key); slots_[i].used; i = (i + 1) & (slots_.size() - 1)) {
+                    if (slots_[i].value.first == key) {
+                        return iterator(&slots_[i]);
+                    }
+                }
+                return end();
+            }
+
+            std::pair<iterator, bool> insert(const value_type& value)
+            {
+                if ((size_ + 1) * 2 > slots_.size()) {
+                    grow();
+                }
+                size_t i = home(value.first);
+                for ( ; slots_[i].used; i = (i + 1) & (slots_.size() - 1)) {
+                    if (slots_[i].value.first == value.first) {
+                        return std::make_pair(iterator(&slots_[i]), false);
+                    }
+                }
+                slots_[i].value = value;
+                slots_[i].used  = true;
+                ++size_;
+                return std::make_pair(iterator(&slots_[i]), true);
+            }
+
+            size_t erase(const K& key)
+            {
+                if (!size_) {
+                    return 0;
+                }
+                size_t mask = slots_.size() - 1;
+                size_t i    = home(key);
+                for ( ; slots_[i].used && !(slots_[i].value.first == key); i = (i + 1) & mask) {
+                }
+                if (!slots_[i].used) {
+                    return 0;
+                }
+                //! -- pull back every later entry of the run whose home isn't between the hole and itself
+                for (size_t j = (i + 1) & mask; slots_[j].used; j = (j + 1) & mask) {
+                    size_t k = home(slots_[j].value.first);
+                    if (((j > i) && ((k <= i) || (k > j))) || ((j < i) && (k <= i) && (k > j))) {
+                        slots_[i].value = slots_[j].value;
+                        i = j;
+                    }
+                }
+                slots_[i].value = value_type();
+                slots_[i].used  = false;
+                --size_;
+                return 1;
+            }
+
+            //! -- keeps the array for the next round
+            void clear()
+            {
+                for (size_t i = 0; i < slots_.size(); ++i) {
+                    if (slots_[i].used) {
+                        slots_[i].value = value_type();
+                        slots_[i].used  = false;
+                    }
+                }
+                size_ = 0;
+            }
+    };
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <stddef.h>
+extern "C" {
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/uio.h>
+}
+
+namespace FWL {
+    //! -- the back end every Log writes through. A calling thread formats its record into a ring of its
+    //! -- own without taking a lock; one writer thread stamps the records and hands them to the sinks in
+    //! -- batches with writev. A full ring drops the record and counts it rather than making the caller
+    //! -- wait; the writer reports the count in the sink. Nothing here goes through the interposed calls
+    class Journal
+    {
+        private:
+            struct Record;
+            struct Ring;
+
+            pthread_key_t   key_;
+            pthread_mutex_t lock_;
+            pthread_cond_t  wakeup_;
+            pthread_cond_t  flushed_;
+            pthread_t       writer_;
+            bool            running_;
+            bool            idle_;
+            Ring            *rings_;
+            unsigned long   requested_;
+            unsigned long   done_;
+            time_t          last_time_;
+            char            time_[20];
+
+            Journal();
+            Journal(const Journal&);
+            Journal& operator=(const Journal&);
+
+            static void create();
+            static void release(void *ring);
+            static void *writer(void *journal);
+            void start();
+            void run();
+            Ring *ring();
+            bool pending() const;
+            bool drain(Ring& ring);
+            void reap();
+            void stamp(Record& record);
+            void write(int fd, struct iovec *iov, size_t count);
+            void fill(Record& record, const char *severity, const int *fds, size_t fd_count, const char *format, va_list args);
+
+        public:
+            static Journal& Instance();
+            //! -- severity is three letters; records go to at most four sinks
+            void Write(const char *severity, const int *fds, size_t fd_count, bool urgent, const char *format, va_list args);
+            //! -- waits, for a second at most, until what was queued before the call is written
+            void Flush();
+            //! -- pthread_atfork: the child drops what it inherited queued, the parent writes it
+            void BeforeFork();
+            void AfterFork(bool child);
+    };
+}
@@ -3,6 +3,7 @@
 #include <boost/unordered_map.hpp>
 #include <list>
 #include <string>
+#include <vector>
 extern "C" {
 #include <time.h>
 #include <stdio.h>
@@ -29,19 +30,18 @@ namespace FWL {
         private:
             typedef boost::unordered_map<std::string, FILE *>   SinkList;
             SinkList registered_sinks_;
-            typedef std::list<FILE *>                           Sinks;
-            Sinks  sink_files_;
-            Sinks  sinks_;
-            Level  level_;
-            char   time_[19];
-            time_t last_time_;
-            const char *makeTime();
-            std::string record(const std::string& sev, const std::string& format, va_list args);
-            void print(const std::string& sev, const std::string& format, va_list args);
+            typedef std::list<FILE *>                           SinkFiles;
+            SinkFiles sink_files_;
+            //! -- descriptors of the sinks in use: records are written by the Journal, not through stdio
+            std::vector<int> sinks_;
+            Level     level_;
+            void print(Level level, const char *sev, const char *format, va_list args);
         public:
             Log(Level level);
             Log(const std::string& name);
             Level GetLevel() const;
+            //! -- inline so a disabled trace costs a compare, see trace.h
+            bool Enabled(Level level) const { return level_ >= level; }
 
             Log(const Log& log);
             void RegisterSink(const std::string& name, FILE *sink);
@@ -51,9 +51,9 @@ namespace FWL {
             void ClearSinks();
             bool UseSink(const std::string& name);
             ~Log();
-            void Inf(const std::string& format, ...);
-            void Dbg(const std::string& format, ...);
-            void Wrn(const std::string& format, ...);
-            void Err(const std::string& format, ...);
+            void Inf(const char *format, ...);
+            void Dbg(const char *format, ...);
+            void Wrn(const char *format, ...);
+            void Err(const char *format, ...);
     };
 }
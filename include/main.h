@@ -2,42 +2,112 @@
 #define BOOST_FILESYSTEM_VERSION    3
 #include <list>
 #include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
 #include "comparer.h"
 #include "connector.h"
 #include "fdmanager.h"
 #include "log.h"
 #include "connectors.h"
+#include "json.h"
+#include "path.h"
+#include "prefixtrie.h"
+#include "snapshot.h"
 extern "C" {
 #include <ctype.h>
+#include <pthread.h>
 }
 namespace FWL {
     class Main
     {
+        //! -- the connector is resolved on the first matching path and cached
         class Location
         {
             private:
                 ComparerIntr comparer_;
+                std::string  name_;
                 Connector    *connector_;
             public:
-                Location(ComparerIntr comparer, Connector *connector);
-                Connector *operator()(const std::string& str) const;
+                Location(ComparerIntr comparer, const std::string& name);
+                bool operator()(const char *str, size_t size) const;
+                const std::string& Name() const { return name_; }
+                Connector *Cached() const { return __atomic_load_n(&connector_, __ATOMIC_ACQUIRE); }
+                void Cache(Connector *connector) { __atomic_store_n(&connector_, connector, __ATOMIC_RELEASE); }
+                void Prepare() { comparer_->Prepare(); }
         };
 
-        typedef boost::unordered_map<std::string, ConnectorIntr>          Connectors;
+        //! -- a "prefix://" location: found through the prefix trie rather than tried in order
+        class Mount
+        {
+            private:
+                std::string  name_;
+                bool         strip_;
+                Connector    *connector_;
+            public:
+                Mount(const std::string& name, bool strip) : name_(name), strip_(strip), connector_(NULL) {}
+                const std::string& Name() const { return name_; }
+                //! -- the connector sees paths with the prefix removed
+                bool Strip() const { return strip_; }
+                Connector *Cached() const { return __atomic_load_n(&connector_, __ATOMIC_ACQUIRE); }
+                void Cache(Connector *connector) { __atomic_store_n(&connector_, connector, __ATOMIC_RELEASE); }
+        };
+
+        typedef ConnectorMap                                              Connectors;
         typedef boost::unordered_map<std::string, ConnectorFactoryIntr>   ConnectorFactories;
         typedef boost::unordered_map<std::string, ComparerFactoryIntr>    ComparerFactories;
         typedef std::list<Location>                                       Locations;
+        typedef std::vector<Mount>                                        Mounts;
+        typedef boost::unordered_map<std::string, JsonNode *>             ConnectorConfigs;
+        typedef boost::unordered_map<std::string, boost::shared_ptr<JsonNode> > ConfigOwners;
+
+        //! -- one loaded config and the connectors built from it; a reload replaces it as a whole
+        struct Routing
+        {
+            //! -- connectors keep references into it, so it lives as long as they do
+            boost::shared_ptr<JsonNode> root;
+            //! -- roots of earlier routings whose connectors were carried over into this one
+            ConfigOwners     owners;
+            //! -- set when the config is a snapshot: connector configs are decoded from it on first use
+            std::auto_ptr<Snapshot> snapshot;
+            ConnectorConfigs configs;
+            Connectors       connectors;
+            //! -- in the order they were built, so every connector comes after the ones it links to
+            std::vector<Connector *> built;
+            Locations        locations;
+            //! -- the longest matching mount wins; locations only see paths under no mount
+            PrefixTrie       prefixes;
+            Mounts           mounts;
+            //! -- set once prepared for fork: comparers compiled and, with fork.warmup, connectors built
+            bool             warm;
+            Routing() : root(new JsonNode), warm(false) {}
+        };
 
         ConnectorFactories connector_factories_;
         ComparerFactories  comparer_factories_;
 
         std::string config_file_;
-        Connectors  connectors_;
+        //! -- read without a lock under a Pin; replaced routings wait in retired_ until nothing can reach them
+        Routing          *routing_;
+        std::list<Routing *> retired_;
+        long             epoch_;
+        long             readers_[2];
+        boost::mutex     lock_;
+        boost::mutex     reload_lock_;
         FdManager   fd_manager_;
-        Locations   locations_;
         LogIntr     log_;
-        
+
+        //! -- reload triggers: inotify on the config file and/or a signal, both served by one thread
+        bool        watch_;
+        int         signal_;
+        pthread_t   watcher_;
+        bool        watching_;
+        int         wakeup_;
+        int         inotify_;
+        bool        stop_;
+        bool        warmup_;
+
         std::string toLower(const std::string& src)
         {
     	    std::string str;
@@ -58,13 +128,70 @@ namespace FWL {
         
         void createConnectors();
         void createComparers();
-        
+        Routing *current() const { return __atomic_load_n(&routing_, __ATOMIC_ACQUIRE); }
+        bool load(Routing& routing, bool first);
+        Connector *build(Routing& routing, const std::string& name);
+        bool carry(Routing& routing, Routing& old, const std::string& name);
+        void references(const Routing& routing, const JsonNode& node, std::vector<std::string>& names) const;
+        void synchronize();
+        void reclaim();
+        bool busy(const Routing& routing, const Connectors& current) const;
+        void watch(const JsonNode& config);
+        void start();
+        void run();
+        void connectors(std::vector<Connector *>& all) const;
+        static void *watcher(void *arg);
+
+        Main(const Main&);
+        Main& operator=(const Main&);
+
         public:
+            //! -- held around every call that looks up or uses a connector; a reload frees a routing
+            //! -- only after all pins taken while it was current are gone. Pins never wait.
+            class Pin
+            {
+                private:
+                    Main& main_;
+                    long  epoch_;
+                    Pin(const Pin&);
+                    Pin& operator=(const Pin&);
+                public:
+                    explicit Pin(Main& main)
+                        : main_(main)
+                    {
+                        for (;;) {
+                            epoch_ = __atomic_load_n(&main_.epoch_, __ATOMIC_SEQ_CST);
+                            __atomic_add_fetch(&main_.readers_[epoch_ & 1], 1, __ATOMIC_SEQ_CST);
+                            if (__atomic_load_n(&main_.epoch_, __ATOMIC_SEQ_CST) == epoch_) {
+                                break;
+                            }
+                            __atomic_sub_fetch(&main_.readers_[epoch_ & 1], 1, __ATOMIC_SEQ_CST);
+                        }
+                    }
+                    ~Pin()
+                    {
+                        __atomic_sub_fetch(&main_.readers_[epoch_ & 1], 1, __ATOMIC_RELEASE);
+                    }
+            };
+
             Log& Logger() const;
-            Main(const std::string& config_file);
+            //! -- reloadable is false for users that hold files across calls outside the fd manager (farwel-agent)
+            Main(const std::string& config_file, bool reloadable = true);
+            ~Main();
             Connector *GetConnector(int fd);
             Connector *GetDirConnector(void *dd);
-            Connector *GetConnector(const std::string& path);
-            bool LoadConfig();
+            //! -- path is replaced by what the connector should see when its mount strips the prefix
+            Connector *GetConnector(PathHandle& path);
+            //! -- routes a path that isn't interned yet; realpath is set, interned, only once a connector matched
+            Connector *GetConnector(const char *path, size_t size, PathHandle& realpath);
+            //! -- file made canonical against cwd on the stack: calls for real paths intern and allocate nothing
+            Connector *Route(const Path& cwd, const char *file, PathHandle& realpath);
+            Connector *GetConnectorByName(const std::string& name);
+            //! -- builds a routing from the config file off the hot path and publishes it; false keeps the current one
+            bool Reload();
+            //! -- pthread_atfork handlers: routing state built before the fork is shared copy-on-write,
+            //! -- connections, open descriptors and helper threads are the parent's and are dropped in the child
+            void BeforeFork();
+            void AfterFork(bool child);
     };
 }
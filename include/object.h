@@ -11,11 +11,11 @@ namespace FWL {
         public:
             void AddRef();
             void Release();
+            long References() const { return count_; }
             virtual ~Object() {}
     };
-}
 
-namespace boost {
-    void intrusive_ptr_add_ref(FWL::Object *obj);
-    void intrusive_ptr_release(FWL::Object *obj);
-};
+    //! -- found by argument dependent lookup, whatever the order boost/intrusive_ptr.hpp was included in
+    void intrusive_ptr_add_ref(Object *obj);
+    void intrusive_ptr_release(Object *obj);
+}
@@ -1,12 +1,55 @@
 #pragma once
 #include <string>
 #include <vector>
+#include "object.h"
+#include <boost/intrusive_ptr.hpp>
 namespace FWL {
+    //! -- a canonical path, interned: equal paths share one entry, so comparing two handles is a
+    //! -- pointer compare and the hash is computed once, when the path is first seen
+    class PathHandle
+    {
+        private:
+            class Entry
+                : public Object
+            {
+                public:
+                    std::string path;
+                    size_t      hash;
+                    Entry(const char *str, size_t size, size_t h) : path(str, size), hash(h) {}
+            };
+
+            typedef boost::intrusive_ptr<Entry>   EntryIntr;
+
+            EntryIntr entry_;
+
+            void intern(const char *str, size_t size);
+
+        public:
+            PathHandle() {}
+            PathHandle(const char *str, size_t size) { intern(str, size); }
+            PathHandle(const char *str);
+            PathHandle(const std::string& str) { intern(str.data(), str.size()); }
+
+            const std::string& Str() const;
+            size_t Hash() const { return entry_ ? entry_->hash : 0; }
+            bool operator==(const PathHandle& other) const { return entry_ == other.entry_; }
+            bool operator!=(const PathHandle& other) const { return entry_ != other.entry_; }
+
+            static size_t HashOf(const char *str, size_t size);
+            //! -- pthread_atfork: the intern table lock must not be held by a thread that stays behind
+            static void BeforeFork();
+            static void AfterFork();
+    };
+
+    inline size_t hash_value(const PathHandle& path)
+    {
+        return path.Hash();
+    }
+
     class Path
     {
         private:
             std::string      current_path_;
-            std::vector<int> slashes_;
         public:
             Path();
 
@@ -15,7 +58,10 @@ namespace FWL {
                 return current_path_;
             }
 
-            std::string Absolute(const std::string& file);
+            //! -- resolves ".", ".." and repeated slashes against the working directory into buf;
+            //! -- false if the result doesn't fit in size bytes. Nothing is interned: most paths a host
+            //! -- touches are real ones, and only those that route to a connector become PathHandles
+            bool Canonical(const char *file, char *buf, size_t size, size_t& length) const;
             static std::string Directory(const std::string& file);
             static std::string File(const std::string& file);
     };
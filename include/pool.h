@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <boost/thread/mutex.hpp>
+extern "C" {
+#include <pthread.h>
+}
+namespace FWL {
+    //! -- fixed size blocks carved from slabs that are never given back to malloc. Each thread keeps
+    //! -- its own free list, so an allocate/free pair takes no lock; a block freed on another thread
+    //! -- joins that thread's list. Threads holding too many blocks, or exiting, hand them to a depot
+    class Pool
+    {
+        private:
+            struct Block
+            {
+                Block *next;
+            };
+
+            struct Cache
+            {
+                Pool   *pool;
+                Block  *head;
+                size_t count;
+            };
+
+            size_t        size_;
+            pthread_key_t key_;
+            boost::mutex  lock_;
+            Block         *depot_;
+
+            Pool(const Pool&);
+            Pool& operator=(const Pool&);
+
+            Cache& cache();
+            bool refill(Cache& cache);
+            void spill(Cache& cache, size_t keep);
+            static void release(void *cache);
+
+        public:
+            explicit Pool(size_t size);
+            //! -- NULL only when a new slab can't be had
+            void *Allocate();
+            void Free(void *block);
+            //! -- pthread_atfork: the depot lock must not be held by a thread that stays behind
+            void BeforeFork() { lock_.lock(); }
+            void AfterFork() { lock_.unlock(); }
+    };
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <utility>
+#include <vector>
+namespace FWL {
+    //! -- maps path prefixes to values, one trie level per path component; a lookup walks the
+    //! -- components of the path once and keeps the deepest value passed, so the longest prefix wins
+    class PrefixTrie
+    {
+        private:
+            struct Node
+            {
+                //! -- sorted by name, searched without building a string per component
+                typedef std::vector<std::pair<std::string, Node *> >   Children;
+
+                Children children;
+                size_t   value;
+                bool     set;
+                Node() : value(0), set(false) {}
+                ~Node();
+                Node *find(const char *name, size_t size) const;
+            };
+
+            Node root_;
+
+            PrefixTrie(const PrefixTrie&);
+            PrefixTrie& operator=(const PrefixTrie&);
+
+        public:
+            PrefixTrie() {}
+            //! -- false if the prefix is already there; "", "." and repeated slashes are ignored
+            bool Add(const std::string& prefix, size_t value);
+            //! -- length is how much of path the prefix covers, up to (not including) the next slash
+            bool Match(const char *path, size_t size, size_t& value, size_t& length) const;
+    };
+}
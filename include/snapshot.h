@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <boost/unordered_map.hpp>
+#include "json.h"
+
+namespace FWL {
+    //! -- binary image of a parsed config, written by farwel-compile and mapped instead of parsing JSON
+    class Snapshot
+    {
+        public:
+            enum {
+                Magic   = 0x534c5746,   //! -- "FWLS"
+                Version = 1
+            };
+
+            struct Header
+            {
+                uint32_t magic;
+                uint32_t version;
+                uint64_t size;
+                uint64_t checksum;
+            };
+
+        private:
+            typedef boost::unordered_map<std::string, uint64_t>   Offsets;
+
+            const char *map_;
+            size_t     size_;
+            Offsets    deferred_;
+
+            Snapshot(const Snapshot&);
+            Snapshot& operator=(const Snapshot&);
+
+        public:
+            Snapshot();
+            ~Snapshot();
+            //! -- false if path is not a snapshot at all; throws on a damaged or incompatible one
+            bool Open(const std::string& path);
+            //! -- children of the top level node `deferred` are left empty until Decode asks for them
+            void Read(JsonNode& root, const std::string& deferred = std::string());
+            bool Decode(const std::string& name, JsonNode& node) const;
+
+            static bool Load(const std::string& path, JsonNode& root);
+            static bool Save(const std::string& path, const JsonNode& root);
+            static uint64_t Checksum(const char *data, size_t size);
+    };
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include "log.h"
+
+//! -- FWL_LOG_LEVEL is the most verbose level (0 none .. 4 info, see Log::Level) a build can log at:
+//! -- traces above it compile to nothing. At or below it the runtime level is checked inline, before
+//! -- any of the arguments is evaluated
+#ifndef FWL_LOG_LEVEL
+#define FWL_LOG_LEVEL 4
+#endif
+
+#define FWL_TRACE(log, level, method, ...)                         \
+    do {                                                           \
+        if ((level) <= FWL_LOG_LEVEL) {                            \
+            FWL::Log& fwl_log_ = (log);                            \
+            if (fwl_log_.Enabled(level)) {                         \
+                fwl_log_.method(__VA_ARGS__);                      \
+            }                                                      \
+        }                                                          \
+    } while (0)
+
+#define FWL_ERR(log, ...) FWL_TRACE(log, FWL::Log::Error, Err, __VA_ARGS__)
+#define FWL_WRN(log, ...) FWL_TRACE(log, FWL::Log::Warn, Wrn, __VA_ARGS__)
+#define FWL_DBG(log, ...) FWL_TRACE(log, FWL::Log::Debug, Dbg, __VA_ARGS__)
+#define FWL_INF(log, ...) FWL_TRACE(log, FWL::Log::Info, Inf, __VA_ARGS__)
+
+//! -- USDT probes of the "farwel" provider. Unattached, a probe is a nop and its arguments stay where
+//! -- they already are; without sys/sdt.h, or with FWL_NO_SDT, they aren't compiled in at all
+#if !defined(FWL_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FWL_SDT 1
+#endif
+#endif
+
+#ifdef FWL_SDT
+#define FWL_PROBE1(name, a1)             DTRACE_PROBE1(farwel, name, a1)
+#define FWL_PROBE2(name, a1, a2)         DTRACE_PROBE2(farwel, name, a1, a2)
+#define FWL_PROBE3(name, a1, a2, a3)     DTRACE_PROBE3(farwel, name, a1, a2, a3)
+#else
+#define FWL_PROBE1(name, a1)             do {} while (0)
+#define FWL_PROBE2(name, a1, a2)         do {} while (0)
+#define FWL_PROBE3(name, a1, a2, a3)     do {} while (0)
+#endif
+
+namespace FWL {
+    //! -- one round trip to a backend: query(connector, op, target) when built, query_done(connector,
+    //! -- op, ok) when it goes out of scope, ok once Ok() was called. The strings must outlive it
+    class QueryProbe
+    {
+        private:
+            const char *connector_;
+            const char *op_;
+            bool       ok_;
+
+            QueryProbe(const QueryProbe&);
+            QueryProbe& operator=(const QueryProbe&);
+        public:
+            QueryProbe(const std::string& connector, const char *op, const char *target)
+                : connector_(connector.c_str())
+                , op_(op)
+                , ok_(false)
+            {
+                FWL_PROBE3(query, connector_, op_, target);
+            }
+            ~QueryProbe()
+            {
+                FWL_PROBE3(query_done, connector_, op_, ok_);
+            }
+            void Ok() { ok_ = true; }
+    };
+}
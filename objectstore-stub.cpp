@@ -0,0 +1,442 @@
+extern "C" {
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+}
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+
+//! -- in-memory S3-like server for trying the objectstore connector without a real store
+//! -- usage: objectstore-stub [-p port] [-c] [-m connections] [-v]
+//! -- speaks just what the connector sends: ranged GET, HEAD, PUT (plain, copy and multipart parts),
+//! -- DELETE, list-type=2 listings and multipart create/complete/abort; buckets spring into existence.
+//! -- -c sends bodies chunked, in chunks of up to chunk_size bytes and with a trailer field, like proxies do;
+//! -- -m closes connections past the first few at once, which fails a client that doesn't keep them alive
+
+typedef std::map<std::string, std::string> Objects;
+typedef std::map<int, std::string>         Parts;
+
+struct Upload
+{
+    std::string object;
+    Parts       parts;
+};
+
+typedef std::map<std::string, Upload> Uploads;
+
+struct Reply
+{
+    int         status;
+    std::string headers;
+    std::string body;
+    Reply() : status(200) {}
+};
+
+static boost::mutex lock;
+static Objects      objects;
+static Uploads      uploads;
+static unsigned     next_upload = 0;
+static bool         verbose     = false;
+static bool         chunked     = false;
+static const size_t chunk_size  = 1000;
+static int          max_accept  = 0;
+
+std::string decode(const std::string& str)
+{
+    std::string out;
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        if ((str[i] == '%') && (i + 2 < str.size())) {
+            out += (char)::strtol(str.substr(i + 1, 2).c_str(), NULL, 16);
+            i   += 2;
+        } else if (str[i] == '+') {
+            out += ' ';
+        } else {
+            out += str[i];
+        }
+    }
+    return out;
+}
+
+std::string escape(const std::string& str)
+{
+    std::string out;
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        switch (str[i]) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            default: out += str[i];
+        }
+    }
+    return out;
+}
+
+std::string number(unsigned long long value)
+{
+    char buf[32];
+
+    ::snprintf(&buf[0], sizeof(buf), "%llu", value);
+    return buf;
+}
+
+std::string etag(const std::string& data)
+{
+    //! -- FNV-1a is enough to tell parts apart; nobody checks it against MD5
+    unsigned long long hash = 14695981039346656037ULL;
+    char               buf[32];
+
+    for (size_t i = 0; i < data.size(); ++i) {
+        hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+    }
+    ::snprintf(&buf[0], sizeof(buf), "\"%016llx\"", hash);
+    return buf;
+}
+
+std::map<std::string, std::string> parseQuery(const std::string& query)
+{
+    std::map<std::string, std::string> args;
+    size_t                             start = 0;
+
+    while (start < query.size()) {
+        size_t      end  = query.find('&', start);
+        std::string pair = query.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+        size_t      eq   = pair.find('=');
+        args[decode(pair.substr(0, eq))] = (eq == std::string::npos) ? "" : decode(pair.substr(eq + 1));
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+    return args;
+}
+
+void list(const std::string& bucket, std::map<std::string, std::string>& args, Reply& reply)
+{
+    const std::string&    prefix    = args["prefix"];
+    const std::string&    delimiter = args["delimiter"];
+    std::set<std::string> prefixes;
+    std::string           base      = bucket + "/";
+
+    reply.body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><ListBucketResult><Name>" + escape(bucket) + "</Name><Prefix>" + escape(prefix) + "</Prefix>";
+    for (Objects::const_iterator it = objects.lower_bound(base + prefix); it != objects.end(); ++it) {
+        if (it->first.compare(0, base.size() + prefix.size(), base + prefix)) {
+            break;
+        }
+        std::string key = it->first.substr(base.size());
+        size_t      cut = delimiter.empty() ? std::string::npos : key.find(delimiter, prefix.size());
+        if (cut != std::string::npos) {
+            prefixes.insert(key.substr(0, cut + delimiter.size()));
+        } else {
+            reply.body += "<Contents><Key>" + escape(key) + "</Key><Size>" + number(it->second.size()) + "</Size><ETag>" + escape(etag(it->second)) + "</ETag></Contents>";
+        }
+    }
+    for (std::set<std::string>::const_iterator it = prefixes.begin(); it != prefixes.end(); ++it) {
+        reply.body += "<CommonPrefixes><Prefix>" + escape(*it) + "</Prefix></CommonPrefixes>";
+    }
+    reply.body    += "<IsTruncated>false</IsTruncated></ListBucketResult>";
+    reply.headers += "Content-Type: application/xml\r\n";
+}
+
+void get(const std::string& object, const std::string& range, bool head, Reply& reply)
+{
+    Objects::const_iterator it = objects.find(object);
+
+    if (it == objects.end()) {
+        reply.status = 404;
+        reply.body   = "<Error><Code>NoSuchKey</Code></Error>";
+        return;
+    }
+
+    const std::string& data = it->second;
+    unsigned long long first, last;
+    if (head) {
+        reply.headers += "Content-Length: " + number(data.size()) + "\r\n";
+    } else if (::sscanf(range.c_str(), "bytes=%llu-%llu", &first, &last) == 2) {
+        if (first >= data.size()) {
+            reply.status   = 416;
+            reply.headers += "Content-Range: bytes */" + number(data.size()) + "\r\n";
+            return;
+        }
+        last           = std::min<unsigned long long>(last, data.size() - 1);
+        reply.status   = 206;
+        reply.headers += "Content-Range: bytes " + number(first) + "-" + number(last) + "/" + number(data.size()) + "\r\n";
+        reply.body     = data.substr(first, last - first + 1);
+    } else {
+        reply.body = data;
+    }
+    reply.headers += "ETag: " + etag(data) + "\r\n";
+}
+
+void handle(const std::string& method, const std::string& target, std::map<std::string, std::string>& headers, const std::string& body, Reply& reply)
+{
+    size_t                             mark   = target.find('?');
+    std::string                        path   = decode(target.substr(1, (mark == std::string::npos) ? std::string::npos : mark - 1));
+    std::map<std::string, std::string> args   = parseQuery((mark == std::string::npos) ? "" : target.substr(mark + 1));
+    size_t                             slash  = path.find('/');
+    std::string                        bucket = path.substr(0, slash);
+    boost::mutex::scoped_lock          guard(lock);
+
+    if ((slash == std::string::npos) || (slash + 1 == path.size())) {
+        if ((method == "GET") && (args["list-type"] == "2")) {
+            list(bucket, args, reply);
+        } else {
+            reply.status = ((method == "PUT") || (method == "HEAD")) ? 200 : 400;
+        }
+        return;
+    }
+
+    if (args.count("uploadId")) {
+        Uploads::iterator upload = uploads.find(args["uploadId"]);
+        if ((upload == uploads.end()) || (upload->second.object != path)) {
+            reply.status = 404;
+            reply.body   = "<Error><Code>NoSuchUpload</Code></Error>";
+        } else if ((method == "PUT") && args.count("partNumber")) {
+            upload->second.parts[::atoi(args["partNumber"].c_str())] = body;
+            reply.headers += "ETag: " + etag(body) + "\r\n";
+        } else if (method == "POST") {
+            std::string data;
+            for (Parts::const_iterator it = upload->second.parts.begin(); it != upload->second.parts.end(); ++it) {
+                data += it->second;
+            }
+            objects[path].swap(data);
+            uploads.erase(upload);
+            reply.body = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><CompleteMultipartUploadResult><Key>" + escape(path.substr(slash + 1)) + "</Key></CompleteMultipartUploadResult>";
+        } else if (method == "DELETE") {
+            uploads.erase(upload);
+            reply.status = 204;
+        } else {
+            reply.status = 400;
+        }
+        return;
+    }
+
+    if ((method == "POST") && args.count("uploads")) {
+        std::string id = number(++next_upload);
+        uploads[id].object = path;
+        reply.body         = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><InitiateMultipartUploadResult><Key>" + escape(path.substr(slash + 1)) + "</Key><UploadId>" + id + "</UploadId></InitiateMultipartUploadResult>";
+    } else if ((method == "GET") || (method == "HEAD")) {
+        get(path, headers["range"], method == "HEAD", reply);
+    } else if (method == "PUT") {
+        std::string source = headers["x-amz-copy-source"];
+        if (source.empty()) {
+            objects[path]  = body;
+            reply.headers += "ETag: " + etag(body) + "\r\n";
+            return;
+        }
+        source = decode(source.substr(source[0] == '/' ? 1 : 0));
+        Objects::const_iterator it = objects.find(source);
+        if (it == objects.end()) {
+            reply.status = 404;
+            reply.body   = "<Error><Code>NoSuchKey</Code></Error>";
+            return;
+        }
+        std::string data = it->second;
+        objects[path].swap(data);
+        reply.body = "<CopyObjectResult><ETag>" + escape(etag(objects[path])) + "</ETag></CopyObjectResult>";
+    } else if (method == "DELETE") {
+        objects.erase(path);
+        reply.status = 204;
+    } else {
+        reply.status = 405;
+    }
+}
+
+const char *reason(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
+        default: return "Error";
+    }
+}
+
+std::string chunk(const std::string& body)
+{
+    std::string out;
+
+    for (size_t pos = 0; pos < body.size(); pos += chunk_size) {
+        char   size[32];
+        size_t part = std::min(chunk_size, body.size() - pos);
+        ::snprintf(&size[0], sizeof(size), "%lx\r\n", (unsigned long)part);
+        out += size;
+        out.append(body, pos, part);
+        out += "\r\n";
+    }
+    //! -- without the empty line that ends the trailer: serve() sends it late
+    return out + "0\r\nX-Stub-Trailer: done\r\n";
+}
+
+bool sendAll(int sock, const std::string& data)
+{
+    size_t done = 0;
+
+    while (done < data.size()) {
+        ssize_t n = ::send(sock, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+void serve(int sock)
+{
+    std::string in;
+    char        buf[65536];
+
+    while (true) {
+        size_t end;
+        while ((end = in.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = ::recv(sock, &buf[0], sizeof(buf), 0);
+            if (n <= 0) {
+                ::close(sock);
+                return;
+            }
+            in.append(&buf[0], n);
+        }
+
+        std::map<std::string, std::string> headers;
+        std::string                        method, target;
+        size_t                             line = in.find("\r\n");
+        std::string                        request = in.substr(0, line);
+        size_t                             first   = request.find(' ');
+        size_t                             second  = request.find(' ', first + 1);
+        method = request.substr(0, first);
+        target = request.substr(first + 1, second - first - 1);
+        while (line < end) {
+            size_t      next   = in.find("\r\n", line + 2);
+            std::string header = in.substr(line + 2, next - line - 2);
+            size_t      colon  = header.find(':');
+            if (colon != std::string::npos) {
+                std::string name = header.substr(0, colon);
+                for (size_t i = 0; i < name.size(); ++i) {
+                    name[i] = ::tolower(name[i]);
+                }
+                size_t value = header.find_first_not_of(' ', colon + 1);
+                headers[name] = (value == std::string::npos) ? "" : header.substr(value);
+            }
+            line = next;
+        }
+
+        size_t length = ::strtoull(headers["content-length"].c_str(), NULL, 10);
+        in.erase(0, end + 4);
+        while (in.size() < length) {
+            ssize_t n = ::recv(sock, &buf[0], sizeof(buf), 0);
+            if (n <= 0) {
+                ::close(sock);
+                return;
+            }
+            in.append(&buf[0], n);
+        }
+        std::string body = in.substr(0, length);
+        in.erase(0, length);
+
+        Reply reply;
+        handle(method, target, headers, body, reply);
+        if (verbose) {
+            ::fprintf(stderr, "%s %s %s- %d\n", method.c_str(), target.c_str(), headers["range"].empty() ? "" : (headers["range"] + " ").c_str(), reply.status);
+        }
+
+        bool        close = !::strcasecmp(headers["connection"].c_str(), "close");
+        bool        empty = (method == "HEAD") || (reply.status == 204);
+        std::string out   = "HTTP/1.1 " + number(reply.status) + " " + reason(reply.status) + "\r\n" + reply.headers;
+        if (!empty) {
+            out += chunked ? std::string("Transfer-Encoding: chunked\r\n") : "Content-Length: " + number(reply.body.size()) + "\r\n";
+        }
+        out += close ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+        if (!empty) {
+            out += chunked ? chunk(reply.body) : reply.body;
+        }
+        if (!sendAll(sock, out)) {
+            ::close(sock);
+            return;
+        }
+        //! -- like a proxy flushing the end of the stream on its own; a client that stops reading at
+        //! -- the last chunk finds it in front of its next response
+        if (chunked && !empty) {
+            ::usleep(10000);
+            if (!sendAll(sock, "\r\n")) {
+                ::close(sock);
+                return;
+            }
+        }
+        if (close) {
+            ::close(sock);
+            return;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int port = 9000;
+    int opt;
+
+    while ((opt = ::getopt(argc, argv, "p:cm:v")) != -1) {
+        switch (opt) {
+            case 'p': port       = ::atoi(optarg); break;
+            case 'c': chunked    = true; break;
+            case 'm': max_accept = ::atoi(optarg); break;
+            case 'v': verbose    = true; break;
+            default:
+                ::fprintf(stderr, "usage: %s [-p port] [-c] [-m connections] [-v]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int                listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int                on       = 1;
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((::bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (::listen(listener, 128) < 0)) {
+        ::perror("objectstore-stub");
+        return 1;
+    }
+    ::fprintf(stderr, "objectstore-stub: listening on 127.0.0.1:%d\n", port);
+
+    int accepted = 0;
+    while (true) {
+        int sock = ::accept(listener, NULL, NULL);
+        if (sock < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::perror("objectstore-stub");
+            return 1;
+        }
+        if (max_accept && (++accepted > max_accept)) {
+            ::fprintf(stderr, "objectstore-stub: refused connection %d\n", accepted);
+            ::close(sock);
+            continue;
+        }
+        ::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        //! -- one thread per connection: the connector keeps several keep-alive connections open at once
+        boost::thread(boost::bind(&serve, sock)).detach();
+    }
+}
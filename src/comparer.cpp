@@ -1,20 +1,15 @@
-#include <boost/regex.h>
 #include "comparer.h"
 namespace FWL {
+    //! -- "type://argument", split at the last "://" like the greedy "^(.*)://(.*)$" it replaces
     bool Comparer::Parse(const std::string& str, std::pair<std::string, std::string>& ret)
     {
-        static boost::regex re_("^(.*)://(.*)$", boost::regex::perl);
-        boost::match_results<std::string::const_iterator> what;
+        size_t pos = str.rfind("://");
 
-        if (!boost::regex_match(str, what, re_) || (what.size() < 3)) {
+        if (pos == std::string::npos) {
             return false;
         }
-
-        if (!what[1].matched && !what[2].matched) {
-            return false;
-        }
-        ret.first  = std::string(what[1].first, what[1].second);
-        ret.second = std::string(what[2].first, what[2].second);
+        ret.first  = str.substr(0, pos);
+        ret.second = str.substr(pos + 3);
         return true;
     }
 };
@@ -5,7 +5,7 @@ namespace FWL {
     Always::Always(const std::string& pattern)
     {}
 
-    bool Always::operator()(const std::string& target)
+    bool Always::operator()(const char *target, size_t size)
     {
         return true;
     }
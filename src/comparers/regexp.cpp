@@ -1,14 +1,43 @@
+extern "C" {
+#include <stdio.h>
+}
 #include <boost/regex.hpp>
 #include "comparers/regexp.h"
 
 namespace FWL {
+    //! -- compiled on the first lookup: most processes never route most locations
     Regexp::Regexp(const std::string& pattern)
-        : re_(pattern, boost::regex_constants::perl)
+        : pattern_(pattern)
+        , valid_(false)
+        , compiled_(false)
     {}
 
-    bool Regexp::operator()(const std::string& target)
+    //! -- a broken pattern just never matches; farwel-compile reports it up front
+    void Regexp::compile()
+    {
+        try {
+            re_.assign(pattern_, boost::regex_constants::perl);
+            valid_ = true;
+        } catch (const boost::regex_error& e) {
+            fprintf(stderr, "farwel: location regexp %s: %s\n", pattern_.c_str(), e.what());
+        }
+    }
+
+    void Regexp::Prepare()
+    {
+        if (!__atomic_load_n(&compiled_, __ATOMIC_ACQUIRE)) {
+            boost::mutex::scoped_lock lock(lock_);
+            if (!compiled_) {
+                compile();
+                __atomic_store_n(&compiled_, true, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    bool Regexp::operator()(const char *target, size_t size)
     {
-        return boost::regex_search(target, re_);
+        Prepare();
+        return valid_ && boost::regex_search(target, target + size, re_);
     }
 
     Comparer *RegexpFactory::Create(const std::string& name)
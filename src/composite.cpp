@@ -0,0 +1,63 @@
+extern "C" {
+#include <fcntl.h>
+}
+#include "composite.h"
+
+namespace FWL {
+    boost::detail::atomic_count Composite::scratch_(0);
+
+    Composite::Composite(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+    {}
+
+    ConnectorIntr Composite::link(const ConnectorMap& connectors, const std::string& name)
+    {
+        ConnectorMap::const_iterator it = connectors.find(name);
+
+        if (it == connectors.end()) {
+            Logger().Err("%s: connector %s not found", Name().c_str(), name.c_str());
+            return ConnectorIntr();
+        }
+        if (!it->second) {
+            Logger().Err("%s: connector %s is unavailable", Name().c_str(), name.c_str());
+            return ConnectorIntr();
+        }
+        if (it->second.get() == this) {
+            Logger().Err("%s: connector can't link to itself", Name().c_str());
+            return ConnectorIntr();
+        }
+        return it->second;
+    }
+
+    FileIntr Composite::scratch(const std::string& name, int flags)
+    {
+        return FileIntr(new File(-2 - (int)++scratch_, name, flags));
+    }
+
+    bool Composite::copy(Connector& from, Connector& to, const std::string& name, const std::string& newname)
+    {
+        FileIntr src = scratch(name, O_RDONLY);
+        FileIntr dst = scratch(newname, O_WRONLY | O_CREAT | O_TRUNC);
+
+        if (!exists(from, src)) {
+            return false;
+        }
+        bool ok = exists(to, dst) ? truncate(to, dst) : create(to, dst);
+        char buf[65536];
+        while (ok) {
+            int n = read(from, src, &buf[0], sizeof(buf));
+            if (n <= 0) {
+                ok = !n;
+                break;
+            }
+            src->Seek(src->Offset() + n);
+            if (write(to, dst, &buf[0], n) != n) {
+                ok = false;
+                break;
+            }
+            dst->Seek(dst->Offset() + n);
+        }
+        close(from, src);
+        return close(to, dst) && ok;
+    }
+}
@@ -2,6 +2,7 @@
 #include "connector.h"
 extern "C" {
 #include <errno.h>
+#include <fcntl.h>
 }
 namespace FWL {
     Connector::Connector(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
@@ -36,32 +37,32 @@ namespace FWL {
         bool creat = (bool)(file->Flags() & O_CREAT);
         bool exist = Exists(file);         //! \todo: optimize it
 
-        Logger().Dbg("%d %d - %d %d\n", file->Fd(), file->Flags(), creat, exist);
+        FWL_DBG(Logger(), "%d %d - %d %d\n", file->Fd(), file->Flags(), creat, exist);
         if (!creat && !exist) {
-            Logger().Dbg("Not for create and not exists");
+            FWL_DBG(Logger(), "Not for create and not exists");
             errno = ENOENT;
             return -1;
         }
         if (creat) {
             if (!exist) {
-                Logger().Dbg("For create and not exists");
+                FWL_DBG(Logger(), "For create and not exists");
                 if (!Create(file)) {
-                    Logger().Dbg("Couldn't create");
+                    FWL_DBG(Logger(), "Couldn't create");
                     errno = EACCES;
                     return -1;
                 }
                 return file->Fd();
             } else {
-                Logger().Dbg("For create and exists");
+                FWL_DBG(Logger(), "For create and exists");
                 if (file->Flags() & O_EXCL) {
-                    Logger().Dbg("Check for exists");
+                    FWL_DBG(Logger(), "Check for exists");
                     errno = EEXIST;
                     return -1;
                 }
                 if (file->Flags() & O_TRUNC) {
-                    Logger().Dbg("Need to trunc");
+                    FWL_DBG(Logger(), "Need to trunc");
                     if (!Truncate(file)) {
-                        Logger().Dbg("Trunc error");
+                        FWL_DBG(Logger(), "Trunc error");
                         errno = EACCES;
                         return -1;
                     }
@@ -72,12 +73,18 @@ namespace FWL {
         return file->Fd();
     }
 
-    int Connector::Open(const std::string& path, int flags)
+    int Connector::Open(const PathHandle& path, int flags)
     {
-        FileIntr file(new File(fd_manager_.Get(this), path, flags));
+        int fd = fd_manager_.Get(this);
+        if (fd < 0) {
+            errno = EMFILE;
+            return -1;
+        }
+        FileIntr file(new File(fd, path, flags));
         int ret = openFile(file);
         if (ret < 0) {
             fd_manager_.Release(file->Fd(), this);
+            return ret;
         }
         
         insert(file);
@@ -108,15 +115,20 @@ namespace FWL {
         return it->second->Read();
     }
 
-    void *Connector::OpenDir(const std::string& name)
+    void *Connector::OpenDir(const PathHandle& name)
     {
-        DirectoryIntr dir(new Directory(fd_manager_.Get(this), name));
+        int fd = fd_manager_.Get(this);
+        if (fd < 0) {
+            errno = EMFILE;
+            return NULL;
+        }
+        DirectoryIntr dir(new Directory(fd, name));
         if (!Open(dir)) {
             fd_manager_.Release(dir->Fd(), this);
             return NULL;
         }
         insert(dir);
-        return (void*)dir.get();
+        return (void*)dir->Handle();
     }
     
     int Connector::Write(int fd, const void* data, size_t size)
@@ -126,7 +138,11 @@ namespace FWL {
 	    return -1;
 	}
 	
-	return Write(it->second, data, size);
+	int ret = Write(it->second, data, size);
+	if (ret > 0) {
+	    it->second->Seek(it->second->Offset() + ret);
+	}
+	return ret;
     }
     
     int Connector::Read(int fd, void* data, size_t size)
@@ -135,7 +151,11 @@ namespace FWL {
 	if (it == files_.end()) {
 	    return -1;
 	}
-	return Read(it->second, data, size);
+	int ret = Read(it->second, data, size);
+	if (ret > 0) {
+	    it->second->Seek(it->second->Offset() + ret);
+	}
+	return ret;
     }
 
     int Connector::CloseDir(DIR *dd)
@@ -154,6 +174,12 @@ namespace FWL {
         return -1;
     }
 
+    bool Connector::GetFileSize(const PathHandle& name, size_t& size)
+    {
+        FileIntr file(new File(-1, name, O_RDONLY));
+        return GetFileSize(file, size);
+    }
+
     bool Connector::GetFileSize(int fd, size_t& size)
     {
         Files::iterator it = files_.find(fd);
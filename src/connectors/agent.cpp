@@ -0,0 +1,472 @@
+extern "C" {
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+}
+#include <algorithm>
+#include "connectors/agent.h"
+#include "real.h"
+
+namespace FWL {
+    static Real real;
+    //! -- AgentOp names, for the query probe
+    static const char *ops[] = { "exists", "create", "truncate", "write", "read", "close", "size", "list", "mkdir", "unlink", "rmdir", "rename" };
+
+    Agent::Agent(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+        , socket_(config.get<std::string>("socket", "/run/farwel/agent.sock"))
+        , entries_(std::max<size_t>(config.get<size_t>("queue_depth", 64), 1))
+        , slot_size_(std::max<size_t>(config.get<size_t>("slot_size", 65536), 4096))
+        , sock_(-1)
+        , sq_event_(-1)
+        , cq_event_(-1)
+        , shared_(NULL)
+        , inflight_(0)
+        , broken_(false)
+        , reaping_(false)
+    {}
+
+    Agent::~Agent()
+    {
+        disconnect();
+    }
+
+    bool Agent::connect()
+    {
+        struct sockaddr_un addr;
+        int                memfd = -1;
+        size_t             size  = AgentShared::Size(entries_, slot_size_);
+
+        ::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        ::strncpy(addr.sun_path, socket_.c_str(), sizeof(addr.sun_path) - 1);
+        sock_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if ((sock_ < 0) || ::connect(sock_, (struct sockaddr *)&addr, sizeof(addr))) {
+            Logger().Err("Agent: couldn't connect to %s: %s", socket_.c_str(), ::strerror(errno));
+            disconnect();
+            return false;
+        }
+
+        //! -- the rings live in a memfd of ours: the agent maps it, nobody else can
+        memfd     = ::memfd_create("farwel-agent", MFD_CLOEXEC);
+        sq_event_ = ::eventfd(0, EFD_CLOEXEC);
+        cq_event_ = ::eventfd(0, EFD_CLOEXEC);
+        if ((memfd < 0) || (sq_event_ < 0) || (cq_event_ < 0) || ::ftruncate(memfd, size)) {
+            Logger().Err("Agent: couldn't set up rings: %s", ::strerror(errno));
+            if (memfd >= 0) {
+                real.close(memfd);
+            }
+            disconnect();
+            return false;
+        }
+        void *region = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (region == MAP_FAILED) {
+            real.close(memfd);
+            disconnect();
+            return false;
+        }
+        shared_            = (AgentShared *)region;
+        shared_->magic     = AgentMagic;
+        shared_->version   = AgentVersion;
+        shared_->entries   = entries_;
+        shared_->slot_size = slot_size_;
+
+        AgentHello hello;
+        hello.magic     = AgentMagic;
+        hello.version   = AgentVersion;
+        hello.pid       = ::getpid();
+        hello.entries   = entries_;
+        hello.slot_size = slot_size_;
+
+        int           fds[3] = { memfd, sq_event_, cq_event_ };
+        char          control[CMSG_SPACE(sizeof(fds))];
+        struct iovec  iov;
+        struct msghdr msg;
+        iov.iov_base = &hello;
+        iov.iov_len  = sizeof(hello);
+        ::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+        ::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        int32_t status = EPROTO;
+        bool    ok     = (::sendmsg(sock_, &msg, MSG_NOSIGNAL) == sizeof(hello)) && (::recv(sock_, &status, sizeof(status), MSG_WAITALL) == sizeof(status)) && !status;
+        real.close(memfd);
+        if (!ok) {
+            Logger().Err("Agent: handshake with %s failed: %s", socket_.c_str(), ::strerror(status));
+            disconnect();
+            return false;
+        }
+
+        free_.clear();
+        for (size_t i = entries_; i > 0; --i) {
+            free_.push_back(i - 1);
+        }
+        finished_.assign(entries_, 0);
+        completions_.resize(entries_);
+        FWL_DBG(Logger(), "Agent: connected to %s", socket_.c_str());
+        return true;
+    }
+
+    void Agent::disconnect()
+    {
+        if (shared_) {
+            ::munmap(shared_, AgentShared::Size(entries_, slot_size_));
+            shared_ = NULL;
+        }
+        int *fds[] = { &sock_, &sq_event_, &cq_event_ };
+        for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+            if (*fds[i] >= 0) {
+                real.close(*fds[i]);
+                *fds[i] = -1;
+            }
+        }
+        broken_ = false;
+        free_.clear();
+    }
+
+    void Agent::BeforeFork()
+    {
+        lock_.lock();
+        sq_lock_.lock();
+        cq_lock_.lock();
+    }
+
+    void Agent::AfterFork(bool child)
+    {
+        if (child) {
+            //! -- the session belongs to the parent; the child gets rings of its own on first use
+            inflight_ = 0;
+            reaping_  = false;
+            Renew(cq_wakeup_);
+            Renew(slot_wakeup_);
+            disconnect();
+        }
+        cq_lock_.unlock();
+        sq_lock_.unlock();
+        lock_.unlock();
+    }
+
+    bool Agent::begin()
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!shared_ && !connect()) {
+            errno = EIO;
+            return false;
+        }
+        ++inflight_;
+        return true;
+    }
+
+    void Agent::end()
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        boost::mutex::scoped_lock cq_lock(cq_lock_);
+
+        if (!--inflight_ && broken_) {
+            disconnect();
+        }
+    }
+
+    int Agent::acquire()
+    {
+        boost::mutex::scoped_lock lock(cq_lock_);
+
+        while (free_.empty() && !broken_) {
+            slot_wakeup_.wait(lock);
+        }
+        if (broken_) {
+            errno = EIO;
+            return -1;
+        }
+        int slot = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+
+    bool Agent::reap(int slot)
+    {
+        boost::mutex::scoped_lock lock(cq_lock_);
+        AgentRing&                cq = shared_->cq;
+
+        while (!finished_[slot]) {
+            if (broken_) {
+                errno = EIO;
+                return false;
+            }
+
+            bool drained = false;
+            while (cq.head != cq.tail) {
+                __sync_synchronize();
+                const AgentCompletion& completion = shared_->Completions(entries_)[cq.head % entries_];
+                completions_[completion.slot] = completion;
+                finished_[completion.slot]    = 1;
+                __sync_synchronize();
+                ++cq.head;
+                drained = true;
+            }
+            if (drained) {
+                cq_wakeup_.notify_all();
+                continue;
+            }
+            if (reaping_) {
+                cq_wakeup_.wait(lock);
+                continue;
+            }
+
+            //! -- one thread sleeps on the eventfd for everybody; the agent only signals a sleeping reaper
+            reaping_    = true;
+            cq.sleeping = 1;
+            __sync_synchronize();
+            bool dead = false;
+            if (cq.head == cq.tail) {
+                lock.unlock();
+                struct pollfd fds[2] = {
+                    { cq_event_, POLLIN, 0 },
+                    { sock_, POLLIN, 0 }
+                };
+                if (::poll(fds, 2, -1) > 0) {
+                    uint64_t count;
+                    if (fds[0].revents & POLLIN) {
+                        real.read(cq_event_, &count, sizeof(count));
+                    }
+                    dead = fds[1].revents != 0;
+                }
+                lock.lock();
+            }
+            cq.sleeping = 0;
+            reaping_    = false;
+            if (dead && (cq.head == cq.tail)) {
+                Logger().Err("Agent: lost connection to %s", socket_.c_str());
+                broken_ = true;
+                slot_wakeup_.notify_all();
+            }
+            cq_wakeup_.notify_all();
+        }
+        finished_[slot] = 0;
+        return true;
+    }
+
+    bool Agent::call(AgentOp op, const FileIntr& file, const std::string& path, const std::string& path2, const void *data, size_t size, uint64_t offset, AgentCompletion& completion, void *out)
+    {
+        if ((path.size() > 0xFFFF) || (path2.size() > 0xFFFF) || (path.size() + path2.size() + size > slot_size_)) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        QueryProbe probe(Name(), ops[op], path.c_str());
+        if (!begin()) {
+            return false;
+        }
+        int slot = acquire();
+        if (slot < 0) {
+            end();
+            return false;
+        }
+
+        char *buf = shared_->Slot(slot, entries_, slot_size_);
+        ::memcpy(buf, path.data(), path.size());
+        ::memcpy(buf + path.size(), path2.data(), path2.size());
+        if (data) {
+            ::memcpy(buf + path.size() + path2.size(), data, size);
+        }
+
+        AgentRequest request;
+        request.op     = op;
+        request.slot   = slot;
+        request.fd     = file ? file->Fd() : -1;
+        request.flags  = file ? file->Flags() : 0;
+        request.offset = offset;
+        request.size   = size;
+        request.path   = path.size();
+        request.path2  = path2.size();
+        {
+            boost::mutex::scoped_lock lock(sq_lock_);
+            AgentRing&                sq   = shared_->sq;
+            uint32_t                  tail = sq.tail;
+            shared_->Requests()[tail % entries_] = request;
+            __sync_synchronize();
+            sq.tail = tail + 1;
+            __sync_synchronize();
+            if (sq.sleeping) {
+                uint64_t one = 1;
+                real.write(sq_event_, &one, sizeof(one));
+            }
+        }
+
+        bool ok = reap(slot);
+        if (ok) {
+            probe.Ok();
+            completion = completions_[slot];
+            if (out && (completion.result > 0)) {
+                ::memcpy(out, buf + path.size() + path2.size(), std::min<size_t>(completion.result, size));
+            }
+            boost::mutex::scoped_lock lock(cq_lock_);
+            free_.push_back(slot);
+            slot_wakeup_.notify_one();
+        }
+        end();
+        return ok;
+    }
+
+    int64_t Agent::simple(AgentOp op, const FileIntr& file, const std::string& path, const std::string& path2, uint64_t offset)
+    {
+        AgentCompletion completion;
+
+        if (!call(op, file, path, path2, NULL, 0, offset, completion)) {
+            return -1;
+        }
+        if (completion.result < 0) {
+            errno = completion.error;
+        }
+        return completion.result;
+    }
+
+    bool Agent::Exists(FileIntr& file)
+    {
+        return simple(AgentExists, file, file->Name()) > 0;
+    }
+
+    bool Agent::Create(FileIntr& file)
+    {
+        return simple(AgentCreate, file, file->Name()) > 0;
+    }
+
+    bool Agent::Truncate(FileIntr& file)
+    {
+        return simple(AgentTruncate, file, file->Name()) > 0;
+    }
+
+    int Agent::Write(FileIntr& file, const void *data, size_t size)
+    {
+        size_t done = 0;
+
+        while (done < size) {
+            AgentCompletion completion;
+            size_t          chunk = std::min(size - done, slot_size_ - std::min(slot_size_, file->Name().size()));
+            if (!call(AgentWrite, file, file->Name(), "", (const char *)data + done, chunk, file->Offset() + done, completion)) {
+                return done ? done : -1;
+            }
+            if (completion.result < 0) {
+                errno = completion.error;
+                return done ? done : -1;
+            }
+            done += completion.result;
+            if ((size_t)completion.result < chunk) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    int Agent::Read(FileIntr& file, void *data, size_t size)
+    {
+        size_t done = 0;
+
+        while (done < size) {
+            AgentCompletion completion;
+            size_t          chunk = std::min(size - done, slot_size_ - std::min(slot_size_, file->Name().size()));
+            if (!call(AgentRead, file, file->Name(), "", NULL, chunk, file->Offset() + done, completion, (char *)data + done)) {
+                return done ? done : -1;
+            }
+            if (completion.result < 0) {
+                errno = completion.error;
+                return done ? done : -1;
+            }
+            done += completion.result;
+            if ((size_t)completion.result < chunk) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    bool Agent::Close(FileIntr& file)
+    {
+        return !simple(AgentClose, file, file->Name());
+    }
+
+    bool Agent::GetFileSize(FileIntr& file, size_t& size)
+    {
+        int64_t result = simple(AgentSize, file, file->Name());
+
+        if (result < 0) {
+            return false;
+        }
+        size = result;
+        return true;
+    }
+
+    bool Agent::Open(DirectoryIntr& dir)
+    {
+        std::vector<char> buf(slot_size_);
+        size_t            index = 0;
+
+        //! -- a listing that doesn't fit in a slot comes in several pieces
+        while (true) {
+            AgentCompletion completion;
+            size_t          size = slot_size_ - std::min(slot_size_, dir->Name().size());
+            if (!call(AgentList, NULL, dir->Name(), "", NULL, size, index, completion, &buf[0])) {
+                return false;
+            }
+            if (completion.result < 0) {
+                errno = completion.error;
+                return false;
+            }
+            if (!completion.result && completion.more) {
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            for (size_t pos = 0; pos < (size_t)completion.result; ++index) {
+                std::string name(&buf[pos]);
+                dir->AddFile(name);
+                pos += name.size() + 1;
+            }
+            if (!completion.more) {
+                return true;
+            }
+        }
+    }
+
+    bool Agent::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    int Agent::MkDir(const std::string& path, mode_t mode)
+    {
+        return simple(AgentMkDir, NULL, path, "", mode);
+    }
+
+    int Agent::Unlink(const std::string& path)
+    {
+        return simple(AgentUnlink, NULL, path);
+    }
+
+    int Agent::RmDir(const std::string& path)
+    {
+        return simple(AgentRmDir, NULL, path);
+    }
+
+    int Agent::Rename(const std::string& name, const std::string& newname)
+    {
+        return simple(AgentRename, NULL, name, newname);
+    }
+
+    Connector *AgentFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Agent(name, config, fd_manager, log);
+    }
+}
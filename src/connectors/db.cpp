@@ -1,40 +1,884 @@
 extern "C" {
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef FWL_DB_ASYNC
+#include <ctype.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <mysql.h>
+#include <errmsg.h>
+#endif
 }
 #include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#ifdef FWL_DB_ASYNC
+#include <algorithm>
+#include <deque>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#endif
 #include "connectors/db.h"
 namespace FWL {
+    namespace {
+        uint64_t now()
+        {
+            struct timespec ts;
+
+            ::clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        }
+    }
+
+#ifdef FWL_DB_ASYNC
+    //! -- one event loop thread drives a few connections through the MariaDB non-blocking API;
+    //! -- callers queue a statement and sleep on their own condition until the loop completes it
+    class DbAsync
+    {
+        private:
+            enum State {
+                Down,
+                Connecting,
+                Idle,
+                Querying,
+                Storing
+            };
+
+            struct Request
+            {
+                std::string                                query;
+                std::vector<std::vector<std::string> >     *rows;
+                uint64_t                                   affected;
+                std::string                                error;
+                bool                                       ok;
+                bool                                       done;
+                boost::condition_variable                  wakeup;
+            };
+
+            struct Connection
+            {
+                MYSQL       mysql;
+                State       state;
+                int         wait;
+                uint64_t    deadline;
+                uint64_t    retry_at;
+                size_t      setup;
+                Request     *request;
+                int         error;
+                MYSQL_RES   *result;
+            };
+
+            std::string              host_;
+            std::string              user_;
+            std::string              password_;
+            std::string              db_;
+            std::string              socket_;
+            unsigned int             port_;
+            std::vector<std::string> setup_;
+            uint64_t                 retry_;
+            Log&                     log_;
+
+            //! -- sized once before the loop starts: MYSQL handles must not move
+            std::vector<Connection>  connections_;
+            boost::mutex             lock_;
+            std::deque<Request *>    pending_;
+            int                      wakeup_;
+            bool                     stop_;
+            boost::thread            thread_;
+
+            void parse(const std::string& conn_str);
+            void run();
+            void connect(Connection& c);
+            void down(Connection& c);
+            void resume(Connection& c, int ready);
+            void dispatch(Connection& c);
+            void query(Connection& c, const std::string& sql);
+            void queried(Connection& c);
+            void stored(Connection& c);
+            void finish(Connection& c, bool ok);
+            void complete(Request *request, bool ok, const std::string& error);
+
+        public:
+            DbAsync(const std::string& conn_str, size_t connections, const std::vector<std::string>& setup, uint64_t retry, Log& log);
+            ~DbAsync();
+            bool Execute(const std::string& query, std::vector<std::vector<std::string> > *rows, uint64_t& affected, std::string& error);
+            void BeforeFork();
+            void AfterFork(bool child);
+    };
+
+    DbAsync::DbAsync(const std::string& conn_str, size_t connections, const std::vector<std::string>& setup, uint64_t retry, Log& log)
+        : port_(0)
+        , setup_(setup)
+        , retry_(retry)
+        , log_(log)
+        , connections_(std::max(connections, (size_t)1))
+        , wakeup_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        , stop_(false)
+    {
+        parse(conn_str);
+        BOOST_FOREACH(Connection & c, connections_)
+        {
+            c.state    = Down;
+            c.wait     = 0;
+            c.deadline = 0;
+            c.retry_at = 0;
+            c.request  = NULL;
+            c.result   = NULL;
+        }
+        thread_ = boost::thread(boost::bind(&DbAsync::run, this));
+    }
+
+    DbAsync::~DbAsync()
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            stop_ = true;
+        }
+        ::eventfd_write(wakeup_, 1);
+        thread_.join();
+        ::close(wakeup_);
+    }
+
+    //! -- soci style "mysql://db=x user=y password='z' host=h port=p unix_socket=s"
+    void DbAsync::parse(const std::string& conn_str)
+    {
+        std::string str = conn_str;
+        size_t      pos = str.find("://");
+
+        if (pos != std::string::npos) {
+            str = str.substr(pos + 3);
+        }
+        pos = 0;
+        while (pos < str.size()) {
+            while ((pos < str.size()) && (str[pos] == ' ')) {
+                ++pos;
+            }
+            size_t eq = str.find('=', pos);
+            if (eq == std::string::npos) {
+                break;
+            }
+            std::string name = str.substr(pos, eq - pos);
+            std::string value;
+            pos = eq + 1;
+            if ((pos < str.size()) && ((str[pos] == '\'') || (str[pos] == '"'))) {
+                size_t end = str.find(str[pos], pos + 1);
+                if (end == std::string::npos) {
+                    end = str.size();
+                }
+                value = str.substr(pos + 1, end - pos - 1);
+                pos   = end + 1;
+            } else {
+                size_t end = std::min(str.find(' ', pos), str.size());
+                value = str.substr(pos, end - pos);
+                pos   = end;
+            }
+
+            if (name == "host") {
+                host_ = value;
+            } else if ((name == "db") || (name == "dbname") || (name == "service")) {
+                db_ = value;
+            } else if (name == "user") {
+                user_ = value;
+            } else if ((name == "password") || (name == "pass")) {
+                password_ = value;
+            } else if (name == "port") {
+                port_ = ::atoi(value.c_str());
+            } else if ((name == "unix_socket") || (name == "socket")) {
+                socket_ = value;
+            }
+        }
+    }
+
+    void DbAsync::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    //! -- in the child the loop thread is gone and the connections are the parent's: mysql_close would
+    //! -- log the parent out, so the child only drops its copy of the sockets and starts over
+    void DbAsync::AfterFork(bool child)
+    {
+        if (child) {
+            BOOST_FOREACH(Connection & c, connections_)
+            {
+                if (c.state != Down) {
+                    ::close(::mysql_get_socket(&c.mysql));
+                }
+                c.state    = Down;
+                c.wait     = 0;
+                c.deadline = 0;
+                c.retry_at = 0;
+                c.request  = NULL;
+                c.result   = NULL;
+            }
+            pending_.clear();
+            ::close(wakeup_);
+            wakeup_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            Renew(thread_);
+        }
+        lock_.unlock();
+        if (child) {
+            thread_ = boost::thread(boost::bind(&DbAsync::run, this));
+        }
+    }
+
+    bool DbAsync::Execute(const std::string& query, std::vector<std::vector<std::string> > *rows, uint64_t& affected, std::string& error)
+    {
+        Request request;
+
+        request.query    = query;
+        request.rows     = rows;
+        request.affected = 0;
+        request.ok       = false;
+        request.done     = false;
+
+        boost::mutex::scoped_lock lock(lock_);
+        if (stop_) {
+            error = "shutting down";
+            return false;
+        }
+        pending_.push_back(&request);
+        ::eventfd_write(wakeup_, 1);
+        while (!request.done) {
+            request.wakeup.wait(lock);
+        }
+        affected = request.affected;
+        error    = request.error;
+        return request.ok;
+    }
+
+    void DbAsync::complete(Request *request, bool ok, const std::string& error)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        request->ok    = ok;
+        request->error = error;
+        request->done  = true;
+        request->wakeup.notify_one();
+    }
+
+    void DbAsync::connect(Connection& c)
+    {
+        MYSQL    *ret  = NULL;
+        unsigned flags = CLIENT_FOUND_ROWS;
+
+        ::mysql_init(&c.mysql);
+        ::mysql_options(&c.mysql, MYSQL_OPT_NONBLOCK, 0);
+        ::mysql_options(&c.mysql, MYSQL_SET_CHARSET_NAME, "utf8mb4");
+        c.state = Connecting;
+        c.setup = 0;
+        c.wait  = ::mysql_real_connect_start(&ret, &c.mysql, host_.empty() ? NULL : host_.c_str(), user_.c_str(), password_.c_str(),
+                                             db_.empty() ? NULL : db_.c_str(), port_, socket_.empty() ? NULL : socket_.c_str(), flags);
+        if (!c.wait) {
+            if (!ret) {
+                down(c);
+                return;
+            }
+            c.state = Idle;
+            dispatch(c);
+        }
+    }
+
+    void DbAsync::down(Connection& c)
+    {
+        log_.Err("DbAsync: %s", ::mysql_error(&c.mysql));
+        ::mysql_close(&c.mysql);
+        c.state    = Down;
+        c.wait     = 0;
+        c.deadline = 0;
+        c.retry_at = now() + retry_;
+        if (c.result) {
+            ::mysql_free_result(c.result);
+            c.result = NULL;
+        }
+        if (c.request) {
+            complete(c.request, false, "connection lost");
+            c.request = NULL;
+        }
+    }
+
+    void DbAsync::resume(Connection& c, int ready)
+    {
+        c.wait     = 0;
+        c.deadline = 0;
+        if (c.state == Connecting) {
+            MYSQL *ret = NULL;
+            c.wait = ::mysql_real_connect_cont(&ret, &c.mysql, ready);
+            if (!c.wait) {
+                if (!ret) {
+                    down(c);
+                    return;
+                }
+                c.state = Idle;
+                dispatch(c);
+            }
+        } else if (c.state == Querying) {
+            c.wait = ::mysql_real_query_cont(&c.error, &c.mysql, ready);
+            if (!c.wait) {
+                queried(c);
+            }
+        } else if (c.state == Storing) {
+            c.wait = ::mysql_store_result_cont(&c.result, &c.mysql, ready);
+            if (!c.wait) {
+                stored(c);
+            }
+        }
+    }
+
+    //! -- a fresh connection runs create_table and init_queries before it takes requests
+    void DbAsync::dispatch(Connection& c)
+    {
+        if (c.state != Idle) {
+            return;
+        }
+        if (c.setup < setup_.size()) {
+            query(c, setup_[c.setup]);
+        } else if (c.request) {
+            query(c, c.request->query);
+        }
+    }
+
+    void DbAsync::query(Connection& c, const std::string& sql)
+    {
+        c.state = Querying;
+        c.wait  = ::mysql_real_query_start(&c.error, &c.mysql, sql.data(), sql.size());
+        if (!c.wait) {
+            queried(c);
+        }
+    }
+
+    void DbAsync::queried(Connection& c)
+    {
+        if (c.error) {
+            finish(c, false);
+            return;
+        }
+        c.state  = Storing;
+        c.result = NULL;
+        c.wait   = ::mysql_store_result_start(&c.result, &c.mysql);
+        if (!c.wait) {
+            stored(c);
+        }
+    }
+
+    void DbAsync::stored(Connection& c)
+    {
+        if (!c.result) {
+            finish(c, !::mysql_field_count(&c.mysql));
+            return;
+        }
+        if (c.request && c.request->rows) {
+            unsigned int fields = ::mysql_num_fields(c.result);
+            MYSQL_ROW    row;
+            while ((row = ::mysql_fetch_row(c.result))) {
+                unsigned long *lengths = ::mysql_fetch_lengths(c.result);
+                c.request->rows->push_back(std::vector<std::string>(fields));
+                for (unsigned int i = 0; i < fields; ++i) {
+                    if (row[i]) {
+                        c.request->rows->back()[i].assign(row[i], lengths[i]);
+                    }
+                }
+            }
+        }
+        ::mysql_free_result(c.result);
+        c.result = NULL;
+        finish(c, true);
+    }
+
+    void DbAsync::finish(Connection& c, bool ok)
+    {
+        unsigned int code = ::mysql_errno(&c.mysql);
+
+        if (!ok && ((code == CR_SERVER_GONE_ERROR) || (code == CR_SERVER_LOST))) {
+            down(c);
+            return;
+        }
+        c.state = Idle;
+        if (c.setup < setup_.size()) {
+            if (!ok) {
+                log_.Err("DbAsync: %s: %s", setup_[c.setup].c_str(), ::mysql_error(&c.mysql));
+            }
+            ++c.setup;
+        } else if (c.request) {
+            c.request->affected = ok ? ::mysql_affected_rows(&c.mysql) : 0;
+            complete(c.request, ok, ok ? std::string() : ::mysql_error(&c.mysql));
+            c.request = NULL;
+        }
+        dispatch(c);
+    }
+
+    void DbAsync::run()
+    {
+        std::vector<struct pollfd> fds;
+        std::vector<Connection *>  polled;
+
+        while (true) {
+            uint64_t current = now();
+            BOOST_FOREACH(Connection & c, connections_)
+            {
+                if ((c.state == Down) && (c.retry_at <= current)) {
+                    connect(c);
+                }
+            }
+            {
+                boost::mutex::scoped_lock lock(lock_);
+                if (stop_) {
+                    break;
+                }
+                bool alive = false;
+                BOOST_FOREACH(Connection & c, connections_)
+                {
+                    alive = alive || (c.state != Down);
+                    if ((c.state == Idle) && !c.request && (c.setup == setup_.size()) && !pending_.empty()) {
+                        c.request = pending_.front();
+                        pending_.pop_front();
+                    }
+                }
+                //! -- nothing to wait for: fail fast instead of parking callers until a reconnect
+                while (!alive && !pending_.empty()) {
+                    pending_.front()->error = "not connected";
+                    pending_.front()->done  = true;
+                    pending_.front()->wakeup.notify_one();
+                    pending_.pop_front();
+                }
+            }
+
+            int timeout = -1;
+            fds.clear();
+            polled.clear();
+            fds.push_back(pollfd());
+            fds.back().fd     = wakeup_;
+            fds.back().events = POLLIN;
+            BOOST_FOREACH(Connection & c, connections_)
+            {
+                if ((c.state == Idle) && c.request) {
+                    dispatch(c);
+                }
+                if (c.state == Down) {
+                    int wait = (int)(std::max(c.retry_at, current) - current);
+                    timeout = (timeout < 0) ? wait : std::min(timeout, wait);
+                    continue;
+                }
+                if (!c.wait) {
+                    continue;
+                }
+                if (c.wait & MYSQL_WAIT_TIMEOUT) {
+                    if (!c.deadline) {
+                        c.deadline = current + ::mysql_get_timeout_value_ms(&c.mysql);
+                    }
+                    int wait = (int)(std::max(c.deadline, current) - current);
+                    timeout = (timeout < 0) ? wait : std::min(timeout, wait);
+                }
+                fds.push_back(pollfd());
+                fds.back().fd     = ::mysql_get_socket(&c.mysql);
+                fds.back().events = ((c.wait & MYSQL_WAIT_READ) ? POLLIN : 0) | ((c.wait & MYSQL_WAIT_WRITE) ? POLLOUT : 0) | ((c.wait & MYSQL_WAIT_EXCEPT) ? POLLPRI : 0);
+                polled.push_back(&c);
+            }
+
+            if ((::poll(&fds[0], fds.size(), timeout) < 0) && (errno != EINTR)) {
+                log_.Err("DbAsync: poll: %s", ::strerror(errno));
+                continue;
+            }
+            if (fds[0].revents & POLLIN) {
+                eventfd_t value;
+                ::eventfd_read(wakeup_, &value);
+            }
+
+            current = now();
+            for (size_t i = 0; i < polled.size(); ++i) {
+                Connection& c     = *polled[i];
+                short       ev    = fds[i + 1].revents;
+                int         ready = 0;
+                if (ev & (POLLIN | POLLERR | POLLHUP)) {
+                    ready |= MYSQL_WAIT_READ;
+                }
+                if (ev & (POLLOUT | POLLERR)) {
+                    ready |= MYSQL_WAIT_WRITE;
+                }
+                if (ev & POLLPRI) {
+                    ready |= MYSQL_WAIT_EXCEPT;
+                }
+                if ((c.wait & MYSQL_WAIT_TIMEOUT) && (c.deadline <= current)) {
+                    ready |= MYSQL_WAIT_TIMEOUT;
+                }
+                if (ready) {
+                    resume(c, ready);
+                }
+            }
+        }
+
+        BOOST_FOREACH(Connection & c, connections_)
+        {
+            if (c.state != Down) {
+                if (c.result) {
+                    ::mysql_free_result(c.result);
+                }
+                if (c.request) {
+                    complete(c.request, false, "shutting down");
+                }
+                ::mysql_close(&c.mysql);
+            }
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        BOOST_FOREACH(Request * request, pending_)
+        {
+            request->error = "shutting down";
+            request->done  = true;
+            request->wakeup.notify_one();
+        }
+        pending_.clear();
+    }
+
+    namespace {
+        //! -- MySQL string literal; the value column is a blob so it goes in as _binary
+        std::string literal(const std::string& name, const std::string& value)
+        {
+            std::string out = (name == "value") ? "_binary'" : "'";
+
+            out.reserve(out.size() + value.size() + 1);
+            BOOST_FOREACH(char c, value)
+            {
+                switch (c) {
+                    case '\0':   out += "\\0"; break;
+                    case '\n':   out += "\\n"; break;
+                    case '\r':   out += "\\r"; break;
+                    case '\\':   out += "\\\\"; break;
+                    case '\'':   out += "\\'"; break;
+                    case '"':    out += "\\\""; break;
+                    case '\032': out += "\\Z"; break;
+                    default:     out += c;
+                }
+            }
+            return out + "'";
+        }
+    }
+#endif
+
+    bool Db::execute(const std::string& query, const Params& params, Rows *rows, uint64_t *affected)
+    {
+#ifdef FWL_DB_ASYNC
+        std::string sql;
+
+        sql.reserve(query.size());
+        for (size_t pos = 0; pos < query.size(); ) {
+            if ((query[pos] == ':') && (pos + 1 < query.size()) && (::isalpha(query[pos + 1]) || (query[pos + 1] == '_'))) {
+                size_t end = pos + 1;
+                while ((end < query.size()) && (::isalnum(query[end]) || (query[end] == '_'))) {
+                    ++end;
+                }
+                std::string name = query.substr(pos + 1, end - pos - 1);
+                bool        found = false;
+                BOOST_FOREACH(const Params::value_type & it, params)
+                {
+                    if (it.first == name) {
+                        sql  += literal(name, it.second);
+                        found = true;
+                        break;
+                    }
+                }
+                if (found) {
+                    pos = end;
+                    continue;
+                }
+            }
+            sql += query[pos++];
+        }
+
+        uint64_t    count = 0;
+        std::string error;
+        FWL_DBG(Logger(), "Query: %s", query.c_str());
+        QueryProbe probe(Name(), query.c_str(), params.empty() ? "" : params.front().second.c_str());
+        if (!async_->Execute(sql, rows, count, error)) {
+            Logger().Err("Query %s: %s", query.c_str(), error.c_str());
+            return false;
+        }
+        probe.Ok();
+        if (affected) {
+            *affected = count;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    Dialect *Dialect::Create(const std::string& name)
+    {
+        if (name == "mysql") {
+            return new MysqlDialect;
+        } else if ((name == "sqlite3") || (name == "sqlite")) {
+            return new SqliteDialect;
+        } else if ((name == "postgresql") || (name == "postgres")) {
+            return new PostgresqlDialect;
+        }
+        return NULL;
+    }
+
+    std::string MysqlDialect::Quote(const std::string& identifier) const
+    {
+        return "`" + identifier + "`";
+    }
+
+    std::string MysqlDialect::Concat(const std::string& left, const std::string& right) const
+    {
+        return "CONCAT(" + left + "," + right + ")";
+    }
+
+    std::string MysqlDialect::Length(const std::string& expr) const
+    {
+        return "length(" + expr + ")";
+    }
+
+    std::string MysqlDialect::CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const
+    {
+        return (boost::format("create table if not exists %1% (%2% varchar(255) not null primary key, %3% longblob not null, %4% varchar(255) not null, key (%4%))")
+                % Quote(table) % Quote(key) % Quote(value) % Quote(parent)).str();
+    }
+
+    std::string SqliteDialect::Quote(const std::string& identifier) const
+    {
+        return "\"" + identifier + "\"";
+    }
+
+    //! -- || yields text; cast back so appended values stay blobs
+    std::string SqliteDialect::Concat(const std::string& left, const std::string& right) const
+    {
+        return "cast(" + left + " || " + right + " as blob)";
+    }
+
+    std::string SqliteDialect::Length(const std::string& expr) const
+    {
+        return "length(cast(" + expr + " as blob))";
+    }
+
+    std::string SqliteDialect::CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const
+    {
+        return (boost::format("create table if not exists %1% (%2% text not null primary key, %3% blob not null default x'', %4% text not null)")
+                % Quote(table) % Quote(key) % Quote(value) % Quote(parent)).str();
+    }
+
+    std::string SqliteDialect::Value(const std::string& expr) const
+    {
+        return "cast(" + expr + " as blob)";
+    }
+
+    void SqliteDialect::Prepare(soci::session& session, const JsonNode& config) const
+    {
+        session << "PRAGMA journal_mode=" + config.get<std::string>("journal_mode", "WAL");
+        session << "PRAGMA synchronous=" + config.get<std::string>("synchronous", "NORMAL");
+        session << "PRAGMA mmap_size=" + config.get<std::string>("mmap_size", "268435456");
+        session << "PRAGMA busy_timeout=" + config.get<std::string>("busy_timeout", "5000");
+    }
+
+    std::string PostgresqlDialect::Quote(const std::string& identifier) const
+    {
+        return "\"" + identifier + "\"";
+    }
+
+    std::string PostgresqlDialect::Concat(const std::string& left, const std::string& right) const
+    {
+        return left + " || " + right;
+    }
+
+    std::string PostgresqlDialect::Length(const std::string& expr) const
+    {
+        return "octet_length(" + expr + ")";
+    }
+
+    std::string PostgresqlDialect::CreateTable(const std::string& table, const std::string& key, const std::string& value, const std::string& parent) const
+    {
+        return (boost::format("create table if not exists %1% (%2% text not null primary key, %3% bytea not null default '', %4% text not null)")
+                % Quote(table) % Quote(key) % Quote(value) % Quote(parent)).str();
+    }
+
+    //! -- a text parameter can't carry a NUL byte, so bytea goes over the wire hex encoded
+    std::string PostgresqlDialect::Value(const std::string& expr) const
+    {
+        return "decode(" + expr + ", 'hex')";
+    }
+
+    std::string PostgresqlDialect::Select(const std::string& column) const
+    {
+        return "encode(" + column + ", 'hex')";
+    }
+
+    const std::string& PostgresqlDialect::Encode(const std::string& data, std::string& buf) const
+    {
+        static const char digits[] = "0123456789abcdef";
+
+        buf.resize(data.size() * 2);
+        for (size_t i = 0; i < data.size(); ++i) {
+            buf[2 * i]     = digits[(unsigned char)data[i] >> 4];
+            buf[2 * i + 1] = digits[(unsigned char)data[i] & 0x0f];
+        }
+        return buf;
+    }
+
+    void PostgresqlDialect::Decode(std::string& data) const
+    {
+        size_t size = data.size() / 2;
+
+        for (size_t i = 0; i < size; ++i) {
+            char hi = data[2 * i], lo = data[2 * i + 1];
+            data[i] = (char)((((hi <= '9') ? hi - '0' : (hi | 0x20) - 'a' + 10) << 4) | ((lo <= '9') ? lo - '0' : (lo | 0x20) - 'a' + 10));
+        }
+        data.resize(size);
+    }
+
+    void PostgresqlDialect::Prepare(soci::session& session, const JsonNode& config) const
+    {
+        boost::optional<std::string> commit = config.get_optional<std::string>("synchronous_commit");
+        if (commit) {
+            session << "SET synchronous_commit TO " + *commit;
+        }
+    }
+
     soci::session& Db::Session()
     {
         if (!session_.get()) {
-            Logger().Dbg("ConnStr: %s\n", conn_str_.c_str());
+            FWL_DBG(Logger(), "ConnStr: %s\n", conn_str_.c_str());
             session_.reset(new soci::session(conn_str_));
+            prepare(*session_);
         }
         return *session_;
     }
 
-    bool Db::Exists(FileIntr& file)
+    soci::session& Db::reader(const std::string& key, size_t& replica)
     {
-        static const std::string query = (boost::format("select count(*) from `%1%` where `%2%` = :key") % table_name_ % key_column_).str();
+        replica = replicas_.size();
+        //! -- entries under a just renamed or written directory stay on the primary too
+        if (replicas_.empty() || recent(key) || recent(Path::Directory(key))) {
+            return Session();
+        }
+        for (size_t i = 0; i < replicas_.size(); ++i) {
+            size_t   index = next_replica_++ % replicas_.size();
+            Replica& it    = replicas_[index];
+            if (it.retry_at > now()) {
+                continue;
+            }
+            try {
+                if (!it.session) {
+                    FWL_DBG(Logger(), "Replica ConnStr: %s\n", it.conn_str.c_str());
+                    it.session.reset(new soci::session(it.conn_str));
+                    dialect_->Prepare(*it.session, Config());
+                }
+                replica = index;
+                return *it.session;
+            } catch (const soci::soci_error& e) {
+                failed(index, e);
+            }
+        }
+        return Session();
+    }
 
-        try {
-            Logger().Dbg("Query: %s (key = %s)", query.c_str(), file->Name().c_str());
-            int count = 0;
-            Session() << query, soci::use(file->Name()), soci::into(count);
-            return count > 0;
-        } catch (const std::exception& e) {
-            Logger().Err("Exists:%s", e.what());
+    bool Db::failed(size_t replica, const std::exception& e)
+    {
+        if (replica >= replicas_.size()) {
             return false;
         }
+        Logger().Wrn("Replica %s: %s", replicas_[replica].conn_str.c_str(), e.what());
+        replicas_[replica].session.reset();
+        replicas_[replica].retry_at = now() + replica_retry_;
+        return true;
+    }
+
+    void Db::touch(const std::string& key)
+    {
+        if (replicas_.empty() || !consistency_window_) {
+            return;
+        }
+        uint64_t until = now() + consistency_window_;
+        if (written_.size() > 4096) {
+            uint64_t current = now();
+            for (Written::iterator it = written_.begin(); it != written_.end(); ) {
+                if (it->second < current) {
+                    it = written_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        //! -- the parent too, so a listing right after a create sees the new entry
+        written_[key]                  = until;
+        written_[Path::Directory(key)] = until;
     }
 
-    bool Db::Create(FileIntr& file)
+    bool Db::recent(const std::string& key)
     {
-        static const std::string query = (boost::format("insert into `%1%` (`%2%`,`%3%`,`%4%`) value(:key,'',:parent)") % table_name_ % key_column_ % value_column_ % parent_column_).str();
+        Written::iterator it = written_.find(key);
 
+        if (it == written_.end()) {
+            return false;
+        }
+        if (it->second < now()) {
+            written_.erase(it);
+            return false;
+        }
+        return true;
+    }
+
+    void Db::prepare(soci::session& session)
+    {
+        dialect_->Prepare(session, Config());
+        if (Config().get<bool>("create_table", false)) {
+            session << dialect_->CreateTable(table_name_, key_column_, value_column_, parent_column_);
+        }
+
+        JsonNodeConstOp init = Config().get_child_optional("init_queries");
+        if (init) {
+            BOOST_FOREACH(const JsonNode::value_type & it, *init)
+            {
+                session << it.second.get_value<std::string>();
+            }
+        }
+    }
+
+    bool Db::Exists(FileIntr& file)
+    {
+        if (async_) {
+            Rows   rows;
+            Params params(1, Params::value_type("key", file->Name()));
+            return execute(queries_.exists, params, &rows) && !rows.empty() && (::atoi(rows[0][0].c_str()) > 0);
+        }
+        for (size_t attempt = 0; attempt <= replicas_.size(); ++attempt) {
+            size_t replica = replicas_.size();
+            try {
+                soci::session& session = reader(file->Name(), replica);
+                FWL_DBG(Logger(), "Query: %s (key = %s)", queries_.exists.c_str(), file->Name().c_str());
+                int        count = 0;
+                QueryProbe probe(Name(), queries_.exists.c_str(), file->Name().c_str());
+                session << queries_.exists, soci::use(file->Name()), soci::into(count);
+                probe.Ok();
+                return count > 0;
+            } catch (const std::exception& e) {
+                if (!failed(replica, e)) {
+                    Logger().Err("Exists:%s", e.what());
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool Db::Create(FileIntr& file)
+    {
+        if (async_) {
+            Params params;
+            params.push_back(Params::value_type("key", file->Name()));
+            params.push_back(Params::value_type("parent", Path::Directory(file->Name())));
+            return execute(queries_.create, params);
+        }
         try {
-            Logger().Dbg("Query:%s - key:%s / parent: %s\n ", query.c_str(), file->Name().c_str(), Path::Directory(file->Name()).c_str());
-            Session() << query, soci::use(file->Name()), soci::use(Path::Directory(file->Name()));
+            std::string parent = Path::Directory(file->Name());
+            touch(file->Name());
+            FWL_DBG(Logger(), "Query:%s - key:%s / parent: %s\n ", queries_.create.c_str(), file->Name().c_str(), parent.c_str());
+            QueryProbe probe(Name(), queries_.create.c_str(), file->Name().c_str());
+            Session() << queries_.create, soci::use(file->Name()), soci::use(parent);
+            probe.Ok();
             return true;
         } catch (const soci::soci_error& e) {
             Logger().Err("Create: %s", e.what());
@@ -44,12 +888,18 @@ namespace FWL {
 
     bool Db::Truncate(FileIntr& file)
     {
-        static const std::string query = (boost::format("update `%1%` set `%3%` = '' where `%2%` = :key ") % table_name_ % key_column_ % value_column_).str();
-
+        if (async_) {
+            uint64_t affected = 0;
+            Params   params(1, Params::value_type("key", file->Name()));
+            return execute(queries_.truncate, params, NULL, &affected) && affected;
+        }
         try {
-            Logger().Dbg("Query:%s\n", query.c_str());
-            soci::statement st((Session().prepare << query, soci::use(file->Name())));
-            st.execute();
+            FWL_DBG(Logger(), "Query:%s\n", queries_.truncate.c_str());
+            touch(file->Name());
+            QueryProbe      probe(Name(), queries_.truncate.c_str(), file->Name().c_str());
+            soci::statement st((Session().prepare << queries_.truncate, soci::use(file->Name())));
+            st.execute(true);
+            probe.Ok();
             return st.get_affected_rows();
         } catch (const soci::soci_error& e) {
             Logger().Err("Update: %s", e.what());
@@ -59,11 +909,21 @@ namespace FWL {
 
     bool Db::update(const std::string& key, const std::string& value)
     {
-        static const std::string query = (boost::format("update `%1%` set `%3%` = :value where `%2%` = :key ") % table_name_ % key_column_ % value_column_).str();
-
+        if (async_) {
+            uint64_t affected = 0;
+            Params   params;
+            params.push_back(Params::value_type("key", key));
+            params.push_back(Params::value_type("value", value));
+            return execute(queries_.update, params, NULL, &affected) && affected;
+        }
         try {
-            Logger().Dbg("Query:%s\n", query.c_str());
-            soci::statement st((Session().prepare << query, soci::use(key, "key"), soci::use(value, "value")));
+            FWL_DBG(Logger(), "Query:%s\n", queries_.update.c_str());
+            touch(key);
+            std::string     buf;
+            QueryProbe      probe(Name(), queries_.update.c_str(), key.c_str());
+            soci::statement st((Session().prepare << queries_.update, soci::use(key, "key"), soci::use(dialect_->Encode(value, buf), "value")));
+            st.execute(true);
+            probe.Ok();
             return st.get_affected_rows();
         } catch (const soci::soci_error& e) {
             Logger().Err("Update %s", e.what());
@@ -73,12 +933,21 @@ namespace FWL {
 
     bool Db::append(const std::string& key, const std::string& value)
     {
-        static const std::string query = (boost::format("update `%1%` set `%3%` = CONCAT(`%3%`,:value) where `%2%` = :key ") % table_name_ % key_column_ % value_column_).str();
-
+        if (async_) {
+            uint64_t affected = 0;
+            Params   params;
+            params.push_back(Params::value_type("key", key));
+            params.push_back(Params::value_type("value", value));
+            return execute(queries_.append, params, NULL, &affected) && affected;
+        }
         try {
-            Logger().Dbg("Query:%s\n", query.c_str());
-            soci::statement st((Session().prepare << query, soci::use(key, "key"), soci::use(value, "value")));
-            st.execute();
+            FWL_DBG(Logger(), "Query:%s\n", queries_.append.c_str());
+            touch(key);
+            std::string     buf;
+            QueryProbe      probe(Name(), queries_.append.c_str(), key.c_str());
+            soci::statement st((Session().prepare << queries_.append, soci::use(key, "key"), soci::use(dialect_->Encode(value, buf), "value")));
+            st.execute(true);
+            probe.Ok();
             return st.get_affected_rows();
         } catch (const soci::soci_error& e) {
             Logger().Err("Append: %s", e.what());
@@ -88,18 +957,27 @@ namespace FWL {
 
     bool Db::remove(const std::string& key)
     {
-        static const std::string query       = (boost::format("delete from `%1%` where `%2%` = :key ") % table_name_ % key_column_).str();
-        static const std::string clear_query = (boost::format("delete from `%1%` where `%2%` = :key ") % table_name_ % parent_column_).str();
-
+        if (async_) {
+            uint64_t affected = 0;
+            Params   params(1, Params::value_type("key", key));
+            if (!execute(queries_.remove, params, NULL, &affected)) {
+                return false;
+            }
+            return execute(queries_.clear, params) && affected;
+        }
         try {
-            Logger().Dbg("Query:%s key:%s", query.c_str(), key.c_str());
-            soci::statement st((Session().prepare << query, soci::use(key)));
-            st.execute();
-            st.get_affected_rows();
-            Logger().Dbg("Query:%s key:%s", clear_query.c_str(), key.c_str());
-            soci::statement clst((Session().prepare << clear_query, soci::use(key)));
-            clst.execute();
-            return true;
+            FWL_DBG(Logger(), "Query:%s key:%s", queries_.remove.c_str(), key.c_str());
+            touch(key);
+            QueryProbe      probe(Name(), queries_.remove.c_str(), key.c_str());
+            soci::statement st((Session().prepare << queries_.remove, soci::use(key)));
+            st.execute(true);
+            //! -- -1 where the backend can't tell (sqlite3)
+            bool removed = st.get_affected_rows() != 0;
+            FWL_DBG(Logger(), "Query:%s key:%s", queries_.clear.c_str(), key.c_str());
+            soci::statement clst((Session().prepare << queries_.clear, soci::use(key)));
+            clst.execute(true);
+            probe.Ok();
+            return removed;
         } catch (const soci::soci_error& e) {
             Logger().Err("Remove: %s", e.what());
             return false;
@@ -108,47 +986,109 @@ namespace FWL {
 
     bool Db::read(const std::string& key, std::string& data)
     {
-        static const std::string query = (boost::format("select `%3%` from `%1%` where `%2%` = :key ") % table_name_ % key_column_ % value_column_).str();
-
-        try {
-            Logger().Dbg("Query:%s\n", query.c_str());
-            Session() << query, soci::into(data);
+        if (async_) {
+            Rows   rows;
+            Params params(1, Params::value_type("key", key));
+            if (!execute(queries_.read, params, &rows) || rows.empty()) {
+                return false;
+            }
+            data.swap(rows[0][0]);
             return true;
-        } catch (const soci::soci_error& e) {
-            Logger().Err("Read: %s", e.what());
-            return false;
         }
+        for (size_t attempt = 0; attempt <= replicas_.size(); ++attempt) {
+            size_t replica = replicas_.size();
+            try {
+                soci::session& session = reader(key, replica);
+                FWL_DBG(Logger(), "Query:%s\n", queries_.read.c_str());
+                soci::indicator ind = soci::i_ok;
+                QueryProbe      probe(Name(), queries_.read.c_str(), key.c_str());
+                session << queries_.read, soci::use(key), soci::into(data, ind);
+                probe.Ok();
+                if (!session.got_data()) {
+                    return false;
+                }
+                dialect_->Decode(data);
+                return true;
+            } catch (const soci::soci_error& e) {
+                if (!failed(replica, e)) {
+                    Logger().Err("Read: %s", e.what());
+                    return false;
+                }
+            }
+        }
+        return false;
     }
 
     bool Db::readdir(const std::string& key, std::vector<std::string>& files)
     {
-        static const std::string query = (boost::format("select `%2%` from `%1%` where `%3%` = :parent ") % table_name_ % key_column_ % parent_column_).str();
-
-        try {
-            soci::rowset<std::string> rs = (Session().prepare << query, soci::use(key));
-
+        if (async_) {
+            Rows   rows;
+            Params params(1, Params::value_type("parent", key));
+            if (!execute(queries_.readdir, params, &rows)) {
+                return false;
+            }
             files.clear();
-            for (soci::rowset<std::string>::const_iterator it = rs.begin(); it != rs.end(); ++it) {
-                files.push_back(Path::File(*it));
+            BOOST_FOREACH(const Rows::value_type & row, rows)
+            {
+                files.push_back(Path::File(row[0]));
             }
             return true;
-        } catch (const soci::soci_error& e) {
-            Logger().Err("Readdir: %s", e.what());
-            return false;
         }
+        for (size_t attempt = 0; attempt <= replicas_.size(); ++attempt) {
+            size_t replica = replicas_.size();
+            try {
+                soci::session& session = reader(key, replica);
+                QueryProbe                probe(Name(), queries_.readdir.c_str(), key.c_str());
+                soci::rowset<std::string> rs = (session.prepare << queries_.readdir, soci::use(key));
+
+                files.clear();
+                for (soci::rowset<std::string>::const_iterator it = rs.begin(); it != rs.end(); ++it) {
+                    files.push_back(Path::File(*it));
+                }
+                probe.Ok();
+                return true;
+            } catch (const soci::soci_error& e) {
+                if (!failed(replica, e)) {
+                    Logger().Err("Readdir: %s", e.what());
+                    return false;
+                }
+            }
+        }
+        return false;
     }
 
     bool Db::length(const std::string& key, size_t& size)
     {
-        static const std::string query = (boost::format("select length(`%3%`) from `%2%` where `%2%` = :key") % table_name_ % key_column_ % value_column_).str();
-
-        try {
-            Session() << query, soci::use(key), soci::into(size);
+        if (async_) {
+            Rows   rows;
+            Params params(1, Params::value_type("key", key));
+            if (!execute(queries_.length, params, &rows) || rows.empty()) {
+                return false;
+            }
+            size = ::strtoull(rows[0][0].c_str(), NULL, 10);
             return true;
-        } catch (const soci::soci_error& e) {
-            Logger().Err("length: %s", e.what());
-            return false;
         }
+        for (size_t attempt = 0; attempt <= replicas_.size(); ++attempt) {
+            size_t replica = replicas_.size();
+            try {
+                soci::session& session = reader(key, replica);
+                long long  len = 0;
+                QueryProbe probe(Name(), queries_.length.c_str(), key.c_str());
+                session << queries_.length, soci::use(key), soci::into(len);
+                probe.Ok();
+                if (!session.got_data()) {
+                    return false;
+                }
+                size = len;
+                return true;
+            } catch (const soci::soci_error& e) {
+                if (!failed(replica, e)) {
+                    Logger().Err("length: %s", e.what());
+                    return false;
+                }
+            }
+        }
+        return false;
     }
 
     Db::Db(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
@@ -158,52 +1098,187 @@ namespace FWL {
         , key_column_(config.get<std::string>("key_column"))
         , value_column_(config.get<std::string>("value_column"))
         , parent_column_(config.get<std::string>("parent_column"))
-    {}
+        , next_replica_(0)
+        , consistency_window_(config.get<uint64_t>("read_your_writes_ms", 1000))
+        , replica_retry_(config.get<uint64_t>("replica_retry_ms", 5000))
+    {
+        std::string backend = conn_str_.substr(0, conn_str_.find("://"));
+        dialect_.reset(Dialect::Create(config.get<std::string>("dialect", backend)), false);
+        if (!dialect_) {
+            Logger().Wrn("Unknown SQL dialect for %s, falling back to mysql", conn_str_.c_str());
+            dialect_.reset(new MysqlDialect, false);
+        }
+        FWL_DBG(Logger(), "Dialect: %s", dialect_->Name());
+
+        JsonNodeConstOp replicas = config.get_child_optional("replicas");
+        if (replicas) {
+            BOOST_FOREACH(const JsonNode::value_type & it, *replicas)
+            {
+                Replica replica;
+                replica.conn_str = it.second.get_value<std::string>();
+                replica.retry_at = 0;
+                replicas_.push_back(replica);
+            }
+        }
+
+        const Dialect& d      = *dialect_;
+        std::string    table  = d.Quote(table_name_);
+        std::string    key    = d.Quote(key_column_);
+        std::string    value  = d.Quote(value_column_);
+        std::string    parent = d.Quote(parent_column_);
+
+        queries_.exists     = (boost::format("select count(*) from %1% where %2% = :key") % table % key).str();
+        queries_.create     = (boost::format("insert into %1% (%2%,%3%,%4%) values (:key,%5%,:parent)") % table % key % value % parent % d.Value("''")).str();
+        queries_.truncate   = (boost::format("update %1% set %3% = %4% where %2% = :key") % table % key % value % d.Value("''")).str();
+        queries_.update     = (boost::format("update %1% set %3% = %4% where %2% = :key") % table % key % value % d.Value(":value")).str();
+        queries_.append     = (boost::format("update %1% set %3% = %4% where %2% = :key") % table % key % value % d.Concat(value, d.Value(":value"))).str();
+        queries_.remove     = (boost::format("delete from %1% where %2% = :key") % table % key).str();
+        queries_.clear      = (boost::format("delete from %1% where %2% = :key") % table % parent).str();
+        queries_.read       = (boost::format("select %3% from %1% where %2% = :key") % table % key % d.Select(value)).str();
+        queries_.readdir    = (boost::format("select %2% from %1% where %3% = :parent") % table % key % parent).str();
+        queries_.length     = (boost::format("select %3% from %1% where %2% = :key") % table % key % d.Length(value)).str();
+        queries_.rename     = (boost::format("update %1% set %2% = :newkey, %3% = :newparent where %2% = :key") % table % key % parent).str();
+        queries_.rename_dir = (boost::format("update %1% set %2% = :newkey where %2% = :key") % table % parent).str();
+
+        if (config.get<std::string>("driver", "soci") == "async") {
+#ifdef FWL_DB_ASYNC
+            if (backend == "mysql") {
+                std::vector<std::string> setup;
+                if (config.get<bool>("create_table", false)) {
+                    setup.push_back(d.CreateTable(table_name_, key_column_, value_column_, parent_column_));
+                }
+                JsonNodeConstOp init = config.get_child_optional("init_queries");
+                if (init) {
+                    BOOST_FOREACH(const JsonNode::value_type & it, *init)
+                    {
+                        setup.push_back(it.second.get_value<std::string>());
+                    }
+                }
+                async_.reset(new DbAsync(conn_str_, config.get<size_t>("async_connections", 4), setup, replica_retry_, Logger()));
+            } else {
+                Logger().Wrn("Async driver needs a mysql conn_str, using soci for %s", conn_str_.c_str());
+            }
+#else
+            Logger().Wrn("Built without FWL_DB_ASYNC, using soci for %s", conn_str_.c_str());
+#endif
+        }
+    }
+
+    void Db::BeforeFork()
+    {
+#ifdef FWL_DB_ASYNC
+        if (async_) {
+            async_->BeforeFork();
+        }
+#endif
+    }
+
+    //! -- sessions inherited from the parent are left open, never closed: closing one would end the
+    //! -- parent's connection too. The child connects again on first use.
+    void Db::AfterFork(bool child)
+    {
+#ifdef FWL_DB_ASYNC
+        if (async_) {
+            async_->AfterFork(child);
+        }
+#endif
+        if (!child) {
+            return;
+        }
+        session_.release();
+        BOOST_FOREACH(Replica & replica, replicas_)
+        {
+            new boost::shared_ptr<soci::session>(replica.session);   //! -- leaked on purpose, see above
+            replica.session.reset();
+            replica.retry_at = 0;
+        }
+    }
 
     int Db::Rename(const std::string& name, const std::string& newname)
     {
-        static const std::string query     = (boost::format("update `%1%` set `%2%` = :newkey where `%2%` = :key") % table_name_ % key_column_).str();
-        static const std::string dir_query = (boost::format("update `%1%` set `%2%` = :newkey where `%2%` = :key") % table_name_ % parent_column_).str();
+        std::string newparent = Path::Directory(newname);
 
         errno = 0;
-        soci::statement st((Session().prepare << query, soci::use(name, ":key"), soci::use(newname, ":newkey")));
-        st.execute();
-        if (!st.get_affected_rows()) {
-            errno = EEXIST;
+        touch(name);
+        touch(newname);
+        if (async_) {
+            uint64_t affected = 0;
+            Params   params;
+            params.push_back(Params::value_type("key", name));
+            params.push_back(Params::value_type("newkey", newname));
+            params.push_back(Params::value_type("newparent", newparent));
+            if (!execute(queries_.rename, params, NULL, &affected)) {
+                errno = EIO;
+                return -1;
+            }
+            if (!affected) {
+                errno = ENOENT;
+                return -1;
+            }
+            if (!execute(queries_.rename_dir, params)) {
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+        }
+        try {
+            QueryProbe      probe(Name(), queries_.rename.c_str(), name.c_str());
+            soci::statement st((Session().prepare << queries_.rename, soci::use(name, "key"), soci::use(newname, "newkey"), soci::use(newparent, "newparent")));
+            st.execute(true);
+            if (!st.get_affected_rows()) {
+                probe.Ok();
+                errno = ENOENT;
+                return -1;
+            }
+            soci::statement dirst((Session().prepare << queries_.rename_dir, soci::use(name, "key"), soci::use(newname, "newkey")));
+            dirst.execute(true);
+            probe.Ok();
+            return 0;
+        } catch (const soci::soci_error& e) {
+            Logger().Err("Rename: %s", e.what());
+            errno = EIO;
             return -1;
         }
-        soci::statement dirst((Session().prepare << dir_query, soci::use(name, ":key"), soci::use(newname, ":newkey")));
-        dirst.execute();
-        return 0;
     }
 
     int Db::MkDir(const std::string& path, mode_t mode)
     {
-        return Connector::Open(path, O_CREAT);
+        FileIntr dir(new File(-1, path, O_CREAT));
+
+        if (Exists(dir)) {
+            errno = EEXIST;
+            return -1;
+        }
+        return Create(dir) ? 0 : -1;
     }
 
     bool Db::Close(DirectoryIntr& dir)
     {
         return true;
     }
-    
-    int Db::Write(FileIntr& file,const void *data, size_t size)
+
+    int Db::Write(FileIntr& file, const void *data, size_t size)
     {
-        Logger().Dbg("Write: %d\n", file->Fd());
+        FWL_DBG(Logger(), "Write: %d\n", file->Fd());
         if (!append(file->Name(), std::string((const char *)data, size))) {
             return -1;
         }
         return size;
     }
 
-    int Db::Read(FileIntr& file,void *data, size_t size)
+    int Db::Read(FileIntr& file, void *data, size_t size)
     {
-	std::string str;
+        std::string str;
+
         if (!read(file->Name(), str)) {
             return -1;
         }
-        size_t msize = std::min(size, str.size());
-        ::memcpy(data, str.data(), msize);
+        size_t offset = file->Offset();
+        if (offset >= str.size()) {
+            return 0;
+        }
+        size_t msize = std::min(size, str.size() - offset);
+        ::memcpy(data, str.data() + offset, msize);
         return msize;
     }
 
@@ -214,7 +1289,7 @@ namespace FWL {
 
     bool Db::Close(FileIntr& file)
     {
-        return 0;
+        return true;
     }
 
     bool Db::GetFileSize(FileIntr& file, size_t& size)
@@ -224,7 +1299,11 @@ namespace FWL {
 
     int Db::Unlink(const std::string& path)
     {
-        return remove(path);
+        if (!remove(path)) {
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
     }
 
     int Db::RmDir(const std::string& path)
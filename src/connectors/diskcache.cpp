@@ -0,0 +1,472 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+}
+#include <algorithm>
+#include <vector>
+#include "connectors/diskcache.h"
+#include "real.h"
+
+#define DISKCACHE_MAGIC     0x43445746
+#define DISKCACHE_FORMAT    1
+
+namespace FWL {
+    static Real real;
+
+    Diskcache::Diskcache(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Composite(name, config, fd_manager, log)
+        , path_(config.get<std::string>("path"))
+        , capacity_(config.get<uint64_t>("capacity", 1ULL << 30))
+        , validate_interval_(config.get<time_t>("validate_interval", 5))
+        , index_fd_(-1)
+        , header_(NULL)
+        , slots_(NULL)
+        , index_size_(0)
+        , hits_(0)
+        , misses_(0)
+    {
+        if (!attach(config.get<uint64_t>("index_slots", 65536))) {
+            Logger().Err("Diskcache: couldn't attach index in %s: %s", path_.c_str(), ::strerror(errno));
+        }
+    }
+
+    Diskcache::~Diskcache()
+    {
+        for (Handles::iterator it = handles_.begin(); it != handles_.end(); ++it) {
+            if (it->second >= 0) {
+                real.close(it->second);
+            }
+        }
+        if (header_) {
+            ::munmap(header_, index_size_);
+        }
+        if (index_fd_ >= 0) {
+            real.close(index_fd_);
+        }
+        FWL_INF(Logger(), "Diskcache %s: %lu hits, %lu misses", Name().c_str(), hits_, misses_);
+    }
+
+    void Diskcache::BeforeFork()
+    {
+        index_lock_.lock();
+        lock_.lock();
+    }
+
+    void Diskcache::AfterFork(bool child)
+    {
+        if (child) {
+            for (Handles::iterator it = handles_.begin(); it != handles_.end(); ++it) {
+                if (it->second >= 0) {
+                    real.close(it->second);
+                }
+            }
+            handles_.clear();
+            //! -- flock belongs to the open file, which the child shares with the parent: it needs its own to exclude it
+            if (index_fd_ >= 0) {
+                int fd = real.open((path_ + "/index").c_str(), O_RDWR | O_CLOEXEC, 0);
+                if (fd >= 0) {
+                    real.close(index_fd_);
+                    index_fd_ = fd;
+                } else {
+                    Logger().Err("Diskcache %s: couldn't reopen index: %s", Name().c_str(), ::strerror(errno));
+                }
+            }
+        }
+        lock_.unlock();
+        index_lock_.unlock();
+    }
+
+    bool Diskcache::Link(const ConnectorMap& connectors)
+    {
+        backend_ = link(connectors, Config().get<std::string>("backend"));
+        return backend_.get() != NULL;
+    }
+
+    uint64_t Diskcache::hash(const std::string& path)
+    {
+        uint64_t h = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < path.size(); ++i) {
+            h ^= (unsigned char)path[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    std::string Diskcache::object(const Slot& slot) const
+    {
+        char name[48];
+
+        ::snprintf(&name[0], sizeof(name), "/objects/%016llx-%llx", (unsigned long long)slot.hash, (unsigned long long)slot.version);
+        return path_ + name;
+    }
+
+    bool Diskcache::attach(uint64_t slots)
+    {
+        real.mkdir(path_.c_str(), 0755);
+        real.mkdir((path_ + "/objects").c_str(), 0755);
+
+        index_fd_ = real.open((path_ + "/index").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (index_fd_ < 0) {
+            return false;
+        }
+
+        ::flock(index_fd_, LOCK_EX);
+        IndexHeader header;
+        ::memset(&header, 0, sizeof(header));
+        if ((::pread(index_fd_, &header, sizeof(header), 0) == sizeof(header)) && (header.magic == DISKCACHE_MAGIC) && (header.format == DISKCACHE_FORMAT)) {
+            slots = header.slots;
+        } else {
+            //! -- new or foreign index: start over, the objects it pointed to are unreachable anyway
+            header.magic   = DISKCACHE_MAGIC;
+            header.format  = DISKCACHE_FORMAT;
+            header.slots   = slots;
+            header.used    = 0;
+            header.clock   = 0;
+            header.version = 0;
+            if ((::ftruncate(index_fd_, 0) < 0) || (::ftruncate(index_fd_, sizeof(IndexHeader) + slots * sizeof(Slot)) < 0) || (::pwrite(index_fd_, &header, sizeof(header), 0) != sizeof(header))) {
+                ::flock(index_fd_, LOCK_UN);
+                return false;
+            }
+        }
+
+        index_size_ = sizeof(IndexHeader) + slots * sizeof(Slot);
+        void *base = ::mmap(NULL, index_size_, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd_, 0);
+        ::flock(index_fd_, LOCK_UN);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        header_ = (IndexHeader *)base;
+        slots_  = (Slot *)((char *)base + sizeof(IndexHeader));
+        return true;
+    }
+
+    void Diskcache::lockIndex()
+    {
+        index_lock_.lock();
+        ::flock(index_fd_, LOCK_EX);
+    }
+
+    void Diskcache::unlockIndex()
+    {
+        ::flock(index_fd_, LOCK_UN);
+        index_lock_.unlock();
+    }
+
+    Diskcache::Slot *Diskcache::find(const std::string& path, bool insert)
+    {
+        if (!header_ || (path.size() >= sizeof(slots_->path))) {
+            return NULL;
+        }
+
+        uint64_t h    = hash(path);
+        Slot     *dead = NULL;
+        for (uint64_t i = 0; i < header_->slots; ++i) {
+            Slot& slot = slots_[(h + i) % header_->slots];
+            if (slot.state == SlotEmpty) {
+                return insert ? (dead ? dead : &slot) : NULL;
+            }
+            if (slot.state == SlotDead) {
+                dead = dead ? dead : &slot;
+            } else if ((slot.hash == h) && (slot.length == path.size()) && !::memcmp(slot.path, path.data(), path.size())) {
+                return &slot;
+            }
+        }
+        return insert ? dead : NULL;
+    }
+
+    void Diskcache::drop(Slot& slot)
+    {
+        real.unlink(object(slot).c_str());
+        header_->used -= std::min(header_->used, slot.size);
+        slot.state     = SlotDead;
+    }
+
+    void Diskcache::evict()
+    {
+        uint64_t low = capacity_ - capacity_ / 10;
+
+        if (header_->used <= capacity_) {
+            return;
+        }
+        //! -- one scan per eviction round, oldest first, down to 90% so the next fills don't scan again
+        std::vector<std::pair<uint64_t, Slot *> > used;
+        for (uint64_t i = 0; i < header_->slots; ++i) {
+            if (slots_[i].state == SlotUsed) {
+                used.push_back(std::make_pair(slots_[i].atime, &slots_[i]));
+            }
+        }
+        std::sort(used.begin(), used.end());
+        for (size_t i = 0; (i < used.size()) && (header_->used > low); ++i) {
+            drop(*used[i].second);
+        }
+    }
+
+    bool Diskcache::validate(const std::string& path)
+    {
+        uint64_t version = 0;
+        uint64_t size    = 0;
+
+        lockIndex();
+        Slot *slot  = find(path, false);
+        bool  fresh = slot && ((time(NULL) - (time_t)slot->validated) < validate_interval_);
+        if (slot) {
+            version = slot->version;
+            size    = slot->size;
+        }
+        unlockIndex();
+        if (!slot || fresh) {
+            return fresh;
+        }
+
+        //! -- connectors expose no version or mtime, so a stale object is checked against the backend's size:
+        //! -- one metadata call instead of refetching the body. The backend is asked without the index locked.
+        size_t   current = 0;
+        FileIntr probe(scratch(path, O_RDONLY));
+        bool     same    = length(*backend_, probe, current) && (current == size);
+        close(*backend_, probe);
+
+        lockIndex();
+        slot    = find(path, false);
+        bool ok = slot && (slot->version == version);
+        if (ok && same) {
+            slot->validated = time(NULL);
+        } else if (ok) {
+            drop(*slot);
+            ok = false;
+        }
+        unlockIndex();
+        return ok;
+    }
+
+    int Diskcache::fill(FileIntr& file)
+    {
+        static unsigned long counter = 0;
+        char                 name[64];
+
+        ::snprintf(&name[0], sizeof(name), "/objects/tmp.%d.%lu", (int)::getpid(), __sync_add_and_fetch(&counter, 1));
+        std::string tmp = path_ + name;
+        int         out = real.open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (out < 0) {
+            return -1;
+        }
+
+        FileIntr src  = scratch(file->Name(), O_RDONLY);
+        uint64_t size = 0;
+        bool     ok   = exists(*backend_, src);
+        char     buf[65536];
+        while (ok) {
+            int n = read(*backend_, src, &buf[0], sizeof(buf));
+            if (n <= 0) {
+                ok = !n;
+                break;
+            }
+            src->Seek(src->Offset() + n);
+            ok    = real.write(out, &buf[0], n) == n;
+            size += n;
+        }
+        close(*backend_, src);
+        real.close(out);
+        if (!ok) {
+            real.unlink(tmp.c_str());
+            return -1;
+        }
+
+        int fd = -1;
+        lockIndex();
+        Slot *slot = find(file->Name(), true);
+        if (slot) {
+            if (slot->state == SlotUsed) {
+                drop(*slot);
+            }
+            slot->hash      = hash(file->Name());
+            slot->version   = ++header_->version;
+            slot->size      = size;
+            slot->atime     = ++header_->clock;
+            slot->validated = time(NULL);
+            slot->length    = file->Name().size();
+            ::memcpy(slot->path, file->Name().data(), file->Name().size());
+            std::string target = object(*slot);
+            if (!::rename(tmp.c_str(), target.c_str())) {
+                slot->state    = SlotUsed;
+                header_->used += size;
+                fd             = real.open(target.c_str(), O_RDONLY | O_CLOEXEC);
+                evict();
+            } else {
+                slot->state = SlotDead;
+            }
+        }
+        unlockIndex();
+        if (fd < 0) {
+            real.unlink(tmp.c_str());
+        }
+        return fd;
+    }
+
+    int Diskcache::handle(FileIntr& file)
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::const_iterator   it = handles_.find(file->Fd());
+            if (it != handles_.end()) {
+                return it->second;
+            }
+        }
+
+        int fd = -1;
+        if (validate(file->Name())) {
+            lockIndex();
+            Slot *slot = find(file->Name(), false);
+            if (slot) {
+                slot->atime = ++header_->clock;
+                fd          = real.open(object(*slot).c_str(), O_RDONLY | O_CLOEXEC);
+            }
+            unlockIndex();
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        if (fd >= 0) {
+            ++hits_;
+        } else {
+            ++misses_;
+            lock.unlock();
+            fd = fill(file);
+            lock.lock();
+        }
+        if (fd >= 0) {
+            handles_[file->Fd()] = fd;
+        }
+        return fd;
+    }
+
+    void Diskcache::invalidate(const std::string& path)
+    {
+        lockIndex();
+        Slot *slot = find(path, false);
+        if (slot) {
+            drop(*slot);
+        }
+        unlockIndex();
+    }
+
+    bool Diskcache::Exists(FileIntr& file)
+    {
+        return validate(file->Name()) || exists(*backend_, file);
+    }
+
+    bool Diskcache::GetFileSize(FileIntr& file, size_t& size)
+    {
+        if (validate(file->Name())) {
+            lockIndex();
+            Slot *slot = find(file->Name(), false);
+            if (slot) {
+                size = slot->size;
+            }
+            unlockIndex();
+            if (slot) {
+                return true;
+            }
+        }
+        return length(*backend_, file, size);
+    }
+
+    int Diskcache::Read(FileIntr& file, void *data, size_t size)
+    {
+        int fd = handle(file);
+
+        if (fd < 0) {
+            return read(*backend_, file, data, size);
+        }
+        return ::pread(fd, data, size, file->Offset());
+    }
+
+    bool Diskcache::Create(FileIntr& file)
+    {
+        invalidate(file->Name());
+        return create(*backend_, file);
+    }
+
+    bool Diskcache::Truncate(FileIntr& file)
+    {
+        invalidate(file->Name());
+        return truncate(*backend_, file);
+    }
+
+    int Diskcache::Write(FileIntr& file, const void *data, size_t size)
+    {
+        bool written;
+        {
+            //! -- a descriptor that wrote keeps -1 as its handle: reads go to the backend until close
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::iterator         it = handles_.find(file->Fd());
+            written = (it != handles_.end()) && (it->second < 0);
+            if (it != handles_.end() && !written) {
+                real.close(it->second);
+            }
+            handles_[file->Fd()] = -1;
+        }
+        if (!written) {
+            invalidate(file->Name());
+        }
+        return write(*backend_, file, data, size);
+    }
+
+    bool Diskcache::Close(FileIntr& file)
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::iterator         it = handles_.find(file->Fd());
+            if (it != handles_.end()) {
+                if (it->second >= 0) {
+                    real.close(it->second);
+                }
+                handles_.erase(it);
+            }
+        }
+        return close(*backend_, file);
+    }
+
+    bool Diskcache::Open(DirectoryIntr& dir)
+    {
+        return open(*backend_, dir);
+    }
+
+    bool Diskcache::Close(DirectoryIntr& dir)
+    {
+        return close(*backend_, dir);
+    }
+
+    int Diskcache::MkDir(const std::string& path, mode_t mode)
+    {
+        return backend_->MkDir(path, mode);
+    }
+
+    int Diskcache::Unlink(const std::string& path)
+    {
+        invalidate(path);
+        return backend_->Unlink(path);
+    }
+
+    int Diskcache::RmDir(const std::string& path)
+    {
+        return backend_->RmDir(path);
+    }
+
+    int Diskcache::Rename(const std::string& name, const std::string& newname)
+    {
+        invalidate(name);
+        invalidate(newname);
+        return backend_->Rename(name, newname);
+    }
+
+    Connector *DiskcacheFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Diskcache(name, config, fd_manager, log);
+    }
+}
@@ -0,0 +1,523 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+}
+#include <algorithm>
+#include "connectors/localfs.h"
+#include "real.h"
+
+namespace FWL {
+    static Real real;
+
+    Uring::Uring(unsigned entries)
+        : fd_(-1)
+        , entries_(0)
+        , sq_ring_(MAP_FAILED)
+        , cq_ring_(MAP_FAILED)
+        , sq_ring_size_(0)
+        , cq_ring_size_(0)
+        , sqes_((struct io_uring_sqe *)MAP_FAILED)
+        , leader_(false)
+        , queued_(0)
+        , inflight_(0)
+        , ops_(0)
+        , enters_(0)
+    {
+        setup(entries);
+    }
+
+    void Uring::setup(unsigned entries)
+    {
+        struct io_uring_params params;
+
+        ::memset(&params, 0, sizeof(params));
+        fd_ = ::syscall(__NR_io_uring_setup, entries, &params);
+        if (fd_ < 0) {
+            return;
+        }
+
+        entries_      = params.sq_entries;
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = ::mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ring_ = sq_ring_;
+        } else {
+            cq_ring_ = ::mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        }
+        sqes_ = (struct io_uring_sqe *)::mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if ((sq_ring_ == MAP_FAILED) || (cq_ring_ == MAP_FAILED) || (sqes_ == MAP_FAILED)) {
+            teardown();
+            return;
+        }
+
+        char *sq = (char *)sq_ring_;
+        char *cq = (char *)cq_ring_;
+        sq_head_  = (unsigned *)(sq + params.sq_off.head);
+        sq_tail_  = (unsigned *)(sq + params.sq_off.tail);
+        sq_mask_  = (unsigned *)(sq + params.sq_off.ring_mask);
+        sq_array_ = (unsigned *)(sq + params.sq_off.array);
+        cq_head_  = (unsigned *)(cq + params.cq_off.head);
+        cq_tail_  = (unsigned *)(cq + params.cq_off.tail);
+        cq_mask_  = (unsigned *)(cq + params.cq_off.ring_mask);
+        cqes_     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    }
+
+    Uring::~Uring()
+    {
+        teardown();
+    }
+
+    void Uring::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    void Uring::AfterFork(bool child)
+    {
+        //! -- the rings are shared mappings: a child submitting into the parent's ring would corrupt it
+        if (child && (fd_ >= 0)) {
+            unsigned entries = entries_;
+
+            teardown();
+            leader_   = false;
+            queued_   = 0;
+            inflight_ = 0;
+            Renew(changed_);
+            setup(entries);
+        }
+        lock_.unlock();
+    }
+
+    void Uring::teardown()
+    {
+        if (sqes_ != MAP_FAILED) {
+            ::munmap(sqes_, entries_ * sizeof(struct io_uring_sqe));
+            sqes_ = (struct io_uring_sqe *)MAP_FAILED;
+        }
+        if ((cq_ring_ != MAP_FAILED) && (cq_ring_ != sq_ring_)) {
+            ::munmap(cq_ring_, cq_ring_size_);
+        }
+        cq_ring_ = MAP_FAILED;
+        if (sq_ring_ != MAP_FAILED) {
+            ::munmap(sq_ring_, sq_ring_size_);
+            sq_ring_ = MAP_FAILED;
+        }
+        if (fd_ >= 0) {
+            real.close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void Uring::reap()
+    {
+        unsigned head = *cq_head_;
+
+        while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe& cqe        = cqes_[head & *cq_mask_];
+            Completion                 *completion = (Completion *)(uintptr_t)cqe.user_data;
+            completion->res  = cqe.res;
+            completion->done = true;
+            --inflight_;
+            ++head;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    //! -- takes the entries the kernel hasn't consumed back out of the ring and completes them with res
+    void Uring::fail(int res)
+    {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+        for (unsigned index = head; index != *sq_tail_; ++index) {
+            Completion *completion = (Completion *)(uintptr_t)sqes_[sq_array_[index & *sq_mask_]].user_data;
+            completion->res  = res;
+            completion->done = true;
+        }
+        __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+        queued_ = 0;
+    }
+
+    int Uring::execute(const struct io_uring_sqe& sqe)
+    {
+        Completion                completion = { 0, false };
+        boost::mutex::scoped_lock lock(lock_);
+
+        //! -- completions can't outnumber the submission ring, so the CQ ring never overflows
+        while (queued_ + inflight_ >= entries_) {
+            changed_.wait(lock);
+        }
+
+        unsigned tail  = *sq_tail_;
+        unsigned index = tail & *sq_mask_;
+        sqes_[index]           = sqe;
+        sqes_[index].user_data = (uintptr_t)&completion;
+        sq_array_[index]       = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++queued_;
+        ++ops_;
+
+        while (!completion.done) {
+            if (leader_) {
+                changed_.wait(lock);
+                continue;
+            }
+
+            leader_ = true;
+            unsigned submit = queued_;
+            queued_    = 0;
+            inflight_ += submit;
+            lock.unlock();
+            int ret   = ::syscall(__NR_io_uring_enter, fd_, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            int error = errno;
+            lock.lock();
+
+            //! -- per request failures come back as completions; a failed enter submitted nothing:
+            //! -- after EINTR the entries stay queued for the next round, any other error fails them
+            ++enters_;
+            if (ret < 0) {
+                queued_   += submit;
+                inflight_ -= submit;
+                if (error != EINTR) {
+                    fail(-error);
+                }
+            } else if ((unsigned)ret < submit) {
+                queued_   += submit - ret;
+                inflight_ -= submit - ret;
+            }
+            reap();
+            leader_ = false;
+            changed_.notify_all();
+        }
+
+        if (completion.res < 0) {
+            errno = -completion.res;
+            return -1;
+        }
+        return completion.res;
+    }
+
+    int Uring::Open(const char *path, int flags, mode_t mode)
+    {
+        struct io_uring_sqe sqe;
+
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode     = IORING_OP_OPENAT;
+        sqe.fd         = AT_FDCWD;
+        sqe.addr       = (uintptr_t)path;
+        sqe.len        = mode;
+        sqe.open_flags = flags;
+        return execute(sqe);
+    }
+
+    int Uring::Close(int fd)
+    {
+        struct io_uring_sqe sqe;
+
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_CLOSE;
+        sqe.fd     = fd;
+        return execute(sqe);
+    }
+
+    int Uring::Read(int fd, void *data, size_t size, off_t offset)
+    {
+        struct io_uring_sqe sqe;
+
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd     = fd;
+        sqe.addr   = (uintptr_t)data;
+        sqe.len    = size;
+        sqe.off    = offset;
+        return execute(sqe);
+    }
+
+    int Uring::Write(int fd, const void *data, size_t size, off_t offset)
+    {
+        struct io_uring_sqe sqe;
+
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd     = fd;
+        sqe.addr   = (uintptr_t)data;
+        sqe.len    = size;
+        sqe.off    = offset;
+        return execute(sqe);
+    }
+
+    int Uring::Fsync(int fd, bool datasync)
+    {
+        struct io_uring_sqe sqe;
+
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode      = IORING_OP_FSYNC;
+        sqe.fd          = fd;
+        sqe.fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+        return execute(sqe);
+    }
+
+    int Uring::Statx(const char *path, struct statx *buf)
+    {
+        struct io_uring_sqe sqe;
+
+        ::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode      = IORING_OP_STATX;
+        sqe.fd          = AT_FDCWD;
+        sqe.addr        = (uintptr_t)path;
+        sqe.len         = STATX_TYPE | STATX_SIZE;
+        sqe.off         = (uintptr_t)buf;
+        sqe.statx_flags = AT_STATX_SYNC_AS_STAT;
+        return execute(sqe);
+    }
+
+    Localfs::Localfs(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+        , root_(config.get<std::string>("root"))
+        , strip_(config.get<std::string>("strip", ""))
+        , mode_(config.get<mode_t>("mode", 0644))
+        , sync_(SyncNone)
+        , ring_(config.get<unsigned>("queue_depth", 256))
+    {
+        std::string sync = config.get<std::string>("sync", "none");
+        if (sync == "data") {
+            sync_ = SyncData;
+        } else if (sync == "full") {
+            sync_ = SyncFull;
+        }
+        if (!ring_.Valid()) {
+            Logger().Wrn("Localfs: io_uring unavailable (%s), using plain syscalls", ::strerror(errno));
+        }
+    }
+
+    Localfs::~Localfs()
+    {
+        for (Handles::iterator it = handles_.begin(); it != handles_.end(); ++it) {
+            close(it->second);
+        }
+        if (ring_.Valid()) {
+            FWL_INF(Logger(), "Localfs: %lu operations in %lu io_uring_enter calls", ring_.Ops(), ring_.Enters());
+        }
+    }
+
+    void Localfs::BeforeFork()
+    {
+        lock_.lock();
+        ring_.BeforeFork();
+    }
+
+    void Localfs::AfterFork(bool child)
+    {
+        ring_.AfterFork(child);
+        if (child) {
+            for (Handles::iterator it = handles_.begin(); it != handles_.end(); ++it) {
+                close(it->second);
+            }
+            handles_.clear();
+        }
+        lock_.unlock();
+    }
+
+    std::string Localfs::path(const std::string& name) const
+    {
+        if (!strip_.empty() && !name.compare(0, strip_.size(), strip_)) {
+            return root_ + "/" + name.substr(strip_.size());
+        }
+        return root_ + "/" + name;
+    }
+
+    int Localfs::stat(const std::string& name, struct statx& buf)
+    {
+        std::string file = path(name);
+
+        if (ring_.Valid()) {
+            return ring_.Statx(file.c_str(), &buf);
+        }
+        return ::statx(AT_FDCWD, file.c_str(), AT_STATX_SYNC_AS_STAT, STATX_TYPE | STATX_SIZE, &buf);
+    }
+
+    int Localfs::read(int fd, void *data, size_t size, off_t offset)
+    {
+        return ring_.Valid() ? ring_.Read(fd, data, size, offset) : ::pread(fd, data, size, offset);
+    }
+
+    int Localfs::write(int fd, const void *data, size_t size, off_t offset)
+    {
+        return ring_.Valid() ? ring_.Write(fd, data, size, offset) : ::pwrite(fd, data, size, offset);
+    }
+
+    int Localfs::sync(int fd)
+    {
+        if (sync_ == SyncNone) {
+            return 0;
+        }
+        if (ring_.Valid()) {
+            return ring_.Fsync(fd, sync_ == SyncData);
+        }
+        return (sync_ == SyncData) ? ::fdatasync(fd) : ::fsync(fd);
+    }
+
+    int Localfs::close(int fd)
+    {
+        return ring_.Valid() ? ring_.Close(fd) : real.close(fd);
+    }
+
+    int Localfs::open(FileIntr& file, int flags)
+    {
+        std::string name = path(file->Name());
+        int         fd   = ring_.Valid() ? ring_.Open(name.c_str(), flags | O_CLOEXEC, mode_) : ::openat(AT_FDCWD, name.c_str(), flags | O_CLOEXEC, mode_);
+
+        if (fd < 0) {
+            return -1;
+        }
+        //! -- probes on throwaway nodes (fd -1) don't keep a descriptor around
+        if (file->Fd() == -1) {
+            close(fd);
+            return 0;
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        std::pair<Handles::iterator, bool> it = handles_.insert(std::make_pair(file->Fd(), fd));
+        if (!it.second) {
+            close(it.first->second);
+            it.first->second = fd;
+        }
+        return fd;
+    }
+
+    int Localfs::handle(FileIntr& file)
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::const_iterator   it = handles_.find(file->Fd());
+            if (it != handles_.end()) {
+                return it->second;
+            }
+        }
+        return open(file, file->Flags() & ~(O_CREAT | O_TRUNC | O_EXCL));
+    }
+
+    bool Localfs::Exists(FileIntr& file)
+    {
+        struct statx buf;
+
+        return !stat(file->Name(), buf) && S_ISREG(buf.stx_mode);
+    }
+
+    bool Localfs::Create(FileIntr& file)
+    {
+        int access = file->Flags() & O_ACCMODE;
+
+        return open(file, (access == O_RDONLY ? O_RDWR : access) | O_CREAT | O_TRUNC) >= 0;
+    }
+
+    bool Localfs::Truncate(FileIntr& file)
+    {
+        int access = file->Flags() & O_ACCMODE;
+
+        return open(file, (access == O_RDONLY ? O_RDWR : access) | O_TRUNC) >= 0;
+    }
+
+    int Localfs::Write(FileIntr& file, const void *data, size_t size)
+    {
+        int fd = handle(file);
+
+        if (fd < 0) {
+            return -1;
+        }
+        return write(fd, data, size, file->Offset());
+    }
+
+    int Localfs::Read(FileIntr& file, void *data, size_t size)
+    {
+        int fd = handle(file);
+
+        if (fd < 0) {
+            return -1;
+        }
+        return read(fd, data, size, file->Offset());
+    }
+
+    bool Localfs::Close(FileIntr& file)
+    {
+        int fd;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::iterator         it = handles_.find(file->Fd());
+            if (it == handles_.end()) {
+                return true;
+            }
+            fd = it->second;
+            handles_.erase(it);
+        }
+        bool ok = !sync(fd);
+        return !close(fd) && ok;
+    }
+
+    bool Localfs::GetFileSize(FileIntr& file, size_t& size)
+    {
+        struct statx buf;
+
+        if (stat(file->Name(), buf)) {
+            return false;
+        }
+        size = buf.stx_size;
+        return true;
+    }
+
+    bool Localfs::Open(DirectoryIntr& dir)
+    {
+        DIR *dd = real.opendir(path(dir->Name()).c_str());
+
+        if (!dd) {
+            return false;
+        }
+        struct dirent *entry;
+        while ((entry = real.readdir(dd))) {
+            if (::strcmp(entry->d_name, ".") && ::strcmp(entry->d_name, "..")) {
+                dir->AddFile(entry->d_name);
+            }
+        }
+        real.closedir(dd);
+        return true;
+    }
+
+    bool Localfs::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    int Localfs::MkDir(const std::string& name, mode_t mode)
+    {
+        return real.mkdir(path(name).c_str(), mode);
+    }
+
+    int Localfs::Unlink(const std::string& name)
+    {
+        return real.unlink(path(name).c_str());
+    }
+
+    int Localfs::RmDir(const std::string& name)
+    {
+        return real.rmdir(path(name).c_str());
+    }
+
+    int Localfs::Rename(const std::string& name, const std::string& newname)
+    {
+        return ::rename(path(name).c_str(), path(newname).c_str());
+    }
+
+    Connector *LocalfsFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Localfs(name, config, fd_manager, log);
+    }
+}
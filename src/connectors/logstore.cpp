@@ -0,0 +1,556 @@
+extern "C" {
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+}
+#include <boost/crc.hpp>
+#include <boost/bind.hpp>
+#include "connectors/logstore.h"
+#include "real.h"
+#include "path.h"
+
+#define LOGSTORE_MAGIC    0x52574c46
+
+namespace FWL {
+    static Real real;
+
+    size_t Logstore::recordSize(size_t key_size, size_t value_size)
+    {
+        return (sizeof(Header) + key_size + value_size + 7) & ~(size_t)7;
+    }
+
+    std::string Logstore::segmentName(uint32_t id) const
+    {
+        char buf[32];
+
+        ::snprintf(&buf[0], sizeof(buf), "/%08x.seg", id);
+        return path_ + &buf[0];
+    }
+
+    Logstore::Segment *Logstore::openSegment(uint32_t id, size_t size, bool create)
+    {
+        std::string name = segmentName(id);
+        Segment     segment;
+
+        segment.id   = id;
+        segment.tail = 0;
+        segment.dead = 0;
+        segment.fd   = real.open(name.c_str(), O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644);
+        if (segment.fd < 0) {
+            Logger().Err("Logstore: couldn't open %s: %s", name.c_str(), ::strerror(errno));
+            return NULL;
+        }
+        if (create) {
+            if (::ftruncate(segment.fd, size) < 0) {
+                Logger().Err("Logstore: couldn't allocate %s: %s", name.c_str(), ::strerror(errno));
+                real.close(segment.fd);
+                return NULL;
+            }
+        } else {
+            struct stat st;
+            real.fstat(segment.fd, &st);
+            size = st.st_size;
+        }
+        segment.size = size;
+        segment.base = (char *)::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd, 0);
+        if (segment.base == MAP_FAILED) {
+            Logger().Err("Logstore: couldn't map %s: %s", name.c_str(), ::strerror(errno));
+            real.close(segment.fd);
+            return NULL;
+        }
+        return &(segments_[id] = segment);
+    }
+
+    void Logstore::closeSegment(Segment& segment, bool unlink)
+    {
+        ::munmap(segment.base, segment.size);
+        real.close(segment.fd);
+        if (unlink) {
+            real.unlink(segmentName(segment.id).c_str());
+        }
+    }
+
+    bool Logstore::recover()
+    {
+        real.mkdir(path_.c_str(), 0755);
+        DIR *dir = real.opendir(path_.c_str());
+        if (!dir) {
+            Logger().Err("Logstore: couldn't open %s: %s", path_.c_str(), ::strerror(errno));
+            return false;
+        }
+
+        std::set<uint32_t> ids;
+        struct dirent      *de;
+        while ((de = real.readdir(dir))) {
+            unsigned id = 0;
+            char     ext[8];
+            if ((::sscanf(de->d_name, "%8x.%3s", &id, &ext[0]) == 2) && !::strcmp(&ext[0], "seg")) {
+                ids.insert(id);
+            }
+        }
+        real.closedir(dir);
+
+        for (std::set<uint32_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+            Segment *segment = openSegment(*it, 0, false);
+            if (!segment) {
+                return false;
+            }
+            replay(*segment);
+            active_ = segment;
+        }
+        FWL_INF(Logger(), "Logstore: recovered %lu keys from %lu segments", (unsigned long)index_.size(), (unsigned long)segments_.size());
+        return true;
+    }
+
+    void Logstore::replay(Segment& segment)
+    {
+        size_t pos = 0;
+
+        while (pos + sizeof(Header) <= segment.size) {
+            const Header *header = (const Header *)(segment.base + pos);
+            if (header->magic != LOGSTORE_MAGIC) {
+                break;
+            }
+            size_t size = recordSize(header->key_size, header->value_size);
+            if (pos + size > segment.size) {
+                break;
+            }
+
+            const char       *key = (const char *)(header + 1);
+            boost::crc_32_type crc;
+            crc.process_bytes(&header->type, sizeof(Header) - offsetof(Header, type));
+            crc.process_bytes(key, header->key_size + header->value_size);
+            if (crc.checksum() != header->crc) {
+                Logger().Wrn("Logstore: broken record in segment %u at %lu", segment.id, (unsigned long)pos);
+                break;
+            }
+
+            Location loc;
+            loc.segment = segment.id;
+            loc.offset  = pos + sizeof(Header) + header->key_size;
+            loc.length  = header->value_size;
+            loc.record  = size;
+            loc.dir     = header->type == Dir;
+            apply(header->type, std::string(key, header->key_size), loc, segment.base + loc.offset);
+            pos += size;
+        }
+        segment.tail = pos;
+    }
+
+    void Logstore::attach(const std::string& key)
+    {
+        children_[Path::Directory(key)].insert(Path::File(key));
+    }
+
+    void Logstore::detach(const std::string& key)
+    {
+        Children::iterator it = children_.find(Path::Directory(key));
+
+        if (it != children_.end()) {
+            it->second.erase(Path::File(key));
+            if (it->second.empty()) {
+                children_.erase(it);
+            }
+        }
+    }
+
+    void Logstore::forget(const std::string& key)
+    {
+        Index::iterator it = index_.find(key);
+
+        if (it == index_.end()) {
+            return;
+        }
+        segments_[it->second.segment].dead += it->second.record;
+        index_.erase(it);
+        detach(key);
+    }
+
+    void Logstore::apply(uint32_t type, const std::string& key, const Location& loc, const char *value)
+    {
+        switch (type) {
+            case Put:
+            case Dir:
+                forget(key);
+                index_[key] = loc;
+                attach(key);
+                return;
+            case Delete:
+                forget(key);
+                break;
+            case Move: {
+                std::string     target(value, loc.length);
+                Index::iterator it = index_.find(key);
+                if (it != index_.end()) {
+                    Location moved = it->second;
+                    index_.erase(it);
+                    detach(key);
+                    forget(target);
+                    index_[target] = moved;
+                    attach(target);
+                }
+                break;
+            }
+        }
+        segments_[loc.segment].dead += loc.record;
+    }
+
+    bool Logstore::append(uint32_t type, const std::string& key, const char *value, size_t size)
+    {
+        size_t record = recordSize(key.size(), size);
+
+        if (readonly_) {
+            errno = EROFS;
+            return false;
+        }
+        if (!active_ || (active_->tail + record > active_->size)) {
+            uint32_t id = segments_.empty() ? 1 : segments_.rbegin()->first + 1;
+            Segment  *segment = openSegment(id, std::max(segment_size_, record), true);
+            if (!segment) {
+                return false;
+            }
+            active_ = segment;
+            wakeup_.notify_one();
+        }
+
+        char   *dst    = active_->base + active_->tail;
+        Header *header = (Header *)dst;
+        header->type       = type;
+        header->key_size   = key.size();
+        header->value_size = size;
+        ::memcpy(dst + sizeof(Header), key.data(), key.size());
+        ::memcpy(dst + sizeof(Header) + key.size(), value, size);
+
+        boost::crc_32_type crc;
+        crc.process_bytes(&header->type, sizeof(Header) - offsetof(Header, type));
+        crc.process_bytes(dst + sizeof(Header), key.size() + size);
+        header->crc   = crc.checksum();
+        header->magic = LOGSTORE_MAGIC;
+
+        Location loc;
+        loc.segment = active_->id;
+        loc.offset  = active_->tail + sizeof(Header) + key.size();
+        loc.length  = size;
+        loc.record  = record;
+        loc.dir     = type == Dir;
+        active_->tail += record;
+        apply(type, key, loc, dst + sizeof(Header) + key.size());
+        return true;
+    }
+
+    bool Logstore::lookup(const std::string& key, Location& loc)
+    {
+        Index::const_iterator it = index_.find(key);
+
+        if (it == index_.end()) {
+            return false;
+        }
+        loc = it->second;
+        return true;
+    }
+
+    Logstore::Pending& Logstore::pending(FileIntr& file)
+    {
+        Pendings::iterator it = pendings_.find(file->Fd());
+
+        if (it != pendings_.end()) {
+            return it->second;
+        }
+        Pending& pending = pendings_[file->Fd()];
+        Location loc;
+        pending.dirty = false;
+        if (lookup(file->Name(), loc)) {
+            pending.data.assign(segments_[loc.segment].base + loc.offset, loc.length);
+        }
+        return pending;
+    }
+
+    bool Logstore::compact()
+    {
+        if (segments_.size() < 2) {
+            return false;
+        }
+        Segment& oldest = segments_.begin()->second;
+        if ((&oldest == active_) || !oldest.tail || ((double)oldest.dead / oldest.tail < compaction_ratio_)) {
+            return false;
+        }
+
+        std::vector<std::string> live;
+        for (Index::const_iterator it = index_.begin(); it != index_.end(); ++it) {
+            if (it->second.segment == oldest.id) {
+                live.push_back(it->first);
+            }
+        }
+        for (std::vector<std::string>::const_iterator it = live.begin(); it != live.end(); ++it) {
+            const Location& loc = index_[*it];
+            if (!append(loc.dir ? Dir : Put, *it, oldest.base + loc.offset, loc.length)) {
+                return false;
+            }
+        }
+        FWL_DBG(Logger(), "Logstore: compacted segment %u, %lu live keys", oldest.id, (unsigned long)live.size());
+        closeSegment(oldest, true);
+        segments_.erase(segments_.begin());
+        return true;
+    }
+
+    void Logstore::compactor()
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        while (!stop_) {
+            wakeup_.timed_wait(lock, boost::posix_time::seconds(compaction_interval_));
+            while (!stop_ && compact()) {}
+        }
+    }
+
+    Logstore::Logstore(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+        , path_(config.get<std::string>("path"))
+        , segment_size_(config.get<size_t>("segment_size", 64 << 20))
+        , compaction_ratio_(config.get<double>("compaction_ratio", 0.5))
+        , compaction_interval_(config.get<int>("compaction_interval", 10))
+        , sync_(config.get<bool>("sync", false))
+        , readonly_(false)
+        , stop_(false)
+        , active_(NULL)
+    {
+        recover();
+        compactor_ = boost::thread(boost::bind(&Logstore::compactor, this));
+    }
+
+    Logstore::~Logstore()
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            stop_ = true;
+            wakeup_.notify_one();
+        }
+        if (compactor_.joinable()) {
+            compactor_.join();
+        }
+        for (Segments::iterator it = segments_.begin(); it != segments_.end(); ++it) {
+            closeSegment(it->second, false);
+        }
+    }
+
+    void Logstore::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    void Logstore::AfterFork(bool child)
+    {
+        if (child) {
+            //! -- the index is a private copy from here on; appends from both sides would land at the
+            //! -- same offsets, so the parent stays the only writer and the child doesn't compact either
+            FWL_INF(Logger(), "Logstore %s: read-only in forked child %d", Name().c_str(), (int)::getpid());
+            readonly_ = true;
+            pendings_.clear();
+            Renew(wakeup_);
+            Renew(compactor_);
+        }
+        lock_.unlock();
+    }
+
+    bool Logstore::Exists(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Index::const_iterator     it = index_.find(file->Name());
+
+        return (it != index_.end()) && !it->second.dir;
+    }
+
+    bool Logstore::Create(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return append(Put, file->Name(), "", 0);
+    }
+
+    bool Logstore::Truncate(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Pendings::iterator        it = pendings_.find(file->Fd());
+
+        if (it != pendings_.end()) {
+            it->second.data.clear();
+            it->second.dirty = false;
+        }
+        return append(Put, file->Name(), "", 0);
+    }
+
+    int Logstore::Write(FileIntr& file, const void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (readonly_) {
+            errno = EROFS;
+            return -1;
+        }
+        Pending&                  p      = pending(file);
+        size_t                    offset = (file->Flags() & O_APPEND) ? p.data.size() : file->Offset();
+
+        if (p.data.size() < offset + size) {
+            p.data.resize(offset + size);
+        }
+        p.data.replace(offset, size, (const char *)data, size);
+        p.dirty = true;
+        return size;
+    }
+
+    int Logstore::Read(FileIntr& file, void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        size_t                    offset = file->Offset();
+        const char                *src;
+        size_t                    length;
+
+        Pendings::const_iterator it = pendings_.find(file->Fd());
+        if (it != pendings_.end()) {
+            src    = it->second.data.data();
+            length = it->second.data.size();
+        } else {
+            Location loc;
+            if (!lookup(file->Name(), loc)) {
+                errno = ENOENT;
+                return -1;
+            }
+            src    = segments_[loc.segment].base + loc.offset;
+            length = loc.length;
+        }
+        if (offset >= length) {
+            return 0;
+        }
+        size_t msize = std::min(size, length - offset);
+        ::memcpy(data, src + offset, msize);
+        return msize;
+    }
+
+    bool Logstore::Open(DirectoryIntr& dir)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Children::const_iterator  it = children_.find(dir->Name());
+
+        if (it == children_.end()) {
+            return index_.count(dir->Name()) > 0;
+        }
+        dir->Files().assign(it->second.begin(), it->second.end());
+        return true;
+    }
+
+    bool Logstore::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    bool Logstore::Close(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Pendings::iterator        it = pendings_.find(file->Fd());
+
+        if (it == pendings_.end()) {
+            return true;
+        }
+        bool ok = true;
+        if (it->second.dirty) {
+            ok = append(Put, file->Name(), it->second.data.data(), it->second.data.size());
+            if (ok && sync_ && ::msync(active_->base, active_->tail, MS_SYNC)) {
+                Logger().Err("Logstore: couldn't sync segment %u: %s", active_->id, ::strerror(errno));
+                ok = false;
+            }
+        }
+        pendings_.erase(it);
+        return ok;
+    }
+
+    bool Logstore::GetFileSize(FileIntr& file, size_t& size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Pendings::const_iterator  it = pendings_.find(file->Fd());
+
+        if (it != pendings_.end()) {
+            size = it->second.data.size();
+            return true;
+        }
+        Location loc;
+        if (!lookup(file->Name(), loc)) {
+            return false;
+        }
+        size = loc.length;
+        return true;
+    }
+
+    int Logstore::MkDir(const std::string& path, mode_t mode)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (index_.count(path)) {
+            errno = EEXIST;
+            return -1;
+        }
+        return append(Dir, path, "", 0) ? 0 : -1;
+    }
+
+    int Logstore::Unlink(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!index_.count(path)) {
+            errno = ENOENT;
+            return -1;
+        }
+        return append(Delete, path, "", 0) ? 0 : -1;
+    }
+
+    int Logstore::RmDir(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (children_.count(path)) {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+        if (!index_.count(path)) {
+            errno = ENOENT;
+            return -1;
+        }
+        return append(Delete, path, "", 0) ? 0 : -1;
+    }
+
+    int Logstore::Rename(const std::string& name, const std::string& newname)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!index_.count(name) && !children_.count(name)) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        std::vector<std::string> keys(1, name);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            Children::const_iterator it = children_.find(keys[i]);
+            if (it != children_.end()) {
+                for (std::set<std::string>::const_iterator cit = it->second.begin(); cit != it->second.end(); ++cit) {
+                    keys.push_back(keys[i] + "/" + *cit);
+                }
+            }
+        }
+        for (std::vector<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+            std::string target = newname + it->substr(name.size());
+            if (index_.count(*it) && !append(Move, *it, target.data(), target.size())) {
+                errno = EIO;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    Connector *LogstoreFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Logstore(name, config, fd_manager, log);
+    }
+}
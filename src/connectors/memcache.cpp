@@ -1,80 +1,526 @@
-#include <libmemcached/memcached.hpp>
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+}
+#include <libmemcached/memcached.h>
 #include <boost/foreach.hpp>
-#include "connectors/dummy.h"
-
+#include <boost/unordered_set.hpp>
+#include "connectors/memcache.h"
+#include "path.h"
 
 namespace FWL {
     Memcache::Memcache(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
         : Connector(name, config, fd_manager, log)
-        , client_(new memcache::Memcache)
+        , client_(::memcached_create(NULL))
+        , key_prefix_(config.get<std::string>("key_prefix", ""))
+        , prefetch_limit_(config.get<size_t>("prefetch", 256))
+        , prefetch_ttl_(config.get<time_t>("prefetch_ttl", 1))
+        , cas_retries_(config.get<int>("cas_retries", 16))
     {
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, config.get<bool>("binary", true));
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_NO_BLOCK, 1);
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_TCP_NODELAY, 1);
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_SUPPORT_CAS, 1);
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_DISTRIBUTION, MEMCACHED_DISTRIBUTION_CONSISTENT_KETAMA);
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_KETAMA_WEIGHTED, 1);
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_CONNECT_TIMEOUT, config.get<uint64_t>("timeout_ms", 1000));
+        ::memcached_behavior_set(client_, MEMCACHED_BEHAVIOR_POLL_TIMEOUT, config.get<uint64_t>("timeout_ms", 1000));
+
         BOOST_FOREACH(const JsonNode::value_type & server, config.get_child("servers"))
         {
-            client_->addServer(server.second.get<std::string>("host"), server.second.get<in_port_t>("port"));
+            std::string host   = server.second.get<std::string>("host");
+            in_port_t   port   = server.second.get<in_port_t>("port", 11211);
+            uint32_t    weight = server.second.get<uint32_t>("weight", 1);
+            memcached_return_t rc = ::memcached_server_add_with_weight(client_, host.c_str(), port, weight);
+            if (rc != MEMCACHED_SUCCESS) {
+                Logger().Err("Memcache: server %s:%d - %s", host.c_str(), port, ::memcached_strerror(client_, rc));
+            }
         }
     }
 
-    int Memcache::Write(int fd, const void *data, size_t size)
+    Memcache::~Memcache()
     {
-    /*    MemCacheClient::MemRequest request;
-        request.mKey = GetKey(fd);
-        request.mData.WriteBytes(data, size);
-        return client_->Append(request) && request.mResult == MCERR_OK;*/
-        return 0;
+        ::memcached_free(client_);
     }
 
-    int Memcache::Read(int fd, void *data, size_t size)
+    void Memcache::BeforeFork()
     {
-        /*MemCacheClient::MemRequest request;
-        request.mKey = GetKey(fd);
-        if (client_->Get(request)) {
-    	    request.mData.ReadBytes(data, size);
-    	    return request.mData.GetReadSize();
+        lock_.lock();
+    }
+
+    void Memcache::AfterFork(bool child)
+    {
+        if (child) {
+            //! -- memcached_free would send quit on the parent's connections; the clone keeps servers and behaviors but connects anew
+            memcached_st *client = ::memcached_clone(NULL, client_);
+            if (client) {
+                client_ = client;
+            }
+            contents_.clear();
+            lengths_.clear();
         }
-        return -1;*/
-        
-        return 0;
+        lock_.unlock();
     }
 
-    int Memcache::Rename(const std::string& name, const std::string& newname)
+    bool Memcache::get(const std::string& key, std::string& value)
     {
-        
-        return 0;
+        size_t             length = 0;
+        uint32_t           flags  = 0;
+        memcached_return_t rc;
+        QueryProbe         probe(Name(), "get", key.c_str());
+        char               *data = ::memcached_get(client_, key.data(), key.size(), &length, &flags, &rc);
+
+        if (rc != MEMCACHED_SUCCESS) {
+            if (rc != MEMCACHED_NOTFOUND) {
+                Logger().Err("Memcache get %s: %s", key.c_str(), ::memcached_strerror(client_, rc));
+                return false;
+            }
+            probe.Ok();
+            return false;
+        }
+        probe.Ok();
+        value.assign(data ? data : "", length);
+        ::free(data);
+        return true;
     }
 
-    int Memcache::MkDir(const std::string& name, mode_t mode)
+    bool Memcache::gets(const std::string& key, std::string& value, uint64_t& cas)
     {
-        return 0;
+        const char *keys[]    = { key.data() };
+        size_t     lengths[]  = { key.size() };
+        QueryProbe probe(Name(), "gets", key.c_str());
+        memcached_return_t rc = ::memcached_mget(client_, keys, lengths, 1);
+
+        if (rc != MEMCACHED_SUCCESS) {
+            Logger().Err("Memcache gets %s: %s", key.c_str(), ::memcached_strerror(client_, rc));
+            return false;
+        }
+        bool                found   = false;
+        memcached_result_st *result = ::memcached_result_create(client_, NULL);
+        while (::memcached_fetch_result(client_, result, &rc)) {
+            value.assign(::memcached_result_value(result), ::memcached_result_length(result));
+            cas   = ::memcached_result_cas(result);
+            found = true;
+        }
+        ::memcached_result_free(result);
+        probe.Ok();
+        return found;
     }
 
-    int Memcache::RmDir(const std::string& name)
+    bool Memcache::set(const std::string& key, const std::string& value)
     {
-        return 0;
+        QueryProbe         probe(Name(), "set", key.c_str());
+        memcached_return_t rc = ::memcached_set(client_, key.data(), key.size(), value.data(), value.size(), 0, 0);
+
+        if (rc != MEMCACHED_SUCCESS) {
+            Logger().Err("Memcache set %s: %s", key.c_str(), ::memcached_strerror(client_, rc));
+            return false;
+        }
+        probe.Ok();
+        return true;
     }
 
-    bool Memcache::GetFileSize(const std::string& name, size_t& size)
+    bool Memcache::cas(const std::string& key, const std::string& value, uint64_t cas)
     {
-        size = 0;
+        QueryProbe probe(Name(), "cas", key.c_str());
+
+        if (::memcached_cas(client_, key.data(), key.size(), value.data(), value.size(), 0, 0, cas) != MEMCACHED_SUCCESS) {
+            return false;
+        }
+        probe.Ok();
         return true;
     }
 
-    bool Memcache::OpenDir(Directory& dir)
+    bool Memcache::append(const std::string& key, const std::string& value)
     {
+        QueryProbe probe(Name(), "append", key.c_str());
+
+        if (::memcached_append(client_, key.data(), key.size(), value.data(), value.size(), 0, 0) != MEMCACHED_SUCCESS) {
+            return false;
+        }
+        probe.Ok();
         return true;
     }
 
-    bool Memcache::CloseDir(Directory& dir)
+    bool Memcache::remove(const std::string& key)
     {
+        QueryProbe probe(Name(), "delete", key.c_str());
+
+        if (::memcached_delete(client_, key.data(), key.size(), 0) != MEMCACHED_SUCCESS) {
+            return false;
+        }
+        probe.Ok();
         return true;
     }
 
-    int Memcache::CloseFd(int fd)
+    bool Memcache::addEntry(const std::string& path)
     {
+        std::string key   = dirKey(Path::Directory(path));
+        std::string entry = Path::File(path) + "\n";
+
+        for (int i = 0; i < cas_retries_; ++i) {
+            if (append(key, entry)) {
+                return true;
+            }
+            if (::memcached_add(client_, key.data(), key.size(), entry.data(), entry.size(), 0, 0) == MEMCACHED_SUCCESS) {
+                return true;
+            }
+        }
+        Logger().Err("Memcache: couldn't add %s to directory", path.c_str());
+        return false;
+    }
+
+    bool Memcache::removeEntry(const std::string& path)
+    {
+        std::string key  = dirKey(Path::Directory(path));
+        std::string name = Path::File(path);
+
+        for (int i = 0; i < cas_retries_; ++i) {
+            std::string list;
+            uint64_t    version = 0;
+            if (!gets(key, list, version)) {
+                return true;
+            }
+            std::string rest;
+            size_t      pos = 0;
+            while (pos < list.size()) {
+                size_t end = list.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = list.size();
+                }
+                if (list.compare(pos, end - pos, name)) {
+                    rest.append(list, pos, end - pos).append("\n");
+                }
+                pos = end + 1;
+            }
+            if (cas(key, rest, version)) {
+                return true;
+            }
+        }
+        Logger().Err("Memcache: couldn't remove %s from directory", path.c_str());
+        return false;
+    }
+
+    void Memcache::prefetch(const std::string& dir, const std::vector<std::string>& files)
+    {
+        std::vector<std::string> keys;
+        std::vector<const char *> key_ptrs;
+        std::vector<size_t>       key_lengths;
+        size_t                    count = std::min(files.size(), prefetch_limit_);
+
+        if (!count) {
+            return;
+        }
+        keys.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            keys.push_back(fileKey(dir + "/" + files[i]));
+            key_ptrs.push_back(keys.back().data());
+            key_lengths.push_back(keys.back().size());
+        }
+
+        memcached_return_t rc = ::memcached_mget(client_, &key_ptrs[0], &key_lengths[0], count);
+        if (rc != MEMCACHED_SUCCESS) {
+            Logger().Err("Memcache mget %s: %s", dir.c_str(), ::memcached_strerror(client_, rc));
+            return;
+        }
+
+        if (prefetch_.size() > prefetch_limit_) {
+            prefetch_.clear();
+        }
+        size_t              skip    = key_prefix_.size() + 2;
+        time_t              now     = ::time(NULL);
+        memcached_result_st *result = ::memcached_result_create(client_, NULL);
+        while (::memcached_fetch_result(client_, result, &rc)) {
+            std::string key(::memcached_result_key_value(result), ::memcached_result_key_length(result));
+            Prefetched& entry = prefetch_[key.substr(skip)];
+            entry.value.assign(::memcached_result_value(result), ::memcached_result_length(result));
+            entry.time = now;
+        }
+        ::memcached_result_free(result);
+    }
+
+    bool Memcache::prefetched(const std::string& path, std::string& value)
+    {
+        PrefetchCache::iterator it = prefetch_.find(path);
+
+        if (it == prefetch_.end()) {
+            return false;
+        }
+        if (::time(NULL) - it->second.time > prefetch_ttl_) {
+            prefetch_.erase(it);
+            return false;
+        }
+        value = it->second.value;
+        return true;
+    }
+
+    void Memcache::invalidate(const std::string& path)
+    {
+        prefetch_.erase(path);
+        for (Contents::iterator it = contents_.begin(); it != contents_.end(); ) {
+            if (it->second.path == path) {
+                it = contents_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool Memcache::content(FileIntr& file, std::string& value)
+    {
+        Contents::iterator it = contents_.find(file->Fd());
+
+        if (it != contents_.end()) {
+            value = it->second.value;
+            return true;
+        }
+        if (!prefetched(file->Name(), value) && !get(fileKey(file->Name()), value)) {
+            return false;
+        }
+        if (file->Fd() >= 0) {
+            Content& cached = contents_[file->Fd()];
+            cached.path  = file->Name();
+            cached.value = value;
+        }
+        return true;
+    }
+
+    bool Memcache::Exists(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               value;
+
+        if (prefetched(file->Name(), value)) {
+            return true;
+        }
+        std::string key = fileKey(file->Name());
+        return ::memcached_exist(client_, key.data(), key.size()) == MEMCACHED_SUCCESS;
+    }
+
+    bool Memcache::Create(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               key = fileKey(file->Name());
+        memcached_return_t        rc  = ::memcached_add(client_, key.data(), key.size(), "", 0, 0, 0);
+
+        if (rc != MEMCACHED_SUCCESS && rc != MEMCACHED_NOTSTORED && rc != MEMCACHED_DATA_EXISTS) {
+            Logger().Err("Memcache create %s: %s", key.c_str(), ::memcached_strerror(client_, rc));
+            return false;
+        }
+        invalidate(file->Name());
+        lengths_[file->Fd()] = 0;
+        return addEntry(file->Name());
+    }
+
+    bool Memcache::Truncate(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        invalidate(file->Name());
+        if (!set(fileKey(file->Name()), std::string())) {
+            return false;
+        }
+        lengths_[file->Fd()] = 0;
+        return true;
+    }
+
+    int Memcache::Write(FileIntr& file, const void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               key    = fileKey(file->Name());
+        size_t                    offset = file->Offset();
+        Lengths::iterator         it     = lengths_.find(file->Fd());
+
+        invalidate(file->Name());
+        if ((file->Flags() & O_APPEND) || ((it != lengths_.end()) && (it->second == offset))) {
+            if (!append(key, std::string((const char *)data, size))) {
+                errno = EIO;
+                return -1;
+            }
+            if (it != lengths_.end()) {
+                it->second += size;
+            }
+            return size;
+        }
+
+        for (int i = 0; i < cas_retries_; ++i) {
+            std::string value;
+            uint64_t    version = 0;
+            if (!gets(key, value, version)) {
+                errno = ENOENT;
+                return -1;
+            }
+            if (value.size() < offset + size) {
+                value.resize(offset + size);
+            }
+            value.replace(offset, size, (const char *)data, size);
+            if (cas(key, value, version)) {
+                lengths_[file->Fd()] = value.size();
+                return size;
+            }
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+
+    int Memcache::Read(FileIntr& file, void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               value;
+
+        if (!content(file, value)) {
+            errno = ENOENT;
+            return -1;
+        }
+        size_t offset = file->Offset();
+        if (offset >= value.size()) {
+            return 0;
+        }
+        size_t msize = std::min(size, value.size() - offset);
+        ::memcpy(data, value.data() + offset, msize);
+        return msize;
+    }
+
+    bool Memcache::Open(DirectoryIntr& dir)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               list;
+
+        if (!get(dirKey(dir->Name()), list)) {
+            std::string marker;
+            return get(fileKey(dir->Name()), marker);
+        }
+
+        boost::unordered_set<std::string> seen;
+        size_t                            pos = 0;
+        while (pos < list.size()) {
+            size_t end = list.find('\n', pos);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+            std::string name(list, pos, end - pos);
+            if (!name.empty() && seen.insert(name).second) {
+                dir->AddFile(name);
+            }
+            pos = end + 1;
+        }
+        prefetch(dir->Name(), dir->Files());
+        return true;
+    }
+
+    bool Memcache::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    bool Memcache::Close(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        contents_.erase(file->Fd());
+        lengths_.erase(file->Fd());
+        return true;
+    }
+
+    bool Memcache::GetFileSize(FileIntr& file, size_t& size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               value;
+
+        if (!content(file, value)) {
+            return false;
+        }
+        size = value.size();
+        return true;
+    }
+
+    int Memcache::MkDir(const std::string& path, mode_t mode)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               key = fileKey(path);
+
+        if (::memcached_add(client_, key.data(), key.size(), "", 0, 0, 0) != MEMCACHED_SUCCESS) {
+            errno = EEXIST;
+            return -1;
+        }
+        return addEntry(path) ? 0 : -1;
+    }
+
+    int Memcache::unlink(const std::string& path)
+    {
+        invalidate(path);
+        if (!remove(fileKey(path))) {
+            errno = ENOENT;
+            return -1;
+        }
+        removeEntry(path);
         return 0;
     }
 
     int Memcache::Unlink(const std::string& path)
     {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return unlink(path);
+    }
+
+    int Memcache::RmDir(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               list;
+
+        if (get(dirKey(path), list) && (list.find_first_not_of('\n') != std::string::npos)) {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+        remove(dirKey(path));
+        return unlink(path);
+    }
+
+    int Memcache::Rename(const std::string& name, const std::string& newname)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               value;
+
+        if (!get(fileKey(name), value)) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (!set(fileKey(newname), value)) {
+            errno = EIO;
+            return -1;
+        }
+
+        std::string list;
+        if (get(dirKey(name), list)) {
+            set(dirKey(newname), list);
+            size_t pos = 0;
+            while (pos < list.size()) {
+                size_t end = list.find('\n', pos);
+                if (end == std::string::npos) {
+                    end = list.size();
+                }
+                std::string child(list, pos, end - pos);
+                if (!child.empty()) {
+                    std::string data;
+                    if (get(fileKey(name + "/" + child), data)) {
+                        set(fileKey(newname + "/" + child), data);
+                        remove(fileKey(name + "/" + child));
+                    }
+                }
+                pos = end + 1;
+            }
+            remove(dirKey(name));
+        }
+
+        remove(fileKey(name));
+        invalidate(name);
+        invalidate(newname);
+        removeEntry(name);
+        addEntry(newname);
         return 0;
     }
 
@@ -0,0 +1,504 @@
+extern "C" {
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+}
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include "connectors/mirror.h"
+
+namespace FWL {
+    namespace {
+        struct ByLatency
+        {
+            const std::vector<double>& ewma;
+            ByLatency(const std::vector<double>& latencies) : ewma(latencies) {}
+            bool operator()(size_t left, size_t right) const { return ewma[left] < ewma[right]; }
+        };
+    }
+
+    Mirror::Mirror(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Composite(name, config, fd_manager, log)
+        , window_(std::max<size_t>(config.get<size_t>("latency_window", 256), 16))
+        , percentile_(config.get<double>("hedge_percentile", 95) / 100)
+        , hedge_delay_(config.get<uint64_t>("hedge_delay_us", 10000))
+        , hedge_min_(config.get<uint64_t>("hedge_min_us", 500))
+        , hedge_max_(config.get<uint64_t>("hedge_max_us", 1000000))
+        , stats_interval_(config.get<unsigned long>("stats_interval", 10000))
+        , reads_(0)
+        , hedged_(0)
+        , hedge_wins_(0)
+    {}
+
+    Mirror::~Mirror()
+    {
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            {
+                boost::mutex::scoped_lock lock(replica->lock);
+                replica->stop = true;
+                replica->wakeup.notify_one();
+            }
+            if (replica->worker.joinable()) {
+                replica->worker.join();
+            }
+        }
+        report();
+    }
+
+    void Mirror::BeforeFork()
+    {
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            replica->call.lock();
+        }
+        lock_.lock();
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            replica->lock.lock();
+        }
+    }
+
+    void Mirror::AfterFork(bool child)
+    {
+        for (Replicas::reverse_iterator it = replicas_.rbegin(); it != replicas_.rend(); ++it) {
+            ReplicaIntr& replica = *it;
+            if (child) {
+                //! -- queued attempts belong to races of threads that stayed in the parent
+                replica->tasks.clear();
+                replica->current = Task();
+                Renew(replica->wakeup);
+                Renew(replica->worker);
+            }
+            replica->lock.unlock();
+        }
+        if (child) {
+            listings_.clear();
+        }
+        lock_.unlock();
+        for (Replicas::reverse_iterator it = replicas_.rbegin(); it != replicas_.rend(); ++it) {
+            ReplicaIntr& replica = *it;
+            replica->call.unlock();
+            if (child) {
+                replica->worker = boost::thread(boost::bind(&Mirror::worker, this, replica));
+            }
+        }
+    }
+
+    bool Mirror::Link(const ConnectorMap& connectors)
+    {
+        BOOST_FOREACH(const JsonNode::value_type & it, Config().get_child("replicas"))
+        {
+            ReplicaIntr replica(new Replica);
+            replica->connector = link(connectors, it.second.get_value<std::string>());
+            if (!replica->connector) {
+                return false;
+            }
+            replica->samples.resize(window_);
+            replicas_.push_back(replica);
+        }
+        if (replicas_.empty()) {
+            Logger().Err("Mirror %s: no replicas configured", Name().c_str());
+            return false;
+        }
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            replica->worker = boost::thread(boost::bind(&Mirror::worker, this, replica));
+        }
+        return true;
+    }
+
+    uint64_t Mirror::now()
+    {
+        struct timespec ts;
+
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    void Mirror::worker(ReplicaIntr replica)
+    {
+        while (true) {
+            Task task;
+            {
+                boost::mutex::scoped_lock lock(replica->lock);
+                while (!replica->stop && replica->tasks.empty()) {
+                    replica->wakeup.wait(lock);
+                }
+                if (replica->tasks.empty()) {
+                    return;
+                }
+                task = replica->tasks.front();
+                replica->tasks.pop_front();
+                replica->current = task;
+            }
+
+            Attempt& attempt = task.first->attempts[task.second];
+            int      ret     = -1;
+            int      error   = EBADF;
+            bool     skipped;
+            {
+                //! -- Close marks the race before it takes the call lock, so once we hold it a loser
+                //! -- either reads before the replica closes the descriptor or sees it was abandoned
+                boost::mutex::scoped_lock lock(replica->call);
+                {
+                    boost::mutex::scoped_lock race_lock(task.first->lock);
+                    skipped = task.first->abandoned;
+                }
+                if (!skipped) {
+                    ret   = read(*replica->connector, attempt.file, &attempt.data[0], attempt.data.size());
+                    error = errno;
+                }
+            }
+            {
+                boost::mutex::scoped_lock lock(replica->lock);
+                replica->current = Task();
+                if (!skipped) {
+                    record(*replica, now() - attempt.started, ret < 0);
+                }
+            }
+            finish(*task.first, attempt, ret, error);
+        }
+    }
+
+    void Mirror::finish(Race& race, Attempt& attempt, int ret, int error)
+    {
+        boost::mutex::scoped_lock lock(race.lock);
+
+        attempt.ret   = ret;
+        attempt.error = error;
+        attempt.done  = true;
+        race.finished.notify_all();
+    }
+
+    void Mirror::abandon(Replica& replica, int fd)
+    {
+        std::vector<RaceIntr> running;
+        std::vector<Task>     dropped;
+        {
+            boost::mutex::scoped_lock lock(replica.lock);
+            for (std::deque<Task>::iterator it = replica.tasks.begin(); it != replica.tasks.end(); ) {
+                if (it->first->attempts[it->second].file->Fd() == fd) {
+                    dropped.push_back(*it);
+                    it = replica.tasks.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (replica.current.first && (replica.current.first->attempts[replica.current.second].file->Fd() == fd)) {
+                running.push_back(replica.current.first);
+            }
+        }
+
+        //! -- race locks are taken after the replica lock is released: Read holds a race lock while it launches
+        BOOST_FOREACH(Task & task, dropped)
+        {
+            finish(*task.first, task.first->attempts[task.second], -1, EBADF);
+        }
+        BOOST_FOREACH(RaceIntr & race, running)
+        {
+            boost::mutex::scoped_lock lock(race->lock);
+            race->abandoned = true;
+        }
+    }
+
+    void Mirror::launch(RaceIntr& race, size_t attempt, size_t replica, FileIntr& file, size_t size)
+    {
+        Attempt& it = race->attempts[attempt];
+
+        //! -- same fd so per-descriptor state in the replica lines up with Close(); a clone, because the
+        //! -- worker must not share a descriptor's (non-atomic) count with the caller
+        it.replica = replica;
+        it.file    = new File(file->Fd(), file->Interned(), file->Flags());
+        it.file->Seek(file->Offset());
+        it.data.resize(size);
+        it.started = now();
+
+        Replica&                  target = *replicas_[replica];
+        boost::mutex::scoped_lock lock(target.lock);
+        target.tasks.push_back(std::make_pair(race, attempt));
+        target.wakeup.notify_one();
+    }
+
+    void Mirror::record(Replica& replica, uint64_t elapsed, bool failed)
+    {
+        //! -- a failure counts as a slow answer so the replica drops in the ranking
+        if (failed) {
+            ++replica.errors;
+            elapsed = std::max(elapsed, hedge_max_);
+        }
+        ++replica.reads;
+        replica.samples[replica.next] = (uint32_t)std::min<uint64_t>(elapsed, 0xFFFFFFFF);
+        replica.next                  = (replica.next + 1) % replica.samples.size();
+        replica.filled                = std::min(replica.filled + 1, replica.samples.size());
+        replica.ewma                  = replica.ewma ? (replica.ewma * 0.9 + elapsed * 0.1) : elapsed;
+    }
+
+    void Mirror::rank(std::vector<size_t>& order)
+    {
+        std::vector<double> ewma(replicas_.size());
+
+        order.resize(replicas_.size());
+        for (size_t i = 0; i < replicas_.size(); ++i) {
+            boost::mutex::scoped_lock lock(replicas_[i]->lock);
+            ewma[i]  = replicas_[i]->ewma;
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), ByLatency(ewma));
+    }
+
+    uint64_t Mirror::delay(size_t index)
+    {
+        Replica&                  replica = *replicas_[index];
+        boost::mutex::scoped_lock lock(replica.lock);
+
+        if (replica.filled < 16) {
+            return hedge_delay_;
+        }
+        std::vector<uint32_t> samples(replica.samples.begin(), replica.samples.begin() + replica.filled);
+        std::vector<uint32_t>::iterator nth = samples.begin() + (size_t)(percentile_ * (samples.size() - 1));
+        std::nth_element(samples.begin(), nth, samples.end());
+        return std::min(std::max<uint64_t>(*nth, hedge_min_), hedge_max_);
+    }
+
+    void Mirror::stats()
+    {
+        if (stats_interval_ && !(reads_ % stats_interval_)) {
+            report();
+        }
+    }
+
+    void Mirror::report()
+    {
+        FWL_INF(Logger(), "Mirror %s: %lu reads, %lu hedged (%.1f%%), %lu won by the hedge", Name().c_str(), reads_, hedged_, reads_ ? 100.0 * hedged_ / reads_ : 0.0, hedge_wins_);
+        for (size_t i = 0; i < replicas_.size(); ++i) {
+            uint64_t p = delay(i);
+            boost::mutex::scoped_lock lock(replicas_[i]->lock);
+            FWL_INF(Logger(), "Mirror %s: replica %s - %lu reads, %lu errors, ewma %.0fus, p%.0f %luus", Name().c_str(), replicas_[i]->connector->Name().c_str(), replicas_[i]->reads, replicas_[i]->errors, replicas_[i]->ewma, percentile_ * 100, (unsigned long)p);
+        }
+    }
+
+    int Mirror::Read(FileIntr& file, void *data, size_t size)
+    {
+        std::vector<size_t> order;
+        rank(order);
+
+        if ((replicas_.size() == 1) || !size) {
+            boost::mutex::scoped_lock lock(replicas_[order[0]]->call);
+            return read(*replicas_[order[0]]->connector, file, data, size);
+        }
+
+        RaceIntr race(new Race);
+        uint64_t wait = delay(order[0]);
+        launch(race, 0, order[0], file, size);
+
+        boost::mutex::scoped_lock lock(race->lock);
+        Attempt&                  first  = race->attempts[0];
+        Attempt&                  second = race->attempts[1];
+        boost::system_time       deadline = boost::get_system_time() + boost::posix_time::microseconds(wait);
+        bool                      hedged = false;
+
+        while (!first.done) {
+            if (!race->finished.timed_wait(lock, deadline)) {
+                break;
+            }
+        }
+        if (!first.done || (first.ret < 0)) {
+            //! -- slower than the replica's usual tail, or failed outright: ask the next best one too
+            launch(race, 1, order[1], file, size);
+            hedged = true;
+        }
+        while (!(first.done && (first.ret >= 0)) && !(second.done && (second.ret >= 0)) && !(first.done && second.done)) {
+            race->finished.wait(lock);
+        }
+
+        Attempt& winner = (first.done && (first.ret >= 0)) ? first : ((second.done && (second.ret >= 0)) ? second : first);
+        if (winner.ret > 0) {
+            ::memcpy(data, &winner.data[0], winner.ret);
+        }
+        int ret   = winner.ret;
+        int error = winner.error;
+        lock.unlock();
+
+        {
+            boost::mutex::scoped_lock stats_lock(lock_);
+            ++reads_;
+            if (hedged) {
+                ++hedged_;
+                if (&winner == &second) {
+                    ++hedge_wins_;
+                }
+            }
+            stats();
+        }
+        errno = error;
+        return ret;
+    }
+
+    bool Mirror::Exists(FileIntr& file)
+    {
+        std::vector<size_t> order;
+        rank(order);
+
+        boost::mutex::scoped_lock lock(replicas_[order[0]]->call);
+        return exists(*replicas_[order[0]]->connector, file);
+    }
+
+    bool Mirror::GetFileSize(FileIntr& file, size_t& size)
+    {
+        std::vector<size_t> order;
+        rank(order);
+
+        BOOST_FOREACH(size_t index, order)
+        {
+            boost::mutex::scoped_lock lock(replicas_[index]->call);
+            if (length(*replicas_[index]->connector, file, size)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Mirror::Open(DirectoryIntr& dir)
+    {
+        std::vector<size_t> order;
+        rank(order);
+
+        BOOST_FOREACH(size_t index, order)
+        {
+            boost::mutex::scoped_lock lock(replicas_[index]->call);
+            if (open(*replicas_[index]->connector, dir)) {
+                boost::mutex::scoped_lock listings_lock(lock_);
+                listings_[dir->Fd()] = index;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Mirror::Close(DirectoryIntr& dir)
+    {
+        size_t index;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Listings::iterator        it = listings_.find(dir->Fd());
+            if (it == listings_.end()) {
+                return false;
+            }
+            index = it->second;
+            listings_.erase(it);
+        }
+        boost::mutex::scoped_lock lock(replicas_[index]->call);
+        return close(*replicas_[index]->connector, dir);
+    }
+
+    bool Mirror::Create(FileIntr& file)
+    {
+        bool ok = true;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            ok = create(*replica->connector, file) && ok;
+        }
+        return ok;
+    }
+
+    bool Mirror::Truncate(FileIntr& file)
+    {
+        bool ok = true;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            ok = truncate(*replica->connector, file) && ok;
+        }
+        return ok;
+    }
+
+    int Mirror::Write(FileIntr& file, const void *data, size_t size)
+    {
+        int ret = (int)size;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            if (write(*replica->connector, file, data, size) != (int)size) {
+                Logger().Err("Mirror %s: write of %s to %s failed", Name().c_str(), file->Name().c_str(), replica->connector->Name().c_str());
+                ret = -1;
+            }
+        }
+        if (ret < 0) {
+            errno = EIO;
+        }
+        return ret;
+    }
+
+    bool Mirror::Close(FileIntr& file)
+    {
+        bool ok = true;
+
+        //! -- a hedge loser left behind must not reopen per-descriptor state in its replica after the close
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            abandon(*replica, file->Fd());
+            boost::mutex::scoped_lock lock(replica->call);
+            ok = close(*replica->connector, file) && ok;
+        }
+        return ok;
+    }
+
+    int Mirror::MkDir(const std::string& path, mode_t mode)
+    {
+        int ret = 0;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            ret = replica->connector->MkDir(path, mode) ? -1 : ret;
+        }
+        return ret;
+    }
+
+    int Mirror::Unlink(const std::string& path)
+    {
+        int ret = 0;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            ret = replica->connector->Unlink(path) ? -1 : ret;
+        }
+        return ret;
+    }
+
+    int Mirror::RmDir(const std::string& path)
+    {
+        int ret = 0;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            ret = replica->connector->RmDir(path) ? -1 : ret;
+        }
+        return ret;
+    }
+
+    int Mirror::Rename(const std::string& name, const std::string& newname)
+    {
+        int ret = 0;
+
+        BOOST_FOREACH(ReplicaIntr & replica, replicas_)
+        {
+            boost::mutex::scoped_lock lock(replica->call);
+            ret = replica->connector->Rename(name, newname) ? -1 : ret;
+        }
+        return ret;
+    }
+
+    Connector *MirrorFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Mirror(name, config, fd_manager, log);
+    }
+}
@@ -0,0 +1,882 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+}
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
+#include "connectors/objectstore.h"
+#include "real.h"
+
+namespace FWL {
+    static Real real;
+
+    std::string Objectstore::Response::Header(const std::string& name) const
+    {
+        boost::unordered_map<std::string, std::string>::const_iterator it = headers.find(name);
+
+        return (it == headers.end()) ? std::string() : it->second;
+    }
+
+    Objectstore::Objectstore(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+        , host_(config.get<std::string>("host", "127.0.0.1"))
+        , port_(config.get<std::string>("port", "80"))
+        , bucket_(config.get<std::string>("bucket"))
+        , prefix_(config.get<std::string>("prefix", ""))
+        , timeout_ms_(config.get<int>("timeout_ms", 5000))
+        , range_size_(config.get<size_t>("range_size", 1 << 20))
+        , parallel_(std::min<size_t>(std::max<size_t>(config.get<size_t>("parallel_ranges", 4), 1), 64))
+        , threshold_(config.get<size_t>("multipart_threshold", 16 << 20))
+        , part_size_(std::max<size_t>(config.get<size_t>("part_size", 8 << 20), 5 << 20))
+        , connections_(std::max<size_t>(config.get<size_t>("connections", 8), parallel_))
+        , open_(0)
+        , fetcher_count_(0)
+        , stop_(false)
+    {
+        //! -- no request signing here: static credentials, if any, go in as plain headers
+        JsonNodeConstOp headers = config.get_child_optional("headers");
+        if (headers) {
+            BOOST_FOREACH(const JsonNode::value_type & it, *headers)
+            {
+                headers_ += it.first + ": " + it.second.get_value<std::string>() + "\r\n";
+            }
+        }
+    }
+
+    Objectstore::~Objectstore()
+    {
+        {
+            boost::mutex::scoped_lock lock(fetch_lock_);
+            stop_ = true;
+            fetch_wakeup_.notify_all();
+        }
+        fetchers_.join_all();
+        BOOST_FOREACH(int sock, idle_)
+        {
+            real.close(sock);
+        }
+    }
+
+    void Objectstore::BeforeFork()
+    {
+        fetch_lock_.lock();
+        pool_lock_.lock();
+        lock_.lock();
+    }
+
+    void Objectstore::AfterFork(bool child)
+    {
+        if (child) {
+            //! -- keep-alive sockets stay with the parent; sockets other threads had checked out don't exist here
+            BOOST_FOREACH(int sock, idle_)
+            {
+                real.close(sock);
+            }
+            idle_.clear();
+            open_ = 0;
+            Renew(pool_wakeup_);
+            streams_.clear();
+            uploads_.clear();
+            //! -- queued ranges belong to readers that stayed in the parent; fetchers are started again on demand
+            fetches_.clear();
+            Renew(fetch_wakeup_);
+            Renew(fetchers_);
+            fetcher_count_ = 0;
+        }
+        lock_.unlock();
+        pool_lock_.unlock();
+        fetch_lock_.unlock();
+    }
+
+    std::string Objectstore::key(const std::string& path) const
+    {
+        size_t start = 0;
+
+        while ((start < path.size()) && (path[start] == '/')) {
+            ++start;
+        }
+        return prefix_ + path.substr(start);
+    }
+
+    std::string Objectstore::target(const std::string& key) const
+    {
+        return "/" + bucket_ + "/" + encode(key, true);
+    }
+
+    std::string Objectstore::encode(const std::string& str, bool slash)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string       out;
+
+        out.reserve(str.size());
+        for (size_t i = 0; i < str.size(); ++i) {
+            unsigned char c = str[i];
+            if (::isalnum(c) || (c == '-') || (c == '_') || (c == '.') || (c == '~') || (slash && (c == '/'))) {
+                out += c;
+            } else {
+                out += '%';
+                out += hex[c >> 4];
+                out += hex[c & 15];
+            }
+        }
+        return out;
+    }
+
+    void Objectstore::extract(const std::string& xml, const std::string& tag, std::vector<std::string>& values)
+    {
+        std::string open  = "<" + tag + ">";
+        std::string close = "</" + tag + ">";
+        size_t      pos   = 0;
+
+        while ((pos = xml.find(open, pos)) != std::string::npos) {
+            pos += open.size();
+            size_t end = xml.find(close, pos);
+            if (end == std::string::npos) {
+                break;
+            }
+            std::string value;
+            for (size_t i = pos; i < end; ++i) {
+                if (xml[i] != '&') {
+                    value += xml[i];
+                } else if (!xml.compare(i, 5, "&amp;")) {
+                    value += '&';
+                    i += 4;
+                } else if (!xml.compare(i, 4, "&lt;")) {
+                    value += '<';
+                    i += 3;
+                } else if (!xml.compare(i, 4, "&gt;")) {
+                    value += '>';
+                    i += 3;
+                } else if (!xml.compare(i, 6, "&quot;")) {
+                    value += '"';
+                    i += 5;
+                } else if (!xml.compare(i, 6, "&apos;")) {
+                    value += '\'';
+                    i += 5;
+                } else {
+                    value += xml[i];
+                }
+            }
+            values.push_back(value);
+            pos = end + close.size();
+        }
+    }
+
+    int Objectstore::connect()
+    {
+        struct addrinfo hints;
+        struct addrinfo *res = NULL;
+        int             sock = -1;
+
+        ::memset(&hints, 0, sizeof(hints));
+        hints.ai_family   = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (::getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res)) {
+            Logger().Err("Objectstore: couldn't resolve %s", host_.c_str());
+            return -1;
+        }
+        for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+            sock = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (sock < 0) {
+                continue;
+            }
+            if (!::connect(sock, ai->ai_addr, ai->ai_addrlen)) {
+                break;
+            }
+            real.close(sock);
+            sock = -1;
+        }
+        ::freeaddrinfo(res);
+        if (sock < 0) {
+            Logger().Err("Objectstore: couldn't connect to %s:%s", host_.c_str(), port_.c_str());
+            return -1;
+        }
+
+        int            flag = 1;
+        struct timeval timeout;
+        timeout.tv_sec  = timeout_ms_ / 1000;
+        timeout.tv_usec = (timeout_ms_ % 1000) * 1000;
+        ::setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        ::setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        return sock;
+    }
+
+    int Objectstore::checkout(bool fresh)
+    {
+        boost::mutex::scoped_lock lock(pool_lock_);
+
+        while (true) {
+            if (!idle_.empty()) {
+                int sock = idle_.back();
+                idle_.pop_back();
+                if (!fresh) {
+                    return sock;
+                }
+                //! -- a retry wants a new connection; give up the idle one's slot for it
+                real.close(sock);
+                --open_;
+            }
+            if (open_ < connections_) {
+                break;
+            }
+            pool_wakeup_.wait(lock);
+        }
+        ++open_;
+        lock.unlock();
+
+        int sock = connect();
+        if (sock < 0) {
+            lock.lock();
+            --open_;
+            pool_wakeup_.notify_one();
+        }
+        return sock;
+    }
+
+    void Objectstore::checkin(int sock, bool reuse)
+    {
+        boost::mutex::scoped_lock lock(pool_lock_);
+
+        if (reuse) {
+            idle_.push_back(sock);
+        } else {
+            real.close(sock);
+            --open_;
+        }
+        pool_wakeup_.notify_one();
+    }
+
+    bool Objectstore::exchange(int sock, const std::string& request, bool head, Response& response)
+    {
+        for (size_t sent = 0; sent < request.size(); ) {
+            ssize_t n = ::send(sock, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            sent += n;
+        }
+
+        std::string in;
+        char        buf[65536];
+        size_t      header_end;
+        while ((header_end = in.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = ::recv(sock, &buf[0], sizeof(buf), 0);
+            if (n <= 0) {
+                return false;
+            }
+            in.append(&buf[0], n);
+        }
+
+        size_t line_end = in.find("\r\n");
+        size_t space    = in.find(' ');
+        if ((space == std::string::npos) || (space > line_end)) {
+            return false;
+        }
+        response.status = ::atoi(in.c_str() + space + 1);
+        response.headers.clear();
+        for (size_t pos = line_end + 2; pos < header_end; ) {
+            size_t end   = in.find("\r\n", pos);
+            size_t colon = in.find(':', pos);
+            if ((colon != std::string::npos) && (colon < end)) {
+                std::string name = in.substr(pos, colon - pos);
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                size_t value = colon + 1;
+                while ((value < end) && (in[value] == ' ')) {
+                    ++value;
+                }
+                response.headers[name] = in.substr(value, end - value);
+            }
+            pos = end + 2;
+        }
+        response.keep_alive = ::strcasecmp(response.Header("connection").c_str(), "close") != 0;
+        in.erase(0, header_end + 4);
+        response.body.clear();
+
+        if (head || (response.status == 204) || (response.status == 304) || (response.status < 200)) {
+            return true;
+        }
+
+        if (!::strcasecmp(response.Header("transfer-encoding").c_str(), "chunked")) {
+            size_t pos = 0;
+            while (true) {
+                size_t end;
+                while ((end = in.find("\r\n", pos)) == std::string::npos) {
+                    ssize_t n = ::recv(sock, &buf[0], sizeof(buf), 0);
+                    if (n <= 0) {
+                        return false;
+                    }
+                    in.append(&buf[0], n);
+                }
+                size_t chunk = ::strtoul(in.c_str() + pos, NULL, 16);
+                pos = end + 2;
+                if (!chunk) {
+                    //! -- trailer fields up to an empty line follow the last chunk; all of it has to
+                    //! -- leave the socket or the next response on this connection starts with it
+                    while (true) {
+                        while ((end = in.find("\r\n", pos)) == std::string::npos) {
+                            ssize_t n = ::recv(sock, &buf[0], sizeof(buf), 0);
+                            if (n <= 0) {
+                                return false;
+                            }
+                            in.append(&buf[0], n);
+                        }
+                        if (end == pos) {
+                            return true;
+                        }
+                        pos = end + 2;
+                    }
+                }
+                while (in.size() < pos + chunk + 2) {
+                    ssize_t n = ::recv(sock, &buf[0], sizeof(buf), 0);
+                    if (n <= 0) {
+                        return false;
+                    }
+                    in.append(&buf[0], n);
+                }
+                response.body.append(in, pos, chunk);
+                pos += chunk + 2;
+            }
+        }
+
+        std::string length = response.Header("content-length");
+        if (length.empty()) {
+            response.keep_alive = false;
+            response.body.swap(in);
+            ssize_t n;
+            while ((n = ::recv(sock, &buf[0], sizeof(buf), 0)) > 0) {
+                response.body.append(&buf[0], n);
+            }
+            return true;
+        }
+
+        size_t size = ::strtoull(length.c_str(), NULL, 10);
+        response.body.swap(in);
+        response.body.reserve(size);
+        while (response.body.size() < size) {
+            ssize_t n = ::recv(sock, &buf[0], std::min(sizeof(buf), size - response.body.size()), 0);
+            if (n <= 0) {
+                return false;
+            }
+            response.body.append(&buf[0], n);
+        }
+        return true;
+    }
+
+    bool Objectstore::request(const std::string& method, const std::string& target, const std::string& headers, const std::string& body, Response& response)
+    {
+        std::string request = method + " " + target + " HTTP/1.1\r\nHost: " + host_ + "\r\n" + headers_ + headers;
+        if (!body.empty() || (method == "PUT") || (method == "POST")) {
+            char length[32];
+            ::snprintf(&length[0], sizeof(length), "Content-Length: %lu\r\n", (unsigned long)body.size());
+            request += length;
+        }
+        request += "\r\n";
+        request += body;
+
+        QueryProbe probe(Name(), method.c_str(), target.c_str());
+        //! -- a pooled connection may have been closed by the server while idle: retry once on a new one
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            int sock = checkout(attempt > 0);
+            if (sock < 0) {
+                break;
+            }
+            if (exchange(sock, request, method == "HEAD", response)) {
+                checkin(sock, response.keep_alive);
+                FWL_DBG(Logger(), "Objectstore: %s %s - %d", method.c_str(), target.c_str(), response.status);
+                probe.Ok();
+                return true;
+            }
+            checkin(sock, false);
+        }
+        Logger().Err("Objectstore: %s %s failed", method.c_str(), target.c_str());
+        errno = EIO;
+        return false;
+    }
+
+    bool Objectstore::head(const std::string& key, size_t& size)
+    {
+        Response response;
+
+        if (!request("HEAD", target(key), "", "", response)) {
+            return false;
+        }
+        if (response.status != 200) {
+            errno = (response.status == 404) ? ENOENT : EIO;
+            return false;
+        }
+        size = ::strtoull(response.Header("content-length").c_str(), NULL, 10);
+        return true;
+    }
+
+    bool Objectstore::put(const std::string& key, const std::string& body)
+    {
+        Response response;
+
+        if (!request("PUT", target(key), "", body, response)) {
+            return false;
+        }
+        if ((response.status != 200) && (response.status != 201) && (response.status != 204)) {
+            errno = EIO;
+            return false;
+        }
+        return true;
+    }
+
+    bool Objectstore::remove(const std::string& key)
+    {
+        Response response;
+
+        if (!request("DELETE", target(key), "", "", response)) {
+            return false;
+        }
+        if ((response.status != 200) && (response.status != 204)) {
+            errno = (response.status == 404) ? ENOENT : EIO;
+            return false;
+        }
+        return true;
+    }
+
+    bool Objectstore::fetch(const std::string& key, off_t offset, size_t size, std::string& data, off_t *total)
+    {
+        Response response;
+        char     range[64];
+
+        ::snprintf(&range[0], sizeof(range), "Range: bytes=%llu-%llu\r\n", (unsigned long long)offset, (unsigned long long)(offset + size - 1));
+        if (!request("GET", target(key), range, "", response)) {
+            return false;
+        }
+
+        data.clear();
+        if (response.status == 206) {
+            data.swap(response.body);
+            std::string content_range = response.Header("content-range");
+            size_t      slash         = content_range.find('/');
+            if (total && (slash != std::string::npos) && (content_range[slash + 1] != '*')) {
+                *total = ::strtoull(content_range.c_str() + slash + 1, NULL, 10);
+            }
+            return true;
+        }
+        if (response.status == 200) {
+            //! -- the server ignored the range and sent everything
+            if ((size_t)offset < response.body.size()) {
+                data.assign(response.body, offset, size);
+            }
+            if (total) {
+                *total = response.body.size();
+            }
+            return true;
+        }
+        if (response.status == 416) {
+            std::string content_range = response.Header("content-range");
+            size_t      slash         = content_range.find('/');
+            if (total && (slash != std::string::npos)) {
+                *total = ::strtoull(content_range.c_str() + slash + 1, NULL, 10);
+            }
+            return true;
+        }
+        errno = (response.status == 404) ? ENOENT : EIO;
+        return false;
+    }
+
+    void Objectstore::fetcher()
+    {
+        boost::mutex::scoped_lock lock(fetch_lock_);
+
+        while (true) {
+            while (!stop_ && fetches_.empty()) {
+                fetch_wakeup_.wait(lock);
+            }
+            if (stop_) {
+                return;
+            }
+            Fetch task = fetches_.front();
+            fetches_.pop_front();
+            lock.unlock();
+
+            *task.ok = fetch(task.key, task.offset, task.size, *task.data, NULL);
+            {
+                boost::mutex::scoped_lock done(task.batch->lock);
+                if (!--task.batch->pending) {
+                    task.batch->done.notify_all();
+                }
+            }
+            lock.lock();
+        }
+    }
+
+    bool Objectstore::list(const std::string& prefix, bool delimiter, std::vector<std::string>& keys, std::vector<std::string>& prefixes)
+    {
+        std::string token;
+
+        do {
+            std::string query = "/" + bucket_ + "?list-type=2&prefix=" + encode(prefix, false);
+            if (delimiter) {
+                query += "&delimiter=%2F";
+            }
+            if (!token.empty()) {
+                query += "&continuation-token=" + encode(token, false);
+            }
+
+            Response response;
+            if (!request("GET", query, "", "", response) || (response.status != 200)) {
+                errno = EIO;
+                return false;
+            }
+
+            std::vector<std::string> blocks;
+            extract(response.body, "Contents", blocks);
+            BOOST_FOREACH(const std::string & block, blocks)
+            {
+                extract(block, "Key", keys);
+            }
+            blocks.clear();
+            extract(response.body, "CommonPrefixes", blocks);
+            BOOST_FOREACH(const std::string & block, blocks)
+            {
+                extract(block, "Prefix", prefixes);
+            }
+
+            std::vector<std::string> truncated;
+            std::vector<std::string> next;
+            extract(response.body, "IsTruncated", truncated);
+            extract(response.body, "NextContinuationToken", next);
+            token = (!truncated.empty() && (truncated[0] == "true") && !next.empty()) ? next[0] : std::string();
+        } while (!token.empty());
+        return true;
+    }
+
+    bool Objectstore::uploadPart(const std::string& key, Upload& upload, size_t size)
+    {
+        Response response;
+
+        if (upload.id.empty()) {
+            std::vector<std::string> ids;
+            if (!request("POST", target(key) + "?uploads", "", "", response) || (response.status != 200)) {
+                return false;
+            }
+            extract(response.body, "UploadId", ids);
+            if (ids.empty()) {
+                Logger().Err("Objectstore: no UploadId for %s", key.c_str());
+                return false;
+            }
+            upload.id = ids[0];
+        }
+
+        char part[32];
+        ::snprintf(&part[0], sizeof(part), "?partNumber=%lu", (unsigned long)upload.etags.size() + 1);
+        if (!request("PUT", target(key) + part + "&uploadId=" + encode(upload.id, false), "", upload.data.substr(0, size), response) || (response.status != 200)) {
+            return false;
+        }
+        upload.etags.push_back(response.Header("etag"));
+        upload.data.erase(0, size);
+        upload.base += size;
+        return true;
+    }
+
+    bool Objectstore::flush(const std::string& key, Upload& upload)
+    {
+        if (upload.id.empty()) {
+            return put(key, upload.data);
+        }
+
+        Response response;
+        if (upload.data.empty() || uploadPart(key, upload, upload.data.size())) {
+            std::string body = "<CompleteMultipartUpload>";
+            for (size_t i = 0; i < upload.etags.size(); ++i) {
+                char part[32];
+                ::snprintf(&part[0], sizeof(part), "%lu", (unsigned long)i + 1);
+                body += std::string("<Part><PartNumber>") + part + "</PartNumber><ETag>" + upload.etags[i] + "</ETag></Part>";
+            }
+            body += "</CompleteMultipartUpload>";
+            if (request("POST", target(key) + "?uploadId=" + encode(upload.id, false), "", body, response) && (response.status == 200) && (response.body.find("<Error>") == std::string::npos)) {
+                return true;
+            }
+        }
+        Logger().Err("Objectstore: multipart upload of %s failed, aborting", key.c_str());
+        request("DELETE", target(key) + "?uploadId=" + encode(upload.id, false), "", "", response);
+        errno = EIO;
+        return false;
+    }
+
+    bool Objectstore::move(const std::string& from, const std::string& to)
+    {
+        Response response;
+
+        if (!request("PUT", target(to), "x-amz-copy-source: " + target(from) + "\r\n", "", response) || (response.status != 200)) {
+            errno = (response.status == 404) ? ENOENT : EIO;
+            return false;
+        }
+        return remove(from);
+    }
+
+    bool Objectstore::Exists(FileIntr& file)
+    {
+        size_t size;
+
+        return head(key(file->Name()), size);
+    }
+
+    bool Objectstore::Create(FileIntr& file)
+    {
+        if (!put(key(file->Name()), "")) {
+            return false;
+        }
+        if (file->Fd() != -1) {
+            boost::mutex::scoped_lock lock(lock_);
+            Upload&                   upload = uploads_[file->Fd()] = Upload();
+            upload.loaded = true;
+            streams_.erase(file->Fd());
+        }
+        return true;
+    }
+
+    bool Objectstore::Truncate(FileIntr& file)
+    {
+        return Create(file);
+    }
+
+    int Objectstore::Write(FileIntr& file, const void *data, size_t size)
+    {
+        Upload *upload;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            upload = &uploads_[file->Fd()];
+            streams_.erase(file->Fd());
+        }
+
+        std::string name = key(file->Name());
+        if (!upload->loaded) {
+            //! -- objects are immutable: an in-place write starts from the current content
+            Response response;
+            if (!request("GET", target(name), "", "", response)) {
+                return -1;
+            }
+            if (response.status == 200) {
+                upload->data.swap(response.body);
+            }
+            upload->loaded = true;
+        }
+
+        off_t offset = (file->Flags() & O_APPEND) ? upload->base + upload->data.size() : file->Offset();
+        if (offset < upload->base) {
+            errno = EINVAL;
+            return -1;
+        }
+        size_t pos = offset - upload->base;
+        if (upload->data.size() < pos + size) {
+            upload->data.resize(pos + size);
+        }
+        upload->data.replace(pos, size, (const char *)data, size);
+
+        while ((upload->data.size() >= part_size_) && (!upload->id.empty() || (upload->base + upload->data.size() >= threshold_))) {
+            if (!uploadPart(name, *upload, part_size_)) {
+                errno = EIO;
+                return -1;
+            }
+        }
+        return size;
+    }
+
+    int Objectstore::Read(FileIntr& file, void *data, size_t size)
+    {
+        off_t offset = file->Offset();
+        off_t total;
+        bool  sequential;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Stream&                   stream = streams_[file->Fd()];
+            if ((offset >= stream.start) && (offset < stream.start + (off_t)stream.data.size())) {
+                size_t n = std::min(size, (size_t)(stream.start + stream.data.size() - offset));
+                ::memcpy(data, stream.data.data() + (offset - stream.start), n);
+                stream.next = offset + n;
+                return n;
+            }
+            if ((stream.total >= 0) && (offset >= stream.total)) {
+                return 0;
+            }
+            sequential = (offset > 0) && (offset == stream.next);
+            total      = stream.total;
+        }
+
+        std::string name = key(file->Name());
+        std::string chunk;
+        if (sequential && (parallel_ > 1)) {
+            //! -- a sequential reader gets the next few ranges at once, one connection each
+            size_t window = std::max(size, range_size_ * parallel_);
+            if (total >= 0) {
+                window = std::min(window, (size_t)(total - offset));
+            }
+            size_t                   part  = (window + parallel_ - 1) / parallel_;
+            size_t                   count = (window + part - 1) / part;
+            std::vector<std::string> parts(parallel_);
+            bool                     oks[64];
+            Batch                    batch;
+            batch.pending = count - 1;
+            if (count > 1) {
+                //! -- the first range is fetched right here, the rest by the shared fetchers over pooled connections
+                boost::mutex::scoped_lock lock(fetch_lock_);
+                for ( ; fetcher_count_ < parallel_ - 1; ++fetcher_count_) {
+                    fetchers_.create_thread(boost::bind(&Objectstore::fetcher, this));
+                }
+                for (size_t i = 1; i < count; ++i) {
+                    Fetch task = { name, (off_t)(offset + i * part), std::min(part, window - i * part), &parts[i], &oks[i], &batch };
+                    fetches_.push_back(task);
+                }
+                fetch_wakeup_.notify_all();
+            }
+            oks[0] = fetch(name, offset, std::min(part, window), parts[0], NULL);
+            {
+                boost::mutex::scoped_lock lock(batch.lock);
+                while (batch.pending) {
+                    batch.done.wait(lock);
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (!oks[i]) {
+                    errno = EIO;
+                    return -1;
+                }
+                chunk += parts[i];
+            }
+        } else if (!fetch(name, offset, std::max(size, range_size_), chunk, &total)) {
+            return -1;
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        Stream&                   stream = streams_[file->Fd()];
+        size_t                    n      = std::min(size, chunk.size());
+        ::memcpy(data, chunk.data(), n);
+        stream.start = offset;
+        stream.data.swap(chunk);
+        stream.next  = offset + n;
+        stream.total = total;
+        return n;
+    }
+
+    bool Objectstore::Close(FileIntr& file)
+    {
+        Upload upload;
+        bool   pending = false;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Uploads::iterator         it = uploads_.find(file->Fd());
+            if (it != uploads_.end()) {
+                std::swap(upload, it->second);
+                uploads_.erase(it);
+                pending = upload.loaded;
+            }
+            streams_.erase(file->Fd());
+        }
+        return !pending || flush(key(file->Name()), upload);
+    }
+
+    bool Objectstore::GetFileSize(FileIntr& file, size_t& size)
+    {
+        return head(key(file->Name()), size);
+    }
+
+    bool Objectstore::Open(DirectoryIntr& dir)
+    {
+        std::string prefix = key(dir->Name());
+        if (!prefix.empty() && (prefix[prefix.size() - 1] != '/')) {
+            prefix += '/';
+        }
+
+        std::vector<std::string> keys;
+        std::vector<std::string> prefixes;
+        if (!list(prefix, true, keys, prefixes)) {
+            return false;
+        }
+        BOOST_FOREACH(const std::string & it, keys)
+        {
+            if (it.size() > prefix.size()) {
+                dir->AddFile(it.substr(prefix.size()));
+            }
+        }
+        BOOST_FOREACH(const std::string & it, prefixes)
+        {
+            if (it.size() > prefix.size() + 1) {
+                dir->AddFile(it.substr(prefix.size(), it.size() - prefix.size() - 1));
+            }
+        }
+        return true;
+    }
+
+    bool Objectstore::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    int Objectstore::MkDir(const std::string& path, mode_t mode)
+    {
+        return put(key(path) + "/", "") ? 0 : -1;
+    }
+
+    int Objectstore::Unlink(const std::string& path)
+    {
+        return remove(key(path)) ? 0 : -1;
+    }
+
+    int Objectstore::RmDir(const std::string& path)
+    {
+        std::string              prefix = key(path) + "/";
+        std::vector<std::string> keys;
+        std::vector<std::string> prefixes;
+
+        if (!list(prefix, true, keys, prefixes)) {
+            return -1;
+        }
+        if (!prefixes.empty() || (keys.size() > 1) || ((keys.size() == 1) && (keys[0] != prefix))) {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+        return remove(prefix) ? 0 : -1;
+    }
+
+    int Objectstore::Rename(const std::string& name, const std::string& newname)
+    {
+        std::string from = key(name);
+        std::string to   = key(newname);
+        size_t      size;
+
+        if (head(from, size)) {
+            return move(from, to) ? 0 : -1;
+        }
+
+        //! -- no directories in an object store: move every key under the prefix
+        std::vector<std::string> keys;
+        std::vector<std::string> prefixes;
+        if (!list(from + "/", false, keys, prefixes)) {
+            return -1;
+        }
+        if (keys.empty()) {
+            errno = ENOENT;
+            return -1;
+        }
+        BOOST_FOREACH(const std::string & it, keys)
+        {
+            if (!move(it, to + it.substr(from.size()))) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    Connector *ObjectstoreFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Objectstore(name, config, fd_manager, log);
+    }
+}
@@ -0,0 +1,428 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+}
+#include <boost/foreach.hpp>
+#include <boost/unordered_set.hpp>
+#include "connectors/overlay.h"
+#include "real.h"
+#include "path.h"
+
+#define OVERLAY_WHITEOUT    ".wh."
+#define OVERLAY_OPAQUE      ".wh..wh..opq"
+
+namespace FWL {
+    static Real real;
+
+    Overlay::Overlay(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Composite(name, config, fd_manager, log)
+        , lower_(config.get<std::string>("lower"))
+        , strip_(config.get<std::string>("strip", ""))
+    {}
+
+    Overlay::~Overlay()
+    {
+        for (Handles::iterator it = handles_.begin(); it != handles_.end(); ++it) {
+            if (it->second != Upper) {
+                real.close(it->second);
+            }
+        }
+    }
+
+    void Overlay::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    void Overlay::AfterFork(bool child)
+    {
+        if (child) {
+            for (Handles::iterator it = handles_.begin(); it != handles_.end(); ++it) {
+                if (it->second != Upper) {
+                    real.close(it->second);
+                }
+            }
+            handles_.clear();
+        }
+        lock_.unlock();
+    }
+
+    bool Overlay::Link(const ConnectorMap& connectors)
+    {
+        upper_ = link(connectors, Config().get<std::string>("upper"));
+        return upper_.get() != NULL;
+    }
+
+    std::string Overlay::lower(const std::string& path) const
+    {
+        if (!strip_.empty() && !path.compare(0, strip_.size(), strip_)) {
+            return lower_ + "/" + path.substr(strip_.size());
+        }
+        return lower_ + path;
+    }
+
+    std::string Overlay::whiteout(const std::string& path)
+    {
+        return Path::Directory(path) + "/" OVERLAY_WHITEOUT + Path::File(path);
+    }
+
+    bool Overlay::hidden(const std::string& name)
+    {
+        return !name.compare(0, sizeof(OVERLAY_WHITEOUT) - 1, OVERLAY_WHITEOUT);
+    }
+
+    bool Overlay::upper(const std::string& path)
+    {
+        FileIntr probe = scratch(path, O_RDONLY);
+
+        return exists(*upper_, probe);
+    }
+
+    //! -- a directory made again over a removed lower one: nothing of the lower directory shows through it
+    bool Overlay::opaque(const std::string& path)
+    {
+        FileIntr probe = scratch(path + "/" OVERLAY_OPAQUE, O_RDONLY);
+
+        return exists(*upper_, probe);
+    }
+
+    //! -- hidden by its own whiteout, or by a removed or opaque directory above it
+    bool Overlay::whited(const std::string& path)
+    {
+        FileIntr probe = scratch(whiteout(path), O_RDONLY);
+
+        if (exists(*upper_, probe)) {
+            return true;
+        }
+        for (std::string parent = Path::Directory(path); !parent.empty(); parent = Path::Directory(parent)) {
+            FileIntr marker = scratch(whiteout(parent), O_RDONLY);
+            if (exists(*upper_, marker) || opaque(parent)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! -- true when the merged directory has nothing but whiteouts, which are collected for removal
+    bool Overlay::empty(const std::string& path, std::vector<std::string>& whiteouts)
+    {
+        DirectoryIntr top(new Directory(-1, PathHandle(path)));
+
+        if (open(*upper_, top)) {
+            for (size_t i = 0; i < top->Files().size(); ++i) {
+                const std::string& name = top->Files()[i];
+                if (!hidden(name)) {
+                    close(*upper_, top);
+                    return false;
+                }
+                whiteouts.push_back(path + "/" + name);
+            }
+            close(*upper_, top);
+        }
+
+        DIR *dd = (whited(path) || opaque(path)) ? NULL : real.opendir(lower(path).c_str());
+        if (dd) {
+            struct dirent *entry;
+            bool          found = false;
+            while (!found && (entry = real.readdir(dd))) {
+                found = ::strcmp(entry->d_name, ".") && ::strcmp(entry->d_name, "..") && !whited(path + "/" + entry->d_name);
+            }
+            real.closedir(dd);
+            if (found) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Overlay::shadow(const std::string& path)
+    {
+        FileIntr marker = scratch(whiteout(path), O_WRONLY | O_CREAT);
+        bool     ok     = exists(*upper_, marker) || create(*upper_, marker);
+
+        close(*upper_, marker);
+        return ok;
+    }
+
+    bool Overlay::unshadow(const std::string& path)
+    {
+        return !upper_->Unlink(whiteout(path));
+    }
+
+    bool Overlay::lowerFile(const std::string& path, size_t *size)
+    {
+        struct stat buf;
+
+        if (real.stat(lower(path).c_str(), &buf) || !S_ISREG(buf.st_mode)) {
+            return false;
+        }
+        if (size) {
+            *size = buf.st_size;
+        }
+        return true;
+    }
+
+    bool Overlay::copyUp(const std::string& path, const std::string& newpath)
+    {
+        FileIntr dst = scratch(newpath, O_WRONLY | O_CREAT | O_TRUNC);
+        int      src = real.open(lower(path).c_str(), O_RDONLY | O_CLOEXEC);
+        bool     ok  = (src >= 0) && (exists(*upper_, dst) ? truncate(*upper_, dst) : create(*upper_, dst));
+        char     buf[65536];
+
+        while (ok) {
+            ssize_t n = ::pread(src, &buf[0], sizeof(buf), dst->Offset());
+            if (n <= 0) {
+                ok = !n;
+                break;
+            }
+            ok = write(*upper_, dst, &buf[0], n) == n;
+            dst->Seek(dst->Offset() + n);
+        }
+        if (src >= 0) {
+            real.close(src);
+        }
+        ok = close(*upper_, dst) && ok;
+        if (!ok) {
+            upper_->Unlink(newpath);
+        }
+        return ok;
+    }
+
+    int Overlay::handle(FileIntr& file)
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::const_iterator   it = handles_.find(file->Fd());
+            if (it != handles_.end()) {
+                return it->second;
+            }
+        }
+
+        int fd = Upper;
+        if (!upper(file->Name()) && !whited(file->Name())) {
+            fd = real.open(lower(file->Name()).c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return fd;
+            }
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        handles_[file->Fd()] = fd;
+        return fd;
+    }
+
+    void Overlay::release(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Handles::iterator         it = handles_.find(file->Fd());
+
+        if (it != handles_.end()) {
+            if (it->second != Upper) {
+                real.close(it->second);
+            }
+            handles_.erase(it);
+        }
+    }
+
+    bool Overlay::Exists(FileIntr& file)
+    {
+        if (exists(*upper_, file)) {
+            return true;
+        }
+        return lowerFile(file->Name(), NULL) && !whited(file->Name());
+    }
+
+    bool Overlay::Create(FileIntr& file)
+    {
+        unshadow(file->Name());
+        release(file);
+        return create(*upper_, file);
+    }
+
+    bool Overlay::Truncate(FileIntr& file)
+    {
+        release(file);
+        if (upper(file->Name())) {
+            return truncate(*upper_, file);
+        }
+        unshadow(file->Name());
+        return create(*upper_, file);
+    }
+
+    int Overlay::Write(FileIntr& file, const void *data, size_t size)
+    {
+        int fd = handle(file);
+
+        if (fd != Upper) {
+            //! -- first write to a lower file copies it up; the descriptor follows it and is opened on the upper layer
+            if ((fd >= 0) && (!copyUp(file->Name(), file->Name()) || !exists(*upper_, file))) {
+                errno = EIO;
+                return -1;
+            }
+            release(file);
+            boost::mutex::scoped_lock lock(lock_);
+            handles_[file->Fd()] = Upper;
+        }
+        return write(*upper_, file, data, size);
+    }
+
+    int Overlay::Read(FileIntr& file, void *data, size_t size)
+    {
+        int fd = handle(file);
+
+        if (fd == Upper) {
+            return read(*upper_, file, data, size);
+        }
+        if (fd < 0) {
+            return -1;
+        }
+        return ::pread(fd, data, size, file->Offset());
+    }
+
+    bool Overlay::Close(FileIntr& file)
+    {
+        bool upper = false;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Handles::const_iterator   it = handles_.find(file->Fd());
+            upper = (it == handles_.end()) || (it->second == Upper);
+        }
+        release(file);
+        return upper ? close(*upper_, file) : true;
+    }
+
+    bool Overlay::GetFileSize(FileIntr& file, size_t& size)
+    {
+        if (length(*upper_, file, size)) {
+            return true;
+        }
+        return lowerFile(file->Name(), &size) && !whited(file->Name());
+    }
+
+    bool Overlay::Open(DirectoryIntr& dir)
+    {
+        DirectoryIntr                     top(new Directory(-1, dir->Interned()));
+        bool                              found = open(*upper_, top);
+        boost::unordered_set<std::string> seen;
+        boost::unordered_set<std::string> whiteouts;
+
+        if (found) {
+            for (size_t i = 0; i < top->Files().size(); ++i) {
+                const std::string& name = top->Files()[i];
+                if (hidden(name)) {
+                    whiteouts.insert(name.substr(sizeof(OVERLAY_WHITEOUT) - 1));
+                } else if (seen.insert(name).second) {
+                    dir->AddFile(name);
+                }
+            }
+            close(*upper_, top);
+        }
+
+        DIR *dd = (whited(dir->Name()) || opaque(dir->Name())) ? NULL : real.opendir(lower(dir->Name()).c_str());
+        if (dd) {
+            struct dirent *entry;
+            while ((entry = real.readdir(dd))) {
+                if (!::strcmp(entry->d_name, ".") || !::strcmp(entry->d_name, "..") || whiteouts.count(entry->d_name) || seen.count(entry->d_name)) {
+                    continue;
+                }
+                dir->AddFile(entry->d_name);
+            }
+            real.closedir(dd);
+            found = true;
+        }
+        return found;
+    }
+
+    bool Overlay::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    int Overlay::MkDir(const std::string& path, mode_t mode)
+    {
+        bool removed = unshadow(path);
+
+        if (upper_->MkDir(path, mode)) {
+            if (removed) {
+                shadow(path);
+            }
+            return -1;
+        }
+        if (removed) {
+            FileIntr marker = scratch(path + "/" OVERLAY_OPAQUE, O_WRONLY | O_CREAT);
+            create(*upper_, marker);
+            close(*upper_, marker);
+        }
+        return 0;
+    }
+
+    int Overlay::Unlink(const std::string& path)
+    {
+        bool removed = !upper_->Unlink(path);
+
+        if (lowerFile(path, NULL)) {
+            removed = shadow(path) || removed;
+        }
+        if (!removed) {
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+    int Overlay::RmDir(const std::string& path)
+    {
+        std::vector<std::string> whiteouts;
+
+        if (!empty(path, whiteouts)) {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+        BOOST_FOREACH(const std::string & it, whiteouts)
+        {
+            upper_->Unlink(it);
+        }
+
+        struct stat buf;
+        bool        removed = !upper_->RmDir(path);
+        if (!real.stat(lower(path).c_str(), &buf) && S_ISDIR(buf.st_mode) && !whited(path)) {
+            removed = shadow(path) || removed;
+        }
+        if (!removed) {
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+    int Overlay::Rename(const std::string& name, const std::string& newname)
+    {
+        bool in_lower = lowerFile(name, NULL) && !whited(name);
+
+        unshadow(newname);
+        if (upper(name)) {
+            if (upper_->Rename(name, newname)) {
+                return -1;
+            }
+        } else if (in_lower) {
+            if (!copyUp(name, newname)) {
+                errno = EIO;
+                return -1;
+            }
+        } else {
+            errno = ENOENT;
+            return -1;
+        }
+        if (in_lower) {
+            shadow(name);
+        }
+        return 0;
+    }
+
+    Connector *OverlayFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Overlay(name, config, fd_manager, log);
+    }
+}
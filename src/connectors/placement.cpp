@@ -0,0 +1,615 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+}
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include "connectors/placement.h"
+
+namespace FWL {
+    bool Placement::Rule::Matches(const std::string& extension, size_t size, unsigned long accesses) const
+    {
+        if ((size < min_size) || (size > max_size) || (accesses < min_accesses) || (accesses > max_accesses)) {
+            return false;
+        }
+        return extensions.empty() || (std::find(extensions.begin(), extensions.end(), extension) != extensions.end());
+    }
+
+    Placement::Placement(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Composite(name, config, fd_manager, log)
+        , default_(0)
+        , interval_(std::max(config.get<unsigned long>("frequency_interval", 60), 1UL))
+        , migrate_(config.get<bool>("migrate", true))
+        , stop_(false)
+        , moved_(0)
+    {
+        JsonNodeConstOp rules = config.get_child_optional("rules");
+        if (rules) {
+            BOOST_FOREACH(const JsonNode::value_type & it, *rules)
+            {
+                Rule rule;
+                rule.target       = target(it.second.get<std::string>("connector"));
+                rule.min_size     = it.second.get<size_t>("min_size", 0);
+                rule.max_size     = it.second.get<size_t>("max_size", (size_t)-1);
+                rule.min_accesses = it.second.get<unsigned long>("min_accesses", 0);
+                rule.max_accesses = it.second.get<unsigned long>("max_accesses", (unsigned long)-1);
+                JsonNodeConstOp extensions = it.second.get_child_optional("extensions");
+                if (extensions) {
+                    BOOST_FOREACH(const JsonNode::value_type & ext, *extensions)
+                    {
+                        rule.extensions.push_back(ext.second.get_value<std::string>());
+                    }
+                }
+                rules_.push_back(rule);
+            }
+        }
+        default_ = target(config.get<std::string>("default"));
+
+        JsonNodeConstOp hints = config.get_child_optional("size_hints");
+        if (hints) {
+            BOOST_FOREACH(const JsonNode::value_type & it, *hints)
+            {
+                hints_.insert(std::make_pair(it.first, it.second.get_value<size_t>()));
+            }
+        }
+
+        if (migrate_) {
+            migrator_ = boost::thread(boost::bind(&Placement::migrator, this));
+        }
+    }
+
+    Placement::~Placement()
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            stop_ = true;
+            wakeup_.notify_one();
+        }
+        if (migrator_.joinable()) {
+            migrator_.join();
+        }
+        FWL_INF(Logger(), "Placement %s: %lu objects migrated", Name().c_str(), moved_);
+    }
+
+    void Placement::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    void Placement::AfterFork(bool child)
+    {
+        if (child) {
+            //! -- pending migrations are the parent's to do, and its open files aren't ours
+            queue_.clear();
+            descriptors_.clear();
+            for (Index::iterator it = index_.begin(); it != index_.end(); ++it) {
+                it->second.opened = 0;
+                it->second.queued  = false;
+            }
+            Renew(wakeup_);
+            Renew(migrator_);
+        }
+        lock_.unlock();
+        if (child && migrate_) {
+            migrator_ = boost::thread(boost::bind(&Placement::migrator, this));
+        }
+    }
+
+    size_t Placement::target(const std::string& name)
+    {
+        std::vector<std::string>::const_iterator it = std::find(names_.begin(), names_.end(), name);
+
+        if (it != names_.end()) {
+            return it - names_.begin();
+        }
+        names_.push_back(name);
+        return names_.size() - 1;
+    }
+
+    bool Placement::Link(const ConnectorMap& connectors)
+    {
+        BOOST_FOREACH(const std::string & it, names_)
+        {
+            ConnectorIntr child = link(connectors, it);
+            if (!child) {
+                return false;
+            }
+            targets_.push_back(child);
+        }
+        return true;
+    }
+
+    std::string Placement::extension(const std::string& path)
+    {
+        std::string::size_type slash = path.find_last_of('/');
+        std::string::size_type dot   = path.find_last_of('.');
+
+        //! -- a leading dot names a hidden file, not an extension
+        if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot <= slash + 1)) || !dot) {
+            return std::string();
+        }
+        return path.substr(dot + 1);
+    }
+
+    //! -- an object not closed here yet is classified by the size hint for its extension
+    size_t Placement::classify(const std::string& path, const Entry& entry) const
+    {
+        std::string ext  = extension(path);
+        size_t      size = entry.size;
+
+        if (!entry.sized) {
+            Hints::const_iterator hint = hints_.find(ext);
+            size = (hint != hints_.end()) ? hint->second : 0;
+        }
+        BOOST_FOREACH(const Rule & rule, rules_)
+        {
+            if (rule.Matches(ext, size, entry.accesses)) {
+                return rule.target;
+            }
+        }
+        return default_;
+    }
+
+    unsigned long Placement::now() const
+    {
+        return (unsigned long)::time(NULL) / interval_;
+    }
+
+    //! -- the access count halves every frequency_interval, so it tracks recent accesses per interval
+    void Placement::age(Entry& entry) const
+    {
+        unsigned long epoch = now();
+        unsigned long shift = epoch - entry.epoch;
+
+        entry.accesses = (shift >= sizeof(entry.accesses) * 8) ? 0 : (entry.accesses >> shift);
+        entry.epoch    = epoch;
+    }
+
+    //! -- objects not in the index (written by another process, or before a restart) are looked
+    //! -- for where the rules would put them first, then everywhere else; the probes run unlocked
+    bool Placement::locate(const std::string& path, size_t& target)
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Index::const_iterator     it = index_.find(path);
+            if (it != index_.end()) {
+                target = it->second.target;
+                return true;
+            }
+        }
+
+        Entry  entry;
+        size_t first = classify(path, entry);
+        for (size_t i = 0; i < targets_.size(); ++i) {
+            size_t   candidate = i ? ((i == first) ? 0 : i) : first;
+            FileIntr probe(scratch(path, O_RDONLY));
+            bool     found     = exists(*targets_[candidate], probe);
+            close(*targets_[candidate], probe);
+            if (found) {
+                entry.target = candidate;
+                entry.epoch  = now();
+                boost::mutex::scoped_lock lock(lock_);
+                target = index_.insert(std::make_pair(path, entry)).first->second.target;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Placement::pinned(FileIntr& file, size_t& target)
+    {
+        boost::mutex::scoped_lock   lock(lock_);
+        Descriptors::const_iterator it = descriptors_.find(file->Fd());
+
+        if (it == descriptors_.end()) {
+            return false;
+        }
+        target = it->second.target;
+        return true;
+    }
+
+    //! -- the first read or write pins a descriptor to the object's target: its per-descriptor state
+    //! -- stays there, and the object isn't migrated until every descriptor on it is closed.
+    //! -- Files without a descriptor (scratch copies, per-call clones) are never closed, so they aren't pinned.
+    bool Placement::pin(FileIntr& file, bool create, bool write, size_t& target)
+    {
+        bool held = pinned(file, target);
+        if (!held && !locate(file->Name(), target) && !create) {
+            return false;
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        Index::iterator           entry = index_.find(file->Name());
+        if ((entry == index_.end()) && create && !held) {
+            Entry placed;
+            placed.target = classify(file->Name(), placed);
+            placed.epoch  = now();
+            entry         = index_.insert(std::make_pair(file->Name(), placed)).first;
+        }
+        if (file->Fd() < 0) {
+            if (entry != index_.end()) {
+                target = entry->second.target;
+                if (write) {
+                    ++entry->second.version;
+                }
+            }
+            return true;
+        }
+
+        Descriptors::iterator it = descriptors_.find(file->Fd());
+        if (it == descriptors_.end()) {
+            if (entry == index_.end()) {
+                Entry placed;
+                placed.target = target;
+                placed.epoch  = now();
+                entry         = index_.insert(std::make_pair(file->Name(), placed)).first;
+            }
+            ++entry->second.opened;
+            it                  = descriptors_.insert(std::make_pair(file->Fd(), Descriptor())).first;
+            it->second.target   = entry->second.target;
+            it->second.path     = file->Name();
+        }
+        if (write) {
+            it->second.written = true;
+            Index::iterator current = index_.find(it->second.path);
+            if (current != index_.end()) {
+                ++current->second.version;
+            }
+        }
+        target = it->second.target;
+        return true;
+    }
+
+    bool Placement::unpin(FileIntr& file, Descriptor& descriptor)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Descriptors::iterator     it = descriptors_.find(file->Fd());
+
+        if (it == descriptors_.end()) {
+            return false;
+        }
+        descriptor = it->second;
+        descriptors_.erase(it);
+        Index::iterator entry = index_.find(descriptor.path);
+        if (entry != index_.end()) {
+            --entry->second.opened;
+        }
+        return true;
+    }
+
+    //! -- the object left the index while descriptors were open on it: they no longer count on any entry
+    void Placement::detach(const std::string& path, bool under)
+    {
+        for (Descriptors::iterator it = descriptors_.begin(); it != descriptors_.end(); ++it) {
+            if ((it->second.path == path) || (under && !it->second.path.compare(0, path.size() + 1, path + "/"))) {
+                it->second.path.clear();
+            }
+        }
+    }
+
+    void Placement::reconsider(const std::string& path, Entry& entry)
+    {
+        age(entry);
+        if (!migrate_ || entry.queued || entry.opened || (classify(path, entry) == entry.target)) {
+            return;
+        }
+        entry.queued = true;
+        queue_.push_back(path);
+        wakeup_.notify_one();
+    }
+
+    void Placement::migrator()
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        while (true) {
+            while (!stop_ && queue_.empty()) {
+                wakeup_.wait(lock);
+            }
+            if (stop_) {
+                return;
+            }
+            std::string path = queue_.front();
+            queue_.pop_front();
+            migrate(path, lock);
+        }
+    }
+
+    //! -- the copy runs unlocked; it is published only if nothing opened or wrote the object meanwhile
+    void Placement::migrate(const std::string& path, boost::mutex::scoped_lock& lock)
+    {
+        Index::iterator it = index_.find(path);
+
+        if (it == index_.end()) {
+            return;
+        }
+        it->second.queued = false;
+        size_t to = classify(path, it->second);
+        if (it->second.opened || (to == it->second.target)) {
+            return;
+        }
+        size_t        from    = it->second.target;
+        unsigned long version = it->second.version;
+
+        lock.unlock();
+        bool copied = copy(*targets_[from], *targets_[to], path, path);
+        lock.lock();
+
+        it = index_.find(path);
+        if (!copied || (it == index_.end()) || (it->second.version != version) || (it->second.target != from) || it->second.opened) {
+            if (!copied) {
+                Logger().Err("Placement %s: couldn't move %s from %s to %s", Name().c_str(), path.c_str(), names_[from].c_str(), names_[to].c_str());
+            }
+            if ((it == index_.end()) || (it->second.target != to)) {
+                lock.unlock();
+                targets_[to]->Unlink(path);
+                lock.lock();
+            }
+            return;
+        }
+        it->second.target = to;
+        ++moved_;
+        lock.unlock();
+        targets_[from]->Unlink(path);
+        lock.lock();
+        FWL_DBG(Logger(), "Placement %s: moved %s from %s to %s", Name().c_str(), path.c_str(), names_[from].c_str(), names_[to].c_str());
+    }
+
+    bool Placement::Exists(FileIntr& file)
+    {
+        size_t target;
+
+        if (!locate(file->Name(), target)) {
+            return false;
+        }
+        if (!exists(*targets_[target], file)) {
+            //! -- moved or removed by another process
+            {
+                boost::mutex::scoped_lock lock(lock_);
+                Index::iterator           it = index_.find(file->Name());
+                if ((it != index_.end()) && (it->second.target == target) && !it->second.opened) {
+                    index_.erase(it);
+                }
+            }
+            if (!locate(file->Name(), target) || !exists(*targets_[target], file)) {
+                return false;
+            }
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        Index::iterator           it = index_.find(file->Name());
+        if (it != index_.end()) {
+            age(it->second);
+            ++it->second.accesses;
+            reconsider(file->Name(), it->second);
+        }
+        return true;
+    }
+
+    //! -- a failed open releases the descriptor without Close, so its pin goes here
+    bool Placement::Create(FileIntr& file)
+    {
+        size_t     target;
+        Descriptor descriptor;
+
+        pin(file, true, true, target);
+        if (!create(*targets_[target], file)) {
+            unpin(file, descriptor);
+            return false;
+        }
+        return true;
+    }
+
+    bool Placement::Truncate(FileIntr& file)
+    {
+        size_t     target;
+        Descriptor descriptor;
+
+        pin(file, true, true, target);
+        if (!truncate(*targets_[target], file)) {
+            unpin(file, descriptor);
+            return false;
+        }
+        return true;
+    }
+
+    int Placement::Write(FileIntr& file, const void *data, size_t size)
+    {
+        size_t target;
+
+        pin(file, true, true, target);
+        return write(*targets_[target], file, data, size);
+    }
+
+    int Placement::Read(FileIntr& file, void *data, size_t size)
+    {
+        size_t target;
+
+        if (!pin(file, false, false, target)) {
+            errno = ENOENT;
+            return -1;
+        }
+        return read(*targets_[target], file, data, size);
+    }
+
+    //! -- the size is known for certain only now; a class change is picked up here
+    bool Placement::Close(FileIntr& file)
+    {
+        Descriptor descriptor;
+        bool       used = unpin(file, descriptor);
+
+        if (!used) {
+            //! -- never read or written through: whatever the target keeps for it is where the index says
+            if (!locate(file->Name(), descriptor.target)) {
+                BOOST_FOREACH(ConnectorIntr & target, targets_)
+                {
+                    close(*target, file);
+                }
+                return true;
+            }
+            descriptor.path = file->Name();
+        }
+
+        bool   ok    = close(*targets_[descriptor.target], file);
+        size_t size  = 0;
+        bool   sized = false;
+        if (descriptor.written && !descriptor.path.empty()) {
+            FileIntr probe(scratch(descriptor.path, O_RDONLY));
+            sized = length(*targets_[descriptor.target], probe, size);
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        Index::iterator           it = index_.find(descriptor.path);
+        if (it != index_.end()) {
+            if (descriptor.written) {
+                ++it->second.version;
+            }
+            if (sized && (it->second.target == descriptor.target)) {
+                it->second.size  = size;
+                it->second.sized = true;
+            }
+            reconsider(descriptor.path, it->second);
+        }
+        return ok;
+    }
+
+    bool Placement::GetFileSize(FileIntr& file, size_t& size)
+    {
+        size_t target;
+
+        if (!pinned(file, target) && !locate(file->Name(), target)) {
+            errno = ENOENT;
+            return false;
+        }
+        return length(*targets_[target], file, size);
+    }
+
+    //! -- objects of one directory may live on any target, so listings are merged
+    bool Placement::Open(DirectoryIntr& dir)
+    {
+        boost::unordered_set<std::string> seen;
+        bool                              found = false;
+
+        BOOST_FOREACH(ConnectorIntr & target, targets_)
+        {
+            DirectoryIntr part(new Directory(-1, dir->Interned()));
+            if (!open(*target, part)) {
+                continue;
+            }
+            found = true;
+            for (size_t i = 0; i < part->Files().size(); ++i) {
+                if (seen.insert(part->Files()[i]).second) {
+                    dir->AddFile(part->Files()[i]);
+                }
+            }
+            close(*target, part);
+        }
+        return found;
+    }
+
+    bool Placement::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    int Placement::Unlink(const std::string& path)
+    {
+        size_t target;
+
+        if (!locate(path, target)) {
+            errno = ENOENT;
+            return -1;
+        }
+        int ret = targets_[target]->Unlink(path);
+        if (!ret) {
+            boost::mutex::scoped_lock lock(lock_);
+            index_.erase(path);
+            detach(path, false);
+        }
+        return ret;
+    }
+
+    int Placement::MkDir(const std::string& path, mode_t mode)
+    {
+        int ret = targets_[default_]->MkDir(path, mode);
+
+        for (size_t i = 0; i < targets_.size(); ++i) {
+            if (i != default_) {
+                targets_[i]->MkDir(path, mode);
+            }
+        }
+        return ret;
+    }
+
+    int Placement::RmDir(const std::string& path)
+    {
+        for (size_t i = 0; i < targets_.size(); ++i) {
+            if ((i != default_) && targets_[i]->RmDir(path) && (errno != ENOENT)) {
+                return -1;
+            }
+        }
+        return targets_[default_]->RmDir(path);
+    }
+
+    int Placement::Rename(const std::string& name, const std::string& newname)
+    {
+        size_t from;
+
+        if (!locate(name, from)) {
+            //! -- a directory: renamed on every target, its objects are found again on next use
+            int ret = -1;
+            BOOST_FOREACH(ConnectorIntr & target, targets_)
+            {
+                if (!target->Rename(name, newname)) {
+                    ret = 0;
+                }
+            }
+            boost::mutex::scoped_lock lock(lock_);
+            std::string               under = name + "/";
+            for (Index::iterator it = index_.begin(); it != index_.end(); ) {
+                if (!it->first.compare(0, under.size(), under)) {
+                    it = index_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            detach(name, true);
+            return ret;
+        }
+
+        size_t old;
+        if (locate(newname, old) && (old != from)) {
+            targets_[old]->Unlink(newname);
+        }
+        int ret = targets_[from]->Rename(name, newname);
+        if (ret) {
+            return ret;
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        Index::iterator           it = index_.find(name);
+        if (it == index_.end()) {
+            return 0;
+        }
+        Entry moved = it->second;
+        index_.erase(it);
+        moved.queued = false;
+        ++moved.version;
+        detach(newname, false);
+        for (Descriptors::iterator d = descriptors_.begin(); d != descriptors_.end(); ++d) {
+            if (d->second.path == name) {
+                d->second.path = newname;
+            }
+        }
+        Entry& renamed = index_[newname] = moved;
+        reconsider(newname, renamed);
+        return 0;
+    }
+
+    Connector *PlacementFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Placement(name, config, fd_manager, log);
+    }
+}
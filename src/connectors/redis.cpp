@@ -0,0 +1,528 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+}
+#include <boost/lexical_cast.hpp>
+#include "connectors/redis.h"
+#include "path.h"
+
+namespace FWL {
+    Redis::Command& Redis::Command::operator<<(long long arg)
+    {
+        args_.push_back(boost::lexical_cast<std::string>(arg));
+        return *this;
+    }
+
+    void Redis::Command::Serialize(std::string& out) const
+    {
+        char buf[32];
+
+        ::snprintf(&buf[0], sizeof(buf), "*%lu\r\n", (unsigned long)args_.size());
+        out.append(&buf[0]);
+        for (std::vector<std::string>::const_iterator it = args_.begin(); it != args_.end(); ++it) {
+            ::snprintf(&buf[0], sizeof(buf), "$%lu\r\n", (unsigned long)it->size());
+            out.append(&buf[0]).append(*it).append("\r\n");
+        }
+    }
+
+    Redis::Redis(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+        , unix_socket_(config.get<std::string>("unix_socket", ""))
+        , host_(config.get<std::string>("host", "127.0.0.1"))
+        , port_(config.get<std::string>("port", "6379"))
+        , password_(config.get<std::string>("password", ""))
+        , db_(config.get<int>("db", 0))
+        , key_prefix_(config.get<std::string>("key_prefix", ""))
+        , scan_count_(config.get<size_t>("scan_count", 0))
+        , sock_(-1)
+        , pending_(0)
+        , in_pos_(0)
+    {}
+
+    Redis::~Redis()
+    {
+        disconnect();
+    }
+
+    void Redis::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    void Redis::AfterFork(bool child)
+    {
+        //! -- the parent keeps talking on the inherited socket, the child dials its own
+        if (child) {
+            disconnect();
+        }
+        lock_.unlock();
+    }
+
+    bool Redis::connect(size_t& handshake)
+    {
+        handshake = 0;
+        if (sock_ >= 0) {
+            return true;
+        }
+
+        if (!unix_socket_.empty()) {
+            struct sockaddr_un addr;
+            ::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            ::strncpy(addr.sun_path, unix_socket_.c_str(), sizeof(addr.sun_path) - 1);
+            sock_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if ((sock_ < 0) || (::connect(sock_, (struct sockaddr *)&addr, sizeof(addr)) < 0)) {
+                Logger().Err("Redis: couldn't connect to %s: %s", unix_socket_.c_str(), ::strerror(errno));
+                disconnect();
+                return false;
+            }
+        } else {
+            struct addrinfo hints;
+            struct addrinfo *res = NULL;
+            ::memset(&hints, 0, sizeof(hints));
+            hints.ai_family   = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            if (::getaddrinfo(host_.c_str(), port_.c_str(), &hints, &res)) {
+                Logger().Err("Redis: couldn't resolve %s", host_.c_str());
+                return false;
+            }
+            for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+                sock_ = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                if (sock_ < 0) {
+                    continue;
+                }
+                if (!::connect(sock_, ai->ai_addr, ai->ai_addrlen)) {
+                    break;
+                }
+                ::close(sock_);
+                sock_ = -1;
+            }
+            ::freeaddrinfo(res);
+            if (sock_ < 0) {
+                Logger().Err("Redis: couldn't connect to %s:%s", host_.c_str(), port_.c_str());
+                return false;
+            }
+            int flag = 1;
+            ::setsockopt(sock_, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        }
+
+        std::string hello;
+        if (!password_.empty()) {
+            (Command() << "AUTH" << password_).Serialize(hello);
+            ++handshake;
+        }
+        if (db_) {
+            (Command() << "SELECT" << (long long)db_).Serialize(hello);
+            ++handshake;
+        }
+        out_.insert(0, hello);
+        pending_ += handshake;
+        return true;
+    }
+
+    void Redis::disconnect()
+    {
+        if (sock_ >= 0) {
+            ::close(sock_);
+            sock_ = -1;
+        }
+        out_.clear();
+        in_.clear();
+        in_pos_  = 0;
+        pending_ = 0;
+    }
+
+    bool Redis::fill()
+    {
+        if (in_pos_ == in_.size()) {
+            in_.clear();
+            in_pos_ = 0;
+        }
+        char    buf[16384];
+        ssize_t n = ::recv(sock_, &buf[0], sizeof(buf), 0);
+        if (n <= 0) {
+            Logger().Err("Redis: connection lost");
+            return false;
+        }
+        in_.append(&buf[0], n);
+        return true;
+    }
+
+    bool Redis::line(std::string& str)
+    {
+        size_t end;
+
+        while ((end = in_.find("\r\n", in_pos_)) == std::string::npos) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        str.assign(in_, in_pos_, end - in_pos_);
+        in_pos_ = end + 2;
+        return true;
+    }
+
+    bool Redis::parse(Reply& reply)
+    {
+        std::string head;
+
+        if (!line(head) || head.empty()) {
+            return false;
+        }
+        long long len = ::atoll(head.c_str() + 1);
+        switch (head[0]) {
+            case '+':
+                reply.type = Reply::Status;
+                reply.str.assign(head, 1, std::string::npos);
+                return true;
+            case '-':
+                reply.type = Reply::Error;
+                reply.str.assign(head, 1, std::string::npos);
+                return true;
+            case ':':
+                reply.type    = Reply::Integer;
+                reply.integer = len;
+                return true;
+            case '$':
+                if (len < 0) {
+                    reply.type = Reply::Nil;
+                    return true;
+                }
+                while (in_.size() - in_pos_ < (size_t)len + 2) {
+                    if (!fill()) {
+                        return false;
+                    }
+                }
+                reply.type = Reply::Bulk;
+                reply.str.assign(in_, in_pos_, len);
+                in_pos_ += len + 2;
+                return true;
+            case '*':
+                if (len < 0) {
+                    reply.type = Reply::Nil;
+                    return true;
+                }
+                reply.type = Reply::Array;
+                reply.elements.resize(len);
+                for (long long i = 0; i < len; ++i) {
+                    if (!parse(reply.elements[i])) {
+                        return false;
+                    }
+                }
+                return true;
+        }
+        Logger().Err("Redis: protocol error");
+        return false;
+    }
+
+    void Redis::queue(const Command& cmd)
+    {
+        cmd.Serialize(out_);
+        ++pending_;
+    }
+
+    bool Redis::exec(Replies& replies)
+    {
+        size_t handshake = 0;
+
+        replies.clear();
+        if (!pending_) {
+            return true;
+        }
+        QueryProbe probe(Name(), "exec", out_.c_str());
+        if (!connect(handshake)) {
+            out_.clear();
+            pending_ = 0;
+            return false;
+        }
+        size_t count = pending_;
+        size_t sent  = 0;
+        while (sent < out_.size()) {
+            ssize_t n = ::send(sock_, out_.data() + sent, out_.size() - sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                Logger().Err("Redis: send: %s", ::strerror(errno));
+                disconnect();
+                return false;
+            }
+            sent += n;
+        }
+        out_.clear();
+        pending_ = 0;
+
+        replies.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            if (!parse(replies[i])) {
+                disconnect();
+                return false;
+            }
+        }
+        for (size_t i = 0; i < handshake; ++i) {
+            if (!replies[i].Ok()) {
+                Logger().Err("Redis: %s", replies[i].str.c_str());
+                disconnect();
+                return false;
+            }
+        }
+        replies.erase(replies.begin(), replies.begin() + handshake);
+        probe.Ok();
+        return true;
+    }
+
+    bool Redis::exec(const Command& cmd, Reply& reply)
+    {
+        Replies replies;
+
+        queue(cmd);
+        if (!exec(replies)) {
+            return false;
+        }
+        reply = replies.front();
+        if (!reply.Ok()) {
+            Logger().Err("Redis: %s", reply.str.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool Redis::members(const std::string& key, std::vector<std::string>& names)
+    {
+        Reply reply;
+
+        if (!scan_count_) {
+            if (!exec(Command() << "SMEMBERS" << key, reply)) {
+                return false;
+            }
+            for (size_t i = 0; i < reply.elements.size(); ++i) {
+                names.push_back(reply.elements[i].str);
+            }
+            return true;
+        }
+
+        std::string cursor("0");
+        do {
+            if (!exec(Command() << "SSCAN" << key << cursor << "COUNT" << (long long)scan_count_, reply)) {
+                return false;
+            }
+            if ((reply.elements.size() < 2)) {
+                return false;
+            }
+            cursor = reply.elements[0].str;
+            const Replies& batch = reply.elements[1].elements;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                names.push_back(batch[i].str);
+            }
+        } while (cursor != "0");
+        return true;
+    }
+
+    bool Redis::Exists(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Reply                     reply;
+
+        return exec(Command() << "EXISTS" << fileKey(file->Name()), reply) && reply.integer > 0;
+    }
+
+    bool Redis::Create(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Replies                   replies;
+
+        queue(Command() << "SET" << fileKey(file->Name()) << "" << "NX");
+        queue(Command() << "SADD" << dirKey(Path::Directory(file->Name())) << Path::File(file->Name()));
+        return exec(replies) && replies[0].Ok() && replies[1].Ok();
+    }
+
+    bool Redis::Truncate(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Reply                     reply;
+
+        return exec(Command() << "SET" << fileKey(file->Name()) << "" << "XX", reply) && reply.type != Reply::Nil;
+    }
+
+    int Redis::Write(FileIntr& file, const void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Reply                     reply;
+        std::string               value((const char *)data, size);
+        bool                      ok;
+
+        if (file->Flags() & O_APPEND) {
+            ok = exec(Command() << "APPEND" << fileKey(file->Name()) << value, reply);
+        } else {
+            ok = exec(Command() << "SETRANGE" << fileKey(file->Name()) << (long long)file->Offset() << value, reply);
+        }
+        if (!ok) {
+            errno = EIO;
+            return -1;
+        }
+        return size;
+    }
+
+    int Redis::Read(FileIntr& file, void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Reply                     reply;
+
+        if (!size) {
+            return 0;
+        }
+        long long begin = file->Offset();
+        if (!exec(Command() << "GETRANGE" << fileKey(file->Name()) << begin << (long long)(begin + size - 1), reply)) {
+            errno = EIO;
+            return -1;
+        }
+        size_t msize = std::min(size, reply.str.size());
+        ::memcpy(data, reply.str.data(), msize);
+        return msize;
+    }
+
+    bool Redis::Open(DirectoryIntr& dir)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Reply                     reply;
+
+        if (!members(dirKey(dir->Name()), dir->Files())) {
+            return false;
+        }
+        if (!dir->Files().empty()) {
+            return true;
+        }
+        return exec(Command() << "EXISTS" << fileKey(dir->Name()), reply) && reply.integer > 0;
+    }
+
+    bool Redis::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    bool Redis::Close(FileIntr& file)
+    {
+        return true;
+    }
+
+    bool Redis::GetFileSize(FileIntr& file, size_t& size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Replies                   replies;
+
+        queue(Command() << "EXISTS" << fileKey(file->Name()));
+        queue(Command() << "STRLEN" << fileKey(file->Name()));
+        if (!exec(replies) || !replies[0].integer) {
+            return false;
+        }
+        size = replies[1].integer;
+        return true;
+    }
+
+    int Redis::MkDir(const std::string& path, mode_t mode)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Replies                   replies;
+
+        queue(Command() << "SET" << fileKey(path) << "" << "NX");
+        queue(Command() << "SADD" << dirKey(Path::Directory(path)) << Path::File(path));
+        if (!exec(replies)) {
+            errno = EIO;
+            return -1;
+        }
+        if (replies[0].type == Reply::Nil) {
+            errno = EEXIST;
+            return -1;
+        }
+        return 0;
+    }
+
+    int Redis::Unlink(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return unlink(path);
+    }
+
+    int Redis::unlink(const std::string& path)
+    {
+        Replies replies;
+
+        queue(Command() << "DEL" << fileKey(path));
+        queue(Command() << "SREM" << dirKey(Path::Directory(path)) << Path::File(path));
+        if (!exec(replies)) {
+            errno = EIO;
+            return -1;
+        }
+        if (!replies[0].integer) {
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+    int Redis::RmDir(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        Reply                     reply;
+
+        if (!exec(Command() << "SCARD" << dirKey(path), reply)) {
+            errno = EIO;
+            return -1;
+        }
+        if (reply.integer) {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+        return unlink(path);
+    }
+
+    int Redis::Rename(const std::string& name, const std::string& newname)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return rename(name, newname);
+    }
+
+    int Redis::rename(const std::string& name, const std::string& newname)
+    {
+        std::vector<std::string> children;
+
+        if (!members(dirKey(name), children)) {
+            errno = EIO;
+            return -1;
+        }
+        for (std::vector<std::string>::const_iterator it = children.begin(); it != children.end(); ++it) {
+            if (rename(name + "/" + *it, newname + "/" + *it) < 0) {
+                return -1;
+            }
+        }
+
+        Replies replies;
+        queue(Command() << "RENAME" << fileKey(name) << fileKey(newname));
+        queue(Command() << "SREM" << dirKey(Path::Directory(name)) << Path::File(name));
+        queue(Command() << "SADD" << dirKey(Path::Directory(newname)) << Path::File(newname));
+        if (!exec(replies)) {
+            errno = EIO;
+            return -1;
+        }
+        if (!replies[0].Ok()) {
+            errno = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+    Connector *RedisFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Redis(name, config, fd_manager, log);
+    }
+}
@@ -0,0 +1,249 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+}
+#include <boost/foreach.hpp>
+#include <boost/unordered_set.hpp>
+#include "connectors/sharded.h"
+
+namespace FWL {
+    Sharded::Sharded(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Composite(name, config, fd_manager, log)
+        , vnodes_(config.get<size_t>("vnodes", 160))
+        , by_parent_(config.get<std::string>("placement", "parent") == "parent")
+    {}
+
+    uint64_t Sharded::hash(const std::string& key)
+    {
+        uint64_t h = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < key.size(); ++i) {
+            h ^= (unsigned char)key[i];
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    std::string Sharded::parent(const std::string& path)
+    {
+        std::string::size_type slash = path.find_last_of('/');
+
+        if ((slash == std::string::npos) || !slash) {
+            return "/";
+        }
+        return path.substr(0, slash);
+    }
+
+    bool Sharded::Link(const ConnectorMap& connectors)
+    {
+        BOOST_FOREACH(const JsonNode::value_type & it, Config().get_child("shards"))
+        {
+            std::string   name   = it.second.get<std::string>("connector");
+            size_t        weight = it.second.get<size_t>("weight", 1);
+            ConnectorIntr child  = link(connectors, name);
+            if (!child) {
+                return false;
+            }
+            //! -- ring points are derived from the connector name, not its position,
+            //! -- so adding a shard only takes over the arcs its own points land on
+            for (size_t i = 0; i < vnodes_ * weight; ++i) {
+                char point[32];
+                snprintf(point, sizeof(point), "#%lu", (unsigned long)i);
+                ring_.insert(std::make_pair(hash(name + point), shards_.size()));
+            }
+            shards_.push_back(child);
+        }
+        if (shards_.empty()) {
+            Logger().Err("Sharded %s: no shards configured", Name().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    Connector& Sharded::shard(const std::string& key)
+    {
+        Ring::const_iterator it = ring_.lower_bound(hash(key));
+
+        if (it == ring_.end()) {
+            it = ring_.begin();
+        }
+        return *shards_[it->second];
+    }
+
+    Connector& Sharded::place(const std::string& path)
+    {
+        return shard(by_parent_ ? parent(path) : path);
+    }
+
+    Connector& Sharded::list(const std::string& dir)
+    {
+        if (by_parent_) {
+            return shard((dir.size() > 1 && dir[dir.size() - 1] == '/') ? dir.substr(0, dir.size() - 1) : dir);
+        }
+        return place(dir);
+    }
+
+    bool Sharded::Exists(FileIntr& file)
+    {
+        return exists(place(file->Name()), file);
+    }
+
+    bool Sharded::Create(FileIntr& file)
+    {
+        return create(place(file->Name()), file);
+    }
+
+    bool Sharded::Truncate(FileIntr& file)
+    {
+        return truncate(place(file->Name()), file);
+    }
+
+    int Sharded::Write(FileIntr& file, const void *data, size_t size)
+    {
+        return write(place(file->Name()), file, data, size);
+    }
+
+    int Sharded::Read(FileIntr& file, void *data, size_t size)
+    {
+        return read(place(file->Name()), file, data, size);
+    }
+
+    bool Sharded::Close(FileIntr& file)
+    {
+        return close(place(file->Name()), file);
+    }
+
+    bool Sharded::GetFileSize(FileIntr& file, size_t& size)
+    {
+        return length(place(file->Name()), file, size);
+    }
+
+    bool Sharded::Open(DirectoryIntr& dir)
+    {
+        if (by_parent_) {
+            return open(list(dir->Name()), dir);
+        }
+
+        //! -- placed by full path, the children of a directory are on every shard: merge their listings
+        boost::unordered_set<std::string> seen;
+        bool                              found = false;
+        BOOST_FOREACH(ConnectorIntr & it, shards_)
+        {
+            DirectoryIntr part(new Directory(-1, dir->Interned()));
+            if (!open(*it, part)) {
+                continue;
+            }
+            found = true;
+            BOOST_FOREACH(const std::string & name, part->Files())
+            {
+                if (seen.insert(name).second) {
+                    dir->AddFile(name);
+                }
+            }
+            close(*it, part);
+        }
+        return found;
+    }
+
+    bool Sharded::Close(DirectoryIntr& dir)
+    {
+        if (by_parent_) {
+            return close(list(dir->Name()), dir);
+        }
+        //! -- the per-shard listings were closed as soon as Open merged them
+        return true;
+    }
+
+    int Sharded::Unlink(const std::string& path)
+    {
+        return place(path).Unlink(path);
+    }
+
+    int Sharded::MkDir(const std::string& path, mode_t mode)
+    {
+        Connector& entry    = place(path);
+        Connector& children = list(path);
+        int        ret      = entry.MkDir(path, mode);
+
+        //! -- a directory's children hash on the directory itself, which may be another shard
+        if (!ret && (&children != &entry) && children.MkDir(path, mode) && (errno != EEXIST)) {
+            int error = errno;
+            entry.RmDir(path);
+            errno = error;
+            return -1;
+        }
+        return ret;
+    }
+
+    int Sharded::RmDir(const std::string& path)
+    {
+        Connector& entry    = place(path);
+        Connector& children = list(path);
+
+        if ((&children != &entry) && children.RmDir(path) && (errno != ENOENT)) {
+            return -1;
+        }
+        return entry.RmDir(path);
+    }
+
+    int Sharded::move(const std::string& name, const std::string& newname)
+    {
+        Connector& from = place(name);
+        Connector& to   = place(newname);
+        FileIntr   file(scratch(name, O_RDONLY));
+
+        if (exists(from, file)) {
+            if (&from == &to) {
+                return from.Rename(name, newname);
+            }
+            if (!copy(from, to, name, newname)) {
+                to.Unlink(newname);
+                errno = EIO;
+                return -1;
+            }
+            return from.Unlink(name);
+        }
+
+        //! -- directory: every descendant is placed by a path that changes, so move them one by one
+        DirectoryIntr dir(new Directory(-1, name));
+        if (!Open(dir)) {
+            errno = ENOENT;
+            return -1;
+        }
+        std::vector<std::string> entries(dir->Files());
+        Close(dir);
+
+        if (MkDir(newname, 0755) && (errno != EEXIST)) {
+            return -1;
+        }
+        BOOST_FOREACH(const std::string & entry, entries)
+        {
+            if ((entry == ".") || (entry == "..")) {
+                continue;
+            }
+            if (move(name + "/" + entry, newname + "/" + entry)) {
+                return -1;
+            }
+        }
+        return RmDir(name);
+    }
+
+    int Sharded::Rename(const std::string& name, const std::string& newname)
+    {
+        if (shards_.size() == 1) {
+            return shards_[0]->Rename(name, newname);
+        }
+        return move(name, newname);
+    }
+
+    Connector *ShardedFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Sharded(name, config, fd_manager, log);
+    }
+}
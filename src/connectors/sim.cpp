@@ -0,0 +1,382 @@
+extern "C" {
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+}
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+#include "connectors/sim.h"
+#include "path.h"
+
+namespace FWL {
+    Sim::Sim(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Connector(name, config, fd_manager, log)
+        , random_(config.get<unsigned int>("seed", 1))
+    {
+        static const char *kinds[Kinds] = { "read", "write", "meta" };
+        Profile            defaults;
+
+        ::memset(&defaults, 0, sizeof(defaults));
+        defaults.tail_alpha = 1.5;
+        defaults.error      = EIO;
+        //! -- top level settings apply to every kind of operation, "read", "write" and "meta" override them
+        defaults = profile(config, defaults);
+        for (int kind = 0; kind < Kinds; ++kind) {
+            JsonNodeConstOp node = config.get_child_optional(kinds[kind]);
+            profiles_[kind] = node ? profile(*node, defaults) : defaults;
+        }
+        children_[""];
+    }
+
+    void Sim::BeforeFork()
+    {
+        random_lock_.lock();
+        lock_.lock();
+    }
+
+    void Sim::AfterFork(bool child)
+    {
+        lock_.unlock();
+        random_lock_.unlock();
+    }
+
+    Sim::Profile Sim::profile(const JsonNode& config, const Profile& defaults)
+    {
+        Profile     profile      = defaults;
+        std::string distribution = config.get<std::string>("latency", "");
+
+        if (distribution == "fixed") {
+            profile.distribution = Fixed;
+        } else if (distribution == "normal") {
+            profile.distribution = Normal;
+        } else if (distribution == "longtail") {
+            profile.distribution = LongTail;
+        }
+        profile.latency_us    = config.get<double>("latency_us", defaults.latency_us);
+        profile.stddev_us     = config.get<double>("stddev_us", defaults.stddev_us);
+        profile.tail_alpha    = std::max(config.get<double>("tail_alpha", defaults.tail_alpha), 1.01);
+        profile.max_us        = config.get<double>("max_us", defaults.max_us);
+        profile.ops_per_sec   = config.get<double>("ops_per_sec", defaults.ops_per_sec);
+        profile.bytes_per_sec = config.get<double>("bytes_per_sec", defaults.bytes_per_sec);
+        profile.error_rate    = config.get<double>("error_rate", defaults.error_rate);
+        profile.error         = config.get<int>("error", defaults.error);
+        profile.next_us       = 0;
+        return profile;
+    }
+
+    std::string Sim::normalize(const std::string& path)
+    {
+        size_t end = path.size();
+
+        while (end && (path[end - 1] == '/')) {
+            --end;
+        }
+        return path.substr(0, end);
+    }
+
+    double Sim::now()
+    {
+        struct timespec ts;
+
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+    }
+
+    bool Sim::inject(Kind kind, size_t bytes)
+    {
+        Profile& profile = profiles_[kind];
+        double   delay;
+        bool     fail;
+        {
+            boost::mutex::scoped_lock lock(random_lock_);
+            boost::uniform_01<double> uniform;
+            double                    latency = profile.latency_us;
+
+            if (profile.distribution == Normal) {
+                boost::normal_distribution<double> normal(profile.latency_us, profile.stddev_us);
+                latency = normal(random_);
+            } else if (profile.distribution == LongTail) {
+                //! -- Pareto scaled so that its mean is latency_us
+                double scale = profile.latency_us * (profile.tail_alpha - 1) / profile.tail_alpha;
+                latency = scale / ::pow(1 - uniform(random_), 1 / profile.tail_alpha);
+            }
+            if ((profile.max_us > 0) && (latency > profile.max_us)) {
+                latency = profile.max_us;
+            }
+            fail = (profile.error_rate > 0) && (uniform(random_) < profile.error_rate);
+
+            //! -- throughput limits queue operations behind each other, like a saturated server would
+            double start = now();
+            double cost  = 0;
+            if (profile.ops_per_sec > 0) {
+                cost += 1e6 / profile.ops_per_sec;
+            }
+            if (profile.bytes_per_sec > 0) {
+                cost += bytes * 1e6 / profile.bytes_per_sec;
+            }
+            delay = std::max(latency, 0.0);
+            if (cost > 0) {
+                double begin = std::max(start, profile.next_us);
+                profile.next_us = begin + cost;
+                delay          += profile.next_us - start;
+            }
+        }
+
+        if (delay >= 1) {
+            struct timespec ts;
+            ts.tv_sec  = (time_t)(delay / 1e6);
+            ts.tv_nsec = (long)(::fmod(delay, 1e6) * 1e3);
+            while (::nanosleep(&ts, &ts) && (errno == EINTR)) {}
+        }
+        if (fail) {
+            FWL_DBG(Logger(), "Sim: injected error %d", profile.error);
+            errno = profile.error;
+            return false;
+        }
+        return true;
+    }
+
+    void Sim::attach(const std::string& path)
+    {
+        std::string parent = Path::Directory(path);
+        bool        fresh  = children_.find(parent) == children_.end();
+
+        children_[parent].insert(Path::File(path));
+        if (fresh && !parent.empty()) {
+            attach(parent);
+        }
+    }
+
+    void Sim::detach(const std::string& path)
+    {
+        Children::iterator it = children_.find(Path::Directory(path));
+
+        if (it != children_.end()) {
+            it->second.erase(Path::File(path));
+        }
+    }
+
+    void Sim::move(const std::string& from, const std::string& to)
+    {
+        Children::iterator dir = children_.find(from);
+        if (dir != children_.end()) {
+            std::set<std::string> names;
+            names.swap(dir->second);
+            children_.erase(dir);
+            children_[to] = names;
+            BOOST_FOREACH(const std::string & name, names)
+            {
+                move(from + "/" + name, to + "/" + name);
+            }
+        }
+
+        Files::iterator file = files_.find(from);
+        if (file != files_.end()) {
+            files_[to].swap(file->second);
+            files_.erase(from);
+        }
+    }
+
+    bool Sim::Exists(FileIntr& file)
+    {
+        if (!inject(MetaOp, 0)) {
+            return false;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        return files_.count(file->Name());
+    }
+
+    bool Sim::Create(FileIntr& file)
+    {
+        if (!inject(MetaOp, 0)) {
+            return false;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        files_[file->Name()].clear();
+        attach(file->Name());
+        return true;
+    }
+
+    bool Sim::Truncate(FileIntr& file)
+    {
+        return Create(file);
+    }
+
+    int Sim::Write(FileIntr& file, const void *data, size_t size)
+    {
+        if (!inject(WriteOp, size)) {
+            return -1;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        Files::iterator           it = files_.find(file->Name());
+        if (it == files_.end()) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        size_t offset = file->Offset();
+        if (it->second.size() < offset + size) {
+            it->second.resize(offset + size);
+        }
+        it->second.replace(offset, size, (const char *)data, size);
+        return size;
+    }
+
+    int Sim::Read(FileIntr& file, void *data, size_t size)
+    {
+        size_t length;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            Files::const_iterator     it = files_.find(file->Name());
+            if (it == files_.end()) {
+                errno = ENOENT;
+                return -1;
+            }
+            length = it->second.size();
+        }
+
+        size_t offset = file->Offset();
+        size_t n      = (offset < length) ? std::min(size, length - offset) : 0;
+        if (!inject(ReadOp, n)) {
+            return -1;
+        }
+
+        boost::mutex::scoped_lock lock(lock_);
+        Files::const_iterator     it = files_.find(file->Name());
+        if (it == files_.end()) {
+            errno = ENOENT;
+            return -1;
+        }
+        n = (offset < it->second.size()) ? std::min(size, it->second.size() - offset) : 0;
+        ::memcpy(data, it->second.data() + offset, n);
+        return n;
+    }
+
+    bool Sim::Close(FileIntr& file)
+    {
+        return true;
+    }
+
+    bool Sim::GetFileSize(FileIntr& file, size_t& size)
+    {
+        if (!inject(MetaOp, 0)) {
+            return false;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        Files::const_iterator     it = files_.find(file->Name());
+        if (it == files_.end()) {
+            errno = ENOENT;
+            return false;
+        }
+        size = it->second.size();
+        return true;
+    }
+
+    bool Sim::Open(DirectoryIntr& dir)
+    {
+        if (!inject(MetaOp, 0)) {
+            return false;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        Children::const_iterator  it = children_.find(normalize(dir->Name()));
+        if (it == children_.end()) {
+            errno = ENOENT;
+            return false;
+        }
+        BOOST_FOREACH(const std::string & name, it->second)
+        {
+            dir->AddFile(name);
+        }
+        return true;
+    }
+
+    bool Sim::Close(DirectoryIntr& dir)
+    {
+        return true;
+    }
+
+    int Sim::MkDir(const std::string& path, mode_t mode)
+    {
+        if (!inject(MetaOp, 0)) {
+            return -1;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               dir = normalize(path);
+        if (children_.count(dir) || files_.count(dir)) {
+            errno = EEXIST;
+            return -1;
+        }
+        children_[dir];
+        attach(dir);
+        return 0;
+    }
+
+    int Sim::Unlink(const std::string& path)
+    {
+        if (!inject(MetaOp, 0)) {
+            return -1;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        if (!files_.erase(path)) {
+            errno = ENOENT;
+            return -1;
+        }
+        detach(path);
+        return 0;
+    }
+
+    int Sim::RmDir(const std::string& path)
+    {
+        if (!inject(MetaOp, 0)) {
+            return -1;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               dir = normalize(path);
+        Children::iterator        it  = children_.find(dir);
+        if ((it == children_.end()) || dir.empty()) {
+            errno = dir.empty() ? EBUSY : ENOENT;
+            return -1;
+        }
+        if (!it->second.empty()) {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+        children_.erase(it);
+        detach(dir);
+        return 0;
+    }
+
+    int Sim::Rename(const std::string& name, const std::string& newname)
+    {
+        if (!inject(MetaOp, 0)) {
+            return -1;
+        }
+        boost::mutex::scoped_lock lock(lock_);
+        std::string               from = normalize(name);
+        std::string               to   = normalize(newname);
+        if (!files_.count(from) && !children_.count(from)) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (from == to) {
+            return 0;
+        }
+        if (!to.compare(0, from.size() + 1, from + "/")) {
+            errno = EINVAL;
+            return -1;
+        }
+        files_.erase(to);
+        detach(from);
+        move(from, to);
+        attach(to);
+        return 0;
+    }
+
+    Connector *SimFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Sim(name, config, fd_manager, log);
+    }
+}
@@ -0,0 +1,442 @@
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+}
+#include <algorithm>
+#include <boost/bind.hpp>
+#include "connectors/tiered.h"
+
+namespace FWL {
+    void Tiered::Counter::Report(Log& log, const std::string& name, const char *tier) const
+    {
+        unsigned long total = hits + misses;
+
+        log.Inf("Tiered %s: %s tier hit rate %.1f%% (%lu hits, %lu misses)", name.c_str(), tier, total ? 100.0 * hits / total : 0.0, hits, misses);
+    }
+
+    Tiered::Tiered(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+        : Composite(name, config, fd_manager, log)
+        , async_(config.get<std::string>("write_mode", "sync") == "async")
+        , admission_(AdmitAlways)
+        , admission_size_(config.get<size_t>("admission_max_size", 1 << 20))
+        , eviction_(EvictLru)
+        , capacity_(config.get<size_t>("capacity", 64 << 20))
+        , stats_interval_(config.get<unsigned long>("stats_interval", 10000))
+        , stop_(false)
+        , used_(0)
+    {
+        std::string admission = config.get<std::string>("admission", "always");
+        if (admission == "second_access") {
+            admission_ = AdmitSecondAccess;
+        } else if (admission == "size") {
+            admission_ = AdmitSize;
+        }
+
+        std::string eviction = config.get<std::string>("eviction", "lru");
+        if (eviction == "fifo") {
+            eviction_ = EvictFifo;
+        } else if (eviction == "none") {
+            eviction_ = EvictNone;
+        }
+
+        if (async_) {
+            destager_ = boost::thread(boost::bind(&Tiered::destager, this));
+        }
+    }
+
+    Tiered::~Tiered()
+    {
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            stop_ = true;
+            wakeup_.notify_all();
+        }
+        if (destager_.joinable()) {
+            destager_.join();
+        }
+        upper_stats_.Report(Logger(), Name(), "upper");
+        lower_stats_.Report(Logger(), Name(), "lower");
+    }
+
+    void Tiered::BeforeFork()
+    {
+        lock_.lock();
+    }
+
+    void Tiered::AfterFork(bool child)
+    {
+        if (child) {
+            //! -- files dirty at fork time are destaged by the parent
+            dirty_.clear();
+            destaging_.clear();
+            destage_.clear();
+            Renew(wakeup_);
+            Renew(destager_);
+        }
+        lock_.unlock();
+        if (child && async_) {
+            destager_ = boost::thread(boost::bind(&Tiered::destager, this));
+        }
+    }
+
+    bool Tiered::Link(const ConnectorMap& connectors)
+    {
+        upper_ = link(connectors, Config().get<std::string>("upper"));
+        lower_ = link(connectors, Config().get<std::string>("lower"));
+        return upper_ && lower_;
+    }
+
+    bool Tiered::resident(const std::string& path)
+    {
+        return residents_.count(path) > 0;
+    }
+
+    bool Tiered::admit(FileIntr& file)
+    {
+        switch (admission_) {
+            case AdmitAlways:
+                return true;
+            case AdmitSecondAccess:
+                if (accesses_.size() > capacity_ / 64) {
+                    accesses_.clear();
+                }
+                return ++accesses_[file->Name()] >= 2;
+            case AdmitSize: {
+                size_t size = 0;
+                return length(*lower_, file, size) && (size <= admission_size_);
+            }
+        }
+        return false;
+    }
+
+    bool Tiered::fill(FileIntr& file)
+    {
+        if (!copy(*lower_, *upper_, file->Name(), file->Name())) {
+            return false;
+        }
+        size_t   size = 0;
+        FileIntr probe(scratch(file->Name(), O_RDONLY));
+        length(*upper_, probe, size);
+        account(file->Name(), size);
+        accesses_.erase(file->Name());
+        evict();
+        return true;
+    }
+
+    void Tiered::account(const std::string& path, size_t size)
+    {
+        Residents::iterator it = residents_.find(path);
+
+        if (it == residents_.end()) {
+            Resident resident;
+            resident.size     = size;
+            resident.position = order_.insert(order_.end(), path);
+            residents_.insert(std::make_pair(path, resident));
+            used_ += size;
+            return;
+        }
+        used_           += size;
+        used_           -= it->second.size;
+        it->second.size  = size;
+        if (eviction_ == EvictLru) {
+            order_.splice(order_.end(), order_, it->second.position);
+        }
+    }
+
+    void Tiered::forget(const std::string& path)
+    {
+        Residents::iterator it = residents_.find(path);
+
+        if (it != residents_.end()) {
+            used_ -= it->second.size;
+            order_.erase(it->second.position);
+            residents_.erase(it);
+        }
+    }
+
+    void Tiered::evict()
+    {
+        if (eviction_ == EvictNone) {
+            return;
+        }
+        size_t candidates = order_.size();
+        while ((used_ > capacity_) && candidates--) {
+            std::string victim = order_.front();
+            if (dirty_.count(victim) || destaging_.count(victim) || opened_.count(victim)) {
+                order_.splice(order_.end(), order_, order_.begin());
+                continue;
+            }
+            upper_->Unlink(victim);
+            forget(victim);
+        }
+    }
+
+    void Tiered::touch(FileIntr& file)
+    {
+        if (eviction_ != EvictLru) {
+            return;
+        }
+        Residents::iterator it = residents_.find(file->Name());
+        if (it != residents_.end()) {
+            order_.splice(order_.end(), order_, it->second.position);
+        }
+    }
+
+    //! -- remembers descriptors reading or writing the upper copy, evict() leaves those files alone
+    void Tiered::use(FileIntr& file)
+    {
+        if (descriptors_.insert(std::make_pair(file->Fd(), file->Name())).second) {
+            ++opened_[file->Name()];
+        }
+    }
+
+    //! -- waits until the destager is done with path, so unlinks and renames don't race its copy
+    void Tiered::settle(boost::mutex::scoped_lock& lock, const std::string& path)
+    {
+        while (destaging_.count(path)) {
+            wakeup_.wait(lock);
+        }
+    }
+
+    void Tiered::stats()
+    {
+        if (stats_interval_ && !((upper_stats_.hits + upper_stats_.misses) % stats_interval_)) {
+            upper_stats_.Report(Logger(), Name(), "upper");
+            lower_stats_.Report(Logger(), Name(), "lower");
+        }
+    }
+
+    void Tiered::destager()
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        while (true) {
+            while (!stop_ && destage_.empty()) {
+                wakeup_.wait(lock);
+            }
+            if (destage_.empty()) {
+                return;
+            }
+            std::string path = destage_.front();
+            destage_.pop_front();
+            if (!dirty_.erase(path)) {
+                continue;
+            }
+            //! -- copy without the lock; writes landing meanwhile mark the file dirty again and queue another pass
+            destaging_.insert(path);
+            lock.unlock();
+            bool ok = copy(*upper_, *lower_, path, path);
+            lock.lock();
+            destaging_.erase(path);
+            if (!ok) {
+                Logger().Err("Tiered %s: couldn't destage %s", Name().c_str(), path.c_str());
+                dirty_.insert(path);
+            }
+            wakeup_.notify_all();
+        }
+    }
+
+    bool Tiered::Exists(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return resident(file->Name()) || exists(*lower_, file);
+    }
+
+    bool Tiered::Create(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!(exists(*upper_, file) ? truncate(*upper_, file) : create(*upper_, file))) {
+            return false;
+        }
+        account(file->Name(), 0);
+        if (async_) {
+            dirty_.insert(file->Name());
+            return true;
+        }
+        return exists(*lower_, file) ? truncate(*lower_, file) : create(*lower_, file);
+    }
+
+    bool Tiered::Truncate(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!(exists(*upper_, file) ? truncate(*upper_, file) : create(*upper_, file))) {
+            return false;
+        }
+        account(file->Name(), 0);
+        if (async_) {
+            dirty_.insert(file->Name());
+            return true;
+        }
+        return truncate(*lower_, file);
+    }
+
+    int Tiered::Write(FileIntr& file, const void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!resident(file->Name()) && !fill(file)) {
+            errno = EIO;
+            return -1;
+        }
+        use(file);
+        int ret = write(*upper_, file, data, size);
+        if (ret < 0) {
+            return ret;
+        }
+        Residents::const_iterator it = residents_.find(file->Name());
+        if (it != residents_.end()) {
+            account(file->Name(), std::max(it->second.size, (size_t)file->Offset() + ret));
+        }
+        if (async_) {
+            dirty_.insert(file->Name());
+            return ret;
+        }
+        return write(*lower_, file, data, ret);
+    }
+
+    int Tiered::Read(FileIntr& file, void *data, size_t size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        int                       ret;
+
+        if (resident(file->Name())) {
+            ++upper_stats_.hits;
+            touch(file);
+            use(file);
+            ret = read(*upper_, file, data, size);
+        } else {
+            ++upper_stats_.misses;
+            if (admit(file) && fill(file)) {
+                ++lower_stats_.hits;
+                use(file);
+                ret = read(*upper_, file, data, size);
+            } else {
+                ret = read(*lower_, file, data, size);
+                if (ret < 0) {
+                    ++lower_stats_.misses;
+                } else {
+                    ++lower_stats_.hits;
+                }
+            }
+        }
+        stats();
+        return ret;
+    }
+
+    bool Tiered::Open(DirectoryIntr& dir)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        bool                      found = open(*lower_, dir);
+
+        if (!async_ || (dirty_.empty() && destaging_.empty())) {
+            return found;
+        }
+
+        DirectoryIntr upper(new Directory(-1, dir->Interned()));
+        if (open(*upper_, upper)) {
+            boost::unordered_set<std::string> seen(dir->Files().begin(), dir->Files().end());
+            for (size_t i = 0; i < upper->Files().size(); ++i) {
+                const std::string& name = upper->Files()[i];
+                std::string path = dir->Name() + "/" + name;
+                if ((dirty_.count(path) || destaging_.count(path)) && seen.insert(name).second) {
+                    dir->AddFile(name);
+                    found = true;
+                }
+            }
+            close(*upper_, upper);
+        }
+        return found;
+    }
+
+    bool Tiered::Close(DirectoryIntr& dir)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return close(*lower_, dir);
+    }
+
+    bool Tiered::Close(FileIntr& file)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        bool                      ok = close(*upper_, file);
+
+        ok = close(*lower_, file) && ok;
+        Descriptors::iterator it = descriptors_.find(file->Fd());
+        if (it != descriptors_.end()) {
+            if (!--opened_[it->second]) {
+                opened_.erase(it->second);
+            }
+            descriptors_.erase(it);
+        }
+        if (async_ && dirty_.count(file->Name())) {
+            destage_.push_back(file->Name());
+            wakeup_.notify_all();
+        }
+        evict();
+        return ok;
+    }
+
+    bool Tiered::GetFileSize(FileIntr& file, size_t& size)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        return length(resident(file->Name()) ? *upper_ : *lower_, file, size);
+    }
+
+    int Tiered::MkDir(const std::string& path, mode_t mode)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        upper_->MkDir(path, mode);
+        return lower_->MkDir(path, mode);
+    }
+
+    int Tiered::Unlink(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        settle(lock, path);
+        forget(path);
+        dirty_.erase(path);
+        int upper = upper_->Unlink(path);
+        int lower = lower_->Unlink(path);
+        return (!upper || !lower) ? 0 : -1;
+    }
+
+    int Tiered::RmDir(const std::string& path)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        upper_->RmDir(path);
+        return lower_->RmDir(path);
+    }
+
+    int Tiered::Rename(const std::string& name, const std::string& newname)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        while (destaging_.count(name) || destaging_.count(newname)) {
+            wakeup_.wait(lock);
+        }
+        if (dirty_.count(name)) {
+            if (!copy(*upper_, *lower_, name, name)) {
+                errno = EIO;
+                return -1;
+            }
+            dirty_.erase(name);
+        }
+        forget(name);
+        forget(newname);
+        upper_->Unlink(name);
+        upper_->Unlink(newname);
+        return lower_->Rename(name, newname);
+    }
+
+    Connector *TieredFactory::Create(const std::string& name, const JsonNode& config, FdManager& fd_manager, LogIntr log)
+    {
+        return new Tiered(name, config, fd_manager, log);
+    }
+}
@@ -1,8 +1,11 @@
-#include <boost/detail/atomic_count.hpp>
 extern "C" {
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/sysctl.h>
 }
+#include <new>
+#include <boost/detail/atomic_count.hpp>
 #include "fdmanager.h"
 
 namespace FWL {
@@ -20,10 +23,27 @@ namespace FWL {
         return data;
     }
 
+    namespace {
+        //! -- open virtual descriptors at most; a power of two
+        const size_t slots = 1 << 16;
+        //! -- marks a slot taken whose descriptor isn't published yet
+        Connector *const claimed = reinterpret_cast<Connector *>(1);
+    }
+
     FdManager::FdManager()
         : begin_(getBeginFd())
         , fd_(begin_)
-    {}
+        , slots_(static_cast<Slot *>(::calloc(slots, sizeof(Slot))))
+    {
+        if (!slots_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    FdManager::~FdManager()
+    {
+        ::free(slots_);
+    }
 
     int FdManager::Begin() const
     {
@@ -32,34 +52,49 @@ namespace FWL {
 
     Connector *FdManager::GetConnector(int fd)
     {
-        if (fd < begin_) {
+        if (fd <= begin_) {
             return NULL;
         }
-        Connectors::const_iterator it = connectors_.find(fd);
-        if (it != connectors_.end()) {
-            return it->second;
+        Slot&     slot      = slots_[(fd - begin_) & (slots - 1)];
+        Connector *connector = __atomic_load_n(&slot.connector, __ATOMIC_ACQUIRE);
+        if (!connector || (connector == claimed) || (__atomic_load_n(&slot.fd, __ATOMIC_ACQUIRE) != fd)) {
+            return NULL;
         }
-        return NULL;
+        return connector;
     }
 
     int FdManager::Get(Connector *connector)
     {
-        int fd = ++fd_;
-
-        connectors_.insert(std::make_pair(fd, connector));
-        return fd;
+        //! -- a slot still held by an older descriptor is skipped along with its number
+        for (size_t i = 0; i < slots; ++i) {
+            int       fd   = ++fd_;
+            Slot&     slot = slots_[(fd - begin_) & (slots - 1)];
+            Connector *none = NULL;
+            if (__atomic_compare_exchange_n(&slot.connector, &none, claimed, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&slot.fd, fd, __ATOMIC_RELEASE);
+                __atomic_store_n(&slot.connector, connector, __ATOMIC_RELEASE);
+                return fd;
+            }
+        }
+        return -1;
     }
 
     bool FdManager::Release(int fd, Connector *connector)
     {
-        Connectors::const_iterator it = connectors_.find(fd);
-
-        if (it != connectors_.end()) {
-            if (it->second == connector) {
-                connectors_.erase(it);
-                return true;
-            }
+        if (fd <= begin_) {
+            return false;
+        }
+        Slot& slot = slots_[(fd - begin_) & (slots - 1)];
+        if ((__atomic_load_n(&slot.fd, __ATOMIC_ACQUIRE) != fd) || (__atomic_load_n(&slot.connector, __ATOMIC_ACQUIRE) != connector)) {
+            return false;
         }
-        return false;
+        __atomic_store_n(&slot.fd, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&slot.connector, (Connector *)NULL, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void FdManager::Clear()
+    {
+        ::memset(slots_, 0, slots * sizeof(Slot));
     }
 }
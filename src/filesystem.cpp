@@ -1,9 +1,79 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <new>
 #include "filesystem.h"
+#include "pool.h"
 
 namespace FWL {
-    Directory::Directory(int fd, const std::string& name)
+    namespace {
+        //! -- never destroyed: descriptors may still be released while other statics go away at exit
+        Pool& files()
+        {
+            static Pool *pool = new Pool(sizeof(File));
+            return *pool;
+        }
+
+        Pool& directories()
+        {
+            static Pool *pool = new Pool(sizeof(Directory));
+            return *pool;
+        }
+
+        //! -- a class derived from File or Directory is bigger than the blocks and goes to malloc
+        void *allocate(Pool& pool, size_t size, size_t block)
+        {
+            void *ptr = (size == block) ? pool.Allocate() : ::malloc(size);
+
+            if (!ptr) {
+                throw std::bad_alloc();
+            }
+            return ptr;
+        }
+
+        void deallocate(Pool& pool, void *ptr, size_t size, size_t block)
+        {
+            if (size == block) {
+                pool.Free(ptr);
+            } else {
+                ::free(ptr);
+            }
+        }
+    }
+
+    void Node::BeforeFork()
+    {
+        files().BeforeFork();
+        directories().BeforeFork();
+    }
+
+    void Node::AfterFork()
+    {
+        directories().AfterFork();
+        files().AfterFork();
+    }
+
+    void *File::operator new(size_t size)
+    {
+        return allocate(files(), size, sizeof(File));
+    }
+
+    void File::operator delete(void *ptr, size_t size)
+    {
+        deallocate(files(), ptr, size, sizeof(File));
+    }
+
+    void *Directory::operator new(size_t size)
+    {
+        return allocate(directories(), size, sizeof(Directory));
+    }
+
+    void Directory::operator delete(void *ptr, size_t size)
+    {
+        deallocate(directories(), ptr, size, sizeof(Directory));
+    }
+
+    Directory::Directory(int fd, const PathHandle& name)
 	: Node(fd, name)
         , index_(0)
     {}
@@ -31,8 +101,9 @@ namespace FWL {
         return &dirent_;
     }
     
-    File::File(int fd, const std::string& name, int flags)
+    File::File(int fd, const PathHandle& name, int flags)
 	: Node(fd, name)
+	, offset_(0)
 	, flags_(flags)
     {}
 }
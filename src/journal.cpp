@@ -0,0 +1,423 @@
+extern "C" {
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+}
+#include <algorithm>
+#include <new>
+#include "journal.h"
+
+namespace FWL {
+    namespace {
+        //! -- "[YYYY-MM-DD HH:MM:SS] INF: ", put in front of the text by the writer
+        const size_t header  = 27;
+        //! -- a whole record, header and newline included; longer messages are cut
+        const size_t line    = 512;
+        //! -- records a thread can have queued
+        const size_t slots   = 128;
+        const size_t sinks   = 4;
+        //! -- records per writev, and sinks one batch of them may go to
+        const size_t batch   = 64;
+        const size_t targets = 8;
+        //! -- ms the writer lets records gather once they come in, and sleeps when none do
+        const long   linger  = 10;
+        const long   idle    = 1000;
+
+        Journal        *journal;
+        pthread_once_t once = PTHREAD_ONCE_INIT;
+
+        void deadline(struct timespec& until, long ms)
+        {
+            ::clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec  += ms / 1000;
+            until.tv_nsec += (ms % 1000) * 1000000;
+            if (until.tv_nsec >= 1000000000) {
+                ++until.tv_sec;
+                until.tv_nsec -= 1000000000;
+            }
+        }
+
+        //! -- runs after the static destructors, which may still log
+        void __attribute__((destructor)) shutdown()
+        {
+            if (journal) {
+                journal->Flush();
+            }
+        }
+    }
+
+    struct Journal::Record
+    {
+        time_t     time;
+        const char *severity;
+        int        fds[sinks];
+        size_t     fd_count;
+        size_t     size;
+        char       text[line];
+    };
+
+    //! -- single producer, single consumer: head moves only in the owning thread, tail only in the writer
+    struct Journal::Ring
+    {
+        size_t head;
+        size_t tail;
+        size_t dropped;
+        size_t reported;
+        bool   orphan;
+        Ring   *next;
+        Record records[slots];
+    };
+
+    Journal::Journal()
+        : running_(false)
+        , idle_(false)
+        , rings_(NULL)
+        , requested_(0)
+        , done_(0)
+        , last_time_(0)
+    {
+        ::pthread_key_create(&key_, &Journal::release);
+        ::pthread_mutex_init(&lock_, NULL);
+        ::pthread_cond_init(&wakeup_, NULL);
+        ::pthread_cond_init(&flushed_, NULL);
+        start();
+    }
+
+    void Journal::create()
+    {
+        journal = new Journal;
+    }
+
+    Journal& Journal::Instance()
+    {
+        ::pthread_once(&once, &Journal::create);
+        return *journal;
+    }
+
+    void Journal::release(void *ring)
+    {
+        __atomic_store_n(&static_cast<Ring *>(ring)->orphan, true, __ATOMIC_RELEASE);
+    }
+
+    void *Journal::writer(void *journal)
+    {
+        static_cast<Journal *>(journal)->run();
+        return NULL;
+    }
+
+    void Journal::start()
+    {
+        sigset_t all, saved;
+
+        //! -- signals are the host's business, not the writer's
+        ::sigfillset(&all);
+        ::pthread_sigmask(SIG_SETMASK, &all, &saved);
+        running_ = !::pthread_create(&writer_, NULL, &Journal::writer, this);
+        ::pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        if (running_) {
+            ::pthread_detach(writer_);
+        }
+    }
+
+    void Journal::run()
+    {
+        for (;;) {
+            ::pthread_mutex_lock(&lock_);
+            unsigned long requested = requested_;
+            Ring          *rings    = rings_;
+            ::pthread_mutex_unlock(&lock_);
+
+            //! -- rings are only ever unlinked here, so the list can be walked without the lock
+            bool wrote = false;
+            for (Ring *ring = rings; ring; ring = ring->next) {
+                wrote = drain(*ring) || wrote;
+            }
+
+            struct timespec until;
+            ::pthread_mutex_lock(&lock_);
+            reap();
+            if (done_ != requested) {
+                done_ = requested;
+                ::pthread_cond_broadcast(&flushed_);
+            }
+            if (requested_ == requested) {
+                if (wrote) {
+                    deadline(until, linger);
+                    ::pthread_cond_timedwait(&wakeup_, &lock_, &until);
+                } else {
+                    //! -- a producer that misses the flag has published its record before pending() looks
+                    __atomic_store_n(&idle_, true, __ATOMIC_SEQ_CST);
+                    if (!pending()) {
+                        deadline(until, idle);
+                        ::pthread_cond_timedwait(&wakeup_, &lock_, &until);
+                    }
+                    __atomic_store_n(&idle_, false, __ATOMIC_SEQ_CST);
+                }
+            }
+            ::pthread_mutex_unlock(&lock_);
+        }
+    }
+
+    Journal::Ring *Journal::ring()
+    {
+        Ring *ring = static_cast<Ring *>(::pthread_getspecific(key_));
+
+        if (ring || !running_) {
+            return ring;
+        }
+        ring = new (std::nothrow) Ring;
+        if (!ring) {
+            return NULL;
+        }
+        ring->head     = 0;
+        ring->tail     = 0;
+        ring->dropped  = 0;
+        ring->reported = 0;
+        ring->orphan   = false;
+        ::pthread_mutex_lock(&lock_);
+        ring->next = rings_;
+        rings_     = ring;
+        ::pthread_mutex_unlock(&lock_);
+        ::pthread_setspecific(key_, ring);
+        return ring;
+    }
+
+    bool Journal::pending() const
+    {
+        for (Ring *ring = rings_; ring; ring = ring->next) {
+            if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != ring->tail) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Journal::drain(Ring& ring)
+    {
+        struct Batch
+        {
+            int          fd;
+            size_t       count;
+            struct iovec iov[batch + 1];
+        };
+
+        Batch  batches[targets];
+        Record notice;
+        bool   wrote = false;
+
+        for (;;) {
+            size_t tail    = ring.tail;
+            size_t head    = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+            size_t dropped = __atomic_load_n(&ring.dropped, __ATOMIC_RELAXED);
+            size_t used    = 0;
+            size_t end     = tail;
+
+            if (head == tail) {
+                return wrote;
+            }
+            for ( ; (end != head) && (end - tail < batch); ++end) {
+                Record& record = ring.records[end % slots];
+                Batch   *found[sinks];
+                size_t  missing = 0;
+
+                for (size_t i = 0; i < record.fd_count; ++i) {
+                    found[i] = NULL;
+                    for (size_t j = 0; (j < used) && !found[i]; ++j) {
+                        if (batches[j].fd == record.fds[i]) {
+                            found[i] = &batches[j];
+                        }
+                    }
+                    missing += !found[i];
+                }
+                if (used + missing > targets) {
+                    break;
+                }
+                stamp(record);
+                for (size_t i = 0; i < record.fd_count; ++i) {
+                    if (!found[i]) {
+                        found[i]        = &batches[used++];
+                        found[i]->fd    = record.fds[i];
+                        found[i]->count = 0;
+                    }
+                    found[i]->iov[found[i]->count].iov_base = record.text;
+                    found[i]->iov[found[i]->count].iov_len  = record.size;
+                    ++found[i]->count;
+                }
+            }
+            //! -- the ring only fills up with records in it, so the notice always has sinks to go to
+            if (dropped != ring.reported) {
+                int size = ::snprintf(notice.text + header, line - header, "%lu log records dropped",
+                                      (unsigned long)(dropped - ring.reported));
+                notice.time     = ::time(NULL);
+                notice.severity = "WRN";
+                notice.text[header + size] = '\n';
+                notice.size     = header + size + 1;
+                stamp(notice);
+                for (size_t i = 0; i < used; ++i) {
+                    batches[i].iov[batches[i].count].iov_base = notice.text;
+                    batches[i].iov[batches[i].count].iov_len  = notice.size;
+                    ++batches[i].count;
+                }
+                ring.reported = dropped;
+            }
+            for (size_t i = 0; i < used; ++i) {
+                write(batches[i].fd, batches[i].iov, batches[i].count);
+            }
+            __atomic_store_n(&ring.tail, end, __ATOMIC_RELEASE);
+            wrote = true;
+        }
+    }
+
+    void Journal::reap()
+    {
+        for (Ring **it = &rings_; *it; ) {
+            Ring *ring = *it;
+
+            if (__atomic_load_n(&ring->orphan, __ATOMIC_ACQUIRE) && (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))) {
+                *it = ring->next;
+                delete ring;
+            } else {
+                it = &ring->next;
+            }
+        }
+    }
+
+    void Journal::stamp(Record& record)
+    {
+        if (record.time != last_time_) {
+            struct tm lt;
+            ::localtime_r(&record.time, &lt);
+            ::strftime(time_, sizeof(time_), "%Y-%m-%d %H:%M:%S", &lt);
+            last_time_ = record.time;
+        }
+        record.text[0] = '[';
+        ::memcpy(record.text + 1, time_, 19);
+        ::memcpy(record.text + 20, "] ", 2);
+        ::memcpy(record.text + 22, record.severity, 3);
+        ::memcpy(record.text + 25, ": ", 2);
+    }
+
+    //! -- straight to the kernel: the host's writev may be interposed too, and the sink may be one of its files
+    void Journal::write(int fd, struct iovec *iov, size_t count)
+    {
+        while (count) {
+            long written = ::syscall(SYS_writev, fd, iov, count);
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            for ( ; count && ((size_t)written >= iov->iov_len); ++iov, --count) {
+                written -= iov->iov_len;
+            }
+            if (count) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+                iov->iov_len -= written;
+            }
+        }
+    }
+
+    void Journal::fill(Record& record, const char *severity, const int *fds, size_t fd_count, const char *format, va_list args)
+    {
+        record.time     = ::time(NULL);
+        record.severity = severity;
+        record.fd_count = std::min(fd_count, sinks);
+        std::copy(fds, fds + record.fd_count, record.fds);
+
+        int    size   = ::vsnprintf(record.text + header, line - header, format, args);
+        size_t length = (size < 0) ? 0 : std::min((size_t)size, line - header - 1);
+
+        record.text[header + length] = '\n';
+        record.size = header + length + 1;
+    }
+
+    void Journal::Write(const char *severity, const int *fds, size_t fd_count, bool urgent, const char *format, va_list args)
+    {
+        Ring *ring = this->ring();
+
+        if (!ring) {
+            //! -- no writer thread, or no memory for a ring: the caller writes its record itself
+            Record record;
+            fill(record, severity, fds, fd_count, format, args);
+
+            ::pthread_mutex_lock(&lock_);
+            stamp(record);
+            for (size_t i = 0; i < record.fd_count; ++i) {
+                struct iovec iov;
+                iov.iov_base = record.text;
+                iov.iov_len  = record.size;
+                write(record.fds[i], &iov, 1);
+            }
+            ::pthread_mutex_unlock(&lock_);
+            return;
+        }
+
+        size_t head = ring->head;
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (head - tail == slots) {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        fill(ring->records[head % slots], severity, fds, fd_count, format, args);
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+
+        if (urgent || (head + 1 - tail == slots / 2) || __atomic_load_n(&idle_, __ATOMIC_SEQ_CST)) {
+            ::pthread_mutex_lock(&lock_);
+            __atomic_store_n(&idle_, false, __ATOMIC_SEQ_CST);
+            ::pthread_cond_signal(&wakeup_);
+            ::pthread_mutex_unlock(&lock_);
+        }
+    }
+
+    void Journal::Flush()
+    {
+        if (!running_) {
+            return;
+        }
+
+        struct timespec until;
+        deadline(until, 1000);
+
+        ::pthread_mutex_lock(&lock_);
+        unsigned long target = ++requested_;
+        ::pthread_cond_signal(&wakeup_);
+        while ((done_ < target) && !::pthread_cond_timedwait(&flushed_, &lock_, &until)) {
+        }
+        ::pthread_mutex_unlock(&lock_);
+    }
+
+    void Journal::BeforeFork()
+    {
+        ::pthread_mutex_lock(&lock_);
+    }
+
+    void Journal::AfterFork(bool child)
+    {
+        ::pthread_mutex_unlock(&lock_);
+        if (!child) {
+            return;
+        }
+        //! -- the writer stayed in the parent, possibly inside a wait, and so did the other threads
+        ::pthread_cond_init(&wakeup_, NULL);
+        ::pthread_cond_init(&flushed_, NULL);
+
+        Ring *own = static_cast<Ring *>(::pthread_getspecific(key_));
+        for (Ring *ring = rings_; ring; ring = ring->next) {
+            ring->tail     = ring->head;
+            ring->reported = ring->dropped;
+            if (ring != own) {
+                ring->orphan = true;
+            }
+        }
+        idle_      = false;
+        requested_ = 0;
+        done_      = 0;
+        start();
+    }
+}
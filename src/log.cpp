@@ -1,42 +1,21 @@
 #include "log.h"
+#include "journal.h"
 
-#define PRINT(lev, lev_txt)       \
-    if (level_ < lev) { return; } \
-    va_list args;                 \
-    va_start(args, format);       \
-    print(lev_txt, format, args);
+#define PRINT(lev, lev_txt)            \
+    if (level_ < lev) { return; }      \
+    va_list args;                      \
+    va_start(args, format);            \
+    print(lev, lev_txt, format, args); \
+    va_end(args);
 
 namespace FWL {
-    const char *Log::makeTime()
+    void Log::print(Level level, const char *sev, const char *format, va_list args)
     {
-        time_t t = ::time(NULL);
-
-        if (last_time_ == t) {
-            return &time_[0];
-        }
-        struct tm *lt = ::localtime(&t);
-        ::strftime(&time_[0], sizeof(time_), "%Y-%m-%d %H:%M:%S", lt);
-        return &time_[0];
-    }
-
-    std::string Log::record(const std::string& sev, const std::string& format, va_list args)
-    {
-        char        buf[1024];
-        size_t      size = ::vsprintf(&buf[0], format.c_str(), args);
-        std::string res(size + sizeof(time_) + sev.size() + 5, 0);
-
-        ::sprintf((char *)res.data(), "[%s] %s: %s\n", makeTime(), sev.c_str(), &buf[0]);
-        return res;
-    }
-
-    void Log::print(const std::string& sev, const std::string& format, va_list args)
-    {
-        std::string rec(record(sev, format, args));
-
-        for (Sinks::iterator it = sinks_.begin(); it != sinks_.end(); ++it) {
-            ::fprintf(*it, "%s", rec.c_str());
-            ::fflush(*it);
+        if (sinks_.empty()) {
+            return;
         }
+        //! -- errors wake the writer instead of waiting for the next batch
+        Journal::Instance().Write(sev, &sinks_[0], sinks_.size(), level == Error, format, args);
     }
 
     Log::Log(Level level)
@@ -106,33 +85,36 @@ namespace FWL {
         if (it == registered_sinks_.end()) {
             return false;
         }
-        sinks_.push_back(it->second);
+        sinks_.push_back(::fileno(it->second));
         return true;
     }
 
     Log::~Log()
     {
-        for (Sinks::iterator it = sink_files_.begin(); it != sink_files_.end(); ++it) {
+        if (!sink_files_.empty()) {
+            Journal::Instance().Flush();
+        }
+        for (SinkFiles::iterator it = sink_files_.begin(); it != sink_files_.end(); ++it) {
             ::fclose(*it);
         }
     }
 
-    void Log::Inf(const std::string& format, ...)
+    void Log::Inf(const char *format, ...)
     {
         PRINT(Info, "INF");
     }
 
-    void Log::Dbg(const std::string& format, ...)
+    void Log::Dbg(const char *format, ...)
     {
         PRINT(Debug, "DBG");
     }
 
-    void Log::Wrn(const std::string& format, ...)
+    void Log::Wrn(const char *format, ...)
     {
         PRINT(Warn, "WRN");
     }
 
-    void Log::Err(const std::string& format, ...)
+    void Log::Err(const char *format, ...)
     {
         PRINT(Error, "ERR");
     }
@@ -15,19 +15,43 @@
 #include "real.h"
 #include "json.h"
 #include "log.h"
+#include "journal.h"
 #include "main.h"
+extern "C" {
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+}
 namespace FWL {
-    Main::Location::Location(ComparerIntr comparer, Connector *connector)
+    static Real real;
+    //! -- a signal handler can reach only one Main: the first one configured for a signal
+    static int  reload_event = -1;
+
+    static void signalled(int)
+    {
+        int saved = errno;
+        int event = __atomic_load_n(&reload_event, __ATOMIC_RELAXED);
+
+        if (event != -1) {
+            ::eventfd_write(event, 1);
+        }
+        errno = saved;
+    }
+
+    Main::Location::Location(ComparerIntr comparer, const std::string& name)
         : comparer_(comparer)
-        , connector_(connector)
+        , name_(name)
+        , connector_(NULL)
     {}
 
-    Connector *Main::Location::operator()(const std::string& str) const
+    bool Main::Location::operator()(const char *str, size_t size) const
     {
-        if ((*comparer_)(str)) {
-            return connector_;
-        }
-        return NULL;
+        return (*comparer_)(str, size);
     }
 
     Log& Main::Logger() const
@@ -35,10 +59,20 @@ namespace FWL {
         return *log_;
     }
 
-    Main::Main(const std::string& config_file)
+    Main::Main(const std::string& config_file, bool reloadable)
         : config_file_(config_file)
+        , routing_(NULL)
+        , epoch_(0)
         , log_(new Log(Log::Info))
+        , watch_(false)
+        , signal_(0)
+        , watching_(false)
+        , wakeup_(-1)
+        , inotify_(-1)
+        , stop_(false)
+        , warmup_(false)
     {
+        readers_[0] = readers_[1] = 0;
 //        connector_factories_.insert(std::make_pair("dummy", ConnectorFactoryIntr(new DummyFactory, false)));
 //        connector_factories_.insert(std::make_pair("memory", ConnectorFactoryIntr(new MemoryFactory, false)));
 //        connector_factories_.insert(std::make_pair("sqldb", ConnectorFactoryIntr(new DbFactory, false)));
@@ -49,7 +83,39 @@ namespace FWL {
 	createConnectors();
         Logger().RegisterSink("stderr", stderr);
         Logger().RegisterSink("stdout", stdout);
-        LoadConfig();
+        std::auto_ptr<Routing> routing(new Routing);
+        bool                   loaded = load(*routing, true);
+        routing_ = routing.release();
+        if (loaded) {
+            warmup_ = routing_->root->get<bool>("fork.warmup", false);
+        }
+        if (loaded && reloadable) {
+            JsonNodeOp reload = routing_->root->get_child_optional("reload");
+            if (reload) {
+                watch(*reload);
+            }
+        }
+    }
+
+    Main::~Main()
+    {
+        if (watching_) {
+            __atomic_store_n(&stop_, true, __ATOMIC_RELEASE);
+            ::eventfd_write(wakeup_, 1);
+            ::pthread_join(watcher_, NULL);
+        }
+        __sync_bool_compare_and_swap(&reload_event, wakeup_, -1);
+        if (wakeup_ != -1) {
+            real.close(wakeup_);
+        }
+        if (inotify_ != -1) {
+            real.close(inotify_);
+        }
+        BOOST_FOREACH(Routing * routing, retired_)
+        {
+            delete routing;
+        }
+        delete routing_;
     }
 
     Connector *Main::GetConnector(int fd)
@@ -62,26 +128,553 @@ namespace FWL {
         return fd_manager_.GetDirConnector((int *)dd);
     }
 
-    Connector *Main::GetConnector(const std::string& path)
+    Connector *Main::GetConnector(PathHandle& path)
+    {
+        const std::string& str = path.Str();
+        PathHandle         realpath;
+        Connector          *cntr = GetConnector(str.data(), str.size(), realpath);
+
+        if (cntr) {
+            path = realpath;
+        }
+        return cntr;
+    }
+
+    Connector *Main::Route(const Path& cwd, const char *file, PathHandle& realpath)
     {
-        for (Locations::iterator it = locations_.begin(); it != locations_.end(); ++it) {
-            Connector *cntr = (*it)(path);
+        char   buf[PATH_MAX];
+        size_t length;
+
+        if (!cwd.Canonical(file, buf, sizeof(buf), length)) {
+            //! -- too long for the kernel as well; route it as given
+            return GetConnector(file, ::strlen(file), realpath);
+        }
+        return GetConnector(buf, length, realpath);
+    }
+
+    Connector *Main::GetConnector(const char *str, size_t size, PathHandle& realpath)
+    {
+        Routing& routing = *current();
+        size_t   index, length;
+
+        if (routing.prefixes.Match(str, size, index, length)) {
+            Mount&    mount = routing.mounts[index];
+            Connector *cntr = mount.Cached();
+            if (!cntr) {
+                boost::mutex::scoped_lock lock(lock_);
+                cntr = build(routing, mount.Name());
+                mount.Cache(cntr);
+            }
+            if (cntr && mount.Strip() && length) {
+                realpath = (length < size) ? PathHandle(str + length, size - length) : PathHandle("/", 1);
+            } else if (cntr) {
+                realpath = PathHandle(str, size);
+            }
+            return cntr;
+        }
+        for (Locations::iterator it = routing.locations.begin(); it != routing.locations.end(); ++it) {
+            if (!(*it)(str, size)) {
+                continue;
+            }
+            Connector *cntr = it->Cached();
+            if (!cntr) {
+                boost::mutex::scoped_lock lock(lock_);
+                cntr = build(routing, it->Name());
+                it->Cache(cntr);
+            }
             if (cntr) {
+                realpath = PathHandle(str, size);
                 return cntr;
             }
         }
         return NULL;
     }
 
-    bool Main::LoadConfig()
+    Connector *Main::GetConnectorByName(const std::string& name)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+        return build(*current(), name);
+    }
+
+    //! -- every string in a connector's config that names another connector is a link candidate
+    void Main::references(const Routing& routing, const JsonNode& node, std::vector<std::string>& names) const
+    {
+        if (node.empty()) {
+            if (routing.configs.count(node.data())) {
+                names.push_back(node.data());
+            }
+            return;
+        }
+        BOOST_FOREACH(const JsonNode::value_type & it, node)
+        {
+            references(routing, it.second, names);
+        }
+    }
+
+    //! -- connectors are built on first use; whatever they link to is built first so Link finds it
+    Connector *Main::build(Routing& routing, const std::string& name)
+    {
+        Connectors::iterator it = routing.connectors.find(name);
+        if (it != routing.connectors.end()) {
+            return it->second.get();
+        }
+        ConnectorConfigs::const_iterator config = routing.configs.find(name);
+        if (config == routing.configs.end()) {
+            return NULL;
+        }
+        //! -- stays empty if anything below fails; also stops reference cycles
+        routing.connectors[name];
+
+        try {
+            if (routing.snapshot.get()) {
+                routing.snapshot->Decode(name, *config->second);
+            }
+            const JsonNode&              node    = *config->second;
+            ConnectorFactories::iterator factory = connector_factories_.find(node.get<std::string>("type"));
+            if (factory == connector_factories_.end()) {
+                Logger().Err("Connector %s: unknown type %s", name.c_str(), node.get<std::string>("type").c_str());
+                return NULL;
+            }
+
+            std::vector<std::string> names;
+            references(routing, node, names);
+            BOOST_FOREACH(const std::string & it, names)
+            {
+                if (it != name) {
+                    build(routing, it);
+                }
+            }
+
+            Connector *cntr = factory->second->Create(name, node, fd_manager_, log_);
+            Logger().Inf("Connector %s - %p:\n", name.c_str(), cntr);
+            if (!cntr) {
+                return NULL;
+            }
+            ConnectorIntr intr(cntr, false);
+            if (!cntr->Link(routing.connectors)) {
+                Logger().Err("Connector %s couldn't be linked", name.c_str());
+                return NULL;
+            }
+            routing.connectors[name] = intr;
+            routing.built.push_back(cntr);
+            return cntr;
+        } catch (const std::exception& e) {
+            Logger().Err("Connector %s: %s", name.c_str(), e.what());
+            return NULL;
+        }
+    }
+
+    //! -- an unchanged connector whose links are all carried too moves into the new routing as it is:
+    //! -- rebuilding it would run two instances over the same state until the old routing is reclaimed
+    bool Main::carry(Routing& routing, Routing& old, const std::string& name)
+    {
+        Connectors::iterator             running = old.connectors.find(name);
+        Connectors::iterator             it      = routing.connectors.find(name);
+        if (it != routing.connectors.end()) {
+            return it->second && (running != old.connectors.end()) && (it->second == running->second);
+        }
+        ConnectorConfigs::const_iterator config  = routing.configs.find(name);
+        ConnectorConfigs::const_iterator before  = old.configs.find(name);
+        if ((running == old.connectors.end()) || !running->second || (config == routing.configs.end()) || (before == old.configs.end())) {
+            return false;
+        }
+
+        try {
+            if (routing.snapshot.get()) {
+                routing.snapshot->Decode(name, *config->second);
+            }
+        } catch (const std::exception& e) {
+            Logger().Err("Connector %s: %s", name.c_str(), e.what());
+            return false;
+        }
+        bool exclusive = running->second->Exclusive();
+        bool same      = *config->second == *before->second;
+        if (!same && !exclusive) {
+            return false;
+        }
+
+        //! -- stops reference cycles; dropped again if a link can't come along
+        routing.connectors[name];
+        std::vector<std::string> names;
+        references(routing, *config->second, names);
+        BOOST_FOREACH(const std::string & it, names)
+        {
+            if ((it != name) && !carry(routing, old, it) && !exclusive) {
+                routing.connectors.erase(name);
+                return false;
+            }
+        }
+        if (!same) {
+            Logger().Wrn("Connector %s: config changed, the running instance is kept until restart", name.c_str());
+        }
+        ConfigOwners::const_iterator owner = old.owners.find(name);
+        routing.owners[name]    = (owner != old.owners.end()) ? owner->second : old.root;
+        routing.connectors[name] = running->second;
+        routing.built.push_back(running->second.get());
+        return true;
+    }
+
+    bool Main::Reload()
+    {
+        boost::mutex::scoped_lock reload(reload_lock_);
+        std::auto_ptr<Routing>    routing(new Routing);
+
+        Logger().Inf("Reloading %s", config_file_.c_str());
+        if (!load(*routing, false)) {
+            Logger().Err("Reload of %s failed, keeping the current configuration", config_file_.c_str());
+            return false;
+        }
+
+        //! -- whatever the process has used so far is built here rather than by the next call that needs it
+        Routing                  *old = current();
+        std::vector<std::string> names;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            BOOST_FOREACH(const Connectors::value_type & it, old->connectors)
+            {
+                if (it.second) {
+                    names.push_back(it.first);
+                }
+            }
+        }
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            BOOST_FOREACH(const std::string & it, names)
+            {
+                carry(*routing, *old, it);
+            }
+        }
+        BOOST_FOREACH(const std::string & it, names)
+        {
+            build(*routing, it);
+        }
+        for (Locations::iterator it = routing->locations.begin(); it != routing->locations.end(); ++it) {
+            Connectors::const_iterator cntr = routing->connectors.find(it->Name());
+            if (cntr != routing->connectors.end()) {
+                it->Cache(cntr->second.get());
+            }
+        }
+        for (Mounts::iterator it = routing->mounts.begin(); it != routing->mounts.end(); ++it) {
+            Connectors::const_iterator cntr = routing->connectors.find(it->Name());
+            if (cntr != routing->connectors.end()) {
+                it->Cache(cntr->second.get());
+            }
+        }
+
+        __atomic_store_n(&routing_, routing.release(), __ATOMIC_RELEASE);
+        retired_.push_back(old);
+        reclaim();
+        Logger().Inf("Reloaded %s", config_file_.c_str());
+        return true;
+    }
+
+    //! -- waits until every pin taken before the call has been dropped; only reload_lock_ holders call it
+    void Main::synchronize()
+    {
+        long epoch = __atomic_fetch_add(&epoch_, 1, __ATOMIC_SEQ_CST);
+
+        while (__atomic_load_n(&readers_[epoch & 1], __ATOMIC_SEQ_CST)) {
+            ::usleep(1000);
+        }
+    }
+
+    bool Main::busy(const Routing& routing, const Connectors& current) const
+    {
+        BOOST_FOREACH(const Connectors::value_type & it, routing.connectors)
+        {
+            //! -- carried over: its descriptors belong to the current routing now
+            Connectors::const_iterator kept = current.find(it.first);
+            if ((kept != current.end()) && (kept->second == it.second)) {
+                continue;
+            }
+            if (it.second && !it.second->Idle()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! -- a retired routing goes once none of its connectors has an open descriptor left
+    void Main::reclaim()
+    {
+        if (retired_.empty()) {
+            return;
+        }
+        //! -- past this nothing looks at a retired routing except through descriptors, and no new ones are handed out
+        synchronize();
+
+        //! -- build() adds to the current connectors under lock_, so look them up in a copy taken under it
+        Connectors current;
+        {
+            boost::mutex::scoped_lock lock(lock_);
+            current = routing_->connectors;
+        }
+
+        std::list<Routing *> idle;
+        for (std::list<Routing *>::iterator it = retired_.begin(); it != retired_.end(); ) {
+            if (busy(**it, current)) {
+                ++it;
+                continue;
+            }
+            idle.push_back(*it);
+            it = retired_.erase(it);
+        }
+        if (idle.empty()) {
+            return;
+        }
+        //! -- calls still finishing on a descriptor that was closed in the meantime
+        synchronize();
+        BOOST_FOREACH(Routing * routing, idle)
+        {
+            delete routing;
+        }
+    }
+
+    void Main::watch(const JsonNode& config)
+    {
+        std::string name = config.get<std::string>("signal", "");
+
+        watch_ = config.get<bool>("watch", false);
+        if (name == "SIGHUP") {
+            signal_ = SIGHUP;
+        } else if (name == "SIGUSR1") {
+            signal_ = SIGUSR1;
+        } else if (name == "SIGUSR2") {
+            signal_ = SIGUSR2;
+        } else if (!name.empty()) {
+            Logger().Wrn("Reload signal %s is not supported, use SIGHUP, SIGUSR1 or SIGUSR2", name.c_str());
+        }
+        if (!watch_ && !signal_) {
+            return;
+        }
+        //! -- the disposition survives fork; start() only points the handler at a new eventfd
+        if (signal_ && (__atomic_load_n(&reload_event, __ATOMIC_RELAXED) == -1)) {
+            struct sigaction action;
+            ::memset(&action, 0, sizeof(action));
+            action.sa_handler = signalled;
+            action.sa_flags   = SA_RESTART;
+            ::sigemptyset(&action.sa_mask);
+            ::sigaction(signal_, &action, NULL);
+        } else if (signal_) {
+            Logger().Wrn("Reload signal %s already belongs to another instance", name.c_str());
+            signal_ = 0;
+        }
+        start();
+    }
+
+    void Main::start()
+    {
+        wakeup_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeup_ == -1) {
+            Logger().Err("Reload is off: eventfd: %s", ::strerror(errno));
+            return;
+        }
+        if (watch_) {
+            //! -- the directory, not the file: editors and farwel-compile replace it by rename
+            std::string::size_type slash = config_file_.rfind('/');
+            std::string            dir   = (slash == std::string::npos) ? "." : config_file_.substr(0, slash ? slash : 1);
+            inotify_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if ((inotify_ == -1) || (::inotify_add_watch(inotify_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)) {
+                Logger().Err("Can't watch %s: %s", dir.c_str(), ::strerror(errno));
+                if (inotify_ != -1) {
+                    real.close(inotify_);
+                    inotify_ = -1;
+                }
+            }
+        }
+        if (signal_) {
+            __atomic_store_n(&reload_event, wakeup_, __ATOMIC_RELAXED);
+        }
+
+        //! -- the host's signals are none of the watcher's business
+        sigset_t all, saved;
+        ::sigfillset(&all);
+        ::pthread_sigmask(SIG_SETMASK, &all, &saved);
+        watching_ = !::pthread_create(&watcher_, NULL, watcher, this);
+        ::pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        if (!watching_) {
+            Logger().Err("Reload is off: can't start the watcher thread");
+        }
+    }
+
+    //! -- composites first: their fork hooks may wait for a worker that is still inside a linked connector
+    void Main::connectors(std::vector<Connector *>& all) const
+    {
+        //! -- a carried over connector is in several routings and must see each hook once
+        boost::unordered_set<Connector *> seen;
+
+        all.clear();
+        BOOST_FOREACH(Connector * it, std::make_pair(routing_->built.rbegin(), routing_->built.rend()))
+        {
+            if (seen.insert(it).second) {
+                all.push_back(it);
+            }
+        }
+        BOOST_FOREACH(const Routing * routing, retired_)
+        {
+            BOOST_FOREACH(Connector * it, std::make_pair(routing->built.rbegin(), routing->built.rend()))
+            {
+                if (seen.insert(it).second) {
+                    all.push_back(it);
+                }
+            }
+        }
+    }
+
+    //! -- whatever is prepared here is shared copy-on-write by every child instead of redone in each
+    void Main::BeforeFork()
+    {
+        Routing& routing = *current();
+
+        if (!routing.warm) {
+            for (Locations::iterator it = routing.locations.begin(); it != routing.locations.end(); ++it) {
+                it->Prepare();
+                if (warmup_ && !it->Cached()) {
+                    boost::mutex::scoped_lock lock(lock_);
+                    it->Cache(build(routing, it->Name()));
+                }
+            }
+            for (Mounts::iterator it = routing.mounts.begin(); warmup_ && (it != routing.mounts.end()); ++it) {
+                if (!it->Cached()) {
+                    boost::mutex::scoped_lock lock(lock_);
+                    it->Cache(build(routing, it->Name()));
+                }
+            }
+            routing.warm = true;
+        }
+
+        reload_lock_.lock();
+        lock_.lock();
+        std::vector<Connector *> all;
+        connectors(all);
+        BOOST_FOREACH(Connector * it, all)
+        {
+            it->BeforeFork();
+        }
+        PathHandle::BeforeFork();
+        Node::BeforeFork();
+        Journal::Instance().BeforeFork();
+    }
+
+    void Main::AfterFork(bool child)
+    {
+        std::vector<Connector *> all;
+        connectors(all);
+
+        Journal::Instance().AfterFork(child);
+        Node::AfterFork();
+        PathHandle::AfterFork();
+        if (child) {
+            //! -- pins held by threads that did not come along; descriptors the parent opened stay its own
+            readers_[0] = readers_[1] = 0;
+            fd_manager_.Clear();
+        }
+        BOOST_FOREACH(Connector * it, all)
+        {
+            if (child) {
+                it->Forget();
+            }
+            it->AfterFork(child);
+        }
+        lock_.unlock();
+        reload_lock_.unlock();
+
+        if (child && watching_) {
+            //! -- the watcher thread stayed in the parent, and so do the events on the inherited descriptors
+            watching_ = false;
+            real.close(wakeup_);
+            if (inotify_ != -1) {
+                real.close(inotify_);
+                inotify_ = -1;
+            }
+            start();
+        }
+    }
+
+    void *Main::watcher(void *arg)
+    {
+        static_cast<Main *>(arg)->run();
+        return NULL;
+    }
+
+    void Main::run()
     {
-        JsonNode root;
-        boost::property_tree::read_json(config_file_, root);
+        std::string::size_type slash = config_file_.rfind('/');
+        std::string            name  = config_file_.substr((slash == std::string::npos) ? 0 : slash + 1);
+        char                   events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+        while (!__atomic_load_n(&stop_, __ATOMIC_ACQUIRE)) {
+            struct pollfd fds[2] = { { wakeup_, POLLIN, 0 }, { inotify_, POLLIN, 0 } };
+            int           timeout;
+            {
+                boost::mutex::scoped_lock reload(reload_lock_);
+                timeout = retired_.empty() ? -1 : 1000;
+            }
+            if ((::poll(fds, (inotify_ == -1) ? 1 : 2, timeout) < 0) && (errno != EINTR)) {
+                Logger().Err("Reload watcher stopped: poll: %s", ::strerror(errno));
+                return;
+            }
+            if (__atomic_load_n(&stop_, __ATOMIC_ACQUIRE)) {
+                return;
+            }
+
+            bool     changed = false;
+            eventfd_t value;
+            if ((fds[0].revents & POLLIN) && !::eventfd_read(wakeup_, &value)) {
+                changed = true;
+            }
+            if ((inotify_ != -1) && (fds[1].revents & POLLIN)) {
+                int len;
+                while ((len = real.read(inotify_, events, sizeof(events))) > 0) {
+                    for (char *it = events; it < events + len; ) {
+                        struct inotify_event *event = (struct inotify_event *)it;
+                        if (event->len && (name == event->name)) {
+                            changed = true;
+                        }
+                        it += sizeof(struct inotify_event) + event->len;
+                    }
+                }
+            }
+
+            if (changed) {
+                Reload();
+            } else {
+                boost::mutex::scoped_lock reload(reload_lock_);
+                reclaim();
+            }
+        }
+    }
+
+    bool Main::load(Routing& routing, bool first)
+    {
+        JsonNode& root = *routing.root;
+
+        try {
+            routing.snapshot.reset(new Snapshot);
+            if (routing.snapshot->Open(config_file_)) {
+                routing.snapshot->Read(root, "connectors");
+            } else {
+                routing.snapshot.reset();
+                boost::property_tree::read_json(config_file_, root);
+            }
+        } catch (const std::exception& e) {
+            //! -- the first load has nothing to fall back to; the caller reports it
+            if (first) {
+                throw;
+            }
+            Logger().Err(e.what());
+            return false;
+        }
 
         try {
             Logger().Inf("Loading configuration...");
             JsonNodeOp log = root.get_child_optional("log");
-            if (!log) {
+            //! -- sinks are opened once; a reload only changes the level
+            if (!first) {
+                if (log && log->get_child_optional("level")) {
+                    Logger().SetLogLevel(log->get<std::string>("level"));
+                }
+            } else if (!log) {
                 Logger().UseSink("stdout");
             } else {
                 BOOST_FOREACH(const JsonNode::value_type & it, log->get_child("registered_sinks"))
@@ -97,19 +690,17 @@ namespace FWL {
                         Logger().UseSink(it.second.get_value<std::string>());
                     }
                 }
+                //! -- before the rest, which is chatty at info level
+                JsonNodeOp level = log->get_child_optional("level");
+                if (level) {
+                    Logger().SetLogLevel(level->get_value<std::string>());
+                }
             }
 
-            BOOST_FOREACH(const JsonNode::value_type & it, root.get_child("connectors"))
+            //! -- nothing is constructed here: a process that never touches a location never connects anywhere
+            BOOST_FOREACH(JsonNode::value_type & it, root.get_child("connectors"))
             {
-                ConnectorFactories::iterator cntrit = connector_factories_.find(it.second.get<std::string>("type"));
-
-                if (cntrit != connector_factories_.end()) {
-                    Connector *cntr = cntrit->second->Create(it.first, it.second, fd_manager_, log_);
-                    Logger().Inf("Connector %s - %p:\n", it.first.c_str(), cntr);
-                    if (cntr) {
-                        connectors_.insert(std::make_pair(it.first, ConnectorIntr(cntr, false)));
-                    }
-                }
+                routing.configs.insert(std::make_pair(it.first, &it.second));
             }
 
             const JsonNode& locations = root.get_child("locations");
@@ -118,27 +709,30 @@ namespace FWL {
                 std::string cntr_name = it.second.get<std::string>("connector");
 
                 Logger().Inf("Location:\nconnector:%s - %s\n", it.first.c_str(), cntr_name.c_str());
-                Connectors::iterator cit = connectors_.find(cntr_name);
-                if (cit != connectors_.end()) {
+                if (routing.configs.count(cntr_name)) {
                     Logger().Inf("Connector found: rule:%s\n", it.first.c_str());
                     std::pair<std::string, std::string> ret;
-                    if (Comparer::Parse(it.first, ret)) {
-                        ComparerFactories::iterator cmpit = comparer_factories_.find(ret.first);
-                        if (cmpit != comparer_factories_.end()) {
-                            Comparer *cmpr = cmpit->second->Create(ret.second);
-                            if (cmpr) {
-                                Logger().Inf("Comparer:%p\n", cmpr);
-                                locations_.push_back(Location(ComparerIntr(cmpr, false), cit->second.get()));
-                            }
+                    if (!Comparer::Parse(it.first, ret)) {
+                        continue;
+                    }
+                    if (ret.first == "prefix") {
+                        if (ret.second.empty() || (ret.second[0] != '/')) {
+                            Logger().Err("Prefix is not absolute: %s", it.first.c_str());
+                        } else if (!routing.prefixes.Add(ret.second, routing.mounts.size())) {
+                            Logger().Err("Prefix mounted twice: %s", it.first.c_str());
+                        } else {
+                            routing.mounts.push_back(Mount(cntr_name, it.second.get<bool>("strip_prefix", false)));
+                        }
+                        continue;
+                    }
+                    ComparerFactories::iterator cmpit = comparer_factories_.find(ret.first);
+                    if (cmpit != comparer_factories_.end()) {
+                        Comparer *cmpr = cmpit->second->Create(ret.second);
+                        if (cmpr) {
+                            Logger().Inf("Comparer:%p\n", cmpr);
+                            routing.locations.push_back(Location(ComparerIntr(cmpr, false), cntr_name));
                         }
                     }
-                }
-            }
-
-            if (log) {
-                JsonNodeOp level = log->get_child_optional("level");
-                if (level) {
-                    Logger().SetLogLevel(level->get_value<std::string>());
                 }
             }
         } catch (const std::exception& e) {
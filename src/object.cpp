@@ -14,16 +14,14 @@ namespace FWL {
             delete this;
         }
     }
-}
 
-namespace boost {
-    void intrusive_ptr_add_ref(FWL::Object *obj)
+    void intrusive_ptr_add_ref(Object *obj)
     {
         obj->AddRef();
     }
 
-    void intrusive_ptr_release(FWL::Object *obj)
+    void intrusive_ptr_release(Object *obj)
     {
         obj->Release();
     }
-};
+}
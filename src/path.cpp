@@ -1,11 +1,103 @@
 extern "C" {
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 }
+#include <algorithm>
 #include <exception>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 #include "path.h"
 
 namespace FWL {
+    namespace {
+        //! -- holds one reference to every entry; entries nobody else refers to are swept once it doubles
+        struct Interned
+        {
+            typedef boost::unordered_multimap<size_t, boost::intrusive_ptr<Object> >   Entries;
+
+            boost::mutex lock;
+            Entries      entries;
+            size_t       limit;
+            Interned() : limit(4096) {}
+
+            void sweep()
+            {
+                for (Entries::iterator it = entries.begin(); it != entries.end(); ) {
+                    if (it->second->References() == 1) {
+                        it = entries.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                limit = std::max((size_t)4096, entries.size() * 2);
+            }
+        };
+
+        //! -- never destroyed: handles may still be taken while other statics go away at exit
+        Interned& interned()
+        {
+            static Interned *table = new Interned;
+            return *table;
+        }
+
+        const std::string empty_path;
+    }
+
+    PathHandle::PathHandle(const char *str)
+    {
+        intern(str, ::strlen(str));
+    }
+
+    //! -- FNV-1a: one pass over a short key, no setup
+    size_t PathHandle::HashOf(const char *str, size_t size)
+    {
+        uint64_t h = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < size; ++i) {
+            h ^= (unsigned char)str[i];
+            h *= 1099511628211ULL;
+        }
+        return (size_t)h;
+    }
+
+    void PathHandle::intern(const char *str, size_t size)
+    {
+        size_t                    h     = HashOf(str, size);
+        Interned&                 table = interned();
+        boost::mutex::scoped_lock lock(table.lock);
+
+        std::pair<Interned::Entries::iterator, Interned::Entries::iterator> range = table.entries.equal_range(h);
+        for (Interned::Entries::iterator it = range.first; it != range.second; ++it) {
+            Entry *entry = static_cast<Entry *>(it->second.get());
+            if ((entry->path.size() == size) && !::memcmp(entry->path.data(), str, size)) {
+                entry_ = entry;
+                return;
+            }
+        }
+        if (table.entries.size() >= table.limit) {
+            table.sweep();
+        }
+        entry_ = EntryIntr(new Entry(str, size, h), false);
+        table.entries.insert(std::make_pair(h, boost::intrusive_ptr<Object>(entry_.get())));
+    }
+
+    const std::string& PathHandle::Str() const
+    {
+        return entry_ ? entry_->path : empty_path;
+    }
+
+    void PathHandle::BeforeFork()
+    {
+        interned().lock.lock();
+    }
+
+    void PathHandle::AfterFork()
+    {
+        interned().lock.unlock();
+    }
+
     Path::Path()
     {
         char buf[1024];
@@ -14,44 +106,55 @@ namespace FWL {
             throw std::exception();
         }
         current_path_.assign(&buf[0]);
-        for (size_t i = 0; i < current_path_.size(); ++i) {
-            if (current_path_[i] == '/') {
-                slashes_.push_back(i);
-            }
-        }
     }
 
-    std::string Path::Absolute(const std::string& file)
+    bool Path::Canonical(const char *file, char *buf, size_t size, size_t& length) const
     {
-        if (file[0] == '/') {
-            return std::string(file);
+        size_t len = 0;
+
+        if (file[0] != '/') {
+            len = (current_path_.size() > 1) ? current_path_.size() : 0;
+            if (len >= size) {
+                return false;
+            }
+            ::memcpy(buf, current_path_.data(), len);
         }
-        std::string res;
-        const char  *cc = file.c_str();
-        if (file[0] == '.') {
-            if (file[1] != '.') {
-                res.resize(current_path_.size() + file.size() - 1);
-                ::sprintf((char *)res.data(), "%s%s", current_path_.c_str(), cc + 1);
-            } else {
-                int    k   = slashes_.size();
-                size_t pos = 0;
-                do {
-                    size_t p = file.find("../", pos);
-                    if (p == std::string::npos) {
-                        break;
-                    }
-                    pos = p + 3;
-                    if (--k < 0) {
-                        k = 0;
-                    }
-                } while (1);
-                ::sprintf((char *)res.data(), "%.*s/%s", slashes_[k], current_path_.c_str(), cc + pos);
+        for (const char *it = file; *it; ) {
+            while (*it == '/') {
+                ++it;
+            }
+            const char *end = it;
+            while (*end && (*end != '/')) {
+                ++end;
+            }
+            size_t part = end - it;
+            if ((part == 2) && (it[0] == '.') && (it[1] == '.')) {
+                //! -- ".." above the root stays at the root
+                while (len && (buf[len - 1] != '/')) {
+                    --len;
+                }
+                if (len) {
+                    --len;
+                }
+            } else if (part && !((part == 1) && (it[0] == '.'))) {
+                if (len + 1 + part >= size) {
+                    return false;
+                }
+                buf[len++] = '/';
+                ::memcpy(buf + len, it, part);
+                len += part;
+            }
+            it = end;
+        }
+        if (!len) {
+            if (size < 2) {
+                return false;
             }
-        } else {
-            res.resize(current_path_.size() + file.size() + 1);
-            ::sprintf((char *)res.data(), "%s/%s", current_path_.c_str(), cc);
+            buf[len++] = '/';
         }
-        return res;
+        buf[len] = 0;
+        length   = len;
+        return true;
     }
 
     std::string Path::Directory(const std::string& file)
@@ -0,0 +1,106 @@
+extern "C" {
+#include <stdlib.h>
+}
+#include <algorithm>
+#include "pool.h"
+
+namespace FWL {
+    namespace {
+        //! -- blocks per slab, and per trip to the depot
+        const size_t batch = 64;
+        //! -- a thread's free list is trimmed back to batch blocks once it grows past this
+        const size_t hoard = 4 * batch;
+    }
+
+    Pool::Pool(size_t size)
+        : size_((std::max(size, sizeof(Block)) + 15) & ~(size_t)15)
+        , depot_(NULL)
+    {
+        ::pthread_key_create(&key_, &Pool::release);
+    }
+
+    Pool::Cache& Pool::cache()
+    {
+        Cache *cache = static_cast<Cache *>(::pthread_getspecific(key_));
+
+        if (!cache) {
+            cache        = new Cache;
+            cache->pool  = this;
+            cache->head  = NULL;
+            cache->count = 0;
+            ::pthread_setspecific(key_, cache);
+        }
+        return *cache;
+    }
+
+    bool Pool::refill(Cache& cache)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        if (!depot_) {
+            char *slab = static_cast<char *>(::malloc(size_ * batch));
+            if (!slab) {
+                return false;
+            }
+            for (size_t i = 0; i < batch; ++i) {
+                Block *block = reinterpret_cast<Block *>(slab + i * size_);
+                block->next  = depot_;
+                depot_       = block;
+            }
+        }
+        for (size_t i = 0; (i < batch) && depot_; ++i) {
+            Block *block = depot_;
+            depot_       = block->next;
+            block->next  = cache.head;
+            cache.head   = block;
+            ++cache.count;
+        }
+        return true;
+    }
+
+    void Pool::spill(Cache& cache, size_t keep)
+    {
+        boost::mutex::scoped_lock lock(lock_);
+
+        while (cache.count > keep) {
+            Block *block = cache.head;
+            cache.head   = block->next;
+            block->next  = depot_;
+            depot_       = block;
+            --cache.count;
+        }
+    }
+
+    void Pool::release(void *data)
+    {
+        Cache *cache = static_cast<Cache *>(data);
+
+        cache->pool->spill(*cache, 0);
+        delete cache;
+    }
+
+    void *Pool::Allocate()
+    {
+        Cache& local = cache();
+
+        if (!local.head && !refill(local)) {
+            return NULL;
+        }
+        Block *block = local.head;
+        local.head   = block->next;
+        --local.count;
+        return block;
+    }
+
+    void Pool::Free(void *data)
+    {
+        Cache& local = cache();
+        Block  *block = static_cast<Block *>(data);
+
+        block->next = local.head;
+        local.head  = block;
+        if (++local.count > hoard) {
+            spill(local, batch);
+        }
+    }
+}
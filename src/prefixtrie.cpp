@@ -0,0 +1,119 @@
+extern "C" {
+#include <string.h>
+}
+#include <algorithm>
+#include "prefixtrie.h"
+
+namespace FWL {
+    namespace {
+        //! -- strcmp order of a stored name against a component that isn't terminated
+        int compare(const std::string& stored, const char *name, size_t size)
+        {
+            int c = ::memcmp(stored.data(), name, std::min(stored.size(), size));
+
+            if (c) {
+                return c;
+            }
+            return (stored.size() < size) ? -1 : ((stored.size() > size) ? 1 : 0);
+        }
+
+        //! -- the next component of path at or after pos; false at the end
+        bool component(const char *path, size_t total, size_t& pos, size_t& size)
+        {
+            while ((pos < total) && (path[pos] == '/')) {
+                ++pos;
+            }
+            if (pos >= total) {
+                return false;
+            }
+            const char *end = (const char *)::memchr(path + pos, '/', total - pos);
+            size = (end ? (size_t)(end - path) : total) - pos;
+            return true;
+        }
+    }
+
+    PrefixTrie::Node::~Node()
+    {
+        for (Children::iterator it = children.begin(); it != children.end(); ++it) {
+            delete it->second;
+        }
+    }
+
+    PrefixTrie::Node *PrefixTrie::Node::find(const char *name, size_t size) const
+    {
+        size_t low  = 0;
+        size_t high = children.size();
+
+        while (low < high) {
+            size_t mid = (low + high) / 2;
+            int    c   = compare(children[mid].first, name, size);
+            if (!c) {
+                return children[mid].second;
+            }
+            if (c < 0) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return NULL;
+    }
+
+    bool PrefixTrie::Add(const std::string& prefix, size_t value)
+    {
+        Node   *node = &root_;
+        size_t pos   = 0;
+        size_t size;
+
+        while (component(prefix.data(), prefix.size(), pos, size)) {
+            if ((size == 1) && (prefix[pos] == '.')) {
+                pos += size;
+                continue;
+            }
+            Node *child = node->find(prefix.data() + pos, size);
+            if (!child) {
+                std::string name(prefix, pos, size);
+                child = new Node;
+                Node::Children::iterator it = node->children.begin();
+                while ((it != node->children.end()) && (compare(it->first, name.data(), name.size()) < 0)) {
+                    ++it;
+                }
+                node->children.insert(it, std::make_pair(name, child));
+            }
+            node = child;
+            pos += size;
+        }
+        if (node->set) {
+            return false;
+        }
+        node->value = value;
+        node->set   = true;
+        return true;
+    }
+
+    bool PrefixTrie::Match(const char *path, size_t total, size_t& value, size_t& length) const
+    {
+        const Node *node  = &root_;
+        size_t     pos    = 0;
+        size_t     size;
+        bool       found  = root_.set;
+
+        if (found) {
+            value  = root_.value;
+            length = 0;
+        }
+        while (component(path, total, pos, size)) {
+            node = node->find(path + pos, size);
+            if (!node) {
+                break;
+            }
+            pos += size;
+            if (node->set) {
+                value  = node->value;
+                length = pos;
+                found  = true;
+            }
+        }
+        return found;
+    }
+}
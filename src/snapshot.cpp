@@ -0,0 +1,242 @@
+extern "C" {
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+}
+#include <stdexcept>
+#include <boost/foreach.hpp>
+#include "real.h"
+#include "snapshot.h"
+
+namespace FWL {
+    static Real real;
+
+    namespace {
+        //! -- node: size of the rest, data, child count, then per child: key, node
+        void put(std::string& out, uint32_t value)
+        {
+            out.append((const char *)&value, sizeof(value));
+        }
+
+        void put(std::string& out, const std::string& str)
+        {
+            put(out, (uint32_t)str.size());
+            out.append(str);
+        }
+
+        void encode(std::string& out, const JsonNode& node)
+        {
+            size_t start = out.size();
+
+            put(out, (uint32_t)0);
+            put(out, node.data());
+            put(out, (uint32_t)node.size());
+            BOOST_FOREACH(const JsonNode::value_type & it, node)
+            {
+                put(out, it.first);
+                encode(out, it.second);
+            }
+            uint32_t size = out.size() - start - sizeof(uint32_t);
+            out.replace(start, sizeof(size), (const char *)&size, sizeof(size));
+        }
+
+        class Reader
+        {
+            private:
+                const char *begin_;
+                const char *pos_;
+                const char *end_;
+
+                void need(size_t size) const
+                {
+                    if ((size_t)(end_ - pos_) < size) {
+                        throw std::runtime_error("truncated config snapshot");
+                    }
+                }
+
+            public:
+                Reader(const char *data, size_t size, size_t offset = 0)
+                    : begin_(data)
+                    , pos_(data + std::min(offset, size))
+                    , end_(data + size)
+                {}
+
+                uint32_t Number()
+                {
+                    uint32_t value;
+                    need(sizeof(value));
+                    ::memcpy(&value, pos_, sizeof(value));
+                    pos_ += sizeof(value);
+                    return value;
+                }
+
+                void String(std::string& str)
+                {
+                    uint32_t size = Number();
+                    need(size);
+                    str.assign(pos_, size);
+                    pos_ += size;
+                }
+
+                uint64_t Offset() const { return pos_ - begin_; }
+
+                void Skip()
+                {
+                    uint32_t size = Number();
+                    need(size);
+                    pos_ += size;
+                }
+
+                //! -- with deferred set, its children are only named here and their offsets noted
+                void Node(JsonNode& node, int depth, const std::string *deferred = NULL, boost::unordered_map<std::string, uint64_t> *offsets = NULL)
+                {
+                    if (depth > 256) {
+                        throw std::runtime_error("config snapshot nested too deep");
+                    }
+                    Number();
+                    String(node.data());
+                    uint32_t    children = Number();
+                    std::string key;
+                    for (uint32_t i = 0; i < children; ++i) {
+                        String(key);
+                        JsonNode& child = node.push_back(std::make_pair(key, JsonNode()))->second;
+                        if (deferred && (depth == 1) && offsets) {
+                            (*offsets)[key] = Offset();
+                            Skip();
+                        } else {
+                            bool lazy = deferred && (depth == 0) && (key == *deferred);
+                            Node(child, depth + 1, lazy ? deferred : NULL, lazy ? offsets : NULL);
+                        }
+                    }
+                }
+
+                bool Done() const { return pos_ == end_; }
+        };
+    }
+
+    Snapshot::Snapshot()
+        : map_(NULL)
+        , size_(0)
+    {}
+
+    Snapshot::~Snapshot()
+    {
+        if (map_) {
+            ::munmap((void *)map_, size_);
+        }
+    }
+
+    uint64_t Snapshot::Checksum(const char *data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    bool Snapshot::Open(const std::string& path)
+    {
+        int fd = real.open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        Header      header;
+        if ((real.fstat(fd, &st) < 0) || ((size_t)st.st_size < sizeof(header))
+            || (::pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) || (header.magic != Magic)) {
+            real.close(fd);
+            return false;
+        }
+        if (header.version != Version) {
+            real.close(fd);
+            throw std::runtime_error("unsupported config snapshot version, rebuild it with farwel-compile");
+        }
+        if (header.size != st.st_size - sizeof(header)) {
+            real.close(fd);
+            throw std::runtime_error("truncated config snapshot");
+        }
+
+        void *map = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        real.close(fd);
+        if (map == MAP_FAILED) {
+            throw std::runtime_error("can't map config snapshot");
+        }
+        if (Checksum((const char *)map + sizeof(header), header.size) != header.checksum) {
+            ::munmap(map, st.st_size);
+            throw std::runtime_error("config snapshot checksum mismatch");
+        }
+        if (map_) {
+            ::munmap((void *)map_, size_);
+        }
+        map_  = (const char *)map;
+        size_ = st.st_size;
+        deferred_.clear();
+        return true;
+    }
+
+    void Snapshot::Read(JsonNode& root, const std::string& deferred)
+    {
+        Reader reader(map_ + sizeof(Header), size_ - sizeof(Header));
+
+        root.clear();
+        reader.Node(root, 0, deferred.empty() ? NULL : &deferred, &deferred_);
+        if (!reader.Done()) {
+            throw std::runtime_error("trailing data in config snapshot");
+        }
+    }
+
+    bool Snapshot::Decode(const std::string& name, JsonNode& node) const
+    {
+        Offsets::const_iterator it = deferred_.find(name);
+
+        if (it == deferred_.end()) {
+            return false;
+        }
+        Reader reader(map_ + sizeof(Header), size_ - sizeof(Header), it->second);
+        node.clear();
+        reader.Node(node, 2);
+        return true;
+    }
+
+    bool Snapshot::Load(const std::string& path, JsonNode& root)
+    {
+        Snapshot snapshot;
+
+        if (!snapshot.Open(path)) {
+            return false;
+        }
+        snapshot.Read(root);
+        return true;
+    }
+
+    bool Snapshot::Save(const std::string& path, const JsonNode& root)
+    {
+        std::string payload;
+        Header      header;
+
+        encode(payload, root);
+        header.magic    = Magic;
+        header.version  = Version;
+        header.size     = payload.size();
+        header.checksum = Checksum(payload.data(), payload.size());
+
+        //! -- written aside and renamed, so a process starting meanwhile sees the old or the new one
+        std::string tmp = path + ".tmp";
+        int         fd  = real.open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = (real.write(fd, &header, sizeof(header)) == (int)sizeof(header))
+                  && (real.write(fd, payload.data(), payload.size()) == (int)payload.size())
+                  && !::fsync(fd);
+        real.close(fd);
+        if (!ok || (::rename(tmp.c_str(), path.c_str()) < 0)) {
+            real.unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+}
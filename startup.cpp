@@ -0,0 +1,137 @@
+extern "C" {
+#include <errno.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+}
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//! -- startup cost of the shim: spawns a short lived command with and without LD_PRELOAD
+//! -- usage: startup [-n runs] [-p farwel.so] [-c config.conf] [command args...]
+
+extern char **environ;
+
+inline unsigned long long getns()
+{
+    struct timespec ts;
+
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+std::vector<std::string> environment(const std::string& preload, const std::string& config)
+{
+    std::vector<std::string> env;
+
+    for (char **it = environ; *it; ++it) {
+        if (::strncmp(*it, "LD_PRELOAD=", 11) && ::strncmp(*it, "FRWL_CONFIG_FILE=", 17)) {
+            env.push_back(*it);
+        }
+    }
+    if (!preload.empty()) {
+        env.push_back("LD_PRELOAD=" + preload);
+        env.push_back("FRWL_CONFIG_FILE=" + config);
+    }
+    return env;
+}
+
+bool run(char **argv, const std::vector<std::string>& env, unsigned long long& ns)
+{
+    std::vector<char *> envp;
+    pid_t               pid;
+    int                 status;
+
+    for (size_t i = 0; i < env.size(); ++i) {
+        envp.push_back(const_cast<char *>(env[i].c_str()));
+    }
+    envp.push_back(NULL);
+
+    unsigned long long start = getns();
+    int                error = ::posix_spawnp(&pid, argv[0], NULL, NULL, argv, &envp[0]);
+    if (error) {
+        fprintf(stderr, "%s: %s\n", argv[0], ::strerror(error));
+        return false;
+    }
+    while ((::waitpid(pid, &status, 0) < 0) && (errno == EINTR)) {}
+    ns = getns() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s: exited with status %d\n", argv[0], status);
+        return false;
+    }
+    return true;
+}
+
+void report(const char *name, std::vector<unsigned long long>& samples)
+{
+    unsigned long long sum = 0;
+
+    std::sort(samples.begin(), samples.end());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        sum += samples[i];
+    }
+    printf("%-8s min %8.1fus  p50 %8.1fus  p99 %8.1fus  mean %8.1fus\n", name,
+           samples.front() / 1e3, samples[samples.size() / 2] / 1e3,
+           samples[std::min(samples.size() - 1, samples.size() * 99 / 100)] / 1e3, sum / 1e3 / samples.size());
+}
+
+int main(int argc, char **argv)
+{
+    int         runs    = 200;
+    std::string preload = "./farwel.so";
+    std::string config  = "./config.conf";
+    int         opt;
+
+    while ((opt = ::getopt(argc, argv, "+n:p:c:")) != -1) {
+        switch (opt) {
+            case 'n': runs = std::max(::atoi(optarg), 1); break;
+            case 'p': preload = optarg; break;
+            case 'c': config = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n runs] [-p farwel.so] [-c config.conf] [command args...]\n", argv[0]);
+                return 1;
+        }
+    }
+    if ((preload[0] != '/') || (config[0] != '/')) {
+        char cwd[4096];
+        if (::getcwd(cwd, sizeof(cwd))) {
+            preload = (preload[0] == '/') ? preload : std::string(cwd) + "/" + preload;
+            config  = (config[0] == '/') ? config : std::string(cwd) + "/" + config;
+        }
+    }
+
+    char                     *fallback[] = { const_cast<char *>("/bin/true"), NULL };
+    char                     **command   = (optind < argc) ? argv + optind : fallback;
+    std::vector<std::string> plain       = environment("", "");
+    std::vector<std::string> shimmed     = environment(preload, config);
+
+    std::vector<unsigned long long> base;
+    std::vector<unsigned long long> shim;
+    unsigned long long              ns;
+
+    //! -- one warm up run each, then interleaved so both see the same machine state
+    if (!run(command, plain, ns) || !run(command, shimmed, ns)) {
+        return 1;
+    }
+    for (int i = 0; i < runs; ++i) {
+        if (!run(command, plain, ns)) {
+            return 1;
+        }
+        base.push_back(ns);
+        if (!run(command, shimmed, ns)) {
+            return 1;
+        }
+        shim.push_back(ns);
+    }
+
+    printf("%s, %d runs, preload %s\n", command[0], runs, preload.c_str());
+    report("plain", base);
+    report("farwel", shim);
+    printf("overhead p50 %.1fus\n", ((double)shim[shim.size() / 2] - (double)base[base.size() / 2]) / 1e3);
+    return 0;
+}
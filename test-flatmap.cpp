@@ -0,0 +1,129 @@
+extern "C" {
+#include <stdio.h>
+}
+#include <map>
+#include <string>
+#include "flatmap.h"
+
+//! -- FlatMap insert/find/erase, backward shift deletion in particular: ./test-flatmap,
+//! -- exits with the number of failed checks
+static int failed = 0;
+
+inline void check(bool ok, const std::string& what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok) {
+        ++failed;
+    }
+}
+
+//! -- the key is its own hash, so a test picks the home slot (key & 15 while under 8 entries)
+struct Identity
+{
+    size_t operator()(int key) const { return (size_t)key; }
+};
+
+typedef FWL::FlatMap<int, int, Identity>   Map;
+
+inline bool has(Map& map, int key)
+{
+    Map::iterator it = map.find(key);
+
+    return (it != map.end()) && (it->first == key) && (it->second == key * 10);
+}
+
+inline void fill(Map& map, const int *keys, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        map.insert(std::make_pair(keys[i], keys[i] * 10));
+    }
+}
+
+inline bool all(Map& map, const int *keys, size_t count, int erased)
+{
+    bool ok = (map.size() == count - 1) && !has(map, erased);
+
+    for (size_t i = 0; i < count; ++i) {
+        ok = ok && ((keys[i] == erased) || has(map, keys[i]));
+    }
+    return ok;
+}
+
+//! -- builds the map from keys, erases one of them and checks every other key is still found
+inline void scenario(const int *keys, size_t count, int erase, const char *what)
+{
+    Map map;
+
+    fill(map, keys, count);
+    check((map.erase(erase) == 1) && all(map, keys, count, erase), what);
+}
+
+int main()
+{
+    Map empty;
+    check(!empty.erase(1) && (empty.find(1) == empty.end()), "erase and find on an empty map");
+
+    //! -- 1, 17, 33 share home 1 and sit in 1, 2, 3
+    const int run[] = { 1, 17, 33 };
+    scenario(run, 3, 1, "erase the head of a run");
+    scenario(run, 3, 17, "erase the middle of a run");
+    scenario(run, 3, 33, "erase the tail of a run");
+
+    //! -- 2 sits at its home inside the run of 1 and must stay, 17 behind it moves back
+    const int home[] = { 1, 2, 17 };
+    scenario(home, 3, 1, "entry at its home is left in place");
+
+    //! -- 1, 17 take 1 and 2, so 2 and 3 are pushed to 3 and 4: each moves back one
+    const int chain[] = { 1, 17, 2, 3 };
+    scenario(chain, 4, 1, "displaced entries of other homes move back");
+
+    //! -- 15, 31, 47 wrap around to 15, 0, 1; 0 is pushed to 2
+    const int wrap[] = { 15, 31, 47, 0 };
+    scenario(wrap, 4, 15, "erase across the end of the array");
+    scenario(wrap, 4, 31, "erase at the start of a wrapped run");
+    scenario(wrap, 4, 47, "erase after the wrap");
+    //! -- 14, 30, 46, 62 wrap around to 14, 15, 0, 1: 62 in 1 moves to 0 though its home 14 is the larger index
+    const int across[] = { 14, 30, 46, 62 };
+    scenario(across, 4, 14, "a whole wrapped run moves back");
+    //! -- 15 at its home in 15 keeps 31 in 0, whose home 15 lies past the hole left in 14
+    const int stay[] = { 14, 15, 31 };
+    scenario(stay, 3, 14, "wrapped entry homed past the hole is left in place");
+    //! -- 0 sits at its home in 0 and stays, 31 behind it in 1 goes back to 15
+    const int after[] = { 15, 0, 31 };
+    scenario(after, 3, 15, "entry at its home after the wrap is left in place");
+    //! -- the same run of 14 pushes 0 to 2, behind it
+    const int past[] = { 14, 30, 46, 62, 0 };
+    scenario(past, 5, 14, "a wrapped run and the entry it displaced move back");
+
+    Map map;
+    fill(map, run, 3);
+    check((map.erase(49) == 0) && (map.size() == 3) && has(map, 33), "erase a missing key of the same home");
+    check(!map.insert(std::make_pair(17, 0)).second && has(map, 17), "insert an existing key");
+    map.clear();
+    check(map.empty() && !has(map, 1), "clear");
+    fill(map, run, 3);
+    check((map.size() == 3) && has(map, 1) && has(map, 33), "insert after clear");
+
+    //! -- random inserts and erases over a few homes, growing past several sizes, against std::map
+    Map                     random;
+    std::map<int, int>      expected;
+    unsigned                seed = 12345;
+    bool                    same = true;
+    for (int round = 0; round < 20000; ++round) {
+        seed = seed * 1103515245 + 12345;
+        int key = (int)((seed >> 8) % 512) * 64 + (int)((seed >> 20) % 3);
+        if ((seed >> 4) & 1) {
+            same = same && (random.insert(std::make_pair(key, key * 10)).second == expected.insert(std::make_pair(key, key * 10)).second);
+        } else {
+            same = same && (random.erase(key) == expected.erase(key));
+        }
+    }
+    same = same && (random.size() == expected.size());
+    for (int key = 0; same && (key < 512 * 64); ++key) {
+        same = (expected.count(key) != 0) == has(random, key);
+    }
+    check(same, "random inserts and erases agree with std::map");
+
+    printf("%d failed\n", failed);
+    return failed;
+}
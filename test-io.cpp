@@ -0,0 +1,117 @@
+extern "C" {
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+}
+#include <string>
+#include <algorithm>
+
+//! -- round trip through whatever connector the config routes dirname to:
+//! -- ./test-io [dirname] [size], exits with the number of failed checks
+static int failed = 0;
+
+inline void check(bool ok, const char *what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) {
+        ++failed;
+    }
+}
+
+//! -- every byte value, quotes and backslashes included, so escaping and binary columns get exercised
+inline std::string pattern(size_t size)
+{
+    std::string data(size, '\0');
+
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = (char)(i * 7 + i / 251);
+    }
+    return data;
+}
+
+inline bool put(const std::string& path, const std::string& data, int flags, size_t step)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | flags, 0666);
+
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    for (size_t pos = 0; ok && (pos < data.size()); pos += step) {
+        size_t  size = std::min(step, data.size() - pos);
+        ok = (write(fd, data.data() + pos, size) == (ssize_t)size);
+    }
+    return (close(fd) == 0) && ok;
+}
+
+inline bool get(const std::string& path, std::string& data, size_t step)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+
+    data.clear();
+    if (fd < 0) {
+        return false;
+    }
+    std::string buf(step, '\0');
+    ssize_t     ret;
+    while ((ret = read(fd, &buf[0], step)) > 0) {
+        data.append(buf.data(), ret);
+    }
+    close(fd);
+    return ret == 0;
+}
+
+inline bool listed(const std::string& dirname, const std::string& name)
+{
+    DIR  *dir  = opendir(dirname.c_str());
+    bool found = false;
+
+    if (dir) {
+        struct dirent *de;
+        while ((de = readdir(dir))) {
+            found = found || (name == de->d_name);
+        }
+        closedir(dir);
+    }
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    std::string dirname = argc > 1 ? argv[1] : "./tmp";
+    size_t      size    = argc > 2 ? atoi(argv[2]) : 100000;
+    std::string file    = dirname + "/data.bin";
+    std::string small   = dirname + "/small.txt";
+    std::string data    = pattern(size);
+    std::string back;
+    struct stat st;
+
+    check((mkdir(dirname.c_str(), 0777) == 0) || (errno == EEXIST), "mkdir");
+    check(put(file, data, O_TRUNC, 4096), "create and write in 4096 byte calls");
+    check((stat(file.c_str(), &st) == 0) && ((size_t)st.st_size == size), "stat size");
+    check(get(file, back, size + 1) && (back == data), "read whole file");
+    check(get(file, back, 1000) && (back == data), "read in 1000 byte calls");
+    check(get(file, back, 1) && (back.substr(0, 64) == data.substr(0, 64)) && (back.size() == size), "read byte by byte");
+
+    check(put(small, "first", O_TRUNC, 5), "create small file");
+    check(put(small, " second", O_APPEND, 7), "append");
+    check(get(small, back, 64) && (back == "first second"), "read appended file");
+    check(put(small, "third", O_TRUNC, 5), "truncate");
+    check(get(small, back, 64) && (back == "third"), "read truncated file");
+
+    check(listed(dirname, "data.bin") && listed(dirname, "small.txt"), "list directory");
+    check(unlink(file.c_str()) == 0, "unlink");
+    check((stat(file.c_str(), &st) < 0) && (errno == ENOENT), "stat unlinked file");
+    check(!listed(dirname, "data.bin"), "unlinked file not listed");
+    check(unlink(small.c_str()) == 0, "unlink small file");
+    check(rmdir(dirname.c_str()) == 0, "rmdir");
+
+    printf("%d failed\n", failed);
+    return failed;
+}
@@ -0,0 +1,72 @@
+extern "C" {
+#include <stdio.h>
+#include <string.h>
+}
+#include <string>
+#include "path.h"
+
+//! -- Path::Canonical and PathHandle interning: ./test-path, exits with the number of failed checks
+static int failed = 0;
+
+inline void check(bool ok, const std::string& what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok) {
+        ++failed;
+    }
+}
+
+inline void canonical(const FWL::Path& path, const char *file, const std::string& expected)
+{
+    char   buf[256];
+    size_t length = 0;
+    bool   ok     = path.Canonical(file, &buf[0], sizeof(buf), length);
+
+    check(ok && (expected == std::string(&buf[0], length)) && !buf[length], std::string(file) + " -> " + expected);
+}
+
+inline bool fits(const FWL::Path& path, const char *file, size_t size)
+{
+    char   buf[256];
+    size_t length = 0;
+
+    return path.Canonical(file, &buf[0], size, length);
+}
+
+int main()
+{
+    FWL::Path   path;
+    std::string cwd = (path.CurrentPath() == "/") ? "" : path.CurrentPath();
+
+    canonical(path, "/", "/");
+    canonical(path, "/a/b/c", "/a/b/c");
+    canonical(path, "//a///b//", "/a/b");
+    canonical(path, "/a/./b/.", "/a/b");
+    canonical(path, "/a/b/../c", "/a/c");
+    canonical(path, "/a/b/c/../../d", "/a/d");
+    canonical(path, "/a/b/c/../../..", "/");
+    canonical(path, "/a/b/..", "/a");
+    canonical(path, "/a/../b/../c/..", "/");
+    canonical(path, "/..", "/");
+    canonical(path, "/../../a", "/a");
+    canonical(path, "/a/../../../b/c/..", "/b");
+    canonical(path, "/..a/b../.../c", "/..a/b../.../c");
+    canonical(path, "x/../y", cwd + "/y");
+    canonical(path, "./x/./y/..", cwd + "/x");
+    canonical(path, ".", cwd.empty() ? "/" : cwd);
+
+    check(fits(path, "/abc", 5), "exact fit with the terminator");
+    check(!fits(path, "/abcd", 5), "one byte short");
+    check(fits(path, "/abc/../d", 5), "\"..\" frees room again");
+    check(!fits(path, "/abcd/..", 5), "components have to fit before \"..\" drops them");
+    check(!fits(path, "/", 1), "no room for the terminator of the root");
+
+    check(FWL::PathHandle("/a/b") == FWL::PathHandle(std::string("/a/b")), "equal paths share one handle");
+    check(FWL::PathHandle("/a/b") != FWL::PathHandle("/a/bc"), "different paths don't");
+    check(FWL::PathHandle("/a/b").Str() == "/a/b", "handle keeps the path");
+    check(FWL::PathHandle("/a/b").Hash() == FWL::PathHandle::HashOf("/a/b", 4), "handle keeps the hash");
+    check(FWL::PathHandle().Str().empty() && !FWL::PathHandle().Hash(), "empty handle");
+
+    printf("%d failed\n", failed);
+    return failed;
+}
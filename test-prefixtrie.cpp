@@ -0,0 +1,85 @@
+extern "C" {
+#include <stdio.h>
+#include <string.h>
+}
+#include <string>
+#include "prefixtrie.h"
+
+//! -- PrefixTrie longest prefix matching: ./test-prefixtrie, exits with the number of failed checks
+static int failed = 0;
+
+inline void check(bool ok, const std::string& what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok) {
+        ++failed;
+    }
+}
+
+inline void match(const FWL::PrefixTrie& trie, const char *path, size_t value, size_t length)
+{
+    size_t v = 0;
+    size_t l = 0;
+    bool   ok = trie.Match(path, ::strlen(path), v, l);
+
+    check(ok && (v == value) && (l == length), std::string(path) + " matches " + std::string(path, length));
+}
+
+inline void none(const FWL::PrefixTrie& trie, const char *path)
+{
+    size_t v, l;
+
+    check(!trie.Match(path, ::strlen(path), v, l), std::string(path) + " matches nothing");
+}
+
+int main()
+{
+    FWL::PrefixTrie trie;
+
+    check(trie.Add("/srv/sessions", 1), "add /srv/sessions");
+    check(trie.Add("/srv", 2), "add /srv");
+    check(trie.Add("/srv/sessions/deep/x", 3), "add /srv/sessions/deep/x");
+    check(!trie.Add("/srv/sessions", 4), "add /srv/sessions again");
+    check(!trie.Add("//srv/./sessions/", 4), "add it again spelled differently");
+
+    match(trie, "/srv/sessions/a", 1, 13);
+    match(trie, "/srv/sessions", 1, 13);
+    match(trie, "/srv/sessions/", 1, 13);
+    match(trie, "//srv//sessions//a", 1, 15);
+    match(trie, "/srv/sessions2", 2, 4);
+    match(trie, "/srv/session", 2, 4);
+    match(trie, "/srv/sessions/deep", 1, 13);
+    match(trie, "/srv/sessions/deep/x/y", 3, 20);
+    match(trie, "/srv/sessions/deep/xy", 1, 13);
+    none(trie, "/sr");
+    none(trie, "/srv2/sessions");
+    none(trie, "/");
+    none(trie, "");
+
+    size_t v = 0;
+    size_t l = 0;
+    check(trie.Match("/srv/sessions2", 13, v, l) && (v == 1) && (l == 13), "only size bytes of the path are looked at");
+
+    //! -- siblings added out of order are still found by the binary search
+    const char *names[] = { "m", "b", "z", "a", "ab", "a-", "aa", "mm", "c" };
+    size_t     count    = sizeof(names) / sizeof(names[0]);
+    for (size_t i = 0; i < count; ++i) {
+        trie.Add(std::string("/k/") + names[i], 10 + i);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        std::string path = std::string("/k/") + names[i] + "/f";
+        match(trie, path.c_str(), 10 + i, path.size() - 2);
+    }
+    none(trie, "/k/ac");
+
+    FWL::PrefixTrie root;
+    check(root.Add("/", 7), "add /");
+    check(root.Add("/a", 8), "add /a under /");
+    match(root, "/", 7, 0);
+    match(root, "/b/c", 7, 0);
+    match(root, "/a/c", 8, 2);
+    match(root, "/ab", 7, 0);
+
+    printf("%d failed\n", failed);
+    return failed;
+}